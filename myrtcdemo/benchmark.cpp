@@ -0,0 +1,2624 @@
+/*
+ * Standalone benchmarks for the signaling path of myrtcdemo.
+ *
+ *   myrtcdemobench            run every case
+ *   myrtcdemobench keepalive  run a single case by name
+ *   myrtcdemobench pipeline
+ *   myrtcdemobench httpparse
+ *   myrtcdemobench jsonparse
+ *   myrtcdemobench jsoncorpus   exits non-zero if a corpus check fails
+ *   myrtcdemobench jsonwrite
+ *   myrtcdemobench notify      exits non-zero if a notification is lost,
+ *                              also past a server that fails or loses some
+ *   myrtcdemobench peerlist    exits non-zero if the model loses track
+ *   myrtcdemobench peerdir
+ *   myrtcdemobench render      exits non-zero if a ring frame is wrong
+ *   myrtcdemobench convert     exits non-zero if a conversion is wrong
+ *   myrtcdemobench compose     exits non-zero if the composite is wrong
+ *   myrtcdemobench mailbox     exits non-zero if a frame is unaccounted for
+ *   myrtcdemobench handoff     exits non-zero if a frame tears
+ *   myrtcdemobench conference  exits non-zero if a peer receives no video
+ *
+ * The signaling cases run against a stand-in peerconnection_server
+ * listening on 127.0.0.1, so the numbers only measure our side of the
+ * protocol. conference connects PeerConnections to each other in process.
+ * The others run in memory; peerlist drives real Qt views on the
+ * offscreen platform unless QT_QPA_PLATFORM says otherwise.
+ */
+
+#ifdef WIN32
+#include "rtc_base/win32_socket_init.h"
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "api/audio_codecs/builtin_audio_decoder_factory.h"
+#include "api/audio_codecs/builtin_audio_encoder_factory.h"
+#include "api/create_peerconnection_factory.h"
+#include "api/video/i420_buffer.h"
+#include "api/video_codecs/builtin_video_decoder_factory.h"
+#include "api/video_codecs/builtin_video_encoder_factory.h"
+#include "conference_peer.h"
+#include "fixjson.h"
+#include "frame_converter.h"
+#include "frame_mailbox.h"
+#include "frame_ring.h"
+#include "http_response_parser.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "media/base/adapted_video_track_source.h"
+#include "peer_connection_client.h"
+#include "peer_directory.h"
+#include "peer_list_model.h"
+#include "rtc_base/critical_section.h"
+#include "rtc_base/event.h"
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/socket.h"
+#include "rtc_base/socket_address.h"
+#include "rtc_base/thread.h"
+#include "rtc_base/time_utils.h"
+#include "socket_notifier.h"
+#include "triple_buffer.h"
+#include "third_party/libyuv/include/libyuv/convert_argb.h"
+#include "video_compositor.h"
+
+#include <QApplication>
+#include <QEvent>
+#include <QLabel>
+#include <QListView>
+#include <QListWidget>
+#include <QPainter>
+
+namespace {
+
+    // Checks that failed; main() returns non-zero if any did.
+    int g_failures = 0;
+
+    // Minimal stand-in for examples/peerconnection/server. It answers
+    // sign_in, message and sign_out, forwards messages and peer changes to
+    // wait requests and honours HTTP/1.1 keep-alive the same way a
+    // persistent-connection server would. A wait with stream=1 gets every
+    // notification as a chunk of one response unless streaming is switched
+    // off, in which case it is answered like any other wait.
+    // Plain blocking sockets on purpose: rtc sockets accepted through a
+    // PhysicalSocketServer come back non-blocking.
+    class StandInServer {
+    public:
+        StandInServer()
+        : next_id_(1), messages_(0), connects_(0), stream_supported_(true) {}
+
+        bool Start() {
+            listener_ = socket(AF_INET, SOCK_STREAM, 0);
+            if (listener_ == INVALID_SOCKET)
+                return false;
+            sockaddr_in addr;
+            rtc::SocketAddress("127.0.0.1", 0).ToSockAddr(&addr);
+            socklen_t len = sizeof(addr);
+            if (bind(listener_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+                listen(listener_, 64) != 0 ||
+                getsockname(listener_, reinterpret_cast<sockaddr*>(&addr),
+                            &len) != 0) {
+                return false;
+            }
+            port_ = ntohs(addr.sin_port);
+            // Connection threads are detached: the server lives until exit.
+            std::thread(&StandInServer::AcceptLoop, this).detach();
+            return true;
+        }
+
+        int port() const { return port_; }
+        int messages() const { return messages_; }
+        int connects() const { return connects_; }
+        void set_stream_supported(bool stream) { stream_supported_ = stream; }
+        // Every |fail_every|th message is answered 503 the first time it is
+        // posted; every |lose_every|th is answered 200 and never delivered;
+        // every |repeat_every|th is delivered twice, as a post retried after
+        // its response was lost would be. 0 turns any of them off.
+        void set_faults(int fail_every, int lose_every, int repeat_every) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fail_every_ = fail_every;
+            lose_every_ = lose_every;
+            repeat_every_ = repeat_every;
+            faulty_posts_ = 0;
+            failed_.clear();
+        }
+
+    private:
+        // A response waiting for the peer's next wait request.
+        struct Notification {
+            int pragma;
+            std::string body;
+        };
+
+        struct Peer {
+            std::string name;
+            std::deque<Notification> pending;
+        };
+
+        void AcceptLoop() {
+            while (true) {
+                SOCKET s = accept(listener_, nullptr, nullptr);
+                if (s == INVALID_SOCKET)
+                    return;
+                ++connects_;
+                std::thread(&StandInServer::Serve, this, s).detach();
+            }
+        }
+
+        static bool ReadRequest(SOCKET s, std::string* buf,
+                                std::string* request) {
+            char tmp[4096];
+            size_t eoh;
+            while ((eoh = buf->find("\r\n\r\n")) == std::string::npos) {
+                int n = recv(s, tmp, sizeof(tmp), 0);
+                if (n <= 0)
+                    return false;
+                buf->append(tmp, n);
+            }
+            size_t content_length = 0;
+            size_t cl = buf->find("\r\nContent-Length: ");
+            if (cl != std::string::npos && cl < eoh)
+                content_length = atoi(buf->c_str() + cl + 18);
+            size_t total = eoh + 4 + content_length;
+            while (buf->size() < total) {
+                int n = recv(s, tmp, sizeof(tmp), 0);
+                if (n <= 0)
+                    return false;
+                buf->append(tmp, n);
+            }
+            request->assign(*buf, 0, total);
+            buf->erase(0, total);
+            return true;
+        }
+
+        static std::string FormatResponse(int pragma, const std::string& body,
+                                          bool keep_alive) {
+            char headers[256];
+            snprintf(headers, sizeof(headers),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Server: StandIn/0.1\r\n"
+                     "Content-Type: text/plain\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Pragma: %d\r\n"
+                     "%s\r\n",
+                     body.length(), pragma,
+                     keep_alive ? "" : "Connection: close\r\n");
+            return headers + body;
+        }
+
+        static void Respond(SOCKET s, int pragma, const std::string& body,
+                            bool keep_alive) {
+            std::string out = FormatResponse(pragma, body, keep_alive);
+            send(s, out.data(), static_cast<int>(out.size()), 0);
+        }
+
+        // True once the client has closed a connection it sends nothing on.
+        static bool PeerGone(SOCKET s) {
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(s, &fds);
+            timeval timeout = {0, 0};
+            return select(static_cast<int>(s) + 1, &fds, nullptr, nullptr,
+                          &timeout) != 0;
+        }
+
+        // Called with mutex_ held.
+        void Notify(int to, int pragma, const std::string& body) {
+            auto it = peers_.find(to);
+            if (it == peers_.end())
+                return;
+            it->second.pending.push_back({pragma, body});
+            pending_cv_.notify_all();
+        }
+
+        void ServeWait(SOCKET s, int id, bool stream) {
+            if (stream) {
+                const char kHead[] =
+                "HTTP/1.1 200 OK\r\n"
+                "Server: StandIn/0.1\r\n"
+                "Content-Type: text/plain\r\n"
+                "Transfer-Encoding: chunked\r\n"
+                "\r\n";
+                send(s, kHead, sizeof(kHead) - 1, 0);
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                auto it = peers_.find(id);
+                if (it == peers_.end())
+                    break;
+                if (it->second.pending.empty()) {
+                    pending_cv_.wait_for(lock, std::chrono::milliseconds(20));
+                    if (PeerGone(s))
+                        break;
+                    continue;
+                }
+                if (!stream) {
+                    Notification next = it->second.pending.front();
+                    it->second.pending.pop_front();
+                    lock.unlock();
+                    Respond(s, next.pragma, next.body, false);
+                    return;
+                }
+                // Everything queued so far goes out in one write.
+                std::string out;
+                for (const Notification& next : it->second.pending) {
+                    std::string response =
+                    FormatResponse(next.pragma, next.body, true);
+                    char size[32];
+                    snprintf(size, sizeof(size), "%zx\r\n", response.size());
+                    out += size;
+                    out += response;
+                    out += "\r\n";
+                }
+                it->second.pending.clear();
+                lock.unlock();
+                int sent = send(s, out.data(), static_cast<int>(out.size()), 0);
+                lock.lock();
+                if (sent != static_cast<int>(out.size()))
+                    break;
+            }
+        }
+
+        void Serve(SOCKET s) {
+            std::string buf, request;
+            while (ReadRequest(s, &buf, &request)) {
+                size_t eol = request.find("\r\n");
+                bool keep_alive =
+                request.rfind(" HTTP/1.1", eol) != std::string::npos &&
+                request.find("\r\nConnection: close") == std::string::npos;
+
+                if (request.compare(0, 13, "GET /sign_in?") == 0) {
+                    int id = next_id_++;
+                    std::string name = request.substr(13, request.find(' ', 13) - 13);
+                    std::string entry = name + "," + std::to_string(id) + ",1\n";
+                    std::string list = entry;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        for (auto& peer : peers_) {
+                            list += peer.second.name + "," +
+                            std::to_string(peer.first) + ",1\n";
+                            Notify(peer.first, peer.first, entry);
+                        }
+                        peers_[id].name = name;
+                    }
+                    Respond(s, id, list, keep_alive);
+                } else if (request.compare(0, 10, "GET /wait?") == 0) {
+                    int id = atoi(request.c_str() + request.find("peer_id=") + 8);
+                    bool stream = stream_supported_ &&
+                    request.find("&stream=1") < eol;
+                    ServeWait(s, id, stream);
+                    break;
+                } else if (request.compare(0, 14, "POST /message?") == 0) {
+                    ++messages_;
+                    int from = atoi(request.c_str() + request.find("peer_id=") + 8);
+                    size_t to = request.find("&to=");
+                    std::string body = request.substr(request.find("\r\n\r\n") + 4);
+                    bool fail = false;
+                    if (to < eol) {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        int post = ++faulty_posts_;
+                        if (fail_every_ && post % fail_every_ == 0)
+                            fail = failed_.insert(body).second;
+                        if (!fail && !(lose_every_ && post % lose_every_ == 0)) {
+                            Notify(atoi(request.c_str() + to + 4), from, body);
+                            if (repeat_every_ && post % repeat_every_ == 0)
+                                Notify(atoi(request.c_str() + to + 4), from, body);
+                        }
+                    }
+                    if (fail) {
+                        const char kUnavailable[] =
+                        "HTTP/1.1 503 Service Unavailable\r\n"
+                        "Content-Length: 0\r\n"
+                        "Connection: close\r\n"
+                        "\r\n";
+                        send(s, kUnavailable, sizeof(kUnavailable) - 1, 0);
+                        break;
+                    }
+                    Respond(s, from, "", keep_alive);
+                } else if (request.compare(0, 14, "GET /sign_out?") == 0) {
+                    int id = atoi(request.c_str() + request.find("peer_id=") + 8);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        auto it = peers_.find(id);
+                        if (it != peers_.end()) {
+                            std::string entry =
+                            it->second.name + "," + std::to_string(id) + ",0\n";
+                            peers_.erase(it);
+                            for (auto& peer : peers_)
+                                Notify(peer.first, peer.first, entry);
+                        }
+                        pending_cv_.notify_all();
+                    }
+                    Respond(s, -1, "", keep_alive);
+                } else {
+                    Respond(s, -1, "", keep_alive);
+                }
+                if (!keep_alive)
+                    break;
+            }
+            closesocket(s);
+        }
+
+        SOCKET listener_ = INVALID_SOCKET;
+        int port_ = 0;
+        std::atomic<int> next_id_;
+        std::atomic<int> messages_;
+        std::atomic<int> connects_;
+        std::atomic<bool> stream_supported_;
+        std::mutex mutex_;
+        std::condition_variable pending_cv_;
+        std::map<int, Peer> peers_;
+        // Guarded by mutex_.
+        int fail_every_ = 0;
+        int lose_every_ = 0;
+        int repeat_every_ = 0;
+        int faulty_posts_ = 0;
+        std::set<std::string> failed_;
+    };
+
+    StandInServer* GetStandInServer() {
+        static StandInServer* server = nullptr;
+        if (!server) {
+            server = new StandInServer();
+            if (!server->Start()) {
+                fprintf(stderr, "stand-in server failed to start\n");
+                exit(1);
+            }
+        }
+        return server;
+    }
+
+    rtc::Thread* SocketThread() {
+        return SocketNotifier::GetSocketNotifier()->GetThreadPtr();
+    }
+
+    // The messages of one call setup: an offer followed by trickled
+    // candidates.
+    std::vector<std::string> CallSetupMessages(int candidates) {
+        std::vector<std::string> messages;
+        std::string sdp(4096, 'o');
+        messages.push_back("{\"type\":\"offer\", \"sdp\":\"" + sdp + "\"}");
+        for (int i = 0; i < candidates; ++i) {
+            char candidate[256];
+            snprintf(candidate, sizeof(candidate),
+                     "{\"sdpMid\":\"0\", \"sdpMLineIndex\":0, \"candidate\":"
+                     "\"candidate:%d 1 udp 2122260223 192.168.1.%d 5%04d typ host "
+                     "generation 0 ufrag abcd network-id 1\"}",
+                     i, i % 255, i);
+            messages.push_back(candidate);
+        }
+        return messages;
+    }
+
+    class SignalingBenchObserver : public PeerConnectionClientObserver,
+    public rtc::MessageHandler {
+    public:
+        explicit SignalingBenchObserver(PeerConnectionClient* client)
+        : client_(client), signed_in_(false, false), done_(false, false),
+        disconnected_(false, false) {}
+
+        void OnSignedIn() override { signed_in_.Set(); }
+        void OnDisconnected() override { disconnected_.Set(); }
+        void OnPeerConnected(int id, const std::string& name) override {}
+        void OnPeerDisconnected(int peer_id) override {}
+        void OnMessageFromPeer(int peer_id, const std::string& message) override {}
+        void OnMessageSent(int err) override {
+            if (err)
+                failed_ = true;
+            ++completed_;
+            if (!running_)
+                return;
+            if (pipelined_) {
+                if (completed_ == messages_->size())
+                    Finish();
+            } else {
+                // Send the next one from a fresh loop iteration, the way the
+                // old one-at-a-time queue bounced through the UI thread.
+                rtc::Thread::Current()->Post(RTC_FROM_HERE, this);
+            }
+        }
+        void OnServerConnectionFailure() override {
+            failed_ = true;
+            signed_in_.Set();
+        }
+
+        void OnMessage(rtc::Message* msg) override { SendNext(); }
+
+        // Runs on the socket thread. Pipelined hands every message to the
+        // client at once, otherwise each waits for the previous response.
+        void StartCall(const std::vector<std::string>* messages, bool pipelined) {
+            messages_ = messages;
+            pipelined_ = pipelined;
+            next_ = 0;
+            completed_ = 0;
+            running_ = true;
+            start_us_ = rtc::TimeMicros();
+            if (!pipelined) {
+                SendNext();
+                return;
+            }
+            for (const std::string& message : *messages) {
+                if (!client_->SendToPeer(client_->id() + 1, message)) {
+                    failed_ = true;
+                    Finish();
+                    return;
+                }
+            }
+        }
+
+        void SendNext() {
+            if (!running_ || client_->IsSendingMessage())
+                return;
+            if (next_ == messages_->size()) {
+                Finish();
+                return;
+            }
+            if (!client_->SendToPeer(client_->id() + 1, (*messages_)[next_++])) {
+                failed_ = true;
+                Finish();
+            }
+        }
+
+        void Finish() {
+            running_ = false;
+            elapsed_us_ = rtc::TimeMicros() - start_us_;
+            done_.Set();
+        }
+
+        PeerConnectionClient* client_;
+        rtc::Event signed_in_;
+        rtc::Event done_;
+        rtc::Event disconnected_;
+        const std::vector<std::string>* messages_ = nullptr;
+        size_t next_ = 0;
+        size_t completed_ = 0;
+        bool pipelined_ = false;
+        bool running_ = false;
+        bool failed_ = false;
+        int64_t start_us_ = 0;
+        int64_t elapsed_us_ = 0;
+    };
+
+    // max_in_flight of 0 runs the old one-at-a-time loop.
+    void RunCallSetup(bool keep_alive, int max_in_flight, int rounds,
+                      int candidates) {
+        StandInServer* server = GetStandInServer();
+        std::vector<std::string> messages = CallSetupMessages(candidates);
+
+        std::unique_ptr<PeerConnectionClient> client(new PeerConnectionClient());
+        SignalingBenchObserver observer(client.get());
+        client->RegisterObserver(&observer);
+        client->SetKeepAlive(keep_alive);
+        client->SetMaxInFlight(std::max(max_in_flight, 1));
+
+        int connects_before = server->connects();
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            client->Connect("127.0.0.1", server->port(), "bench");
+        });
+        if (!observer.signed_in_.Wait(5000) || observer.failed_) {
+            fprintf(stderr, "sign in failed\n");
+            return;
+        }
+
+        std::vector<int64_t> samples;
+        for (int i = 0; i < rounds; ++i) {
+            SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+                observer.StartCall(&messages, max_in_flight > 0);
+            });
+            if (!observer.done_.Wait(30000) || observer.failed_) {
+                fprintf(stderr, "call setup %d failed\n", i);
+                break;
+            }
+            samples.push_back(observer.elapsed_us_);
+        }
+        int connects = server->connects() - connects_before;
+        SignalingStats stats = client->GetSignalingStats();
+
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() { client->SignOut(); });
+        observer.disconnected_.Wait(5000);
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() { client.reset(); });
+
+        if (samples.empty())
+            return;
+        std::sort(samples.begin(), samples.end());
+        int64_t total = 0;
+        for (int64_t s : samples)
+            total += s;
+        char label[32];
+        snprintf(label, sizeof(label), "%s", keep_alive ? "keep-alive" : "per-msg");
+        if (max_in_flight > 0) {
+            snprintf(label + strlen(label), sizeof(label) - strlen(label), " x%d",
+                     max_in_flight);
+        }
+        printf("  %-15s messages/call:%zu  mean:%8.3f ms  p50:%8.3f ms  "
+               "min:%8.3f ms  tcp connects:%d  msg latency avg:%7.3f max:%7.3f ms\n",
+               label, messages.size(), total / 1000.0 / samples.size(),
+               samples[samples.size() / 2] / 1000.0, samples.front() / 1000.0,
+               connects,
+               stats.messages_sent
+               ? stats.total_latency_us / 1000.0 / stats.messages_sent : 0.0,
+               stats.max_latency_us / 1000.0);
+    }
+
+    void BenchKeepAlive() {
+        printf("call setup latency, one offer + N candidates over loopback\n");
+        const int kCandidates[] = {10, 30, 60};
+        for (int candidates : kCandidates) {
+            printf(" candidates:%d\n", candidates);
+            RunCallSetup(false, 0, 20, candidates);
+            RunCallSetup(true, 0, 20, candidates);
+        }
+    }
+
+    void BenchPipeline() {
+        printf("call setup latency with N messages in flight\n");
+        const int kCandidates[] = {30, 60};
+        const int kInFlight[] = {1, 2, 4, 8};
+        for (int candidates : kCandidates) {
+            printf(" candidates:%d\n", candidates);
+            RunCallSetup(false, 0, 20, candidates);
+            for (int in_flight : kInFlight)
+                RunCallSetup(true, in_flight, 20, candidates);
+        }
+        printf(" repeated messages\n");
+        RunUnreliableServer("1 in 9 delivered twice", 0, 0, 9, 100);
+    }
+
+    // Counts what arrives at one client of the notify bench.
+    class NotifyBenchObserver : public PeerConnectionClientObserver {
+    public:
+        NotifyBenchObserver()
+        : signed_in_(false, false), received_event_(false, false),
+        disconnected_(false, false) {}
+
+        void OnSignedIn() override { signed_in_.Set(); }
+        void OnDisconnected() override { disconnected_.Set(); }
+        void OnPeerConnected(int id, const std::string& name) override {}
+        void OnPeerDisconnected(int peer_id) override {}
+        void OnMessageFromPeer(int peer_id, const std::string& message) override {
+            // Pipelined messages come with a seq field in front of ours.
+            size_t n = message.find("\"n\":");
+            int number = n == std::string::npos ? -1 : atoi(message.c_str() + n + 4);
+            if (number <= last_)
+                ++out_of_order_;
+            last_ = number;
+            if (++received_ >= expected_)
+                received_event_.Set();
+        }
+        void OnMessageSent(int err) override {
+            if (err)
+                failed_ = true;
+        }
+        void OnServerConnectionFailure() override {
+            failed_ = true;
+            signed_in_.Set();
+        }
+
+        static std::string NotifyMessage(int n) {
+            char message[64];
+            snprintf(message, sizeof(message), "{\"type\":\"ping\",\"n\":%d}", n);
+            return message;
+        }
+
+        rtc::Event signed_in_;
+        rtc::Event received_event_;
+        rtc::Event disconnected_;
+        std::atomic<int> received_{0};
+        std::atomic<int> expected_{0};
+        std::atomic<int> out_of_order_{0};
+        int last_ = -1;
+        std::atomic<bool> failed_{false};
+    };
+
+    // One client sends to another through the stand-in server: first one
+    // message at a time, each waiting for the previous to be delivered, then
+    // a burst. Delivery latency is what the receiver's /wait mode costs.
+    void RunNotify(const char* label, bool stream, bool server_streams,
+                   int rounds, int burst) {
+        StandInServer* server = GetStandInServer();
+        server->set_stream_supported(server_streams);
+
+        std::unique_ptr<PeerConnectionClient> sender(new PeerConnectionClient());
+        std::unique_ptr<PeerConnectionClient> receiver(new PeerConnectionClient());
+        NotifyBenchObserver sender_observer, receiver_observer;
+        sender->RegisterObserver(&sender_observer);
+        receiver->RegisterObserver(&receiver_observer);
+        sender->SetKeepAlive(true);
+        receiver->SetStreamNotifications(stream);
+
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            sender->Connect("127.0.0.1", server->port(), "sender");
+            receiver->Connect("127.0.0.1", server->port(), "receiver");
+        });
+        if (!sender_observer.signed_in_.Wait(5000) ||
+            !receiver_observer.signed_in_.Wait(5000) ||
+            sender_observer.failed_ || receiver_observer.failed_) {
+            fprintf(stderr, "sign in failed\n");
+            ++g_failures;
+            return;
+        }
+
+        int next = 0;
+        auto send = [&](int count) {
+            receiver_observer.expected_ = next + count;
+            SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+                for (int i = 0; i < count; ++i) {
+                    sender->SendToPeer(receiver->id(),
+                                       NotifyBenchObserver::NotifyMessage(next++));
+                }
+            });
+            return receiver_observer.received_event_.Wait(10000);
+        };
+
+        // The first message also waits for the receiver's /wait to connect.
+        bool ok = send(1);
+        int connects_before = server->connects();
+        SignalingStats before = receiver->GetSignalingStats();
+
+        std::vector<int64_t> samples;
+        for (int i = 0; ok && i < rounds; ++i) {
+            int64_t start = rtc::TimeMicros();
+            ok = send(1);
+            samples.push_back(rtc::TimeMicros() - start);
+        }
+        int64_t burst_us = 0;
+        if (ok) {
+            int64_t start = rtc::TimeMicros();
+            ok = send(burst);
+            burst_us = rtc::TimeMicros() - start;
+        }
+
+        int connects = server->connects() - connects_before;
+        SignalingStats after = receiver->GetSignalingStats();
+
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            sender->SignOut();
+            receiver->SignOut();
+        });
+        sender_observer.disconnected_.Wait(5000);
+        receiver_observer.disconnected_.Wait(5000);
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            sender.reset();
+            receiver.reset();
+        });
+        server->set_stream_supported(true);
+
+        if (!ok || receiver_observer.received_ != next ||
+            receiver_observer.out_of_order_ != 0) {
+            printf("  %-22s delivered %d of %d messages, %d out of order\n",
+                   label, receiver_observer.received_.load(), next,
+                   receiver_observer.out_of_order_.load());
+            ++g_failures;
+            return;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        printf("  %-22s one at a time p50:%7.3f ms p90:%7.3f ms  "
+               "burst of %d:%8.3f ms  wait connects:%llu  tcp connects:%d\n",
+               label, samples[samples.size() / 2] / 1000.0,
+               samples[samples.size() * 9 / 10] / 1000.0, burst,
+               burst_us / 1000.0,
+               static_cast<unsigned long long>(after.notification_connects -
+                                               before.notification_connects),
+               connects);
+    }
+
+    // A burst from a pipelining sender through a server that fails, loses
+    // or repeats some of it. Failed posts have to be retried, the receiver
+    // has to give up on lost ones after its hold time instead of holding
+    // everything after them, and must not hand a repeated one over twice.
+    void RunUnreliableServer(const char* label, int fail_every,
+                             int lose_every, int repeat_every, int count) {
+        StandInServer* server = GetStandInServer();
+
+        std::unique_ptr<PeerConnectionClient> sender(new PeerConnectionClient());
+        std::unique_ptr<PeerConnectionClient> receiver(new PeerConnectionClient());
+        NotifyBenchObserver sender_observer, receiver_observer;
+        sender->RegisterObserver(&sender_observer);
+        receiver->RegisterObserver(&receiver_observer);
+        sender->SetKeepAlive(true);
+        sender->SetMaxInFlight(4);
+        receiver->SetStreamNotifications(true);
+
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            sender->Connect("127.0.0.1", server->port(), "sender");
+            receiver->Connect("127.0.0.1", server->port(), "receiver");
+        });
+        if (!sender_observer.signed_in_.Wait(5000) ||
+            !receiver_observer.signed_in_.Wait(5000) ||
+            sender_observer.failed_ || receiver_observer.failed_) {
+            fprintf(stderr, "sign in failed\n");
+            ++g_failures;
+            return;
+        }
+
+        server->set_faults(fail_every, lose_every, repeat_every);
+        int expected = count - (lose_every ? count / lose_every : 0);
+        receiver_observer.expected_ = expected;
+        int64_t start = rtc::TimeMicros();
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            for (int i = 0; i < count; ++i) {
+                sender->SendToPeer(receiver->id(),
+                                   NotifyBenchObserver::NotifyMessage(i));
+            }
+        });
+        bool ok = receiver_observer.received_event_.Wait(10000);
+        int64_t elapsed_us = rtc::TimeMicros() - start;
+        SignalingStats stats = sender->GetSignalingStats();
+        SignalingStats received = receiver->GetSignalingStats();
+        server->set_faults(0, 0, 0);
+
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            sender->SignOut();
+            receiver->SignOut();
+        });
+        sender_observer.disconnected_.Wait(5000);
+        receiver_observer.disconnected_.Wait(5000);
+        SocketThread()->Invoke<void>(RTC_FROM_HERE, [&]() {
+            sender.reset();
+            receiver.reset();
+        });
+
+        // The last post is never a repeat, so every repeat has arrived
+        // before the burst is complete.
+        uint64_t repeats = repeat_every ? (count - 1) / repeat_every : 0;
+        printf("  %-22s delivered %d of %d in %8.3f ms, %llu retried, "
+               "%llu failed, %llu dropped, %d out of order\n",
+               label, receiver_observer.received_.load(), count,
+               elapsed_us / 1000.0,
+               static_cast<unsigned long long>(stats.messages_retried),
+               static_cast<unsigned long long>(stats.messages_failed),
+               static_cast<unsigned long long>(received.messages_dropped),
+               receiver_observer.out_of_order_.load());
+        if (!ok || receiver_observer.received_ != expected ||
+            receiver_observer.out_of_order_ != 0 || stats.messages_failed ||
+            received.messages_dropped != repeats || sender_observer.failed_) {
+            ++g_failures;
+        }
+    }
+
+    void BenchNotify() {
+        printf("message delivery to the receiving client over loopback\n");
+        RunNotify("hanging get", false, true, 200, 100);
+        RunNotify("stream", true, true, 200, 100);
+        RunNotify("stream, server refuses", true, false, 200, 100);
+        RunUnreliableServer("1 in 7 answered 503", 7, 0, 0, 100);
+        RunUnreliableServer("1 in 40 lost", 0, 40, 0, 100);
+    }
+
+    QApplication* GetApplication() {
+        static QApplication* app = nullptr;
+        if (!app) {
+            if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+                qputenv("QT_QPA_PLATFORM", "offscreen");
+            static int argc = 1;
+            static char name[] = "myrtcdemobench";
+            static char* argv[] = {name, nullptr};
+            app = new QApplication(argc, argv);
+        }
+        return app;
+    }
+
+    // A lobby churning through sign-ins and sign-outs, applied to |peers|
+    // one notification at a time.
+    class LobbyChurn {
+    public:
+        LobbyChurn(int lobby, Peers* peers) : peers_(peers), rng_(lobby) {
+            for (int i = 0; i < lobby; ++i) {
+                live_.push_back(next_id_);
+                peers_->Set(next_id_++, PeerName(i));
+            }
+        }
+
+        // Returns the change made: half sign in a new peer, half sign out a
+        // random one.
+        PeerListChange Next() {
+            PeerListChange change;
+            if (peers_->empty() || rng_() % 2) {
+                change.type = PeerListChange::ADDED;
+                change.id = next_id_++;
+                change.name = PeerName(change.id);
+                peers_->Set(change.id, change.name);
+                live_.push_back(change.id);
+            } else {
+                size_t pick = rng_() % live_.size();
+                change.type = PeerListChange::REMOVED;
+                change.id = live_[pick];
+                live_[pick] = live_.back();
+                live_.pop_back();
+                peers_->Remove(change.id);
+            }
+            return change;
+        }
+
+    private:
+        static std::string PeerName(int id) {
+            return "user@host-" + std::to_string(id);
+        }
+
+        Peers* peers_;
+        std::mt19937 rng_;
+        int next_id_ = 1;
+        std::vector<int> live_;
+    };
+
+    // What MainWindow::SwitchToPeerList did on every notification.
+    void LegacyFillPeerList(QListWidget* list, const Peers& peers) {
+        list->clear();
+        int i = 0;
+        for (PeerDirectory::Entry peer : peers) {
+            list->addItem(QString::fromUtf8(peer.name.data(),
+                                            static_cast<int>(peer.name.size())));
+            list->item(i++)->setData(Qt::UserRole, peer.id);
+        }
+    }
+
+    bool ModelMatches(const PeerListModel& model, const Peers& peers) {
+        if (model.rowCount() != static_cast<int>(peers.size()))
+            return false;
+        int row = 0;
+        for (PeerDirectory::Entry peer : peers) {
+            QModelIndex index = model.index(row);
+            if (model.PeerId(row) != peer.id ||
+                model.data(index).toString().toStdString() != peer.name) {
+                return false;
+            }
+            ++row;
+        }
+        return true;
+    }
+
+    void BenchPeerList() {
+        QApplication* app = GetApplication();
+        const int kLobbies[] = {1000, 5000, 20000};
+        const int kEvents = 4000;
+        // Events between two passes of the event loop, so the views get to
+        // lay out and paint what changed.
+        const int kEventsPerFrame = 50;
+
+        printf("peer list updates for sign-in/sign-out churn\n");
+        for (int lobby : kLobbies) {
+            // The full rebuild gets fewer events; it is the slow side.
+            int legacy_events = std::max(20, kEvents * 1000 / lobby / 4);
+            int64_t legacy_ns = 0;
+            {
+                Peers peers;
+                LobbyChurn churn(lobby, &peers);
+                QListWidget list;
+                list.show();
+                LegacyFillPeerList(&list, peers);
+                app->processEvents();
+                int64_t start = rtc::TimeNanos();
+                for (int i = 0; i < legacy_events; ++i) {
+                    churn.Next();
+                    LegacyFillPeerList(&list, peers);
+                    if (i % kEventsPerFrame == kEventsPerFrame - 1)
+                        app->processEvents();
+                }
+                app->processEvents();
+                legacy_ns = rtc::TimeNanos() - start;
+            }
+
+            int64_t model_ns = 0;
+            bool matches = true;
+            {
+                Peers peers;
+                LobbyChurn churn(lobby, &peers);
+                PeerListModel model;
+                QListView view;
+                view.setUniformItemSizes(true);
+                view.setModel(&model);
+                view.show();
+                model.Reset(peers);
+                app->processEvents();
+                int64_t start = rtc::TimeNanos();
+                for (int i = 0; i < kEvents; ++i) {
+                    model.Apply(churn.Next());
+                    if (i % kEventsPerFrame == kEventsPerFrame - 1)
+                        app->processEvents();
+                }
+                app->processEvents();
+                model_ns = rtc::TimeNanos() - start;
+                matches = ModelMatches(model, peers);
+            }
+
+            if (!matches) {
+                printf("  lobby:%d: model does not match the peer list\n", lobby);
+                ++g_failures;
+            }
+            printf("  lobby:%-6d rebuild:%10.1f us/event  delta:%8.1f us/event\n",
+                   lobby, legacy_ns / 1000.0 / legacy_events,
+                   model_ns / 1000.0 / kEvents);
+        }
+
+        // Renames and repeated or unknown entries must leave the rows right.
+        Peers peers;
+        PeerListModel model;
+        model.Reset(peers);
+        PeerListChange change;
+        change.type = PeerListChange::ADDED;
+        for (int id : {5, 1, 9, 3}) {
+            change.id = id;
+            change.name = "peer" + std::to_string(id);
+            model.Apply(change);
+            model.Apply(change);
+            peers.Set(id, change.name);
+        }
+        change.type = PeerListChange::RENAMED;
+        change.id = 9;
+        change.name = "renamed";
+        model.Apply(change);
+        peers.Set(9, change.name);
+        change.type = PeerListChange::REMOVED;
+        change.id = 4;
+        model.Apply(change);
+        change.id = 1;
+        model.Apply(change);
+        peers.Remove(1);
+        if (!ModelMatches(model, peers)) {
+            printf("  edge cases: model does not match the peer list\n");
+            ++g_failures;
+        }
+    }
+
+    // A frame with a gradient in every plane, so conversions that get the
+    // strides or planes wrong show up in the pixels.
+    rtc::scoped_refptr<webrtc::I420Buffer> TestFrame(int width, int height) {
+        rtc::scoped_refptr<webrtc::I420Buffer> frame =
+        webrtc::I420Buffer::Create(width, height);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                frame->MutableDataY()[y * frame->StrideY() + x] =
+                static_cast<uint8_t>(x + y);
+        for (int y = 0; y < frame->ChromaHeight(); ++y) {
+            for (int x = 0; x < frame->ChromaWidth(); ++x) {
+                frame->MutableDataU()[y * frame->StrideU() + x] =
+                static_cast<uint8_t>(x * 2);
+                frame->MutableDataV()[y * frame->StrideV() + x] =
+                static_cast<uint8_t>(y * 2);
+            }
+        }
+        return frame;
+    }
+
+    void ToARGB(const webrtc::I420BufferInterface& frame, uint8_t* argb,
+                int stride) {
+        libyuv::I420ToARGB(frame.DataY(), frame.StrideY(), frame.DataU(),
+                           frame.StrideU(), frame.DataV(), frame.StrideV(),
+                           argb, stride, frame.width(), frame.height());
+    }
+
+    // The video label as MainWindow paints it in frame ring mode.
+    class RingVideoView : public QWidget {
+    public:
+        QImage local;
+        QImage remote;
+        
+    protected:
+        void paintEvent(QPaintEvent*) override {
+            QPainter painter(this);
+            int y = (height() - remote.height()) / 2;
+            painter.drawImage(0, y, remote);
+            painter.drawImage(0, y, local);
+        }
+    };
+
+    // Renders |frames| pairs of a remote frame and a 720p local preview and
+    // paints each pair, the old way and through frame rings.
+    void RunRender(int width, int height, int frames) {
+        QApplication* app = GetApplication();
+        rtc::scoped_refptr<webrtc::I420Buffer> remote = TestFrame(width, height);
+        rtc::scoped_refptr<webrtc::I420Buffer> camera = TestFrame(1280, 720);
+
+        // VideoRenderer::OnFrame and MainWindow::paintEvent before the ring.
+        RenderCounters legacy;
+        int64_t legacy_ns = 0;
+        {
+            std::vector<uint8_t> remote_buf(width * height * 4);
+            std::vector<uint8_t> local_buf(1280 * 720 * 4);
+            QLabel label;
+            label.resize(width, height);
+            label.show();
+            app->processEvents();
+            int64_t start = rtc::TimeNanos();
+            for (int i = 0; i < frames; ++i) {
+                ToARGB(*remote, remote_buf.data(), width * 4);
+                QImage remote_image(remote_buf.data(), width, height,
+                                    QImage::Format_ARGB32);
+                legacy.OnFrame();
+                ToARGB(*camera, local_buf.data(), 1280 * 4);
+                QImage local_image(local_buf.data(), 1280, 720,
+                                   QImage::Format_ARGB32);
+                local_image = local_image.scaled(320, 180);
+                legacy.OnCopy();
+                legacy.OnFrame();
+                {
+                    QPainter painter(&remote_image);
+                    painter.drawImage(0, 0, local_image);
+                }
+                label.setPixmap(QPixmap::fromImage(remote_image));
+                legacy.OnCopy();
+                label.repaint();
+            }
+            legacy_ns = rtc::TimeNanos() - start;
+        }
+
+        RenderCounters ring;
+        int64_t ring_ns = 0;
+        bool same = true;
+        {
+            rtc::scoped_refptr<FrameRing> remote_ring = FrameRing::Create(3);
+            rtc::scoped_refptr<FrameRing> local_ring = FrameRing::Create(3);
+            FrameConverter converter;
+            RingVideoView view;
+            view.resize(width, height);
+            view.show();
+            app->processEvents();
+            int64_t start = rtc::TimeNanos();
+            for (int i = 0; i < frames; ++i) {
+                int slot = remote_ring->Acquire(width, height);
+                if (slot < 0) {
+                    ring.OnDropped();
+                } else {
+                    ToARGB(*remote, remote_ring->pixels(slot),
+                           remote_ring->stride(slot));
+                    view.remote = remote_ring->Publish(slot);
+                    ring.OnFrame();
+                }
+                slot = local_ring->Acquire(320, 180);
+                if (slot < 0) {
+                    ring.OnDropped();
+                } else {
+                    converter.Convert(*camera, webrtc::kVideoRotation_0, 320,
+                                      180, local_ring->pixels(slot),
+                                      local_ring->stride(slot));
+                    view.local = local_ring->Publish(slot);
+                    ring.OnFrame();
+                }
+                view.repaint();
+            }
+            ring_ns = rtc::TimeNanos() - start;
+
+            // The ring must hand out exactly what the old path converted.
+            std::vector<uint8_t> expected(width * height * 4);
+            ToARGB(*remote, expected.data(), width * 4);
+            QImage image = view.remote;
+            view.remote = QImage();
+            // The image outlives the ring it came from.
+            remote_ring = nullptr;
+            for (int y = 0; y < height && same; ++y) {
+                same = memcmp(image.constScanLine(y),
+                              expected.data() + y * width * 4,
+                              width * 4) == 0;
+            }
+        }
+        if (!same) {
+            printf("  %dx%d: ring frame differs from the converted frame\n",
+                   width, height);
+            ++g_failures;
+        }
+
+        RenderStats old_stats = legacy.Get();
+        RenderStats ring_stats = ring.Get();
+        printf("  %4dx%-4d legacy:%8.1f us/frame %.1f copies/frame  "
+               "ring:%8.1f us/frame %.1f copies/frame %llu dropped\n",
+               width, height, legacy_ns / 1000.0 / frames,
+               static_cast<double>(old_stats.copies) / old_stats.frames,
+               ring_ns / 1000.0 / frames,
+               static_cast<double>(ring_stats.copies) /
+               std::max<uint64_t>(ring_stats.frames, 1),
+               static_cast<unsigned long long>(ring_stats.dropped));
+    }
+
+    void BenchRender() {
+        printf("render a remote frame with the local preview on top\n");
+        RunRender(1280, 720, 300);
+        RunRender(1920, 1080, 200);
+
+        // A slot only comes back once every copy of its image is gone.
+        rtc::scoped_refptr<FrameRing> ring = FrameRing::Create(2);
+        QImage first = ring->Publish(ring->Acquire(64, 64));
+        QImage second = ring->Publish(ring->Acquire(64, 64));
+        QImage copy = first;
+        bool full = ring->Acquire(64, 64) < 0;
+        first = QImage();
+        bool still_held = ring->Acquire(64, 64) < 0;
+        copy = QImage();
+        int slot = ring->Acquire(64, 64);
+        if (!full || !still_held || slot < 0) {
+            printf("  ring hands out slots that are still in use\n");
+            ++g_failures;
+        }
+    }
+
+    // What VideoRenderer::OnFrame did before FrameConverter: rotate into a
+    // new buffer, convert at full size, then let Qt scale the preview.
+    QImage LegacyConvert(const webrtc::I420BufferInterface& frame,
+                         webrtc::VideoRotation rotation, bool preview,
+                         std::vector<uint8_t>* argb) {
+        const webrtc::I420BufferInterface* buffer = &frame;
+        rtc::scoped_refptr<webrtc::I420Buffer> rotated;
+        if (rotation != webrtc::kVideoRotation_0) {
+            rotated = webrtc::I420Buffer::Rotate(frame, rotation);
+            buffer = rotated.get();
+        }
+        argb->resize(buffer->width() * buffer->height() * 4);
+        ToARGB(*buffer, argb->data(), buffer->width() * 4);
+        QImage image(argb->data(), buffer->width(), buffer->height(),
+                     QImage::Format_ARGB32);
+        if (preview)
+            image = image.scaled(320, 180);
+        return image;
+    }
+
+    double MeanDifference(const QImage& a, const uint8_t* b, int stride) {
+        int64_t total = 0;
+        for (int y = 0; y < a.height(); ++y) {
+            const uint8_t* row = a.constScanLine(y);
+            for (int x = 0; x < a.width() * 4; ++x)
+                total += abs(row[x] - b[y * stride + x]);
+        }
+        return static_cast<double>(total) / (a.width() * a.height() * 4);
+    }
+
+    void BenchConvert() {
+        struct Size {
+            int width;
+            int height;
+        };
+        const Size kInputs[] = {{1280, 720}, {1920, 1080}, {3840, 2160}};
+        const webrtc::VideoRotation kRotations[] = {
+            webrtc::kVideoRotation_0, webrtc::kVideoRotation_90};
+        FrameConverter converter;
+        std::vector<uint8_t> legacy_argb;
+        std::vector<uint8_t> argb;
+
+        printf("convert a decoded frame for display\n");
+        for (const Size& input : kInputs) {
+            rtc::scoped_refptr<webrtc::I420Buffer> frame =
+            TestFrame(input.width, input.height);
+            int iterations =
+            std::max(20, (400 << 20) / (input.width * input.height * 4));
+            for (webrtc::VideoRotation rotation : kRotations) {
+                for (bool preview : {true, false}) {
+                    int width = 320;
+                    int height = 180;
+                    if (!preview) {
+                        FrameConverter::RotatedSize(input.width, input.height,
+                                                    rotation, &width, &height);
+                    }
+                    argb.resize(width * height * 4);
+
+                    QImage legacy;
+                    int64_t start = rtc::TimeNanos();
+                    for (int i = 0; i < iterations; ++i)
+                        legacy = LegacyConvert(*frame, rotation, preview,
+                                               &legacy_argb);
+                    int64_t legacy_ns = rtc::TimeNanos() - start;
+
+                    start = rtc::TimeNanos();
+                    for (int i = 0; i < iterations; ++i)
+                        converter.Convert(*frame, rotation, width, height,
+                                          argb.data(), width * 4);
+                    int64_t fused_ns = rtc::TimeNanos() - start;
+
+                    // Full size output must match exactly; the preview is
+                    // filtered differently but must show the same picture.
+                    double difference =
+                    MeanDifference(legacy, argb.data(), width * 4);
+                    if (legacy.width() != width || legacy.height() != height ||
+                        difference > (preview ? 24.0 : 0.0)) {
+                        printf("  %dx%d rotation:%d %s: output differs "
+                               "(mean %.1f)\n", input.width, input.height,
+                               static_cast<int>(rotation),
+                               preview ? "preview" : "full", difference);
+                        ++g_failures;
+                    }
+
+                    printf("  %4dx%-4d rotation:%-3d %-7s legacy:%9.1f us  "
+                           "fused:%9.1f us\n", input.width, input.height,
+                           static_cast<int>(rotation),
+                           preview ? "preview" : "full",
+                           legacy_ns / 1000.0 / iterations,
+                           fused_ns / 1000.0 / iterations);
+                }
+            }
+        }
+
+        // Every rotation, with a size that is not a multiple of the
+        // chroma subsampling.
+        rtc::scoped_refptr<webrtc::I420Buffer> odd = TestFrame(321, 179);
+        for (webrtc::VideoRotation rotation :
+             {webrtc::kVideoRotation_0, webrtc::kVideoRotation_90,
+              webrtc::kVideoRotation_180, webrtc::kVideoRotation_270}) {
+            int width, height;
+            FrameConverter::RotatedSize(321, 179, rotation, &width, &height);
+            argb.assign(width * height * 4, 0);
+            converter.Convert(*odd, rotation, width, height, argb.data(),
+                              width * 4);
+            QImage legacy = LegacyConvert(*odd, rotation, false, &legacy_argb);
+            if (MeanDifference(legacy, argb.data(), width * 4) != 0.0) {
+                printf("  321x179 rotation:%d: output differs\n",
+                       static_cast<int>(rotation));
+                ++g_failures;
+            }
+        }
+    }
+
+    QImage SolidFrame(const QSize& size, int shade) {
+        QImage frame(size, QImage::Format_RGB32);
+        frame.fill(qRgb(shade, 255 - shade, (shade * 7) & 0xff));
+        return frame;
+    }
+
+    // Frames from |remotes| streams arrive in turn, with the preview
+    // taking every fifth frame, on a 720p surface. The old paint drew every
+    // stream and the preview again for each of them.
+    void RunCompose(int remotes, int frames) {
+        const QSize kSurface(1280, 720);
+        VideoCompositor compositor;
+        compositor.SetSize(kSurface);
+        compositor.SetRemoteCount(remotes);
+        // Two frames per stream to alternate between.
+        std::vector<QImage> streams[2];
+        for (int i = 0; i < remotes; ++i) {
+            QSize size = compositor.TileRect(i).size();
+            streams[0].push_back(SolidFrame(size, i * 40));
+            streams[1].push_back(SolidFrame(size, i * 40 + 20));
+        }
+        QImage preview = SolidFrame(QSize(320, 180), 200);
+
+        QImage full(kSurface, QImage::Format_RGB32);
+        int64_t start = rtc::TimeNanos();
+        for (int i = 0; i < frames; ++i) {
+            QPainter painter(&full);
+            for (int j = 0; j < remotes; ++j)
+                painter.drawImage(compositor.TileRect(j).topLeft(),
+                                  streams[i % 2][j]);
+            painter.drawImage(0, 0, preview);
+        }
+        int64_t full_ns = rtc::TimeNanos() - start;
+
+        for (int i = 0; i < remotes; ++i)
+            compositor.SetRemote(i, streams[0][i]);
+        compositor.SetLocal(preview);
+        compositor.Compose();
+        ComposeStats before = compositor.stats();
+        start = rtc::TimeNanos();
+        for (int i = 0; i < frames; ++i) {
+            if (i % 5 == 4) {
+                compositor.SetLocal(preview);
+            } else {
+                int stream = i % remotes;
+                compositor.SetRemote(stream, streams[(i + 1) % 2][stream]);
+            }
+            compositor.Compose();
+        }
+        int64_t dirty_ns = rtc::TimeNanos() - start;
+        ComposeStats after = compositor.stats();
+
+        // The surface must look as if it had been drawn from scratch.
+        QImage expected(kSurface, QImage::Format_RGB32);
+        {
+            QPainter painter(&expected);
+            compositor.Draw(&painter, QRect(QPoint(0, 0), kSurface));
+        }
+        if (expected != compositor.surface()) {
+            printf("  remotes:%d: composite differs from a full redraw\n",
+                   remotes);
+            ++g_failures;
+        }
+
+        printf("  remotes:%-2d full:%8.1f us/frame %8d px  "
+               "dirty:%8.1f us/frame %8llu px\n",
+               remotes, full_ns / 1000.0 / frames,
+               kSurface.width() * kSurface.height(),
+               dirty_ns / 1000.0 / frames,
+               static_cast<unsigned long long>(
+                   (after.pixels - before.pixels) / frames));
+    }
+
+    void BenchCompose() {
+        GetApplication();
+        printf("compose one new frame into the call view\n");
+        RunCompose(1, 500);
+        RunCompose(4, 500);
+        RunCompose(9, 500);
+
+        // Frames that do not fit their tile are letterboxed, and resizing
+        // or moving the preview leaves nothing stale behind.
+        VideoCompositor compositor;
+        compositor.SetSize(QSize(640, 360));
+        compositor.SetRemoteCount(3);
+        compositor.SetRemote(0, SolidFrame(QSize(100, 300), 10));
+        compositor.SetLocal(SolidFrame(QSize(320, 180), 90));
+        compositor.Compose();
+        compositor.SetLocal(SolidFrame(QSize(160, 90), 120));
+        compositor.SetRemote(2, SolidFrame(QSize(640, 360), 250));
+        compositor.Compose();
+        QImage expected(compositor.size(), QImage::Format_RGB32);
+        {
+            QPainter painter(&expected);
+            compositor.Draw(&painter, QRect(QPoint(0, 0), compositor.size()));
+        }
+        QRgb corner = compositor.surface().pixel(639, 359);
+        if (expected != compositor.surface() || corner != qRgb(0, 0, 0)) {
+            printf("  letterbox: composite differs from a full redraw\n");
+            ++g_failures;
+        }
+    }
+
+    // Runs functions posted from any thread on the thread it lives on, the
+    // way a queued signal reaches MainWindow.
+    class PostedRunner : public QObject {
+    public:
+        void Post(std::function<void()> function) {
+            QCoreApplication::postEvent(this, new Posted(std::move(function)));
+        }
+
+        bool event(QEvent* event) override {
+            if (event->type() != QEvent::User)
+                return QObject::event(event);
+            static_cast<Posted*>(event)->function();
+            return true;
+        }
+
+    private:
+        class Posted : public QEvent {
+        public:
+            explicit Posted(std::function<void()> function)
+            : QEvent(QEvent::User), function(std::move(function)) {}
+            std::function<void()> function;
+        };
+    };
+
+    // A renderer thread delivers |frames| frames every |interval_ms| to a UI
+    // thread whose paint takes |paint_ms|, longer than a frame lasts. The
+    // old way queues an event per frame; the mailbox keeps only the newest.
+    void RunMailbox(bool use_mailbox, int frames, int interval_ms,
+                    int paint_ms) {
+        QApplication* app = GetApplication();
+        PostedRunner ui;
+        RenderCounters counters;
+        FrameMailbox mailbox(1, &counters);
+        std::vector<FrameMailbox::Frame> taken;
+        QImage image = SolidFrame(QSize(64, 64), 0);
+        std::atomic<int> queued(0);
+        int max_queued = 0;
+        bool done = false;
+
+        auto paint = [&](const FrameMailbox::Frame& frame) {
+            int64_t until = rtc::TimeMicros() + paint_ms * 1000;
+            while (rtc::TimeMicros() < until) {
+            }
+            int64_t latency = rtc::TimeMicros() - frame.arrival_us;
+            counters.OnPainted(latency, latency);
+        };
+        std::thread renderer([&] {
+            for (int i = 0; i < frames; ++i) {
+                FrameMailbox::Frame frame;
+                frame.image = image;
+                frame.arrival_us = rtc::TimeMicros();
+                frame.capture_us = frame.arrival_us;
+                if (use_mailbox) {
+                    if (mailbox.Post(0, std::move(frame))) {
+                        ui.Post([&] {
+                            mailbox.Take(&taken);
+                            if (!taken[0].image.isNull())
+                                paint(taken[0]);
+                        });
+                    }
+                } else {
+                    max_queued = std::max(max_queued, ++queued);
+                    ui.Post([&, frame] {
+                        --queued;
+                        paint(frame);
+                    });
+                }
+                std::this_thread::sleep_for(
+                                            std::chrono::milliseconds(interval_ms));
+            }
+            ui.Post([&] { done = true; });
+        });
+        while (!done)
+            app->processEvents(QEventLoop::WaitForMoreEvents);
+        renderer.join();
+
+        RenderStats stats = counters.Get();
+        if (use_mailbox && stats.painted + stats.replaced != static_cast<uint64_t>(frames)) {
+            printf("  mailbox: %llu painted + %llu replaced != %d frames\n",
+                   static_cast<unsigned long long>(stats.painted),
+                   static_cast<unsigned long long>(stats.replaced), frames);
+            ++g_failures;
+        }
+        printf("  %-8s painted:%4llu replaced:%4llu max queued:%4d  "
+               "latency avg:%7.1f ms max:%7.1f ms\n",
+               use_mailbox ? "mailbox" : "queued",
+               static_cast<unsigned long long>(stats.painted),
+               static_cast<unsigned long long>(stats.replaced),
+               use_mailbox ? 1 : max_queued,
+               stats.total_latency_us / 1000.0 / std::max<uint64_t>(stats.painted, 1),
+               stats.max_latency_us / 1000.0);
+    }
+
+    void BenchMailbox() {
+        printf("60 fps into a UI thread that paints at 40 fps\n");
+        RunMailbox(false, 180, 16, 25);
+        RunMailbox(true, 180, 16, 25);
+
+        // A renderer at 1000 fps is painted no more than once per refresh.
+        QApplication* app = GetApplication();
+        PostedRunner ui;
+        RenderCounters counters;
+        FrameMailbox mailbox(1, &counters);
+        std::vector<FrameMailbox::Frame> taken;
+        int delivered = 0;
+        RepaintPacer pacer([&] {
+            mailbox.Take(&taken);
+            if (!taken[0].image.isNull())
+                ++delivered;
+        });
+        const int kRefreshMs = 20;
+        pacer.SetInterval(kRefreshMs);
+        bool done = false;
+        QImage image = SolidFrame(QSize(64, 64), 0);
+        int64_t start = rtc::TimeMicros();
+        std::thread renderer([&] {
+            for (int i = 0; i < 500; ++i) {
+                FrameMailbox::Frame frame;
+                frame.image = image;
+                if (mailbox.Post(0, std::move(frame)))
+                    ui.Post([&] { pacer.Request(); });
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ui.Post([&] { done = true; });
+        });
+        while (!done)
+            app->processEvents(QEventLoop::WaitForMoreEvents);
+        renderer.join();
+        // Let the last paced delivery happen.
+        int64_t until = rtc::TimeMicros() + 2 * kRefreshMs * 1000;
+        while (rtc::TimeMicros() < until)
+            app->processEvents(QEventLoop::AllEvents, kRefreshMs);
+        int64_t elapsed_ms = (rtc::TimeMicros() - start) / 1000;
+        RenderStats stats = counters.Get();
+        printf("  paced:   %d deliveries in %lld ms at %d ms refresh, "
+               "%llu replaced\n", delivered,
+               static_cast<long long>(elapsed_ms), kRefreshMs,
+               static_cast<unsigned long long>(stats.replaced));
+        if (delivered == 0 || delivered > elapsed_ms / kRefreshMs + 2 ||
+            delivered + stats.replaced != 500) {
+            printf("  paced: deliveries do not match the refresh\n");
+            ++g_failures;
+        }
+    }
+
+    // How long one side of a frame handoff waited to get at a buffer and
+    // then kept the other side out of it.
+    struct LockTimes {
+        int count = 0;
+        int64_t total_wait_ns = 0;
+        int64_t max_wait_ns = 0;
+        int64_t total_hold_ns = 0;
+        int64_t max_hold_ns = 0;
+
+        void Add(int64_t wait_ns, int64_t hold_ns) {
+            ++count;
+            total_wait_ns += wait_ns;
+            max_wait_ns = std::max(max_wait_ns, wait_ns);
+            total_hold_ns += hold_ns;
+            max_hold_ns = std::max(max_hold_ns, hold_ns);
+        }
+
+        void Print(const char* side) const {
+            printf("    %-8s wait avg:%9.1f us max:%9.1f us  "
+                   "hold avg:%9.1f us max:%9.1f us\n", side,
+                   total_wait_ns / 1000.0 / std::max(count, 1),
+                   max_wait_ns / 1000.0,
+                   total_hold_ns / 1000.0 / std::max(count, 1),
+                   max_hold_ns / 1000.0);
+        }
+    };
+
+    // Marks a converted frame at both ends, so a reader can tell when it
+    // got the start of one frame and the end of another.
+    void StampFrame(uint8_t* argb, size_t size, int id) {
+        memcpy(argb, &id, sizeof(id));
+        memcpy(argb + size - sizeof(id), &id, sizeof(id));
+    }
+
+    // Returns the frame id, or -1 if the ends disagree.
+    int ReadStamp(const uint8_t* argb, size_t size) {
+        int first, last;
+        memcpy(&first, argb, sizeof(first));
+        memcpy(&last, argb + size - sizeof(last), sizeof(last));
+        return first == last ? first : -1;
+    }
+
+    // A decoder thread converts |frames| frames while the caller, standing
+    // in for the UI thread, keeps copying out the newest one like
+    // QPixmap::fromImage would. Returns the frames the reader saw torn.
+    int RunHandoff(bool triple, const webrtc::I420BufferInterface& frame,
+                   int frames, LockTimes* producer, LockTimes* consumer) {
+        const size_t size = frame.width() * frame.height() * 4;
+        // The old VideoRenderer: one buffer, locked for the whole
+        // conversion. A reader has to take the same lock to be safe.
+        rtc::CriticalSection lock;
+        std::vector<uint8_t> locked(size);
+        int locked_id = 0;
+        TripleBuffer buffers;
+        std::atomic<bool> done(false);
+
+        std::thread decoder([&] {
+            for (int id = 1; id <= frames; ++id) {
+                if (triple) {
+                    TripleBuffer::Buffer* back = buffers.back();
+                    back->Resize(frame.width(), frame.height());
+                    ToARGB(frame, back->pixels.data(), back->stride());
+                    StampFrame(back->pixels.data(), size, id);
+                    int64_t start = rtc::TimeNanos();
+                    buffers.Publish();
+                    producer->Add(0, rtc::TimeNanos() - start);
+                } else {
+                    int64_t start = rtc::TimeNanos();
+                    rtc::CritScope scope(&lock);
+                    int64_t locked_at = rtc::TimeNanos();
+                    ToARGB(frame, locked.data(), frame.width() * 4);
+                    StampFrame(locked.data(), size, id);
+                    locked_id = id;
+                    producer->Add(locked_at - start,
+                                  rtc::TimeNanos() - locked_at);
+                }
+            }
+            done = true;
+        });
+
+        std::vector<uint8_t> copy(size);
+        int torn = 0;
+        int last_id = 0;
+        while (!done) {
+            int id;
+            if (triple) {
+                int64_t start = rtc::TimeNanos();
+                bool fresh = buffers.Update();
+                if (!fresh)
+                    continue;
+                consumer->Add(rtc::TimeNanos() - start, 0);
+                memcpy(copy.data(), buffers.front().pixels.data(), size);
+                id = ReadStamp(copy.data(), size);
+            } else {
+                int64_t start = rtc::TimeNanos();
+                rtc::CritScope scope(&lock);
+                int64_t locked_at = rtc::TimeNanos();
+                if (locked_id == last_id)
+                    continue;
+                memcpy(copy.data(), locked.data(), size);
+                id = ReadStamp(copy.data(), size);
+                consumer->Add(locked_at - start, rtc::TimeNanos() - locked_at);
+            }
+            if (id < 0 || id < last_id)
+                ++torn;
+            else
+                last_id = id;
+        }
+        decoder.join();
+        return torn;
+    }
+
+    void BenchHandoff() {
+        const int kFrames = 300;
+        printf("hand converted 1080p frames to a reader\n");
+        rtc::scoped_refptr<webrtc::I420Buffer> frame = TestFrame(1920, 1080);
+        for (bool triple : {false, true}) {
+            LockTimes producer;
+            LockTimes consumer;
+            int64_t start = rtc::TimeNanos();
+            int torn = RunHandoff(triple, *frame, kFrames, &producer, &consumer);
+            int64_t elapsed_ns = rtc::TimeNanos() - start;
+            printf("  %-14s %7.1f frames/s\n",
+                   triple ? "triple buffer" : "locked buffer",
+                   kFrames * 1e9 / std::max<int64_t>(elapsed_ns, 1));
+            producer.Print("decoder");
+            consumer.Print("reader");
+            if (torn) {
+                printf("  %d frames read torn or out of order\n", torn);
+                ++g_failures;
+            }
+        }
+    }
+
+    // Camera stand-in for the conference case: a fixed frame, re-stamped
+    // and delivered at 30 fps from its own thread.
+    class SyntheticVideoSource : public rtc::AdaptedVideoTrackSource {
+    public:
+        explicit SyntheticVideoSource(
+                                      rtc::scoped_refptr<webrtc::I420Buffer> frame)
+        : frame_(frame), running_(false), captured_(0) {}
+        ~SyntheticVideoSource() override { Stop(); }
+
+        void Start() {
+            running_ = true;
+            thread_ = std::thread([this] {
+                while (running_) {
+                    OnFrame(webrtc::VideoFrame::Builder()
+                            .set_video_frame_buffer(frame_)
+                            .set_rotation(webrtc::kVideoRotation_0)
+                            .set_timestamp_us(rtc::TimeMicros())
+                            .build());
+                    ++captured_;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(33));
+                }
+            });
+        }
+        void Stop() {
+            running_ = false;
+            if (thread_.joinable())
+                thread_.join();
+        }
+        int captured() const { return captured_; }
+
+        SourceState state() const override { return kLive; }
+        bool remote() const override { return false; }
+        bool is_screencast() const override { return false; }
+        absl::optional<bool> needs_denoising() const override { return false; }
+
+    private:
+        rtc::scoped_refptr<webrtc::I420Buffer> frame_;
+        std::atomic<bool> running_;
+        std::atomic<int> captured_;
+        std::thread thread_;
+    };
+
+    class FrameCounter : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+    public:
+        void OnFrame(const webrtc::VideoFrame& frame) override { ++frames; }
+        std::atomic<int> frames{0};
+    };
+
+    // Pairs of ConferencePeers in one process: even ids send the shared
+    // track, id ^ 1 receives it. Signaling is handed straight across.
+    // Everything but the constructor runs on the signaling thread.
+    class LoopbackConference : public ConferencePeerObserver {
+    public:
+        LoopbackConference(webrtc::PeerConnectionFactoryInterface* factory,
+                           webrtc::VideoTrackInterface* track)
+        : factory_(factory), track_(track) {}
+
+        bool AddPair() {
+            int sender_id = static_cast<int>(peers_.size());
+            webrtc::PeerConnectionInterface::RTCConfiguration config;
+            config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
+            rtc::scoped_refptr<ConferencePeer> sender =
+            ConferencePeer::Create(sender_id, factory_, config, this);
+            rtc::scoped_refptr<ConferencePeer> receiver =
+            ConferencePeer::Create(sender_id + 1, factory_, config, this);
+            if (!sender || !receiver || !sender->AddTrack(track_))
+                return false;
+            peers_.push_back(sender);
+            peers_.push_back(receiver);
+            sender->CreateOffer();
+            return true;
+        }
+
+        void Close() {
+            for (auto& counter : counters_)
+                counter.first->RemoveSink(counter.second.get());
+            counters_.clear();
+            for (auto& peer : peers_)
+                peer->Close();
+            peers_.clear();
+        }
+
+        int pairs() const { return static_cast<int>(peers_.size() / 2); }
+        // Frames decoded by each receiver so far.
+        std::vector<int> Received() const {
+            std::vector<int> frames;
+            for (const auto& counter : counters_)
+                frames.push_back(counter.second->frames);
+            return frames;
+        }
+
+        void OnPeerSignal(int peer_id, const std::string& json) override {
+            JsonToken tokens[1024];
+            JsonReader reader(tokens, 1024);
+            SignalingMessage fields;
+            if (reader.Parse(json) > 0 &&
+                ReadSignalingMessage(reader, 0, &fields)) {
+                peers_[peer_id ^ 1]->HandleMessage(reader, fields);
+            }
+        }
+
+        void OnPeerVideoTrack(
+                              int peer_id,
+                              rtc::scoped_refptr<webrtc::VideoTrackInterface> track) override {
+            std::unique_ptr<FrameCounter> counter(new FrameCounter());
+            track->AddOrUpdateSink(counter.get(), rtc::VideoSinkWants());
+            counters_.emplace_back(track, std::move(counter));
+        }
+
+    private:
+        webrtc::PeerConnectionFactoryInterface* factory_;
+        webrtc::VideoTrackInterface* track_;
+        std::vector<rtc::scoped_refptr<ConferencePeer>> peers_;
+        std::vector<std::pair<rtc::scoped_refptr<webrtc::VideoTrackInterface>,
+        std::unique_ptr<FrameCounter>>> counters_;
+    };
+
+    // User plus system CPU time of the process.
+    int64_t CpuTimeUs() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ll +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    }
+
+    // Current resident set, or the peak where /proc is missing.
+    int64_t ResidentKb() {
+        FILE* statm = fopen("/proc/self/statm", "r");
+        if (statm) {
+            long pages = 0, resident = 0;
+            int read = fscanf(statm, "%ld %ld", &pages, &resident);
+            fclose(statm);
+            if (read == 2)
+                return resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // Adds loopback pairs to a conference that shares one capture source
+    // and reports what each added peer costs.
+    void BenchConference() {
+        const int kPairs[] = {1, 2, 4, 8};
+        const int kSettleMs = 3000;
+        const int kMeasureMs = 3000;
+
+        std::unique_ptr<rtc::Thread> network = rtc::Thread::CreateWithSocketServer();
+        std::unique_ptr<rtc::Thread> worker = rtc::Thread::Create();
+        std::unique_ptr<rtc::Thread> signaling = rtc::Thread::Create();
+        network->Start();
+        worker->Start();
+        signaling->Start();
+        rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory =
+        webrtc::CreatePeerConnectionFactory(
+                                            network.get(), worker.get(), signaling.get(), nullptr /* default_adm */,
+                                            webrtc::CreateBuiltinAudioEncoderFactory(),
+                                            webrtc::CreateBuiltinAudioDecoderFactory(),
+                                            webrtc::CreateBuiltinVideoEncoderFactory(),
+                                            webrtc::CreateBuiltinVideoDecoderFactory(), nullptr /* audio_mixer */,
+                                            nullptr /* audio_processing */);
+        if (!factory) {
+            printf("  no PeerConnectionFactory\n");
+            ++g_failures;
+            return;
+        }
+        rtc::scoped_refptr<SyntheticVideoSource> source(
+                                                        new rtc::RefCountedObject<SyntheticVideoSource>(TestFrame(640, 360)));
+        rtc::scoped_refptr<webrtc::VideoTrackInterface> track =
+        factory->CreateVideoTrack("conference", source);
+        source->Start();
+        LoopbackConference conference(factory, track);
+
+        printf("640x360 at 30 fps from one shared source, one connection per "
+               "peer; the peers decode in this process too\n");
+        printf("  %5s %9s %14s %10s %15s %12s\n", "peers", "cpu %",
+               "cpu %/new peer", "rss MB", "rss MB/new peer", "min recv fps");
+        // The source and factory threads alone.
+        std::this_thread::sleep_for(std::chrono::milliseconds(kSettleMs));
+        int64_t cpu_start = CpuTimeUs();
+        int64_t wall_start = rtc::TimeMicros();
+        std::this_thread::sleep_for(std::chrono::milliseconds(kMeasureMs));
+        double last_cpu = 100.0 * (CpuTimeUs() - cpu_start) /
+        std::max<int64_t>(rtc::TimeMicros() - wall_start, 1);
+        int64_t last_rss_kb = ResidentKb();
+        printf("  %5d %9.1f %14s %10.1f %15s %12s\n", 0, last_cpu, "",
+               last_rss_kb / 1024.0, "", "");
+        int last_pairs = 0;
+        for (int pairs : kPairs) {
+            bool added = signaling->Invoke<bool>(RTC_FROM_HERE, [&] {
+                while (conference.pairs() < pairs) {
+                    if (!conference.AddPair())
+                        return false;
+                }
+                return true;
+            });
+            if (!added) {
+                printf("  could not add a peer\n");
+                ++g_failures;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(kSettleMs));
+
+            std::vector<int> before = signaling->Invoke<std::vector<int>>(
+                RTC_FROM_HERE, [&] { return conference.Received(); });
+            cpu_start = CpuTimeUs();
+            wall_start = rtc::TimeMicros();
+            std::this_thread::sleep_for(std::chrono::milliseconds(kMeasureMs));
+            double cpu = 100.0 * (CpuTimeUs() - cpu_start) /
+            std::max<int64_t>(rtc::TimeMicros() - wall_start, 1);
+            std::vector<int> after = signaling->Invoke<std::vector<int>>(
+                RTC_FROM_HERE, [&] { return conference.Received(); });
+            int64_t rss_kb = ResidentKb();
+
+            double min_fps = 0;
+            if (after.size() < static_cast<size_t>(pairs)) {
+                printf("  only %zu of %d receivers got a track\n", after.size(),
+                       pairs);
+                ++g_failures;
+            } else {
+                min_fps = 1e9;
+                for (size_t i = 0; i < after.size(); ++i) {
+                    int frames = after[i] - (i < before.size() ? before[i] : 0);
+                    min_fps = std::min(min_fps, frames * 1000.0 / kMeasureMs);
+                }
+                if (min_fps <= 0) {
+                    printf("  a receiver decoded no frames\n");
+                    ++g_failures;
+                }
+            }
+            int new_peers = pairs - last_pairs;
+            printf("  %5d %9.1f %14.1f %10.1f %15.2f %12.1f\n", pairs, cpu,
+                   (cpu - last_cpu) / new_peers,
+                   rss_kb / 1024.0, (rss_kb - last_rss_kb) / 1024.0 / new_peers,
+                   min_fps);
+            last_cpu = cpu;
+            last_rss_kb = rss_kb;
+            last_pairs = pairs;
+        }
+        printf("  source captured %d frames for all peers together; "
+               "every sender still encodes on its own\n", source->captured());
+
+        signaling->Invoke<void>(RTC_FROM_HERE, [&] { conference.Close(); });
+        source->Stop();
+        track = nullptr;
+        factory = nullptr;
+    }
+
+    // The sign_in body of a server with |peers| peers signed in.
+    std::string SignInBody(int peers) {
+        std::string body;
+        for (int i = 0; i < peers; ++i) {
+            char entry[64];
+            snprintf(entry, sizeof(entry), "user%d@host-%d,%d,1\n", i, i % 97,
+                     i + 2);
+            body += entry;
+        }
+        return body;
+    }
+
+    // What PeerConnectionClient::ParseEntry did before PeerDirectory.
+    bool LegacyParseEntry(const std::string& entry, std::string* name, int* id,
+                          bool* connected) {
+        *connected = false;
+        size_t separator = entry.find(',');
+        if (separator != std::string::npos) {
+            *id = atoi(&entry[separator + 1]);
+            name->assign(entry.substr(0, separator));
+            separator = entry.find(',', separator + 1);
+            if (separator != std::string::npos) {
+                *connected = atoi(&entry[separator + 1]) ? true : false;
+            }
+        }
+        return !name->empty();
+    }
+
+    void BenchPeerDirectory() {
+        const int kPeers[] = {1000, 100000};
+        const int kLookups = 1000000;
+
+        printf("peer directory: std::map vs PeerDirectory\n");
+        for (int count : kPeers) {
+            std::string body = SignInBody(count);
+
+            int64_t start = rtc::TimeNanos();
+            std::map<int, std::string> legacy;
+            size_t pos = 0;
+            while (pos < body.size()) {
+                size_t eol = body.find('\n', pos);
+                if (eol == std::string::npos)
+                    break;
+                int id = 0;
+                std::string name;
+                bool connected;
+                if (LegacyParseEntry(body.substr(pos, eol - pos), &name, &id,
+                                     &connected)) {
+                    legacy[id] = name;
+                }
+                pos = eol + 1;
+            }
+            int64_t legacy_build_ns = rtc::TimeNanos() - start;
+
+            start = rtc::TimeNanos();
+            PeerDirectory directory;
+            directory.reserve(std::count(body.begin(), body.end(), '\n'),
+                              body.size());
+            absl::string_view rest(body);
+            pos = 0;
+            while (pos < rest.size()) {
+                size_t eol = rest.find('\n', pos);
+                if (eol == absl::string_view::npos)
+                    break;
+                int id = 0;
+                absl::string_view name;
+                bool connected;
+                if (ParsePeerEntry(rest.substr(pos, eol - pos), &name, &id,
+                                   &connected)) {
+                    directory.Set(id, name);
+                }
+                pos = eol + 1;
+            }
+            int64_t build_ns = rtc::TimeNanos() - start;
+
+            bool same = directory.size() == legacy.size();
+            auto it = legacy.begin();
+            for (PeerDirectory::Entry peer : directory) {
+                if (!same)
+                    break;
+                same = peer.id == it->first && peer.name == it->second;
+                ++it;
+            }
+
+            std::mt19937 rng(count);
+            std::vector<int> ids(kLookups);
+            for (int& id : ids)
+                id = static_cast<int>(rng() % (count + count / 4));
+            size_t legacy_hits = 0, hits = 0;
+            start = rtc::TimeNanos();
+            for (int id : ids)
+                legacy_hits += legacy.find(id) != legacy.end();
+            int64_t legacy_lookup_ns = rtc::TimeNanos() - start;
+            start = rtc::TimeNanos();
+            for (int id : ids)
+                hits += directory.Contains(id);
+            int64_t lookup_ns = rtc::TimeNanos() - start;
+            same = same && hits == legacy_hits;
+
+            std::vector<int> legacy_found, found;
+            start = rtc::TimeNanos();
+            for (const auto& peer : legacy) {
+                if (peer.second.find("@host-42") != std::string::npos)
+                    legacy_found.push_back(peer.first);
+            }
+            int64_t legacy_search_ns = rtc::TimeNanos() - start;
+            start = rtc::TimeNanos();
+            directory.Search("@host-42", &found);
+            int64_t search_ns = rtc::TimeNanos() - start;
+            same = same && found == legacy_found;
+
+            start = rtc::TimeNanos();
+            std::map<int, std::string> legacy_copy = legacy;
+            int64_t legacy_copy_ns = rtc::TimeNanos() - start;
+            start = rtc::TimeNanos();
+            PeerDirectory copy = directory;
+            int64_t copy_ns = rtc::TimeNanos() - start;
+            same = same && copy.size() == legacy_copy.size();
+
+            if (!same) {
+                printf("  peers:%d: directory does not match std::map\n", count);
+                ++g_failures;
+            }
+            printf("  peers:%-7d           %12s %12s\n", count, "std::map",
+                   "directory");
+            printf("    sign-in parse  ms  %12.3f %12.3f\n",
+                   legacy_build_ns / 1e6, build_ns / 1e6);
+            printf("    lookup         ns  %12.1f %12.1f\n",
+                   static_cast<double>(legacy_lookup_ns) / kLookups,
+                   static_cast<double>(lookup_ns) / kLookups);
+            printf("    name search    ms  %12.3f %12.3f\n",
+                   legacy_search_ns / 1e6, search_ns / 1e6);
+            printf("    snapshot copy  ms  %12.3f %12.3f\n",
+                   legacy_copy_ns / 1e6, copy_ns / 1e6);
+        }
+    }
+
+    // Server responses as peerconnection_server sends them.
+    std::string CapturedResponse(int pragma, const std::string& body) {
+        char headers[256];
+        snprintf(headers, sizeof(headers),
+                 "HTTP/1.1 200 OK\r\n"
+                 "Server: PeerConnectionTestServer/0.1\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "Connection: close\r\n"
+                 "Content-Type: text/plain\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Pragma: %d\r\n"
+                 "Access-Control-Allow-Origin: *\r\n"
+                 "Access-Control-Allow-Credentials: true\r\n"
+                 "Access-Control-Allow-Methods: POST, GET, OPTIONS\r\n"
+                 "Access-Control-Allow-Headers: Content-Type, "
+                 "Content-Length, Connection, Cache-Control\r\n"
+                 "Access-Control-Expose-Headers: Content-Length, X-Peer-Id\r\n"
+                 "\r\n",
+                 body.size(), pragma);
+        return headers + body;
+    }
+
+    // What ReadIntoBuffer did before HttpResponseParser: append each read,
+    // rescan the whole buffer for every header, then copy the body out.
+    bool LegacyParse(std::string* data, const char* read, size_t len,
+                     std::string* body, size_t* pragma) {
+        data->append(read, len);
+        size_t eoh = data->find("\r\n\r\n");
+        if (eoh == std::string::npos)
+            return false;
+        size_t found = data->find("\r\nContent-Length: ");
+        if (found == std::string::npos || found > eoh)
+            return false;
+        size_t content_length = atoi(data->c_str() + found + 18);
+        if (data->size() < eoh + 4 + content_length)
+            return false;
+        found = data->find("\r\nConnection: ");
+        if (found != std::string::npos && found < eoh) {
+            size_t end = data->find("\r\n", found + 14);
+            std::string value = data->substr(found + 14, end - found - 14);
+        }
+        found = data->find("\r\nPragma: ");
+        if (found != std::string::npos && found < eoh)
+            *pragma = atoi(data->c_str() + found + 10);
+        *body = data->substr(eoh + 4);
+        return true;
+    }
+
+    void BenchHttpParse() {
+        struct Sample {
+            const char* name;
+            std::string response;
+        };
+        std::string peers;
+        for (int i = 0; i < 1000; ++i)
+            peers += "peer" + std::to_string(i) + "@host," + std::to_string(i) + ",1\n";
+        std::vector<Sample> samples = {
+            {"notify", CapturedResponse(7, "alice@host,12,1\n")},
+            {"candidate", CapturedResponse(12, CallSetupMessages(1)[1])},
+            {"offer-4k", CapturedResponse(12, CallSetupMessages(0)[0])},
+            {"offer-64k", CapturedResponse(12, "{\"type\":\"offer\", \"sdp\":\"" +
+                                           std::string(65536, 'o') + "\"}")},
+            {"signin-1k", CapturedResponse(1, peers)},
+        };
+        // A whole response per read, and loopback-sized reads.
+        const size_t kReadSizes[] = {0, 1460};
+
+        printf("parse one response delivered in reads of N bytes\n");
+        for (const Sample& sample : samples) {
+            for (size_t read_size : kReadSizes) {
+                const std::string& response = sample.response;
+                size_t step = read_size ? read_size : response.size();
+                int iterations = std::max<int>(20, (64 << 20) / response.size());
+
+                std::string data, body;
+                size_t pragma = 0, checksum = 0;
+                int64_t start = rtc::TimeNanos();
+                for (int i = 0; i < iterations; ++i) {
+                    data.clear();
+                    for (size_t pos = 0; pos < response.size(); pos += step) {
+                        size_t len = std::min(step, response.size() - pos);
+                        if (LegacyParse(&data, response.data() + pos, len, &body,
+                                        &pragma)) {
+                            checksum += body.size() + pragma;
+                        }
+                    }
+                }
+                int64_t legacy_ns = rtc::TimeNanos() - start;
+
+                HttpResponseParser parser;
+                start = rtc::TimeNanos();
+                for (int i = 0; i < iterations; ++i) {
+                    parser.Reset();
+                    for (size_t pos = 0; pos < response.size(); pos += step) {
+                        size_t len = std::min(step, response.size() - pos);
+                        if (parser.Feed(response.data() + pos, len) ==
+                            HttpResponseParser::kDone) {
+                            parser.GetHeaderNumber("Pragma", &pragma);
+                            checksum -= parser.body().size() + pragma;
+                        }
+                    }
+                }
+                int64_t parser_ns = rtc::TimeNanos() - start;
+
+                printf("  %-10s %6zu bytes  read:%5s  legacy:%9.1f ns  "
+                       "parser:%9.1f ns  speedup:%5.2fx%s\n",
+                       sample.name, response.size(),
+                       read_size ? std::to_string(read_size).c_str() : "all",
+                       static_cast<double>(legacy_ns) / iterations,
+                       static_cast<double>(parser_ns) / iterations,
+                       static_cast<double>(legacy_ns) / std::max<int64_t>(parser_ns, 1),
+                       checksum ? "  MISMATCH" : "");
+            }
+        }
+    }
+
+    // An offer shaped like the ones Chrome produces: |transceivers|
+    // bundled m-sections alternating audio and video.
+    std::string ChromeOffer(int transceivers) {
+        std::string sdp =
+        "v=0\r\n"
+        "o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+        "s=-\r\n"
+        "t=0 0\r\n"
+        "a=group:BUNDLE";
+        for (int i = 0; i < transceivers; ++i)
+            sdp += " " + std::to_string(i);
+        sdp += "\r\na=msid-semantic: WMS ARDAMS\r\n";
+
+        const int kVideoCodecs[][2] = {
+            {96, 97}, {98, 99}, {100, 101}, {102, 122}, {127, 121}, {125, 107},
+        };
+        const char* kVideoNames[] = {"VP8", "VP9", "VP9", "H264", "H264", "H264"};
+        for (int i = 0; i < transceivers; ++i) {
+            std::string mid = std::to_string(i);
+            bool audio = i % 2 == 0;
+            if (audio) {
+                sdp += "m=audio 9 UDP/TLS/RTP/SAVPF 111 103 104 9 0 8 106 105 13 "
+                "110 112 113 126\r\n";
+            } else {
+                sdp += "m=video 9 UDP/TLS/RTP/SAVPF";
+                for (const auto& codec : kVideoCodecs)
+                    sdp += " " + std::to_string(codec[0]) + " " +
+                    std::to_string(codec[1]);
+                sdp += "\r\n";
+            }
+            sdp +=
+            "c=IN IP4 0.0.0.0\r\n"
+            "a=rtcp:9 IN IP4 0.0.0.0\r\n"
+            "a=ice-ufrag:Y2Rp\r\n"
+            "a=ice-pwd:ZxO6ANGNwRVcV+3ZK7GVrfyq\r\n"
+            "a=ice-options:trickle\r\n"
+            "a=fingerprint:sha-256 7B:8B:F0:65:5F:78:E2:51:3B:AC:6F:F3:3F:46:"
+            "1B:35:DC:B8:5F:64:1A:24:C2:43:F0:A1:58:D0:A1:2C:19:08\r\n"
+            "a=setup:actpass\r\n"
+            "a=mid:" + mid + "\r\n";
+            if (audio) {
+                sdp +=
+                "a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n"
+                "a=extmap:2 http://www.ietf.org/id/draft-holmer-rmcat-"
+                "transport-wide-cc-extensions-01\r\n"
+                "a=sendrecv\r\n"
+                "a=msid:ARDAMS audio" + mid + "\r\n"
+                "a=rtcp-mux\r\n"
+                "a=rtpmap:111 opus/48000/2\r\n"
+                "a=rtcp-fb:111 transport-cc\r\n"
+                "a=fmtp:111 minptime=10;useinbandfec=1\r\n"
+                "a=rtpmap:103 ISAC/16000\r\n"
+                "a=rtpmap:104 ISAC/32000\r\n"
+                "a=rtpmap:9 G722/8000\r\n"
+                "a=rtpmap:0 PCMU/8000\r\n"
+                "a=rtpmap:8 PCMA/8000\r\n"
+                "a=rtpmap:106 CN/32000\r\n"
+                "a=rtpmap:105 CN/16000\r\n"
+                "a=rtpmap:13 CN/8000\r\n"
+                "a=rtpmap:110 telephone-event/48000\r\n"
+                "a=rtpmap:112 telephone-event/32000\r\n"
+                "a=rtpmap:113 telephone-event/16000\r\n"
+                "a=rtpmap:126 telephone-event/8000\r\n";
+            } else {
+                sdp +=
+                "a=extmap:14 urn:ietf:params:rtp-hdrext:toffset\r\n"
+                "a=extmap:13 http://www.webrtc.org/experiments/rtp-hdrext/"
+                "abs-send-time\r\n"
+                "a=extmap:12 urn:3gpp:video-orientation\r\n"
+                "a=extmap:2 http://www.ietf.org/id/draft-holmer-rmcat-"
+                "transport-wide-cc-extensions-01\r\n"
+                "a=sendrecv\r\n"
+                "a=msid:ARDAMS video" + mid + "\r\n"
+                "a=rtcp-mux\r\n"
+                "a=rtcp-rsize\r\n";
+                for (size_t c = 0; c < sizeof(kVideoCodecs) / sizeof(kVideoCodecs[0]);
+                     ++c) {
+                    std::string pt = std::to_string(kVideoCodecs[c][0]);
+                    std::string rtx = std::to_string(kVideoCodecs[c][1]);
+                    sdp += "a=rtpmap:" + pt + " " + kVideoNames[c] + "/90000\r\n"
+                    "a=rtcp-fb:" + pt + " goog-remb\r\n"
+                    "a=rtcp-fb:" + pt + " transport-cc\r\n"
+                    "a=rtcp-fb:" + pt + " ccm fir\r\n"
+                    "a=rtcp-fb:" + pt + " nack\r\n"
+                    "a=rtcp-fb:" + pt + " nack pli\r\n";
+                    if (kVideoNames[c][0] == 'H') {
+                        sdp += "a=fmtp:" + pt + " level-asymmetry-allowed=1;"
+                        "packetization-mode=1;profile-level-id=42e01f\r\n";
+                    }
+                    sdp += "a=rtpmap:" + rtx + " rtx/90000\r\n"
+                    "a=fmtp:" + rtx + " apt=" + pt + "\r\n";
+                }
+            }
+            std::string ssrc = std::to_string(1000000 + i * 7919);
+            sdp += "a=ssrc:" + ssrc + " cname:4TOk42mSjXCkVIa6\r\n"
+            "a=ssrc:" + ssrc + " msid:ARDAMS " + (audio ? "audio" : "video") +
+            mid + "\r\n";
+        }
+        return sdp;
+    }
+
+    // The message Conductor::OnSuccess sends for |sdp|.
+    std::string OfferMessage(const std::string& sdp) {
+        JsonWriter writer;
+        writer.StartObject();
+        writer.Key("type");
+        writer.String("offer");
+        writer.Key("sdp");
+        writer.String(sdp);
+        writer.EndObject();
+        return writer.str();
+    }
+
+    // What Conductor::OnMessageFromPeer did before JsonReader: a strstr
+    // scan per key into 10 KB buffers, then a find/replace pass over the sdp.
+    bool LegacyReadMessage(const std::string& message, std::string* type,
+                           std::string* sdp, std::string* candidate) {
+        char jsonvalue[10240];
+        memset(jsonvalue, 0, sizeof(jsonvalue));
+        int vlen = sizeof(jsonvalue);
+        if (LinkGetJsonStringByKey(message.c_str(), "type", jsonvalue, &vlen) == 0) {
+            *type = jsonvalue;
+            memset(jsonvalue, 0, sizeof(jsonvalue));
+            vlen = sizeof(jsonvalue);
+            if (LinkGetJsonStringByKey(message.c_str(), "sdp", jsonvalue, &vlen) != 0)
+                return false;
+            *sdp = jsonvalue;
+            std::string::size_type pos = 0;
+            while ((pos = sdp->find("\\r\\n", pos)) != std::string::npos) {
+                sdp->replace(pos, 4, "\r\n");
+                pos += 2;
+            }
+            return true;
+        }
+        memset(jsonvalue, 0, sizeof(jsonvalue));
+        vlen = sizeof(jsonvalue);
+        if (LinkGetJsonStringByKey(message.c_str(), "sdpMid", jsonvalue, &vlen) != 0)
+            return false;
+        memset(jsonvalue, 0, sizeof(jsonvalue));
+        vlen = sizeof(jsonvalue);
+        if (LinkGetJsonIntByKey(message.c_str(), "sdpMLineIndex") < 0 ||
+            LinkGetJsonStringByKey(message.c_str(), "candidate", jsonvalue, &vlen) != 0)
+            return false;
+        *candidate = jsonvalue;
+        return true;
+    }
+
+    bool ReadMessage(const std::string& message, std::string* type,
+                     std::string* sdp, std::string* candidate) {
+        JsonToken tokens[64];
+        JsonReader reader(tokens, 64);
+        SignalingMessage fields;
+        if (reader.Parse(message) <= 0 || !ReadSignalingMessage(reader, 0, &fields))
+            return false;
+        if (!JsonUnescape(fields.type, type))
+            return false;
+        if (!type->empty())
+            return JsonUnescape(fields.sdp, sdp);
+        std::string sdp_mid;
+        return JsonUnescape(fields.sdp_mid, &sdp_mid) &&
+        fields.sdp_mline_index >= 0 && JsonUnescape(fields.candidate, candidate);
+    }
+
+    void BenchJsonParse() {
+        struct Sample {
+            std::string name;
+            std::string message;
+        };
+        std::vector<Sample> samples = {{"candidate", CallSetupMessages(1)[1]}};
+        const int kTransceivers[] = {2, 10, 50};
+        for (int transceivers : kTransceivers) {
+            samples.push_back({"offer-" + std::to_string(transceivers),
+                OfferMessage(ChromeOffer(transceivers))});
+        }
+
+        printf("extract the fields of one received message\n");
+        for (const Sample& sample : samples) {
+            const std::string& message = sample.message;
+            int iterations = std::max<int>(100, (64 << 20) / message.size());
+            std::string type, sdp, candidate;
+
+            bool legacy_ok = LegacyReadMessage(message, &type, &sdp, &candidate);
+            std::string legacy_sdp = sdp, legacy_candidate = candidate;
+            int64_t legacy_ns = 0;
+            if (legacy_ok) {
+                int64_t start = rtc::TimeNanos();
+                for (int i = 0; i < iterations; ++i) {
+                    type.clear(), sdp.clear(), candidate.clear();
+                    LegacyReadMessage(message, &type, &sdp, &candidate);
+                }
+                legacy_ns = rtc::TimeNanos() - start;
+            }
+
+            int64_t start = rtc::TimeNanos();
+            bool ok = true;
+            for (int i = 0; i < iterations; ++i) {
+                type.clear(), sdp.clear(), candidate.clear();
+                ok &= ReadMessage(message, &type, &sdp, &candidate);
+            }
+            int64_t reader_ns = rtc::TimeNanos() - start;
+            if (!ok || (legacy_ok && (sdp != legacy_sdp || candidate != legacy_candidate))) {
+                printf("  %s: results differ\n", sample.name.c_str());
+                ++g_failures;
+            }
+
+            char legacy[32] = "  failed (>10 KB)";
+            if (legacy_ok) {
+                snprintf(legacy, sizeof(legacy), "%10.1f ns",
+                         static_cast<double>(legacy_ns) / iterations);
+            }
+            printf("  %-10s %7zu bytes  legacy:%s  reader:%10.1f ns  %7.1f MB/s\n",
+                   sample.name.c_str(), message.size(), legacy,
+                   static_cast<double>(reader_ns) / iterations,
+                   message.size() * static_cast<double>(iterations) * 1000.0 /
+                   std::max<int64_t>(reader_ns, 1));
+        }
+    }
+
+    // Messages with the fields the reader must find in them.
+    struct CorpusEntry {
+        std::string json;
+        const char* type;
+        std::string sdp;
+        const char* sdp_mid;
+        const char* candidate;
+        int sdp_mline_index;
+        int batched;
+    };
+
+    std::vector<CorpusEntry> JsonCorpus() {
+        std::vector<CorpusEntry> corpus;
+        const int kTransceivers[] = {2, 10};
+        for (int transceivers : kTransceivers) {
+            std::string sdp = ChromeOffer(transceivers);
+            corpus.push_back({OfferMessage(sdp), "offer", sdp, "", "", -1, -1});
+        }
+        corpus.push_back({"{\"sdpMid\":\"0\", \"sdpMLineIndex\":0, "
+            "\"candidate\":\"candidate:1 1 udp 2122260223 10.0.0.1 50000 typ host\"}",
+            "", "", "0", "candidate:1 1 udp 2122260223 10.0.0.1 50000 typ host", 0, -1});
+        // Keys in a different order, extra members and an escaped quote.
+        corpus.push_back({"{ \"seq\" : 7 ,\"sdp\":\"a\\\"b\\u0041\\\\n\", "
+            "\"extra\":[1, -2.5e3, true, null, {\"sdp\":\"nested\"}],"
+            "\"type\" :\"answer\" }",
+            "answer", "a\"bA\\n", "", "", -1, -1});
+        // A key name inside a value must not be taken for the key.
+        corpus.push_back({"{\"candidate\":\"\\\"type\\\":\\\"offer\\\"\", "
+            "\"sdpMid\":\"audio\",\"sdpMLineIndex\":12,"
+            "\"usernameFragment\":null}",
+            "", "", "audio", "\"type\":\"offer\"", 12, -1});
+        std::string batch = "{\"candidates\":[";
+        for (int i = 0; i < 5; ++i) {
+            if (i)
+                batch += ",";
+            batch += CallSetupMessages(5)[i + 1];
+        }
+        batch += "]}";
+        corpus.push_back({batch, "", "", "", "", -1, 5});
+        return corpus;
+    }
+
+    void CheckCorpusEntry(const CorpusEntry& entry) {
+        JsonToken tokens[256];
+        JsonReader reader(tokens, 256);
+        SignalingMessage fields;
+        std::string type, sdp, sdp_mid, candidate;
+        int batched = -1;
+        bool ok = reader.Parse(entry.json) > 0 &&
+        ReadSignalingMessage(reader, 0, &fields) &&
+        JsonUnescape(fields.type, &type) && JsonUnescape(fields.sdp, &sdp) &&
+        JsonUnescape(fields.sdp_mid, &sdp_mid) &&
+        JsonUnescape(fields.candidate, &candidate);
+        if (fields.candidates >= 0)
+            batched = reader.token(fields.candidates).size;
+        if (!ok || type != entry.type || sdp != entry.sdp ||
+            sdp_mid != entry.sdp_mid || candidate != entry.candidate ||
+            fields.sdp_mline_index != entry.sdp_mline_index ||
+            batched != entry.batched) {
+            printf("  FAIL: wrong fields for %.60s\n", entry.json.c_str());
+            ++g_failures;
+        }
+    }
+
+    // Parses |json| and, if it is accepted, walks everything the client
+    // would. Returns true if it was accepted.
+    bool ParseMutated(const std::string& json) {
+        JsonToken tokens[256];
+        JsonReader reader(tokens, 256);
+        int count = reader.Parse(json);
+        if (count <= 0)
+            return false;
+        for (int i = 0; i < count; ++i) {
+            const JsonToken& token = reader.token(i);
+            if (token.end > json.size() || token.start > token.end ||
+                token.next <= static_cast<uint32_t>(i) ||
+                token.next > static_cast<uint32_t>(count)) {
+                printf("  FAIL: bad token %d in %.60s\n", i, json.c_str());
+                ++g_failures;
+                return true;
+            }
+        }
+        SignalingMessage fields;
+        std::string text;
+        if (ReadSignalingMessage(reader, 0, &fields)) {
+            JsonUnescape(fields.type, &text);
+            JsonUnescape(fields.sdp, &text);
+            JsonUnescape(fields.sdp_mid, &text);
+            JsonUnescape(fields.candidate, &text);
+        }
+        return true;
+    }
+
+    void BenchJsonCorpus() {
+        const int kMutationsPerEntry = 20000;
+        // Bytes that are most likely to change the structure.
+        const char kJsonChars[] = "{}[]\":,\\0e-u";
+        std::mt19937 random(20191017);
+        int entries = 0, truncations = 0, mutations = 0, accepted = 0;
+        for (const CorpusEntry& entry : JsonCorpus()) {
+            ++entries;
+            CheckCorpusEntry(entry);
+
+            // No strict prefix of an object is a complete document.
+            for (size_t len = 0; len < entry.json.size(); ++len) {
+                ++truncations;
+                if (ParseMutated(entry.json.substr(0, len))) {
+                    printf("  FAIL: accepted a %zu byte prefix of %.60s\n", len,
+                           entry.json.c_str());
+                    ++g_failures;
+                }
+            }
+
+            for (int i = 0; i < kMutationsPerEntry; ++i) {
+                std::string json = entry.json;
+                int edits = 1 + random() % 4;
+                for (int e = 0; e < edits; ++e) {
+                    size_t pos = random() % (json.size() + 1);
+                    switch (random() % 3) {
+                        case 0:
+                            if (pos < json.size())
+                                json[pos] = static_cast<char>(random());
+                            break;
+                        case 1:
+                            json.insert(pos, 1, kJsonChars[random() % (sizeof(kJsonChars) - 1)]);
+                            break;
+                        default:
+                            json.erase(pos, 1 + random() % 8);
+                            break;
+                    }
+                }
+                ++mutations;
+                if (ParseMutated(json))
+                    ++accepted;
+            }
+        }
+        printf("  %d entries, %d truncations, %d mutations (%d still valid json), "
+               "%d failures\n",
+               entries, truncations, mutations, accepted, g_failures);
+    }
+
+    // What Conductor::OnSuccess did before JsonWriter: a find/replace pass
+    // per CRLF, then snprintf into a 10 KB buffer. Returns false if the
+    // message was cut short.
+    bool LegacyWriteOffer(std::string sdp, char* jsonstr, size_t size) {
+        memset(jsonstr, 0, size);
+        std::string::size_type pos = 0;
+        std::string srcStr = "\r\n";
+        std::string dstStr = "\\r\\n";
+        while ((pos = sdp.find(srcStr, pos)) != std::string::npos) {
+            sdp.replace(pos, srcStr.length(), dstStr);
+            pos += dstStr.length();
+        }
+        int len = snprintf(jsonstr, size, "{\"%s\":\"%s\", \"%s\":\"%s\"}",
+                           "type", "offer", "sdp", sdp.c_str());
+        return len < static_cast<int>(size);
+    }
+
+    void BenchJsonWrite() {
+        const int kTransceivers[] = {10, 50, 100};
+        char jsonstr[10240];
+        JsonWriter writer;
+
+        printf("serialize one offer\n");
+        for (int transceivers : kTransceivers) {
+            std::string sdp = ChromeOffer(transceivers);
+            int iterations = std::max<int>(100, (32 << 20) / sdp.size());
+
+            bool complete = true;
+            int64_t start = rtc::TimeNanos();
+            for (int i = 0; i < iterations; ++i)
+                complete &= LegacyWriteOffer(sdp, jsonstr, sizeof(jsonstr));
+            int64_t legacy_ns = rtc::TimeNanos() - start;
+
+            start = rtc::TimeNanos();
+            for (int i = 0; i < iterations; ++i) {
+                writer.Reset();
+                writer.StartObject();
+                writer.Key("type");
+                writer.String("offer");
+                writer.Key("sdp");
+                writer.String(sdp);
+                writer.EndObject();
+            }
+            int64_t writer_ns = rtc::TimeNanos() - start;
+
+            // The writer's output has to read back to the same sdp.
+            JsonToken tokens[16];
+            JsonReader reader(tokens, 16);
+            SignalingMessage fields;
+            std::string decoded;
+            if (reader.Parse(writer.str()) <= 0 ||
+                !ReadSignalingMessage(reader, 0, &fields) ||
+                !JsonUnescape(fields.sdp, &decoded) || decoded != sdp) {
+                printf("  transceivers:%d: writer output does not round trip\n",
+                       transceivers);
+                ++g_failures;
+            }
+
+            printf("  transceivers:%-4d sdp:%7zu bytes  legacy:%10.1f ns%s  "
+                   "writer:%10.1f ns  %7.1f MB/s\n",
+                   transceivers, sdp.size(),
+                   static_cast<double>(legacy_ns) / iterations,
+                   complete ? "" : " (truncated)",
+                   static_cast<double>(writer_ns) / iterations,
+                   sdp.size() * static_cast<double>(iterations) * 1000.0 /
+                   std::max<int64_t>(writer_ns, 1));
+        }
+    }
+
+    struct BenchCase {
+        const char* name;
+        void (*run)();
+    };
+
+    const BenchCase kBenchCases[] = {
+        {"keepalive", BenchKeepAlive},
+        {"pipeline", BenchPipeline},
+        {"notify", BenchNotify},
+        {"peerlist", BenchPeerList},
+        {"peerdir", BenchPeerDirectory},
+        {"render", BenchRender},
+        {"convert", BenchConvert},
+        {"compose", BenchCompose},
+        {"mailbox", BenchMailbox},
+        {"handoff", BenchHandoff},
+        {"conference", BenchConference},
+        {"httpparse", BenchHttpParse},
+        {"jsonparse", BenchJsonParse},
+        {"jsoncorpus", BenchJsonCorpus},
+        {"jsonwrite", BenchJsonWrite},
+    };
+
+}  // namespace
+
+int main(int argc, char** argv) {
+#ifdef WIN32
+    rtc::WinsockInitializer winsock_init;
+#endif
+    SocketNotifier::GetSocketNotifier();
+
+    const char* which = argc > 1 ? argv[1] : nullptr;
+    bool ran = false;
+    for (const BenchCase& bench : kBenchCases) {
+        if (which && strcmp(which, bench.name) != 0)
+            continue;
+        printf("== %s\n", bench.name);
+        bench.run();
+        ran = true;
+    }
+    if (!ran) {
+        fprintf(stderr, "unknown benchmark: %s\n", which);
+        return 1;
+    }
+    return g_failures ? 1 : 0;
+}
@@ -41,7 +41,7 @@
 #include "rtc_base/logging.h"
 #include "rtc_base/ref_counted_object.h"
 #include "rtc_base/rtc_certificate_generator.h"
-#include "fixjson.h"
+#include "json_reader.h"
 #include "test/vcm_capturer.h"
 #ifndef USE_WIN32
 #include "socket_notifier.h"
@@ -57,11 +57,42 @@ namespace {
     const char kCandidateSdpMidName[] = "sdpMid";
     const char kCandidateSdpMlineIndexName[] = "sdpMLineIndex";
     const char kCandidateSdpName[] = "candidate";
+    // A batch of candidate objects sent as one message.
+    const char kCandidatesName[] = "candidates";
     
     // Names used for a SessionDescription JSON object.
     const char kSessionDescriptionTypeName[] = "type";
     const char kSessionDescriptionSdpName[] = "sdp";
     
+    // A candidate object takes 7 tokens, so this fits batches of well over
+    // a hundred.
+    const size_t kMaxJsonTokens = 1024;
+    
+    // A remote video track of a conference peer, on its way to the UI.
+    struct ConferenceTrack {
+        int peer_id;
+        rtc::scoped_refptr<webrtc::VideoTrackInterface> track;
+    };
+    
+    rtc::Thread* SignalingThread() {
+#ifndef USE_WIN32
+        return SignalHandler::GetSignalHandler()->GetThreadPtr();
+#else
+        return SocketNotifier::GetSocketNotifier()->GetThreadPtr();
+#endif
+    }
+    
+    webrtc::PeerConnectionInterface::RTCConfiguration MakeConfiguration(
+                                                                        bool dtls) {
+        webrtc::PeerConnectionInterface::RTCConfiguration config;
+        config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
+        config.enable_dtls_srtp = dtls;
+        webrtc::PeerConnectionInterface::IceServer server;
+        server.uri = GetPeerConnectionString();
+        config.servers.push_back(server);
+        return config;
+    }
+    
     class DummySetSessionDescriptionObserver
     : public webrtc::SetSessionDescriptionObserver {
     public:
@@ -115,7 +146,9 @@ namespace {
 }  // namespace
 
 Conductor::Conductor(PeerConnectionClient* client, MainWindow* main_wnd)
-: peer_id_(-1), loopback_(false), client_(client), main_wnd_(main_wnd) {
+: peer_id_(-1), loopback_(false), client_(client), main_wnd_(main_wnd),
+candidate_batch_window_ms_(GetCandidateBatchWindowMs()),
+conference_(UseConferenceMode()) {
     client_->RegisterObserver(this);
     main_wnd->RegisterObserver(this);
     
@@ -133,7 +166,7 @@ Conductor::~Conductor() {
 }
 
 bool Conductor::connection_active() const {
-    return peer_connection_ != nullptr;
+    return peer_connection_ != nullptr || !conference_peers_.empty();
 }
 
 void Conductor::Close() {
@@ -176,6 +209,12 @@ bool Conductor::InitializePeerConnection() {
         return false;
     }
     
+    if (conference_) {
+        // Connections are made per peer; only the tracks exist up front.
+        CreateConferenceTracks();
+        return true;
+    }
+    
     if (!CreatePeerConnection(/*dtls=*/true)) {
         main_wnd_->MessageBox("Error", "CreatePeerConnection failed", true);
         DeletePeerConnection();
@@ -205,19 +244,13 @@ bool Conductor::CreatePeerConnection(bool dtls) {
     RTC_DCHECK(peer_connection_factory_);
     RTC_DCHECK(!peer_connection_);
     
-    webrtc::PeerConnectionInterface::RTCConfiguration config;
-    config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
-    config.enable_dtls_srtp = dtls;
-    webrtc::PeerConnectionInterface::IceServer server;
-    server.uri = GetPeerConnectionString();
-    config.servers.push_back(server);
-    
     peer_connection_ = peer_connection_factory_->CreatePeerConnection(
-                                                                      config, nullptr, nullptr, this);
+                                                                      MakeConfiguration(dtls), nullptr, nullptr, this);
     return peer_connection_ != nullptr;
 }
 
 void Conductor::DeletePeerConnection() {
+    CloseConferencePeers();
     main_wnd_->StopLocalRenderer();
     main_wnd_->StopRemoteRenderer();
     peer_connection_ = nullptr;
@@ -289,27 +322,79 @@ void Conductor::OnIceCandidate(const webrtc::IceCandidateInterface* candidate) {
         return;
     }
     
-    char jsonstr[10240];
-    memset(jsonstr, 0, sizeof(jsonstr));
-    
     std::string sdp;
     if (!candidate->ToString(&sdp)) {
         RTC_LOG(LS_ERROR) << "Failed to serialize candidate";
         return;
     }
     
-    std::string::size_type pos = 0;
-    std::string srcStr = "\r\n";
-    std::string dstStr = "\\r\\n";
-    while ((pos = sdp.find(srcStr, pos)) != std::string::npos) {
-        sdp.replace(pos, srcStr.length(), dstStr);
-        pos += dstStr.length();
+    json_writer_.Reset();
+    json_writer_.StartObject();
+    json_writer_.Key(kCandidateSdpMidName);
+    json_writer_.String(candidate->sdp_mid());
+    json_writer_.Key(kCandidateSdpMlineIndexName);
+    json_writer_.Int(candidate->sdp_mline_index());
+    json_writer_.Key(kCandidateSdpName);
+    json_writer_.String(sdp);
+    json_writer_.EndObject();
+    if (candidate_batch_window_ms_ <= 0) {
+        SendMessage(json_writer_.str());
+        return;
+    }
+    
+    // Hold the candidate until the window closes or gathering completes,
+    // whichever comes first.
+    pending_candidates_.push_back(json_writer_.str());
+    if (!candidate_flush_scheduled_) {
+        candidate_flush_scheduled_ = true;
+        rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE,
+                                            candidate_batch_window_ms_,
+                                            this, MSG_FLUSH_CANDIDATES);
+    }
+}
+
+void Conductor::OnIceGatheringChange(
+                                     webrtc::PeerConnectionInterface::IceGatheringState new_state) {
+    if (new_state == webrtc::PeerConnectionInterface::kIceGatheringComplete)
+        FlushCandidates();
+}
+
+void Conductor::FlushCandidates() {
+    if (pending_candidates_.empty())
+        return;
+    if (!peer_connection_.get()) {
+        pending_candidates_.clear();
+        return;
     }
     
-    snprintf(jsonstr, sizeof(jsonstr), "{\"%s\":\"%s\", \"%s\":%d, \"%s\":\"%s\"}",kCandidateSdpMidName, candidate->sdp_mid().c_str(),
-             kCandidateSdpMlineIndexName, candidate->sdp_mline_index(),
-             kCandidateSdpName, sdp.c_str());
-    SendMessage(jsonstr);
+    if (pending_candidates_.size() == 1) {
+        SendMessage(pending_candidates_[0]);
+    } else {
+        json_writer_.Reset();
+        json_writer_.StartObject();
+        json_writer_.Key(kCandidatesName);
+        json_writer_.StartArray();
+        for (const std::string& candidate : pending_candidates_)
+            json_writer_.Raw(candidate);
+        json_writer_.EndArray();
+        json_writer_.EndObject();
+        RTC_LOG(INFO) << "Sending " << pending_candidates_.size()
+        << " candidates in one message";
+        SendMessage(json_writer_.str());
+    }
+    pending_candidates_.clear();
+}
+
+void Conductor::OnMessage(rtc::Message* msg) {
+    switch (msg->message_id) {
+        case MSG_FLUSH_CANDIDATES:
+            candidate_flush_scheduled_ = false;
+            FlushCandidates();
+            break;
+        default:
+            RTC_NOTREACHED();
+            break;
+    }
 }
 
 //
@@ -318,7 +403,7 @@ void Conductor::OnIceCandidate(const webrtc::IceCandidateInterface* candidate) {
 
 void Conductor::OnSignedIn() {
     RTC_LOG(INFO) << __FUNCTION__;
-    main_wnd_->SwitchToPeerList(client_->peers());
+    main_wnd_->QueueUIThreadCallback(PEER_LIST_CHANGED, NewPeerListReset());
 }
 
 void Conductor::OnDisconnected() {
@@ -330,24 +415,59 @@ void Conductor::OnDisconnected() {
 
 void Conductor::OnPeerConnected(int id, const std::string& name) {
     RTC_LOG(INFO) << __FUNCTION__;
-    // Refresh the list if we're showing it.
-    if (main_wnd_->current_ui() == MainWindow::LIST_PEERS)
-        main_wnd_->SwitchToPeerList(client_->peers());
+    QueuePeerListChange(PeerListChange::ADDED, id, name);
 }
 
 void Conductor::OnPeerDisconnected(int id) {
     RTC_LOG(INFO) << __FUNCTION__;
+    // A BYE also lands here while the peer stays signed in.
+    if (!client_->peers().Contains(id))
+        QueuePeerListChange(PeerListChange::REMOVED, id, std::string());
+    if (conference_) {
+        SignalingThread()->Invoke<void>(RTC_FROM_HERE, [this, id]() {
+            CloseConferencePeer(id);
+        });
+        return;
+    }
     if (id == peer_id_) {
         RTC_LOG(INFO) << "Our peer disconnected";
-        main_wnd_->QueueUIThreadCallback(PEER_CONNECTION_CLOSED, NULL);
-    } else {
-        // Refresh the list if we're showing it.
-        if (main_wnd_->current_ui() == MainWindow::LIST_PEERS)
-            main_wnd_->SwitchToPeerList(client_->peers());
+        main_wnd_->QueueUIThreadCallback(PEER_CONNECTION_CLOSED, NewPeerListReset());
     }
 }
 
+void Conductor::OnPeerRenamed(int id, const std::string& name) {
+    RTC_LOG(INFO) << __FUNCTION__;
+    QueuePeerListChange(PeerListChange::RENAMED, id, name);
+}
+
+void Conductor::QueuePeerListChange(PeerListChange::Type type,
+                                    int id,
+                                    const std::string& name) {
+    PeerListChange* change = new PeerListChange();
+    change->type = type;
+    change->id = id;
+    change->name = name;
+    main_wnd_->QueueUIThreadCallback(PEER_LIST_CHANGED, change);
+}
+
+PeerListChange* Conductor::NewPeerListReset() {
+    // Copy the list here, on the socket thread that owns it.
+    PeerListChange* change = new PeerListChange();
+    change->type = PeerListChange::RESET;
+    change->id = -1;
+    change->peers = client_->peers();
+    return change;
+}
+
 void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
+    if (conference_) {
+        // Client callbacks come on the socket thread; the peers live on
+        // the signaling thread.
+        SignalingThread()->Invoke<void>(RTC_FROM_HERE, [this, peer_id, &message]() {
+            OnConferenceMessage(peer_id, message);
+        });
+        return;
+    }
     RTC_DCHECK(peer_id_ == peer_id || peer_id_ == -1);
     RTC_DCHECK(!message.empty());
     
@@ -362,17 +482,17 @@ void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
         return;
     }
     
-    std::string json_object;
+    JsonToken tokens[kMaxJsonTokens];
+    JsonReader reader(tokens, kMaxJsonTokens);
+    SignalingMessage fields;
+    if (reader.Parse(message) <= 0 ||
+        !ReadSignalingMessage(reader, 0, &fields)) {
+        RTC_LOG(WARNING) << "Received a message that is not a JSON object";
+        return;
+    }
     
-    char jsonvalue[10240];
-    memset(jsonvalue, 0, sizeof(jsonvalue));
-    int vlen = sizeof(jsonvalue);
-    int ret = LinkGetJsonStringByKey(message.c_str(), kSessionDescriptionTypeName, jsonvalue, &vlen);
     std::string type_str;
-    if (ret == 0 )
-        type_str = jsonvalue;
-    memset(jsonvalue, 0, sizeof(jsonvalue));
-    vlen = sizeof(jsonvalue);
+    JsonUnescape(fields.type, &type_str);
     
     if (!type_str.empty()) {
         if (type_str == "offer-loopback") {
@@ -392,33 +512,10 @@ void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
             return;
         }
         webrtc::SdpType type = *type_maybe;
-        std::string sdp;
-        ret = LinkGetJsonStringByKey(message.c_str(), kSessionDescriptionSdpName, jsonvalue, &vlen);
-        if (ret == 0) {
-            sdp = jsonvalue;
-            std::string::size_type pos = 0;
-            std::string srcStr = "\\r\\n";
-            std::string dstStr = "\r\n";
-            while ((pos = sdp.find(srcStr, pos)) != std::string::npos) {
-                sdp.replace(pos, srcStr.length(), dstStr);
-                pos += dstStr.length();
-            }
-        } else
-            RTC_LOG(WARNING) << "get json fail";
-        memset(jsonvalue, 0, sizeof(jsonvalue));
-        vlen = sizeof(jsonvalue);
-        if (sdp.empty()) {
-            RTC_LOG(WARNING) << "Can't parse received session description message.";
-            return;
-        }
-        webrtc::SdpParseError error;
         std::unique_ptr<webrtc::SessionDescriptionInterface> session_description =
-        webrtc::CreateSessionDescription(type, sdp, &error);
-        if (!session_description) {
-            RTC_LOG(WARNING) << "Can't parse received session description message. "
-            << "SdpParseError was: " << error.description;
+        ReadSessionDescription(type, fields);
+        if (!session_description)
             return;
-        }
         RTC_LOG(INFO) << " Received session description :" << message;
         peer_connection_->SetRemoteDescription(
                                                DummySetSessionDescriptionObserver::Create(),
@@ -427,51 +524,145 @@ void Conductor::OnMessageFromPeer(int peer_id, const std::string& message) {
             peer_connection_->CreateAnswer(
                                            this, webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
         }
+    } else if (fields.candidates < 0) {
+        if (AddRemoteCandidate(fields))
+            RTC_LOG(INFO) << " Received candidate :" << message;
     } else {
-        std::string sdp_mid;
-        int sdp_mlineindex = 0;
-        std::string sdp;
-        
-        ret = LinkGetJsonStringByKey(message.c_str(), kCandidateSdpMidName, jsonvalue, &vlen);
-        if (ret == 0)
-            sdp_mid = jsonvalue;
-        else
-            RTC_LOG(WARNING) << "get json fail";
-        memset(jsonvalue, 0, sizeof(jsonvalue));
-        vlen = sizeof(jsonvalue);
-        
-        
-        sdp_mlineindex = LinkGetJsonIntByKey(message.c_str(), kCandidateSdpMlineIndexName);
-        
-        ret = LinkGetJsonStringByKey(message.c_str(), kCandidateSdpName, jsonvalue, &vlen);
-        if (ret == 0)
-            sdp = jsonvalue;
-        memset(jsonvalue, 0, sizeof(jsonvalue));
-        vlen = sizeof(jsonvalue);
-        
-        if (sdp_mlineindex < 0 || sdp.empty() || sdp_mid.empty()) {
-            RTC_LOG(WARNING) << "Can't parse received message.";
-            return;
+        const JsonToken& batch = reader.token(fields.candidates);
+        int item = fields.candidates + 1;
+        int count = 0;
+        for (uint32_t i = 0; i < batch.size; ++i) {
+            SignalingMessage candidate;
+            if (ReadSignalingMessage(reader, item, &candidate) &&
+                AddRemoteCandidate(candidate)) {
+                count++;
+            }
+            item = reader.token(item).next;
         }
-        webrtc::SdpParseError error;
-        std::unique_ptr<webrtc::IceCandidateInterface> candidate(
-                                                                 webrtc::CreateIceCandidate(sdp_mid, sdp_mlineindex, sdp, &error));
-        if (!candidate.get()) {
-            RTC_LOG(WARNING) << "Can't parse received candidate message. "
-            << "SdpParseError was: " << error.description;
+        RTC_LOG(INFO) << " Received " << count << " batched candidates";
+    }
+}
+
+bool Conductor::AddRemoteCandidate(const SignalingMessage& fields) {
+    return ApplyRemoteCandidate(peer_connection_, fields);
+}
+
+//
+// Conference mode.
+//
+
+void Conductor::CreateConferenceTracks() {
+    localMediaStream_ = peer_connection_factory_->CreateLocalMediaStream("ARDAMS");
+    audio_track_ = peer_connection_factory_->CreateAudioTrack(
+                                                              kAudioLabel, peer_connection_factory_->CreateAudioSource(cricket::AudioOptions()));
+    localMediaStream_->AddTrack(audio_track_);
+    // One capturer for all peers; each connection only adds a sink.
+    rtc::scoped_refptr<CapturerTrackSource> video_device = CapturerTrackSource::Create();
+    if (video_device) {
+        video_track_ = peer_connection_factory_->CreateVideoTrack(kVideoLabel, video_device);
+        localMediaStream_->AddTrack(video_track_);
+        main_wnd_->StartLocalRenderer(video_track_);
+    } else {
+        RTC_LOG(LS_ERROR) << "OpenVideoCaptureDevice failed";
+    }
+}
+
+ConferencePeer* Conductor::CreateConferencePeer(int peer_id) {
+    rtc::scoped_refptr<ConferencePeer> peer =
+    ConferencePeer::Create(peer_id, peer_connection_factory_,
+                           MakeConfiguration(/*dtls=*/true), this);
+    if (!peer) {
+        RTC_LOG(LS_ERROR) << "Failed to create a connection for peer " << peer_id;
+        return nullptr;
+    }
+    peer->AddTrack(audio_track_);
+    peer->AddTrack(video_track_);
+    conference_peers_[peer_id] = peer;
+    RTC_LOG(INFO) << "Conference now has " << conference_peers_.size()
+    << " peers";
+    return peer.get();
+}
+
+void Conductor::CloseConferencePeer(int peer_id) {
+    auto it = conference_peers_.find(peer_id);
+    if (it == conference_peers_.end())
+        return;
+    it->second->Close();
+    conference_peers_.erase(it);
+    main_wnd_->QueueUIThreadCallback(CONFERENCE_PEER_LEFT,
+                                     reinterpret_cast<void*>(static_cast<intptr_t>(peer_id)));
+}
+
+void Conductor::CloseConferencePeers() {
+    if (!conference_)
+        return;
+    SignalingThread()->Invoke<void>(RTC_FROM_HERE, [this]() {
+        while (!conference_peers_.empty())
+            CloseConferencePeer(conference_peers_.begin()->first);
+    });
+}
+
+void Conductor::OnConferenceMessage(int peer_id, const std::string& message) {
+    JsonToken tokens[kMaxJsonTokens];
+    JsonReader reader(tokens, kMaxJsonTokens);
+    SignalingMessage fields;
+    if (reader.Parse(message) <= 0 ||
+        !ReadSignalingMessage(reader, 0, &fields)) {
+        RTC_LOG(WARNING) << "Received a message that is not a JSON object";
+        return;
+    }
+    
+    std::string type_str;
+    JsonUnescape(fields.type, &type_str);
+    auto it = conference_peers_.find(peer_id);
+    ConferencePeer* peer = it == conference_peers_.end() ? nullptr : it->second.get();
+    if (peer && peer->offering() && type_str == "offer") {
+        // Both sides called each other at once. The lower id stays the
+        // offerer; the other drops its connection, offer and all, and
+        // answers on a new one. The socket thread is blocked in Invoke()
+        // meanwhile, so client_->id() can be read here.
+        if (client_->id() < peer_id) {
+            RTC_LOG(INFO) << "Offer collision with peer " << peer_id
+            << ", keeping ours";
             return;
         }
-        if (!peer_connection_->AddIceCandidate(candidate.get())) {
-            RTC_LOG(WARNING) << "Failed to apply the received candidate";
+        RTC_LOG(INFO) << "Offer collision with peer " << peer_id
+        << ", answering theirs";
+        peer->Close();
+        conference_peers_.erase(it);
+        peer = nullptr;
+    }
+    if (!peer) {
+        // Anyone may call in; a new peer always starts with an offer.
+        if (type_str != "offer") {
+            RTC_LOG(WARNING) << "Message from peer " << peer_id
+            << " without a connection";
             return;
         }
-        RTC_LOG(INFO) << " Received candidate :" << message;
+        peer = CreateConferencePeer(peer_id);
+        if (!peer)
+            return;
     }
+    peer->HandleMessage(reader, fields);
+}
+
+void Conductor::OnPeerSignal(int peer_id, const std::string& json) {
+    if (!client_->SendToPeer(peer_id, json))
+        RTC_LOG(LS_ERROR) << "SendToPeer failed";
+}
+
+void Conductor::OnPeerVideoTrack(
+                                 int peer_id,
+                                 rtc::scoped_refptr<webrtc::VideoTrackInterface> track) {
+    ConferenceTrack* added = new ConferenceTrack();
+    added->peer_id = peer_id;
+    added->track = track;
+    main_wnd_->QueueUIThreadCallback(CONFERENCE_TRACK_ADDED, added);
 }
 
 void Conductor::OnMessageSent(int err) {
-    // Process the next pending message if any.
-    main_wnd_->QueueUIThreadCallback(SEND_MESSAGE_TO_PEER, NULL);
+    if (err)
+        RTC_LOG(LS_ERROR) << "Failed to send message to peer, error " << err;
 }
 
 void Conductor::OnServerConnectionFailure() {
@@ -496,8 +687,22 @@ void Conductor::DisconnectFromServer() {
 }
 
 void Conductor::ConnectToPeer(int peer_id) {
-    RTC_DCHECK(peer_id_ == -1);
     RTC_DCHECK(peer_id != -1);
+    if (conference_) {
+        if (!isCreatedPc_) {
+            main_wnd_->MessageBox("Error", "Failed to initialize PeerConnection", true);
+            return;
+        }
+        SignalingThread()->Invoke<void>(RTC_FROM_HERE, [this, peer_id]() {
+            if (conference_peers_.count(peer_id))
+                return;
+            ConferencePeer* peer = CreateConferencePeer(peer_id);
+            if (peer)
+                peer->CreateOffer();
+        });
+        return;
+    }
+    RTC_DCHECK(peer_id_ == -1);
     
     if (isCreatedPc_) {
         peer_id_ = peer_id;
@@ -568,53 +773,37 @@ void Conductor::AddVideoTrack() {
 
 void Conductor::DisconnectFromCurrentPeer() {
     RTC_LOG(INFO) << __FUNCTION__;
-    if (peer_connection_.get()) {
+    if (conference_) {
+        SignalingThread()->Invoke<void>(RTC_FROM_HERE, [this]() {
+            while (!conference_peers_.empty()) {
+                int peer_id = conference_peers_.begin()->first;
+                client_->SendHangUp(peer_id);
+                CloseConferencePeer(peer_id);
+            }
+        });
+    } else if (peer_connection_.get()) {
         client_->SendHangUp(peer_id_);
         DeletePeerConnection();
     }
     
-    main_wnd_->SwitchToPeerList(client_->peers());
+    // The client changes the list on the socket thread; copy it there.
+    std::unique_ptr<PeerListChange> reset(
+        SocketNotifier::GetSocketNotifier()->GetThreadPtr()->Invoke<PeerListChange*>(
+            RTC_FROM_HERE, [this]() { return NewPeerListReset(); }));
+    main_wnd_->SwitchToPeerList(reset->peers);
 }
 
 void Conductor::UIThreadCallback(int msg_id, void* data) {
     switch (msg_id) {
-        case PEER_CONNECTION_CLOSED:
+        case PEER_CONNECTION_CLOSED: {
             RTC_LOG(INFO) << "PEER_CONNECTION_CLOSED";
             DeletePeerConnection();
             
-            if (client_->is_connected()) {
-                main_wnd_->SwitchToPeerList(client_->peers());
-            } else {
-                //main_wnd_->SwitchToConnectUI();
-            }
-            break;
-            
-        case SEND_MESSAGE_TO_PEER: {
-            std::string* msg = reinterpret_cast<std::string*>(data);
-            if (msg) {
-                RTC_LOG(INFO) << "mylog:SEND_MESSAGE_TO_PEER"<<*(reinterpret_cast<std::string*>(data));
-                // For convenience, we always run the message through the queue.
-                // This way we can be sure that messages are sent to the server
-                // in the same order they were signaled without much hassle.
-                pending_messages_.push_back(msg);
-            }
-            else
-                RTC_LOG(INFO) << "mylog:SEND_MESSAGE_TO_PEER";
-            
-            if (!pending_messages_.empty() && !client_->IsSendingMessage()) {
-                msg = pending_messages_.front();
-                pending_messages_.pop_front();
-                
-                if (!client_->SendToPeer(peer_id_, *msg) && peer_id_ != -1) {
-                    RTC_LOG(LS_ERROR) << "SendToPeer failed";
-                    DisconnectFromServer();
-                }
-                delete msg;
-            }
-            
-            if (!peer_connection_.get())
-                peer_id_ = -1;
-            
+            // The list was copied on the socket thread while signed in;
+            // client_->peers() must not be read here.
+            auto* change = reinterpret_cast<PeerListChange*>(data);
+            main_wnd_->SwitchToPeerList(change->peers);
+            delete change;
             break;
         }
             
@@ -628,6 +817,18 @@ void Conductor::UIThreadCallback(int msg_id, void* data) {
             break;
         }
             
+        case CONFERENCE_TRACK_ADDED: {
+            auto* added = reinterpret_cast<ConferenceTrack*>(data);
+            main_wnd_->StartPeerRenderer(added->peer_id, added->track);
+            delete added;
+            break;
+        }
+            
+        case CONFERENCE_PEER_LEFT:
+            main_wnd_->StopPeerRenderer(
+                                        static_cast<int>(reinterpret_cast<intptr_t>(data)));
+            break;
+            
         case TRACK_REMOVED: {
             // Remote peer stopped sending a track.
             auto* track = reinterpret_cast<webrtc::MediaStreamTrackInterface*>(data);
@@ -635,6 +836,16 @@ void Conductor::UIThreadCallback(int msg_id, void* data) {
             break;
         }
             
+        case PEER_LIST_CHANGED: {
+            auto* change = reinterpret_cast<PeerListChange*>(data);
+            if (change->type == PeerListChange::RESET)
+                main_wnd_->SwitchToPeerList(change->peers);
+            else
+                main_wnd_->UpdatePeerList(*change);
+            delete change;
+            break;
+        }
+            
         default:
             RTC_NOTREACHED();
             break;
@@ -660,22 +871,15 @@ void Conductor::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
         return;
     }
     
-    char jsonstr[10240];
-    memset(jsonstr, 0, sizeof(jsonstr));
-    
-    std::string::size_type pos = 0;
-    std::string srcStr = "\r\n";
-    std::string dstStr = "\\r\\n";
-    while ((pos = sdp.find(srcStr, pos)) != std::string::npos) {
-        sdp.replace(pos, srcStr.length(), dstStr);
-        pos += dstStr.length();
-    }
-    
-    snprintf(jsonstr, sizeof(jsonstr), "{\"%s\":\"%s\", \"%s\":\"%s\"}",
-             kSessionDescriptionTypeName, webrtc::SdpTypeToString(desc->GetType()),
-             kSessionDescriptionSdpName, sdp.c_str());
+    json_writer_.Reset();
+    json_writer_.StartObject();
+    json_writer_.Key(kSessionDescriptionTypeName);
+    json_writer_.String(webrtc::SdpTypeToString(desc->GetType()));
+    json_writer_.Key(kSessionDescriptionSdpName);
+    json_writer_.String(sdp);
+    json_writer_.EndObject();
     
-    SendMessage(jsonstr);
+    SendMessage(json_writer_.str());
 }
 
 void Conductor::OnFailure(webrtc::RTCError error) {
@@ -687,12 +891,22 @@ void Conductor::OnFailure(const std::string& error) {
 }
 
 void Conductor::SendMessage(const std::string& json_object) {
-    std::string* msg = new std::string(json_object);
-    main_wnd_->QueueUIThreadCallback(SEND_MESSAGE_TO_PEER, msg);
+    // The client queues and orders messages itself, so this goes straight
+    // out from the signaling thread instead of bouncing through the UI.
+    if (!client_->SendToPeer(peer_id_, json_object))
+        RTC_LOG(LS_ERROR) << "SendToPeer failed";
 }
 
 
 bool Conductor::RemoveLocalAudioTrack() {
+    if (conference_) {
+        // Every peer sends the same track, so muting it mutes all of them
+        // without renegotiating each connection.
+        if (!audio_track_)
+            return false;
+        audio_track_->set_enabled(false);
+        return true;
+    }
     if (localMediaStream_ && audio_track_) {
         if(localMediaStream_->RemoveTrack(audio_track_)){
 #ifdef DO_ADD_AUDIO_TRACK
@@ -709,6 +923,12 @@ bool Conductor::RemoveLocalAudioTrack() {
 }
 
 bool Conductor::RemoveLocalVideoTrack() {
+    if (conference_) {
+        if (!video_track_)
+            return false;
+        video_track_->set_enabled(false);
+        return true;
+    }
     if (localMediaStream_ && video_track_) {
         video_track_->set_enabled(false); // most important
         if( localMediaStream_->RemoveTrack(video_track_)){
@@ -726,9 +946,19 @@ bool Conductor::RemoveLocalVideoTrack() {
 }
 
 void Conductor::AddLocalAudioTrack() {
+    if (conference_) {
+        if (audio_track_)
+            audio_track_->set_enabled(true);
+        return;
+    }
     AddAudioTrack();
 }
 
 void Conductor::AddLocalVideoTrack() {
+    if (conference_) {
+        if (video_track_)
+            video_track_->set_enabled(true);
+        return;
+    }
     AddVideoTrack();
 }
@@ -11,7 +11,6 @@
 #ifndef EXAMPLES_PEERCONNECTION_CLIENT_CONDUCTOR_H_
 #define EXAMPLES_PEERCONNECTION_CLIENT_CONDUCTOR_H_
 
-#include <deque>
 #include <map>
 #include <memory>
 #include <string>
@@ -19,6 +18,9 @@
 
 #include "api/media_stream_interface.h"
 #include "api/peer_connection_interface.h"
+#include "conference_peer.h"
+#include "json_reader.h"
+#include "json_writer.h"
 #include "mainwindow.h"
 #include "peer_connection_client.h"
 
@@ -33,14 +35,27 @@ namespace cricket {
 class Conductor : public webrtc::PeerConnectionObserver,
 public webrtc::CreateSessionDescriptionObserver,
 public PeerConnectionClientObserver,
-public MainWndCallback {
+public MainWndCallback,
+public ConferencePeerObserver,
+public rtc::MessageHandler {
 public:
     enum CallbackID {
         MEDIA_CHANNELS_INITIALIZED = 1,
+        // data is a PeerListChange::RESET owned by the callback.
         PEER_CONNECTION_CLOSED,
-        SEND_MESSAGE_TO_PEER,
         NEW_TRACK_ADDED,
         TRACK_REMOVED,
+        // data is a PeerListChange owned by the callback.
+        PEER_LIST_CHANGED,
+        // data is a ConferenceTrack owned by the callback.
+        CONFERENCE_TRACK_ADDED,
+        // data is the peer id.
+        CONFERENCE_PEER_LEFT,
+    };
+    
+    // Messages posted to the signaling thread.
+    enum {
+        MSG_FLUSH_CANDIDATES,
     };
     
     Conductor(PeerConnectionClient* client, MainWindow* main_wnd);
@@ -60,6 +75,19 @@ protected:
     void AddAudioTrack();
     void AddVideoTrack();
     
+    // Conference mode. The map is only touched on the signaling thread.
+    void CreateConferenceTracks();
+    ConferencePeer* CreateConferencePeer(int peer_id);
+    void CloseConferencePeer(int peer_id);
+    void CloseConferencePeers();
+    void OnConferenceMessage(int peer_id, const std::string& message);
+    
+    // ConferencePeerObserver implementation.
+    void OnPeerSignal(int peer_id, const std::string& json) override;
+    void OnPeerVideoTrack(
+                          int peer_id,
+                          rtc::scoped_refptr<webrtc::VideoTrackInterface> track) override;
+    
     //
     // PeerConnectionObserver implementation.
     //
@@ -82,7 +110,7 @@ protected:
     void OnIceConnectionChange(
                                webrtc::PeerConnectionInterface::IceConnectionState new_state) override {}
     void OnIceGatheringChange(
-                              webrtc::PeerConnectionInterface::IceGatheringState new_state) override {}
+                              webrtc::PeerConnectionInterface::IceGatheringState new_state) override;
     void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override;
     void OnIceConnectionReceivingChange(bool receiving) override {}
     
@@ -98,6 +126,8 @@ protected:
     
     void OnPeerDisconnected(int id) override;
     
+    void OnPeerRenamed(int id, const std::string& name) override;
+    
     void OnMessageFromPeer(int peer_id, const std::string& message) override;
     
     void OnMessageSent(int err) override;
@@ -123,6 +153,9 @@ protected:
     virtual void AddLocalAudioTrack() override;
     virtual void AddLocalVideoTrack() override;
     
+    // rtc::MessageHandler implementation.
+    void OnMessage(rtc::Message* msg) override;
+    
     // CreateSessionDescriptionObserver implementation.
     void OnSuccess(webrtc::SessionDescriptionInterface* desc) override;
     void OnFailure(webrtc::RTCError error) override;
@@ -131,6 +164,16 @@ protected:
 protected:
     // Send a message to the remote peer.
     void SendMessage(const std::string& json_object);
+    // Sends the candidates batched so far as one message.
+    void FlushCandidates();
+    bool AddRemoteCandidate(const SignalingMessage& fields);
+    // Hands a peer list change to the UI thread.
+    void QueuePeerListChange(PeerListChange::Type type,
+                             int id,
+                             const std::string& name);
+    // A RESET holding a copy of the whole list. Socket thread only, the
+    // client changes the list there.
+    PeerListChange* NewPeerListReset();
     
     int peer_id_;
     bool loopback_;
@@ -139,10 +182,24 @@ protected:
     peer_connection_factory_;
     PeerConnectionClient* client_;
     MainWindow* main_wnd_;
-    std::deque<std::string*> pending_messages_;
     std::string server_;
     bool isCreatedPc_ = false;
     
+    // WEBRTC_CONFERENCE: a PeerConnection per peer instead of the one
+    // above, all sending the local tracks below.
+    bool conference_;
+    std::map<int, rtc::scoped_refptr<ConferencePeer>> conference_peers_;
+    
+    // Local candidates waiting for the batch window to close. Only touched
+    // on the signaling thread.
+    std::vector<std::string> pending_candidates_;
+    bool candidate_flush_scheduled_ = false;
+    int candidate_batch_window_ms_;
+    
+    // Serializes outgoing messages. Signaling thread only; reused so large
+    // offers stop allocating after the first.
+    JsonWriter json_writer_;
+    
     // local streams
     rtc::scoped_refptr<webrtc::MediaStreamInterface> localMediaStream_;
     rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
@@ -0,0 +1,232 @@
+#include "conference_peer.h"
+
+#include <utility>
+
+#include "defaults.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/ref_counted_object.h"
+
+namespace {
+    // Names used for a IceCandidate JSON object.
+    const char kCandidateSdpMidName[] = "sdpMid";
+    const char kCandidateSdpMlineIndexName[] = "sdpMLineIndex";
+    const char kCandidateSdpName[] = "candidate";
+
+    // Names used for a SessionDescription JSON object.
+    const char kSessionDescriptionTypeName[] = "type";
+    const char kSessionDescriptionSdpName[] = "sdp";
+
+    class LogSetSessionDescriptionObserver
+    : public webrtc::SetSessionDescriptionObserver {
+    public:
+        static LogSetSessionDescriptionObserver* Create(int peer_id) {
+            return new rtc::RefCountedObject<LogSetSessionDescriptionObserver>(
+                peer_id);
+        }
+        void OnSuccess() override {}
+        void OnFailure(webrtc::RTCError error) override {
+            RTC_LOG(WARNING) << "peer " << peer_id_ << ": "
+            << ToString(error.type()) << ": " << error.message();
+        }
+
+    protected:
+        explicit LogSetSessionDescriptionObserver(int peer_id)
+        : peer_id_(peer_id) {}
+
+    private:
+        int peer_id_;
+    };
+}  // namespace
+
+std::unique_ptr<webrtc::SessionDescriptionInterface> ReadSessionDescription(
+    webrtc::SdpType type,
+    const SignalingMessage& fields) {
+    std::string sdp;
+    if (!JsonUnescape(fields.sdp, &sdp))
+        RTC_LOG(WARNING) << "Bad escape in received sdp";
+    if (sdp.empty()) {
+        RTC_LOG(WARNING) << "Can't parse received session description message.";
+        return nullptr;
+    }
+    webrtc::SdpParseError error;
+    std::unique_ptr<webrtc::SessionDescriptionInterface> session_description =
+    webrtc::CreateSessionDescription(type, sdp, &error);
+    if (!session_description) {
+        RTC_LOG(WARNING) << "Can't parse received session description message. "
+        << "SdpParseError was: " << error.description;
+    }
+    return session_description;
+}
+
+bool ApplyRemoteCandidate(webrtc::PeerConnectionInterface* pc,
+                          const SignalingMessage& fields) {
+    std::string sdp_mid;
+    std::string sdp;
+    JsonUnescape(fields.sdp_mid, &sdp_mid);
+    JsonUnescape(fields.candidate, &sdp);
+    int sdp_mlineindex = fields.sdp_mline_index;
+
+    if (sdp_mlineindex < 0 || sdp.empty() || sdp_mid.empty()) {
+        RTC_LOG(WARNING) << "Can't parse received message.";
+        return false;
+    }
+    webrtc::SdpParseError error;
+    std::unique_ptr<webrtc::IceCandidateInterface> candidate(
+        webrtc::CreateIceCandidate(sdp_mid, sdp_mlineindex, sdp, &error));
+    if (!candidate.get()) {
+        RTC_LOG(WARNING) << "Can't parse received candidate message. "
+        << "SdpParseError was: " << error.description;
+        return false;
+    }
+    if (!pc->AddIceCandidate(candidate.get())) {
+        RTC_LOG(WARNING) << "Failed to apply the received candidate";
+        return false;
+    }
+    return true;
+}
+
+rtc::scoped_refptr<ConferencePeer> ConferencePeer::Create(
+    int peer_id,
+    webrtc::PeerConnectionFactoryInterface* factory,
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    ConferencePeerObserver* observer) {
+    rtc::scoped_refptr<ConferencePeer> peer(
+        new rtc::RefCountedObject<ConferencePeer>(peer_id, observer));
+    peer->pc_ = factory->CreatePeerConnection(config, nullptr, nullptr,
+                                              peer.get());
+    if (!peer->pc_)
+        return nullptr;
+    return peer;
+}
+
+ConferencePeer::ConferencePeer(int peer_id, ConferencePeerObserver* observer)
+: peer_id_(peer_id), observer_(observer), offering_(false) {}
+
+ConferencePeer::~ConferencePeer() {
+    Close();
+}
+
+bool ConferencePeer::AddTrack(webrtc::MediaStreamTrackInterface* track) {
+    if (!pc_ || !track)
+        return false;
+    auto result_or_error = pc_->AddTrack(track, {kStreamId});
+    if (!result_or_error.ok()) {
+        RTC_LOG(LS_ERROR) << "Failed to add track for peer " << peer_id_
+        << ": " << result_or_error.error().message();
+        return false;
+    }
+    return true;
+}
+
+void ConferencePeer::CreateOffer() {
+    if (!pc_)
+        return;
+    offering_ = true;
+    pc_->CreateOffer(this,
+                     webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+}
+
+void ConferencePeer::HandleMessage(const JsonReader& reader,
+                                   const SignalingMessage& fields) {
+    if (!pc_)
+        return;
+    if (!fields.type.empty()) {
+        std::string type_str;
+        JsonUnescape(fields.type, &type_str);
+        absl::optional<webrtc::SdpType> type =
+        webrtc::SdpTypeFromString(type_str);
+        if (!type) {
+            RTC_LOG(LS_ERROR) << "Unknown SDP type: " << type_str;
+            return;
+        }
+        std::unique_ptr<webrtc::SessionDescriptionInterface> description =
+        ReadSessionDescription(*type, fields);
+        if (!description)
+            return;
+        if (*type == webrtc::SdpType::kAnswer)
+            offering_ = false;
+        pc_->SetRemoteDescription(
+            LogSetSessionDescriptionObserver::Create(peer_id_),
+            description.release());
+        if (*type == webrtc::SdpType::kOffer)
+            pc_->CreateAnswer(
+                this, webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+    } else if (fields.candidates < 0) {
+        ApplyRemoteCandidate(pc_, fields);
+    } else {
+        const JsonToken& batch = reader.token(fields.candidates);
+        int item = fields.candidates + 1;
+        for (uint32_t i = 0; i < batch.size; ++i) {
+            SignalingMessage candidate;
+            if (ReadSignalingMessage(reader, item, &candidate))
+                ApplyRemoteCandidate(pc_, candidate);
+            item = reader.token(item).next;
+        }
+    }
+}
+
+void ConferencePeer::Close() {
+    observer_ = nullptr;
+    if (pc_) {
+        pc_->Close();
+        pc_ = nullptr;
+    }
+}
+
+void ConferencePeer::OnTrack(
+    rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) {
+    rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track =
+    transceiver->receiver()->track();
+    if (!observer_ ||
+        track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind)
+        return;
+    observer_->OnPeerVideoTrack(
+        peer_id_, static_cast<webrtc::VideoTrackInterface*>(track.get()));
+}
+
+void ConferencePeer::OnIceCandidate(
+    const webrtc::IceCandidateInterface* candidate) {
+    if (!observer_)
+        return;
+    std::string sdp;
+    if (!candidate->ToString(&sdp)) {
+        RTC_LOG(LS_ERROR) << "Failed to serialize candidate";
+        return;
+    }
+    json_writer_.Reset();
+    json_writer_.StartObject();
+    json_writer_.Key(kCandidateSdpMidName);
+    json_writer_.String(candidate->sdp_mid());
+    json_writer_.Key(kCandidateSdpMlineIndexName);
+    json_writer_.Int(candidate->sdp_mline_index());
+    json_writer_.Key(kCandidateSdpName);
+    json_writer_.String(sdp);
+    json_writer_.EndObject();
+    observer_->OnPeerSignal(peer_id_, json_writer_.str());
+}
+
+void ConferencePeer::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
+    if (!pc_ || !observer_) {
+        delete desc;
+        return;
+    }
+    std::string sdp;
+    desc->ToString(&sdp);
+    webrtc::SdpType type = desc->GetType();
+    pc_->SetLocalDescription(
+        LogSetSessionDescriptionObserver::Create(peer_id_), desc);
+
+    json_writer_.Reset();
+    json_writer_.StartObject();
+    json_writer_.Key(kSessionDescriptionTypeName);
+    json_writer_.String(webrtc::SdpTypeToString(type));
+    json_writer_.Key(kSessionDescriptionSdpName);
+    json_writer_.String(sdp);
+    json_writer_.EndObject();
+    observer_->OnPeerSignal(peer_id_, json_writer_.str());
+}
+
+void ConferencePeer::OnFailure(webrtc::RTCError error) {
+    RTC_LOG(LERROR) << "peer " << peer_id_ << ": " << ToString(error.type())
+    << ": " << error.message();
+}
@@ -0,0 +1,87 @@
+#ifndef MYRTCDEMO_CONFERENCE_PEER_H_
+#define MYRTCDEMO_CONFERENCE_PEER_H_
+
+#include <memory>
+#include <string>
+
+#include "api/media_stream_interface.h"
+#include "api/peer_connection_interface.h"
+#include "json_reader.h"
+#include "json_writer.h"
+
+// Parses the session description of a signaling message, or returns null.
+std::unique_ptr<webrtc::SessionDescriptionInterface> ReadSessionDescription(
+    webrtc::SdpType type,
+    const SignalingMessage& fields);
+// Adds one candidate of a signaling message to |pc|.
+bool ApplyRemoteCandidate(webrtc::PeerConnectionInterface* pc,
+                          const SignalingMessage& fields);
+
+class ConferencePeerObserver {
+public:
+    // Signaling thread. |json| is to be sent to |peer_id|.
+    virtual void OnPeerSignal(int peer_id, const std::string& json) = 0;
+    virtual void OnPeerVideoTrack(
+        int peer_id,
+        rtc::scoped_refptr<webrtc::VideoTrackInterface> track) = 0;
+
+protected:
+    virtual ~ConferencePeerObserver() {}
+};
+
+// One PeerConnection of a conference. Every peer gets its own connection,
+// but they all send the same local tracks, so the capture source runs once
+// whatever the number of peers. Lives on the signaling thread.
+class ConferencePeer : public webrtc::PeerConnectionObserver,
+public webrtc::CreateSessionDescriptionObserver {
+public:
+    static rtc::scoped_refptr<ConferencePeer> Create(
+        int peer_id,
+        webrtc::PeerConnectionFactoryInterface* factory,
+        const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+        ConferencePeerObserver* observer);
+
+    int peer_id() const { return peer_id_; }
+    webrtc::PeerConnectionInterface* connection() const { return pc_; }
+
+    bool AddTrack(webrtc::MediaStreamTrackInterface* track);
+    void CreateOffer();
+    // Whether our offer is out, or being made, and not answered yet.
+    bool offering() const { return offering_; }
+    // Applies an offer, answer or candidates received from the peer.
+    void HandleMessage(const JsonReader& reader, const SignalingMessage& fields);
+    // Drops the connection; the observer hears nothing more.
+    void Close();
+
+    //
+    // PeerConnectionObserver implementation.
+    //
+
+    void OnSignalingChange(
+        webrtc::PeerConnectionInterface::SignalingState new_state) override {}
+    void OnTrack(
+        rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) override;
+    void OnDataChannel(
+        rtc::scoped_refptr<webrtc::DataChannelInterface> channel) override {}
+    void OnRenegotiationNeeded() override {}
+    void OnIceGatheringChange(
+        webrtc::PeerConnectionInterface::IceGatheringState new_state) override {}
+    void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override;
+
+    // CreateSessionDescriptionObserver implementation.
+    void OnSuccess(webrtc::SessionDescriptionInterface* desc) override;
+    void OnFailure(webrtc::RTCError error) override;
+
+protected:
+    ConferencePeer(int peer_id, ConferencePeerObserver* observer);
+    ~ConferencePeer();
+
+    int peer_id_;
+    ConferencePeerObserver* observer_;
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+    bool offering_;
+    // Reused for every message to this peer.
+    JsonWriter json_writer_;
+};
+
+#endif  // MYRTCDEMO_CONFERENCE_PEER_H_
@@ -57,3 +57,27 @@ std::string GetPeerName() {
     }
     return ret;
 }
+
+bool UseSignalingKeepAlive() {
+    return GetEnvVarOrDefault("WEBRTC_KEEPALIVE", "0") != "0";
+}
+
+int GetCandidateBatchWindowMs() {
+    return atoi(GetEnvVarOrDefault("WEBRTC_CANDIDATE_BATCH_MS", "0").c_str());
+}
+
+int GetSignalingMaxInFlight() {
+    return atoi(GetEnvVarOrDefault("WEBRTC_SIGNALING_INFLIGHT", "1").c_str());
+}
+
+bool UseNotificationStream() {
+    return GetEnvVarOrDefault("WEBRTC_NOTIFY_STREAM", "0") != "0";
+}
+
+bool UseFrameRing() {
+    return GetEnvVarOrDefault("WEBRTC_RENDER_RING", "0") != "0";
+}
+
+bool UseConferenceMode() {
+    return GetEnvVarOrDefault("WEBRTC_CONFERENCE", "0") != "0";
+}
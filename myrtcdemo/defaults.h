@@ -25,5 +25,22 @@ std::string GetEnvVarOrDefault(const char* env_var_name,
 std::string GetPeerConnectionString();
 std::string GetDefaultServerName();
 std::string GetPeerName();
+// WEBRTC_KEEPALIVE=1 keeps the signaling control connection open.
+bool UseSignalingKeepAlive();
+// WEBRTC_CANDIDATE_BATCH_MS coalesces local ICE candidates gathered within
+// that many milliseconds into one signaling message. 0 sends them one by one.
+int GetCandidateBatchWindowMs();
+// WEBRTC_SIGNALING_INFLIGHT lets that many signaling messages wait for the
+// server at once. 1 sends them strictly one after another.
+int GetSignalingMaxInFlight();
+// WEBRTC_NOTIFY_STREAM=1 asks the server to stream peer notifications over
+// one /wait connection instead of reconnecting after each.
+bool UseNotificationStream();
+// WEBRTC_RENDER_RING=1 hands rendered frames to the UI in shared buffers
+// instead of copying them into a new image each frame.
+bool UseFrameRing();
+// WEBRTC_CONFERENCE=1 keeps a PeerConnection per peer, so several peers can
+// be called at once and share the local tracks.
+bool UseConferenceMode();
 
 #endif  // EXAMPLES_PEERCONNECTION_CLIENT_DEFAULTS_H_
@@ -0,0 +1,66 @@
+#include "frame_converter.h"
+
+#include "third_party/libyuv/include/libyuv/convert_argb.h"
+#include "third_party/libyuv/include/libyuv/rotate.h"
+#include "third_party/libyuv/include/libyuv/scale.h"
+
+void FrameConverter::RotatedSize(int width,
+                                 int height,
+                                 webrtc::VideoRotation rotation,
+                                 int* rotated_width,
+                                 int* rotated_height) {
+    bool transposed = rotation == webrtc::kVideoRotation_90 ||
+    rotation == webrtc::kVideoRotation_270;
+    *rotated_width = transposed ? height : width;
+    *rotated_height = transposed ? width : height;
+}
+
+void FrameConverter::Convert(const webrtc::I420BufferInterface& frame,
+                             webrtc::VideoRotation rotation,
+                             int width,
+                             int height,
+                             uint8_t* argb,
+                             int stride) {
+    // Rotating back gives the size to scale to before rotating.
+    int scaled_width, scaled_height;
+    RotatedSize(width, height, rotation, &scaled_width, &scaled_height);
+    
+    const webrtc::I420BufferInterface* source = &frame;
+    if (frame.width() != scaled_width || frame.height() != scaled_height) {
+        webrtc::I420Buffer* scaled = Reuse(&scaled_, scaled_width, scaled_height);
+        libyuv::I420Scale(frame.DataY(), frame.StrideY(), frame.DataU(),
+                          frame.StrideU(), frame.DataV(), frame.StrideV(),
+                          frame.width(), frame.height(),
+                          scaled->MutableDataY(), scaled->StrideY(),
+                          scaled->MutableDataU(), scaled->StrideU(),
+                          scaled->MutableDataV(), scaled->StrideV(),
+                          scaled_width, scaled_height, libyuv::kFilterBox);
+        source = scaled;
+    }
+    if (rotation != webrtc::kVideoRotation_0) {
+        webrtc::I420Buffer* rotated = Reuse(&rotated_, width, height);
+        // VideoRotation and libyuv::RotationMode use the same degrees.
+        libyuv::I420Rotate(source->DataY(), source->StrideY(), source->DataU(),
+                           source->StrideU(), source->DataV(), source->StrideV(),
+                           rotated->MutableDataY(), rotated->StrideY(),
+                           rotated->MutableDataU(), rotated->StrideU(),
+                           rotated->MutableDataV(), rotated->StrideV(),
+                           scaled_width, scaled_height,
+                           static_cast<libyuv::RotationMode>(rotation));
+        source = rotated;
+    }
+    libyuv::I420ToARGB(source->DataY(), source->StrideY(), source->DataU(),
+                       source->StrideU(), source->DataV(), source->StrideV(),
+                       argb, stride, width, height);
+}
+
+webrtc::I420Buffer* FrameConverter::Reuse(
+                                          rtc::scoped_refptr<webrtc::I420Buffer>* buffer,
+                                          int width,
+                                          int height) {
+    if (!*buffer || (*buffer)->width() != width ||
+        (*buffer)->height() != height) {
+        *buffer = webrtc::I420Buffer::Create(width, height);
+    }
+    return buffer->get();
+}
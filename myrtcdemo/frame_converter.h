@@ -0,0 +1,43 @@
+#ifndef MYRTCDEMO_FRAME_CONVERTER_H_
+#define MYRTCDEMO_FRAME_CONVERTER_H_
+
+#include <stdint.h>
+
+#include "api/video/i420_buffer.h"
+#include "api/video/video_rotation.h"
+#include "rtc_base/scoped_ref_ptr.h"
+
+// Turns a decoded frame into ARGB pixels at the size it is shown, rotating
+// and scaling on the way. Scaling comes first while the frame is still
+// I420, so a small preview of a large frame never exists as a full size
+// image, and rotation only moves the scaled pixels. Each step is one libyuv
+// call with its SIMD paths. The intermediate planes are reused across
+// frames of the same size.
+class FrameConverter {
+public:
+    // Size of a |width|x|height| frame once |rotation| is applied.
+    static void RotatedSize(int width,
+                            int height,
+                            webrtc::VideoRotation rotation,
+                            int* rotated_width,
+                            int* rotated_height);
+    
+    // Writes |frame| rotated by |rotation| and scaled to |width|x|height|
+    // into |argb|.
+    void Convert(const webrtc::I420BufferInterface& frame,
+                 webrtc::VideoRotation rotation,
+                 int width,
+                 int height,
+                 uint8_t* argb,
+                 int stride);
+    
+private:
+    static webrtc::I420Buffer* Reuse(rtc::scoped_refptr<webrtc::I420Buffer>* buffer,
+                                     int width,
+                                     int height);
+    
+    rtc::scoped_refptr<webrtc::I420Buffer> scaled_;
+    rtc::scoped_refptr<webrtc::I420Buffer> rotated_;
+};
+
+#endif  // MYRTCDEMO_FRAME_CONVERTER_H_
@@ -0,0 +1,61 @@
+#include "frame_mailbox.h"
+
+#include <utility>
+
+FrameMailbox::FrameMailbox(int streams, RenderCounters* counters)
+: frames_(streams), wake_pending_(false), counters_(counters) {}
+
+bool FrameMailbox::Post(int stream, Frame frame) {
+    bool wake;
+    {
+        rtc::CritScope lock(&lock_);
+        if (stream < 0 || stream >= static_cast<int>(frames_.size()))
+            return false;
+        if (!frames_[stream].image.isNull())
+            counters_->OnReplaced();
+        // The old frame leaves with |frame|, outside the lock; for a ring
+        // frame that gives its slot back.
+        std::swap(frames_[stream], frame);
+        wake = !wake_pending_;
+        wake_pending_ = true;
+    }
+    return wake;
+}
+
+void FrameMailbox::Take(std::vector<Frame>* frames) {
+    frames->resize(frames_.size());
+    rtc::CritScope lock(&lock_);
+    for (size_t i = 0; i < frames_.size(); ++i) {
+        (*frames)[i] = std::move(frames_[i]);
+        frames_[i] = Frame();
+    }
+    wake_pending_ = false;
+}
+
+RepaintPacer::RepaintPacer(std::function<void()> callback)
+: callback_(std::move(callback)), requested_(false) {
+    timer_.setSingleShot(true);
+    timer_.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&timer_, &QTimer::timeout, [this] { OnTimeout(); });
+}
+
+void RepaintPacer::SetInterval(int interval_ms) {
+    timer_.setInterval(interval_ms);
+}
+
+void RepaintPacer::Request() {
+    if (timer_.isActive()) {
+        requested_ = true;
+        return;
+    }
+    callback_();
+    timer_.start();
+}
+
+void RepaintPacer::OnTimeout() {
+    if (!requested_)
+        return;
+    requested_ = false;
+    callback_();
+    timer_.start();
+}
@@ -0,0 +1,65 @@
+#ifndef MYRTCDEMO_FRAME_MAILBOX_H_
+#define MYRTCDEMO_FRAME_MAILBOX_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+#include <QImage>
+#include <QTimer>
+
+#include "frame_ring.h"
+#include "rtc_base/critical_section.h"
+
+// Hands the newest frame of each video stream from the renderer threads to
+// the UI thread. A stream holds one frame; a newer one replaces it, so a
+// stalled UI thread sees only the latest picture and nothing queues up
+// behind it. Post() reports when the UI needs waking, which is at most once
+// between two calls to Take(), so at most one wakeup is ever in flight.
+class FrameMailbox {
+public:
+    struct Frame {
+        QImage image;
+        // When the renderer got the frame, and the best known time it was
+        // captured, both on the rtc::TimeMicros clock.
+        int64_t arrival_us = 0;
+        int64_t capture_us = 0;
+    };
+    
+    // |counters| counts the frames replaced before the UI took them.
+    FrameMailbox(int streams, RenderCounters* counters);
+    
+    // Renderer threads. Returns true if the UI thread should be woken.
+    bool Post(int stream, Frame frame);
+    // UI thread. Takes the waiting frame of every stream into |frames|,
+    // leaving a null image for streams without one.
+    void Take(std::vector<Frame>* frames);
+    
+private:
+    rtc::CriticalSection lock_;
+    std::vector<Frame> frames_;
+    bool wake_pending_;
+    RenderCounters* counters_;
+};
+
+// Runs a callback at most once per display refresh. Request() runs it right
+// away if the last run was a refresh ago, otherwise once the refresh is up,
+// however many requests came in between. UI thread only.
+class RepaintPacer {
+public:
+    explicit RepaintPacer(std::function<void()> callback);
+    
+    void SetInterval(int interval_ms);
+    int interval_ms() const { return timer_.interval(); }
+    void Request();
+    
+private:
+    void OnTimeout();
+    
+    std::function<void()> callback_;
+    QTimer timer_;
+    bool requested_;
+};
+
+#endif  // MYRTCDEMO_FRAME_MAILBOX_H_
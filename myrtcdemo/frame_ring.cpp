@@ -0,0 +1,81 @@
+#include "frame_ring.h"
+
+rtc::scoped_refptr<FrameRing> FrameRing::Create(size_t slots) {
+    return new rtc::RefCountedObject<FrameRing>(slots);
+}
+
+FrameRing::FrameRing(size_t slots)
+: slots_(new Slot[slots]), count_(slots), next_(0) {
+    for (size_t i = 0; i < count_; ++i)
+        slots_[i].ring = this;
+}
+
+FrameRing::~FrameRing() {}
+
+int FrameRing::Acquire(int width, int height) {
+    for (size_t n = 0; n < count_; ++n) {
+        size_t i = (next_ + n) % count_;
+        Slot& slot = slots_[i];
+        // Only this thread marks slots busy, so a free one stays free.
+        if (slot.busy.load(std::memory_order_acquire))
+            continue;
+        slot.busy.store(true, std::memory_order_relaxed);
+        size_t size = static_cast<size_t>(width) * height * 4;
+        if (slot.pixels.size() < size)
+            slot.pixels.resize(size);
+        slot.width = width;
+        slot.height = height;
+        next_ = (i + 1) % count_;
+        return static_cast<int>(i);
+    }
+    return -1;
+}
+
+QImage FrameRing::Publish(int index) {
+    Slot& slot = slots_[index];
+    // The image holds the ring alive until it lets go of the slot.
+    AddRef();
+    // libyuv leaves alpha at 0xff, so RGB32 is exact and draws without a
+    // per-pixel alpha pass.
+    return QImage(slot.pixels.data(), slot.width, slot.height, slot.width * 4,
+                  QImage::Format_RGB32, &FrameRing::ReleaseSlot, &slot);
+}
+
+void FrameRing::ReleaseSlot(void* info) {
+    Slot* slot = static_cast<Slot*>(info);
+    FrameRing* ring = slot->ring;
+    slot->busy.store(false, std::memory_order_release);
+    ring->Release();
+}
+
+namespace {
+    
+    void UpdateMax(std::atomic<int64_t>* max, int64_t value) {
+        int64_t current = max->load();
+        while (value > current && !max->compare_exchange_weak(current, value)) {
+        }
+    }
+    
+}  // namespace
+
+void RenderCounters::OnPainted(int64_t latency_us, int64_t glass_us) {
+    ++painted_;
+    total_latency_us_ += latency_us;
+    UpdateMax(&max_latency_us_, latency_us);
+    total_glass_us_ += glass_us;
+    UpdateMax(&max_glass_us_, glass_us);
+}
+
+RenderStats RenderCounters::Get() const {
+    RenderStats stats;
+    stats.frames = frames_;
+    stats.dropped = dropped_;
+    stats.replaced = replaced_;
+    stats.copies = copies_;
+    stats.painted = painted_;
+    stats.total_latency_us = total_latency_us_;
+    stats.max_latency_us = max_latency_us_;
+    stats.total_glass_us = total_glass_us_;
+    stats.max_glass_us = max_glass_us_;
+    return stats;
+}
@@ -0,0 +1,98 @@
+#ifndef MYRTCDEMO_FRAME_RING_H_
+#define MYRTCDEMO_FRAME_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QImage>
+
+#include "rtc_base/ref_counted_object.h"
+#include "rtc_base/scoped_ref_ptr.h"
+
+// A few preallocated RGB32 frame buffers passed from a renderer thread to
+// the UI thread without copying. A filled slot is handed over as a QImage
+// that points at the slot's pixels; QImage's own reference count keeps the
+// slot busy until the last copy of that image is gone, then the slot goes
+// back to the ring. If the UI still holds every slot, the renderer drops
+// the frame instead of waiting.
+class FrameRing : public rtc::RefCountInterface {
+public:
+    static rtc::scoped_refptr<FrameRing> Create(size_t slots);
+    
+    // Claims a free slot sized for |width|x|height|, or returns -1 if none is
+    // free. Renderer thread only.
+    int Acquire(int width, int height);
+    uint8_t* pixels(int slot) { return slots_[slot].pixels.data(); }
+    int stride(int slot) const { return slots_[slot].width * 4; }
+    
+    // Wraps a filled slot. Safe to copy to and destroy on any thread.
+    QImage Publish(int slot);
+    
+protected:
+    explicit FrameRing(size_t slots);
+    ~FrameRing() override;
+    
+private:
+    struct Slot {
+        FrameRing* ring = nullptr;
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+        std::atomic<bool> busy{false};
+    };
+    
+    static void ReleaseSlot(void* slot);
+    
+    std::unique_ptr<Slot[]> slots_;
+    size_t count_;
+    // Where the next Acquire starts looking, so slots are used in turn.
+    size_t next_;
+};
+
+// Snapshot of RenderCounters.
+struct RenderStats {
+    // Frames handed to the UI and frames dropped because no slot was free.
+    uint64_t frames = 0;
+    uint64_t dropped = 0;
+    // Frames replaced by a newer one before the UI thread took them.
+    uint64_t replaced = 0;
+    // Full-frame copies made after the I420 to RGB conversion, e.g. scaling
+    // into a new image or converting for a QPixmap. Drawing to the window
+    // itself is not counted.
+    uint64_t copies = 0;
+    // Frames that reached the screen, and their time from OnFrame to paint.
+    uint64_t painted = 0;
+    int64_t total_latency_us = 0;
+    int64_t max_latency_us = 0;
+    // Estimated time from capture until the frame is on the display.
+    int64_t total_glass_us = 0;
+    int64_t max_glass_us = 0;
+};
+
+// Updated from the renderer threads and the UI thread.
+class RenderCounters {
+public:
+    void OnFrame() { ++frames_; }
+    void OnDropped() { ++dropped_; }
+    void OnReplaced() { ++replaced_; }
+    void OnCopy() { ++copies_; }
+    void OnPainted(int64_t latency_us, int64_t glass_us);
+    RenderStats Get() const;
+    
+private:
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> replaced_{0};
+    std::atomic<uint64_t> copies_{0};
+    std::atomic<uint64_t> painted_{0};
+    std::atomic<int64_t> total_latency_us_{0};
+    std::atomic<int64_t> max_latency_us_{0};
+    std::atomic<int64_t> total_glass_us_{0};
+    std::atomic<int64_t> max_glass_us_{0};
+};
+
+#endif  // MYRTCDEMO_FRAME_RING_H_
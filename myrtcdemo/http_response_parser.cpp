@@ -0,0 +1,332 @@
+#include "http_response_parser.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace {
+
+    // A peer list from sign_in is the largest header-less thing we expect;
+    // anything with more header bytes than this is not our server.
+    const size_t kMaxHeaderBytes = 64 * 1024;
+
+    bool EqualsIgnoreCase(absl::string_view a, absl::string_view b) {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            char x = a[i], y = b[i];
+            if (x >= 'A' && x <= 'Z')
+                x += 'a' - 'A';
+            if (y >= 'A' && y <= 'Z')
+                y += 'a' - 'A';
+            if (x != y)
+                return false;
+        }
+        return true;
+    }
+
+    absl::string_view Trim(absl::string_view text) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+            text.remove_prefix(1);
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+            text.remove_suffix(1);
+        return text;
+    }
+
+}  // namespace
+
+HttpResponseParser::HttpResponseParser() : size_(0) {
+    Reset();
+}
+
+void HttpResponseParser::Reset() {
+    size_ = 0;
+    scan_ = 0;
+    line_ = 0;
+    body_ = 0;
+    state_ = kStateStatusLine;
+    status_ = -1;
+    has_content_length_ = false;
+    content_length_ = 0;
+    connection_close_ = false;
+    chunked_ = false;
+    headers_.clear();
+}
+
+HttpResponseParser::Result HttpResponseParser::Next() {
+    size_t end = body_ + content_length_;
+    size_t extra = size_ - end;
+    memmove(buffer_.data(), buffer_.data() + end, extra);
+    Reset();
+    size_ = extra;
+    return Parse();
+}
+
+char* HttpResponseParser::PrepareWrite(size_t min_space, size_t* space) {
+    if (buffer_.size() - size_ < min_space)
+        buffer_.resize(std::max(buffer_.size() * 2, size_ + min_space));
+    *space = buffer_.size() - size_;
+    return buffer_.data() + size_;
+}
+
+HttpResponseParser::Result HttpResponseParser::Commit(size_t bytes) {
+    size_ += bytes;
+    return Parse();
+}
+
+HttpResponseParser::Result HttpResponseParser::Feed(const char* data,
+                                                    size_t len) {
+    size_t space = 0;
+    memcpy(PrepareWrite(len, &space), data, len);
+    return Commit(len);
+}
+
+absl::string_view HttpResponseParser::body() const {
+    if (state_ != kStateDone)
+        return absl::string_view();
+    return View(body_, content_length_);
+}
+
+absl::string_view HttpResponseParser::extra() const {
+    if (state_ != kStateDone)
+        return absl::string_view();
+    size_t end = body_ + content_length_;
+    return View(end, size_ - end);
+}
+
+bool HttpResponseParser::GetHeader(absl::string_view name,
+                                   absl::string_view* value) const {
+    for (const Header& header : headers_) {
+        if (EqualsIgnoreCase(View(header.name, header.name_len), name)) {
+            *value = View(header.value, header.value_len);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HttpResponseParser::GetHeaderNumber(absl::string_view name,
+                                         size_t* value) const {
+    absl::string_view text;
+    return GetHeader(name, &text) && ParseNumber(text, value);
+}
+
+bool HttpResponseParser::ParseNumber(absl::string_view text, size_t* value) {
+    if (text.empty() || text.size() > 18)
+        return false;
+    size_t number = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9')
+            return false;
+        number = number * 10 + (c - '0');
+    }
+    *value = number;
+    return true;
+}
+
+absl::string_view HttpResponseParser::View(size_t offset, size_t len) const {
+    return absl::string_view(buffer_.data() + offset, len);
+}
+
+HttpResponseParser::Result HttpResponseParser::Parse() {
+    if (state_ == kStateError)
+        return kError;
+    if (state_ == kStateDone)
+        return kDone;
+
+    if (state_ != kStateBody) {
+        const char* data = buffer_.data();
+        while (scan_ < size_) {
+            const void* eol = memchr(data + scan_, '\n', size_ - scan_);
+            if (!eol) {
+                scan_ = size_;
+                break;
+            }
+            size_t end = static_cast<const char*>(eol) - data;
+            scan_ = end + 1;
+            if (end > line_ && data[end - 1] == '\r')
+                --end;
+
+            bool ok;
+            if (state_ == kStateStatusLine) {
+                ok = ParseStatusLine(line_, end);
+                state_ = kStateHeaders;
+            } else if (end == line_) {
+                // Blank line: the body follows.
+                ok = has_content_length_ || chunked_;
+                if (chunked_)
+                    content_length_ = 0;
+                body_ = scan_;
+                state_ = kStateBody;
+            } else {
+                ok = ParseHeaderLine(line_, end);
+            }
+            line_ = scan_;
+            if (!ok) {
+                state_ = kStateError;
+                return kError;
+            }
+            if (state_ == kStateBody)
+                break;
+        }
+        if (state_ != kStateBody) {
+            if (size_ > kMaxHeaderBytes) {
+                state_ = kStateError;
+                return kError;
+            }
+            return kNeedMore;
+        }
+    }
+    return CheckBody();
+}
+
+bool HttpResponseParser::ParseStatusLine(size_t begin, size_t end) {
+    // "HTTP/1.1 200 OK"
+    absl::string_view line = View(begin, end - begin);
+    if (line.substr(0, 5) != "HTTP/")
+        return false;
+    size_t space = line.find(' ');
+    if (space == absl::string_view::npos)
+        return false;
+    size_t status = 0;
+    if (!ParseNumber(line.substr(space + 1, 3), &status))
+        return false;
+    status_ = static_cast<int>(status);
+    return true;
+}
+
+bool HttpResponseParser::ParseHeaderLine(size_t begin, size_t end) {
+    absl::string_view line = View(begin, end - begin);
+    size_t colon = line.find(':');
+    if (colon == absl::string_view::npos || colon == 0)
+        return false;
+    absl::string_view name = line.substr(0, colon);
+    absl::string_view value = Trim(line.substr(colon + 1));
+
+    Header header;
+    header.name = begin;
+    header.name_len = name.size();
+    header.value = value.empty() ? end : value.data() - buffer_.data();
+    header.value_len = value.size();
+    headers_.push_back(header);
+
+    // The headers the client acts on are picked up here rather than
+    // looked up again later.
+    if (EqualsIgnoreCase(name, "Content-Length")) {
+        if (!ParseNumber(value, &content_length_))
+            return false;
+        has_content_length_ = true;
+    } else if (EqualsIgnoreCase(name, "Connection")) {
+        connection_close_ = EqualsIgnoreCase(value, "close");
+    } else if (EqualsIgnoreCase(name, "Transfer-Encoding")) {
+        chunked_ = EqualsIgnoreCase(value, "chunked");
+    }
+    return true;
+}
+
+HttpResponseParser::Result HttpResponseParser::CheckBody() {
+    if (size_ - body_ < content_length_)
+        return kNeedMore;
+    state_ = kStateDone;
+    return kDone;
+}
+
+HttpChunkDecoder::HttpChunkDecoder() {
+    Reset();
+}
+
+void HttpChunkDecoder::Reset() {
+    state_ = kStateSize;
+    remaining_ = 0;
+    size_digits_ = 0;
+    trailer_line_empty_ = true;
+}
+
+HttpChunkDecoder::Result HttpChunkDecoder::Decode(char* data, size_t len,
+                                                  size_t* decoded) {
+    size_t out = 0;
+    size_t i = 0;
+    while (i < len && state_ != kStateEnd && state_ != kStateError) {
+        if (state_ == kStateData) {
+            size_t n = std::min(remaining_, len - i);
+            memmove(data + out, data + i, n);
+            out += n;
+            i += n;
+            remaining_ -= n;
+            if (remaining_ == 0)
+                state_ = kStateDataCr;
+            continue;
+        }
+
+        char c = data[i++];
+        bool size_done = false;
+        switch (state_) {
+            case kStateSize: {
+                int digit = -1;
+                if (c >= '0' && c <= '9')
+                    digit = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    digit = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F')
+                    digit = c - 'A' + 10;
+                if (digit >= 0) {
+                    // More than 15 hex digits would overflow size_t.
+                    if (++size_digits_ > 15)
+                        state_ = kStateError;
+                    remaining_ = remaining_ * 16 + digit;
+                } else if (size_digits_ == 0) {
+                    state_ = kStateError;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    state_ = kStateExtension;
+                } else if (c == '\r') {
+                    state_ = kStateSizeLf;
+                } else if (c == '\n') {
+                    size_done = true;
+                } else {
+                    state_ = kStateError;
+                }
+                break;
+            }
+            case kStateExtension:
+                size_done = c == '\n';
+                break;
+            case kStateSizeLf:
+                if (c == '\n')
+                    size_done = true;
+                else
+                    state_ = kStateError;
+                break;
+            case kStateDataCr:
+                if (c == '\r')
+                    state_ = kStateDataLf;
+                else if (c == '\n')
+                    state_ = kStateSize;
+                else
+                    state_ = kStateError;
+                break;
+            case kStateDataLf:
+                state_ = c == '\n' ? kStateSize : kStateError;
+                break;
+            case kStateTrailer:
+                if (c == '\n') {
+                    if (trailer_line_empty_)
+                        state_ = kStateEnd;
+                    trailer_line_empty_ = true;
+                } else if (c != '\r') {
+                    trailer_line_empty_ = false;
+                }
+                break;
+            default:
+                break;
+        }
+        if (size_done) {
+            state_ = remaining_ ? kStateData : kStateTrailer;
+            size_digits_ = 0;
+        }
+    }
+
+    *decoded = out;
+    if (state_ == kStateError)
+        return kError;
+    return state_ == kStateEnd ? kEnd : kNeedMore;
+}
@@ -0,0 +1,139 @@
+#ifndef MYRTCDEMO_HTTP_RESPONSE_PARSER_H_
+#define MYRTCDEMO_HTTP_RESPONSE_PARSER_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+// Incremental parser for the responses of peerconnection_server.
+//
+// The socket reads straight into the parser's buffer (PrepareWrite/Commit),
+// and each Commit only scans the bytes it adds, so a response arriving in
+// many small reads is still parsed once. Headers are stored as offsets and
+// handed out as string_views into that buffer; they stay valid until the
+// next PrepareWrite or Reset.
+//
+// A response needs either Content-Length or "Transfer-Encoding: chunked".
+// A chunked response is done once its head is parsed; the body is left in
+// extra() for HttpChunkDecoder.
+class HttpResponseParser {
+public:
+    enum Result {
+        kNeedMore,
+        kDone,
+        kError,
+    };
+
+    HttpResponseParser();
+
+    // Forgets the current response. The buffer keeps its capacity.
+    void Reset();
+
+    // Returns room for at least |min_space| more bytes at the end of the
+    // buffer. *space receives the room actually available.
+    char* PrepareWrite(size_t min_space, size_t* space);
+    // Parses |bytes| just written to the pointer from PrepareWrite.
+    Result Commit(size_t bytes);
+    // Copies |data| in and parses it.
+    Result Feed(const char* data, size_t len);
+
+    // Starts on the response that follows a done one, keeping the bytes of
+    // it that were already read.
+    Result Next();
+
+    bool done() const { return state_ == kStateDone; }
+    int status() const { return status_; }
+    size_t content_length() const { return content_length_; }
+    bool connection_close() const { return connection_close_; }
+    bool chunked() const { return chunked_; }
+    absl::string_view body() const;
+    // Bytes read past the end of a done response.
+    absl::string_view extra() const;
+
+    // Header names are matched case-insensitively.
+    bool GetHeader(absl::string_view name, absl::string_view* value) const;
+    bool GetHeaderNumber(absl::string_view name, size_t* value) const;
+
+    // Parses a decimal number that makes up all of |text|.
+    static bool ParseNumber(absl::string_view text, size_t* value);
+
+private:
+    enum State {
+        kStateStatusLine,
+        kStateHeaders,
+        kStateBody,
+        kStateDone,
+        kStateError,
+    };
+
+    struct Header {
+        size_t name;
+        size_t name_len;
+        size_t value;
+        size_t value_len;
+    };
+
+    Result Parse();
+    bool ParseStatusLine(size_t begin, size_t end);
+    bool ParseHeaderLine(size_t begin, size_t end);
+    Result CheckBody();
+    absl::string_view View(size_t offset, size_t len) const;
+
+    std::vector<char> buffer_;
+    size_t size_;
+    // Where the next Commit resumes scanning and where the current line
+    // started.
+    size_t scan_;
+    size_t line_;
+    size_t body_;
+    State state_;
+    int status_;
+    bool has_content_length_;
+    size_t content_length_;
+    bool connection_close_;
+    bool chunked_;
+    std::vector<Header> headers_;
+};
+
+// Strips the framing of a chunked body as it arrives, in place, so the
+// payload can go straight into an HttpResponseParser's buffer. Chunk
+// boundaries are not reported; the payload is treated as one stream.
+class HttpChunkDecoder {
+public:
+    enum Result {
+        kNeedMore,
+        // The last chunk and its trailer have been read.
+        kEnd,
+        kError,
+    };
+
+    HttpChunkDecoder();
+
+    void Reset();
+
+    // Moves the payload bytes in |data| to its front and stores their count
+    // in *decoded. Bytes after the end of the body are dropped.
+    Result Decode(char* data, size_t len, size_t* decoded);
+
+private:
+    enum State {
+        kStateSize,
+        kStateExtension,
+        kStateSizeLf,
+        kStateData,
+        kStateDataCr,
+        kStateDataLf,
+        kStateTrailer,
+        kStateEnd,
+        kStateError,
+    };
+
+    State state_;
+    size_t remaining_;
+    int size_digits_;
+    bool trailer_line_empty_;
+};
+
+#endif  // MYRTCDEMO_HTTP_RESPONSE_PARSER_H_
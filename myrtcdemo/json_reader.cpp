@@ -0,0 +1,398 @@
+#include "json_reader.h"
+
+#include <string.h>
+
+namespace {
+
+    // Signaling messages are at most an array of objects deep.
+    const int kMaxDepth = 32;
+    
+    // Bytes that end a run of plain string content: the closing quote, an
+    // escape, or a control character (which is invalid unescaped).
+    struct StringStopTable {
+        bool stop[256];
+        StringStopTable() {
+            for (int c = 0; c < 256; ++c)
+                stop[c] = c < 0x20 || c == '"' || c == '\\';
+        }
+    };
+    const StringStopTable kStringStop;
+
+    int HexValue(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    bool ReadHex4(absl::string_view text, size_t pos, uint32_t* value) {
+        if (pos + 4 > text.size())
+            return false;
+        uint32_t v = 0;
+        for (size_t i = pos; i < pos + 4; ++i) {
+            int digit = HexValue(text[i]);
+            if (digit < 0)
+                return false;
+            v = (v << 4) | digit;
+        }
+        *value = v;
+        return true;
+    }
+
+    char* WriteUtf8(uint32_t code_point, char* out) {
+        if (code_point < 0x80) {
+            *out++ = static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            *out++ = static_cast<char>(0xc0 | (code_point >> 6));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        } else if (code_point < 0x10000) {
+            *out++ = static_cast<char>(0xe0 | (code_point >> 12));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        } else {
+            *out++ = static_cast<char>(0xf0 | (code_point >> 18));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+            *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+        }
+        return out;
+    }
+
+}  // namespace
+
+JsonReader::JsonReader(JsonToken* tokens, size_t max_tokens)
+: tokens_(tokens), max_tokens_(max_tokens), count_(0), pos_(0) {}
+
+int JsonReader::Parse(absl::string_view json) {
+    json_ = json;
+    pos_ = 0;
+    count_ = 0;
+    // Offsets are 32 bit.
+    if (json.size() >= UINT32_MAX)
+        return kErrorTooManyTokens;
+
+    int ret = ParseValue(0);
+    if (ret < 0) {
+        count_ = 0;
+        return ret;
+    }
+    SkipSpace();
+    if (pos_ != json_.size()) {
+        count_ = 0;
+        return kErrorInvalid;
+    }
+    return count_;
+}
+
+absl::string_view JsonReader::Text(int index) const {
+    const JsonToken& token = tokens_[index];
+    return json_.substr(token.start, token.end - token.start);
+}
+
+int JsonReader::Find(int object, absl::string_view key) const {
+    if (object < 0 || object >= count_ || tokens_[object].type != JSON_OBJECT)
+        return -1;
+    int member = object + 1;
+    for (uint32_t i = 0; i < tokens_[object].size; ++i) {
+        int value = member + 1;
+        if (Text(member) == key)
+            return value;
+        member = tokens_[value].next;
+    }
+    return -1;
+}
+
+bool JsonReader::GetInt(int index, int* value) const {
+    if (index < 0 || index >= count_ || tokens_[index].type != JSON_PRIMITIVE)
+        return false;
+    absl::string_view text = Text(index);
+    bool negative = !text.empty() && text[0] == '-';
+    if (negative)
+        text.remove_prefix(1);
+    if (text.empty() || text.size() > 9)
+        return false;
+    int v = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9')
+            return false;
+        v = v * 10 + (c - '0');
+    }
+    *value = negative ? -v : v;
+    return true;
+}
+
+int JsonReader::Add(JsonType type, size_t start) {
+    if (static_cast<size_t>(count_) >= max_tokens_)
+        return kErrorTooManyTokens;
+    JsonToken& token = tokens_[count_];
+    token.type = type;
+    token.start = static_cast<uint32_t>(start);
+    token.end = token.start;
+    token.next = 0;
+    token.size = 0;
+    return count_++;
+}
+
+void JsonReader::SkipSpace() {
+    while (pos_ < json_.size()) {
+        char c = json_[pos_];
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            break;
+        ++pos_;
+    }
+}
+
+int JsonReader::ParseValue(int depth) {
+    if (depth > kMaxDepth)
+        return kErrorTooDeep;
+    SkipSpace();
+    if (pos_ >= json_.size())
+        return kErrorPartial;
+
+    char c = json_[pos_];
+    if (c == '"')
+        return ParseString();
+    if (c != '{' && c != '[')
+        return ParsePrimitive();
+
+    bool object = c == '{';
+    char close = object ? '}' : ']';
+    int index = Add(object ? JSON_OBJECT : JSON_ARRAY, pos_);
+    if (index < 0)
+        return index;
+    ++pos_;
+    SkipSpace();
+    if (pos_ < json_.size() && json_[pos_] == close) {
+        ++pos_;
+    } else {
+        while (true) {
+            int ret;
+            if (object) {
+                SkipSpace();
+                if (pos_ >= json_.size())
+                    return kErrorPartial;
+                if (json_[pos_] != '"')
+                    return kErrorInvalid;
+                if ((ret = ParseString()) < 0)
+                    return ret;
+                SkipSpace();
+                if (pos_ >= json_.size())
+                    return kErrorPartial;
+                if (json_[pos_] != ':')
+                    return kErrorInvalid;
+                ++pos_;
+            }
+            if ((ret = ParseValue(depth + 1)) < 0)
+                return ret;
+            ++tokens_[index].size;
+
+            SkipSpace();
+            if (pos_ >= json_.size())
+                return kErrorPartial;
+            if (json_[pos_] == close) {
+                ++pos_;
+                break;
+            }
+            if (json_[pos_] != ',')
+                return kErrorInvalid;
+            ++pos_;
+        }
+    }
+    tokens_[index].end = static_cast<uint32_t>(pos_);
+    tokens_[index].next = count_;
+    return index;
+}
+
+int JsonReader::ParseString() {
+    size_t start = ++pos_;
+    const unsigned char* data =
+    reinterpret_cast<const unsigned char*>(json_.data());
+    while (pos_ < json_.size()) {
+        // SDP bodies are long runs of plain text between escapes.
+        while (pos_ < json_.size() && !kStringStop.stop[data[pos_]])
+            ++pos_;
+        if (pos_ >= json_.size())
+            break;
+        unsigned char c = data[pos_];
+        if (c == '"') {
+            int index = Add(JSON_STRING, start);
+            if (index < 0)
+                return index;
+            tokens_[index].end = static_cast<uint32_t>(pos_);
+            tokens_[index].next = count_;
+            ++pos_;
+            return index;
+        }
+        if (c < 0x20)
+            return kErrorInvalid;
+        if (c == '\\') {
+            if (++pos_ >= json_.size())
+                return kErrorPartial;
+            switch (json_[pos_]) {
+                case '"': case '\\': case '/': case 'b':
+                case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u': {
+                    uint32_t unused;
+                    if (!ReadHex4(json_, pos_ + 1, &unused))
+                        return pos_ + 5 > json_.size() ? kErrorPartial : kErrorInvalid;
+                    pos_ += 4;
+                    break;
+                }
+                default:
+                    return kErrorInvalid;
+            }
+        }
+        ++pos_;
+    }
+    return kErrorPartial;
+}
+
+int JsonReader::ParsePrimitive() {
+    size_t start = pos_;
+    char c = json_[pos_];
+    if (c == 't' || c == 'f' || c == 'n') {
+        absl::string_view literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+        absl::string_view text = json_.substr(pos_, literal.size());
+        if (text != literal)
+            return literal.substr(0, text.size()) == text ? kErrorPartial
+                                                          : kErrorInvalid;
+        pos_ += literal.size();
+    } else {
+        // -?digits(.digits)?([eE][+-]?digits)?
+        if (c == '-')
+            ++pos_;
+        size_t digits = pos_;
+        while (pos_ < json_.size() && json_[pos_] >= '0' && json_[pos_] <= '9')
+            ++pos_;
+        if (pos_ == digits)
+            return pos_ >= json_.size() ? kErrorPartial : kErrorInvalid;
+        if (pos_ < json_.size() && json_[pos_] == '.') {
+            digits = ++pos_;
+            while (pos_ < json_.size() && json_[pos_] >= '0' && json_[pos_] <= '9')
+                ++pos_;
+            if (pos_ == digits)
+                return pos_ >= json_.size() ? kErrorPartial : kErrorInvalid;
+        }
+        if (pos_ < json_.size() && (json_[pos_] == 'e' || json_[pos_] == 'E')) {
+            ++pos_;
+            if (pos_ < json_.size() && (json_[pos_] == '+' || json_[pos_] == '-'))
+                ++pos_;
+            digits = pos_;
+            while (pos_ < json_.size() && json_[pos_] >= '0' && json_[pos_] <= '9')
+                ++pos_;
+            if (pos_ == digits)
+                return pos_ >= json_.size() ? kErrorPartial : kErrorInvalid;
+        }
+    }
+    int index = Add(JSON_PRIMITIVE, start);
+    if (index < 0)
+        return index;
+    tokens_[index].end = static_cast<uint32_t>(pos_);
+    tokens_[index].next = count_;
+    return index;
+}
+
+bool JsonUnescape(absl::string_view escaped, std::string* out) {
+    // Unescaping never grows the text (\uXXXX is 6 bytes in, at most 4
+    // out), so write into room made up front and trim at the end.
+    size_t base = out->size();
+    out->resize(base + escaped.size());
+    char* begin = &(*out)[0] + base;
+    char* dst = begin;
+    const char* src = escaped.data();
+    const char* end = src + escaped.size();
+    bool ok = true;
+    while (src < end) {
+        const char* slash = static_cast<const char*>(memchr(src, '\\', end - src));
+        if (!slash)
+            slash = end;
+        memcpy(dst, src, slash - src);
+        dst += slash - src;
+        src = slash;
+        if (src == end)
+            break;
+        if (++src == end) {
+            ok = false;
+            break;
+        }
+        char c = *src++;
+        switch (c) {
+            case '"': *dst++ = '"'; break;
+            case '\\': *dst++ = '\\'; break;
+            case '/': *dst++ = '/'; break;
+            case 'b': *dst++ = '\b'; break;
+            case 'f': *dst++ = '\f'; break;
+            case 'n': *dst++ = '\n'; break;
+            case 'r': *dst++ = '\r'; break;
+            case 't': *dst++ = '\t'; break;
+            case 'u': {
+                size_t pos = src - escaped.data();
+                uint32_t code_point;
+                if (!ReadHex4(escaped, pos, &code_point)) {
+                    ok = false;
+                    break;
+                }
+                pos += 4;
+                if (code_point >= 0xd800 && code_point < 0xdc00) {
+                    // High surrogate, the low half must follow.
+                    uint32_t low;
+                    if (pos + 2 > escaped.size() || escaped[pos] != '\\' ||
+                        escaped[pos + 1] != 'u' ||
+                        !ReadHex4(escaped, pos + 2, &low) || low < 0xdc00 ||
+                        low >= 0xe000) {
+                        ok = false;
+                        break;
+                    }
+                    pos += 6;
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) +
+                                 (low - 0xdc00);
+                }
+                src = escaped.data() + pos;
+                dst = WriteUtf8(code_point, dst);
+                break;
+            }
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok)
+            break;
+    }
+    out->resize(base + (dst - begin));
+    return ok;
+}
+
+bool ReadSignalingMessage(const JsonReader& reader,
+                          int object,
+                          SignalingMessage* message) {
+    if (object < 0 || object >= reader.count() ||
+        reader.token(object).type != JSON_OBJECT) {
+        return false;
+    }
+    int member = object + 1;
+    for (uint32_t i = 0; i < reader.token(object).size; ++i) {
+        int value = member + 1;
+        absl::string_view key = reader.Text(member);
+        JsonType type = reader.token(value).type;
+        if (type == JSON_STRING) {
+            if (key == "type")
+                message->type = reader.Text(value);
+            else if (key == "sdp")
+                message->sdp = reader.Text(value);
+            else if (key == "sdpMid")
+                message->sdp_mid = reader.Text(value);
+            else if (key == "candidate")
+                message->candidate = reader.Text(value);
+        } else if (key == "sdpMLineIndex") {
+            reader.GetInt(value, &message->sdp_mline_index);
+        } else if (key == "candidates" && type == JSON_ARRAY) {
+            message->candidates = value;
+        }
+        member = reader.token(value).next;
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef MYRTCDEMO_JSON_READER_H_
+#define MYRTCDEMO_JSON_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+enum JsonType {
+    JSON_UNDEFINED = 0,
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_PRIMITIVE,
+};
+
+// One value of the parsed document. Tokens are stored in document order,
+// so the first child of a container is the token right after it and the
+// next sibling of any value is |next|. Object members are a key token
+// followed by the value token.
+struct JsonToken {
+    JsonType type;
+    // Offsets into the text. Strings exclude the quotes and are still
+    // escaped.
+    uint32_t start;
+    uint32_t end;
+    // Index of the first token after this value and everything inside it.
+    uint32_t next;
+    // Members of an object or elements of an array.
+    uint32_t size;
+};
+
+// Single pass, validating JSON tokenizer. It writes into a caller supplied
+// token array and never allocates; the text must outlive the reader.
+class JsonReader {
+public:
+    enum {
+        kErrorInvalid = -1,
+        kErrorPartial = -2,
+        kErrorTooManyTokens = -3,
+        kErrorTooDeep = -4,
+    };
+
+    JsonReader(JsonToken* tokens, size_t max_tokens);
+
+    // Returns the number of tokens or one of the errors above.
+    int Parse(absl::string_view json);
+
+    int count() const { return count_; }
+    const JsonToken& token(int index) const { return tokens_[index]; }
+    absl::string_view Text(int index) const;
+
+    // Value token of |key| in |object|, or -1.
+    int Find(int object, absl::string_view key) const;
+    bool GetInt(int index, int* value) const;
+
+private:
+    int Add(JsonType type, size_t start);
+    int ParseValue(int depth);
+    int ParseString();
+    int ParsePrimitive();
+    void SkipSpace();
+
+    JsonToken* tokens_;
+    size_t max_tokens_;
+    int count_;
+    absl::string_view json_;
+    size_t pos_;
+};
+
+// Appends the unescaped text of a JSON string to |out|. Returns false on
+// an invalid escape.
+bool JsonUnescape(absl::string_view escaped, std::string* out);
+
+// The fields a peerconnection_client message may carry, gathered in one
+// walk over the members of |object|. Strings are still escaped.
+struct SignalingMessage {
+    absl::string_view type;
+    absl::string_view sdp;
+    absl::string_view sdp_mid;
+    absl::string_view candidate;
+    int sdp_mline_index = -1;
+    // Token of a "candidates" array of batched candidates, or -1.
+    int candidates = -1;
+};
+
+bool ReadSignalingMessage(const JsonReader& reader,
+                          int object,
+                          SignalingMessage* message);
+
+#endif  // MYRTCDEMO_JSON_READER_H_
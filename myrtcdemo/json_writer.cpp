@@ -0,0 +1,126 @@
+#include "json_writer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+    // Escape sequence for each byte, or NULL if it is copied as is.
+    struct EscapeTable {
+        char storage[32][8];
+        const char* escape[256];
+        EscapeTable() {
+            for (int c = 0; c < 256; ++c)
+                escape[c] = nullptr;
+            for (int c = 0; c < 0x20; ++c) {
+                snprintf(storage[c], sizeof(storage[c]), "\\u%04x", c);
+                escape[c] = storage[c];
+            }
+            Set('\b', "\\b");
+            Set('\f', "\\f");
+            Set('\n', "\\n");
+            Set('\r', "\\r");
+            Set('\t', "\\t");
+            Set('"', "\\\"");
+            Set('\\', "\\\\");
+        }
+        void Set(unsigned char c, const char* sequence) { escape[c] = sequence; }
+    };
+    const EscapeTable kEscape;
+
+}  // namespace
+
+JsonWriter::JsonWriter() : has_member_(0), depth_(0), after_key_(false) {}
+
+void JsonWriter::Reset() {
+    out_.clear();
+    has_member_ = 0;
+    depth_ = 0;
+    after_key_ = false;
+}
+
+void JsonWriter::BeforeValue() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ == 0)
+        return;
+    uint64_t bit = 1ull << ((depth_ - 1) & 63);
+    if (has_member_ & bit)
+        out_ += ',';
+    has_member_ |= bit;
+}
+
+void JsonWriter::StartObject() {
+    BeforeValue();
+    out_ += '{';
+    ++depth_;
+    has_member_ &= ~(1ull << ((depth_ - 1) & 63));
+}
+
+void JsonWriter::EndObject() {
+    --depth_;
+    out_ += '}';
+}
+
+void JsonWriter::StartArray() {
+    BeforeValue();
+    out_ += '[';
+    ++depth_;
+    has_member_ &= ~(1ull << ((depth_ - 1) & 63));
+}
+
+void JsonWriter::EndArray() {
+    --depth_;
+    out_ += ']';
+}
+
+void JsonWriter::Key(absl::string_view key) {
+    BeforeValue();
+    out_ += '"';
+    Escape(key, &out_);
+    out_ += "\":";
+    after_key_ = true;
+}
+
+void JsonWriter::String(absl::string_view value) {
+    BeforeValue();
+    out_ += '"';
+    Escape(value, &out_);
+    out_ += '"';
+}
+
+void JsonWriter::Int(int64_t value) {
+    BeforeValue();
+    char buffer[24];
+    int len = snprintf(buffer, sizeof(buffer), "%lld",
+                       static_cast<long long>(value));
+    out_.append(buffer, len);
+}
+
+void JsonWriter::Raw(absl::string_view json) {
+    BeforeValue();
+    out_.append(json.data(), json.size());
+}
+
+void JsonWriter::Escape(absl::string_view value, std::string* out) {
+    // SDP is long plain runs broken by CRLF, so copy runs in one append.
+    // Room for the plain text plus a CRLF every 32 bytes covers most SDP.
+    // Only reserve to grow; some libraries shrink on a smaller request.
+    size_t needed = out->size() + value.size() + value.size() / 16;
+    if (needed > out->capacity())
+        out->reserve(needed);
+    const unsigned char* data =
+    reinterpret_cast<const unsigned char*>(value.data());
+    size_t run = 0;
+    for (size_t i = 0; i < value.size(); ++i) {
+        const char* escape = kEscape.escape[data[i]];
+        if (!escape)
+            continue;
+        out->append(value.data() + run, i - run);
+        out->append(escape);
+        run = i + 1;
+    }
+    out->append(value.data() + run, value.size() - run);
+}
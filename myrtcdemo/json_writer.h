@@ -0,0 +1,45 @@
+#ifndef MYRTCDEMO_JSON_WRITER_H_
+#define MYRTCDEMO_JSON_WRITER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+// Streams JSON text into a buffer that keeps its capacity across Reset(),
+// so once it has grown to the largest message it stops allocating.
+// Strings are escaped in one linear pass. Nesting is tracked only to place
+// commas; callers are trusted to produce balanced output.
+class JsonWriter {
+public:
+    JsonWriter();
+
+    void Reset();
+
+    void StartObject();
+    void EndObject();
+    void StartArray();
+    void EndArray();
+    void Key(absl::string_view key);
+    void String(absl::string_view value);
+    void Int(int64_t value);
+    // Appends a value that is already serialized JSON.
+    void Raw(absl::string_view json);
+
+    const std::string& str() const { return out_; }
+
+    // Appends |value| escaped for use inside a JSON string.
+    static void Escape(absl::string_view value, std::string* out);
+
+private:
+    void BeforeValue();
+
+    std::string out_;
+    // Bit n is set once the container at depth n has a member.
+    uint64_t has_member_;
+    int depth_;
+    bool after_key_;
+};
+
+#endif  // MYRTCDEMO_JSON_WRITER_H_
@@ -4,6 +4,7 @@
 #endif
 #include "rtc_base/ssl_adapter.h"
 #include "conductor.h"
+#include "defaults.h"
 
 #include "mainwindow.h"
 #include <QApplication>
@@ -32,10 +33,14 @@ int main(int argc, char **argv)
     
     QApplication a(argc, argv);
     MainWindow wnd;
+    wnd.SetUseFrameRing(UseFrameRing());
     wnd.show();
     
     rtc::InitializeSSL();
     PeerConnectionClient client;
+    client.SetKeepAlive(UseSignalingKeepAlive());
+    client.SetMaxInFlight(GetSignalingMaxInFlight());
+    client.SetStreamNotifications(UseNotificationStream());
     rtc::scoped_refptr<Conductor> conductor(
                                             new rtc::RefCountedObject<Conductor>(&client, &wnd));
     
@@ -5,28 +5,76 @@
 #include "rtc_base/arraysize.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
-#include "third_party/libyuv/include/libyuv/convert_argb.h"
+#include "rtc_base/time_utils.h"
+#include "system_wrappers/include/clock.h"
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include <QEvent>
+#include <QGuiApplication>
+#include <QPaintEvent>
 #include <QMessageBox>
 #include <QPainter>
 #include <QPoint>
+#include <QScreen>
 
 const char MainWindow::kClassName[] = "WebRTC_MainWnd";
 MainWindow *mainWindow;
 
-void draw(QImage&& img, bool isLocal) {
-    emit mainWindow->getFrameSig(std::forward<QImage>(img), isLocal);
+namespace {
+    
+    // Size of the local preview drawn over the remote video.
+    const int kLocalWidth = 320;
+    const int kLocalHeight = 180;
+    // Three buffers let one be on screen and one be queued while the
+    // renderer fills the third.
+    const size_t kFrameRingSlots = 3;
+    // How often the render counters are logged.
+    const int kRenderStatsLogFrames = 300;
+    // Repaint interval when the screen does not report its refresh rate.
+    const int kDefaultRefreshMs = 16;
+    
+    // Best guess at when |frame| was captured, on the rtc::TimeMicros clock.
+    // Received frames carry the sender's capture time mapped to our NTP
+    // clock once RTCP has been exchanged; local frames are stamped at
+    // capture.
+    int64_t CaptureTimeUs(const webrtc::VideoFrame& frame, int64_t now_us) {
+        if (frame.ntp_time_ms() > 0) {
+            int64_t age_ms =
+            webrtc::Clock::GetRealTimeClock()->CurrentNtpInMilliseconds() -
+            frame.ntp_time_ms();
+            if (age_ms >= 0)
+                return now_us - age_ms * 1000;
+        }
+        if (frame.timestamp_us() > 0 && frame.timestamp_us() <= now_us)
+            return frame.timestamp_us();
+        return now_us;
+    }
+    
+}  // namespace
+
+void draw(QImage&& img, int stream, int64_t arrival_us, int64_t capture_us) {
+    FrameMailbox::Frame frame;
+    frame.image = std::move(img);
+    frame.arrival_us = arrival_us;
+    frame.capture_us = capture_us;
+    mainWindow->PostFrame(stream, std::move(frame));
 };
 
 MainWindow::MainWindow(QWidget *parent) :
 ui(new Ui::MainWindow),
+peerModel_(new PeerListModel(this)),
 ui_(CONNECT_TO_SERVER),
 destroyed_(false),
-nested_msg_(NULL) {
+nested_msg_(NULL),
+shown_(kMaxStreams),
+mailbox_(kMaxStreams, &renderCounters_),
+pacer_([this] { DeliverFrames(); }) {
     
     ui->setupUi(this);
+    ui->listPeer->setModel(peerModel_);
+    // Every row is one line of text; skip measuring each of them.
+    ui->listPeer->setUniformItemSizes(true);
     ui->textAddress->setText("localhost");
     //ui->textAddress->setText("127.0.0.1");
     ui->textAddress->setText("10.93.245.95");
@@ -35,35 +83,216 @@ nested_msg_(NULL) {
     ui->textPort->setText(port_.c_str());
     mainWindow = this;
     connect(this, &MainWindow::uiCallbackSig, this, &MainWindow::uiCallbackSlot, Qt::QueuedConnection);
-    connect(this, &MainWindow::getFrameSig, this, &MainWindow::getFrameSlot, Qt::QueuedConnection);
+    connect(this, &MainWindow::framesReadySig, this, &MainWindow::framesReadySlot, Qt::QueuedConnection);
+    // Frame ring mode paints the video label itself.
+    ui->video->installEventFilter(this);
+    compositor_.SetRemoteCount(1);
+    // Repainting faster than the screen refreshes only burns CPU.
+    QScreen* screen = QGuiApplication::primaryScreen();
+    qreal refresh_hz = screen ? screen->refreshRate() : 0;
+    pacer_.SetInterval(refresh_hz >= 1 ? qRound(1000 / refresh_hz)
+                       : kDefaultRefreshMs);
 }
 
-void MainWindow::getFrameSlot(QImage img, bool isLocal) {
-    if (isLocal)
-        image_ = img;
+void MainWindow::PostFrame(int stream, FrameMailbox::Frame frame) {
+    if (mailbox_.Post(stream, std::move(frame)))
+        FrameAvailable();
+}
+
+void MainWindow::FrameAvailable() {
+    if (!framesReady_.exchange(true))
+        emit framesReadySig();
+}
+
+void MainWindow::framesReadySlot() {
+    pacer_.Request();
+}
+
+void MainWindow::DeliverFrames() {
+    // Cleared first, so a frame published from here on wakes us again.
+    framesReady_ = false;
+    mailbox_.Take(&taken_);
+    if (local_renderer_)
+        local_renderer_->TakeFrame(&taken_[kLocalStream]);
+    if (remote_renderer_)
+        remote_renderer_->TakeFrame(&taken_[kRemoteStream]);
+    for (auto& peer : peerRenderers_)
+        peer.second->TakeFrame(&taken_[peer.second->stream()]);
+    for (int stream = 0; stream < kMaxStreams; ++stream) {
+        if (!taken_[stream].image.isNull())
+            ShowFrame(stream, &taken_[stream]);
+    }
+    
+    if (++framesSinceLog_ >= kRenderStatsLogFrames) {
+        framesSinceLog_ = 0;
+        RenderStats stats = renderCounters_.Get();
+        RTC_LOG(INFO) << "render frames:" << stats.frames
+        << " dropped:" << stats.dropped
+        << " replaced:" << stats.replaced
+        << " copies:" << stats.copies
+        << " painted:" << stats.painted
+        << " avg latency us:"
+        << (stats.painted ? stats.total_latency_us / stats.painted : 0)
+        << " max latency us:" << stats.max_latency_us
+        << " avg glass to glass us:"
+        << (stats.painted ? stats.total_glass_us / stats.painted : 0)
+        << " max glass to glass us:" << stats.max_glass_us;
+        const ComposeStats& compose = compositor_.stats();
+        if (compose.frames) {
+            RTC_LOG(INFO) << "compose frames:" << compose.frames
+            << " avg us:" << compose.total_us / compose.frames
+            << " max us:" << compose.max_us
+            << " avg pixels:" << compose.pixels / compose.frames;
+        }
+    }
+}
+
+void MainWindow::ShowFrame(int stream, FrameMailbox::Frame* frame) {
+    // Moved out so the mailbox no longer holds on to a ring slot.
+    QImage img = std::move(frame->image);
+    frame->image = QImage();
+    int tile = TileOf(stream);
+    // Left over from a peer that has gone since.
+    if (stream != kLocalStream && tile < 0)
+        return;
+    ShownFrame& shown = shown_[stream];
+    shown.image = img;
+    shown.arrival_us = frame->arrival_us;
+    shown.capture_us = frame->capture_us;
+    // A conference fills the label with tiles. A call is as large as the
+    // remote video, or the preview while there is none.
+    QSize size;
+    if (!peerRenderers_.empty()) {
+        size = ui->video->size();
+    } else {
+        const QImage& remote = shown_[kRemoteStream].image;
+        size = remote.isNull() ? shown_[kLocalStream].image.size()
+                               : remote.size();
+    }
+    bool resized = size != compositor_.size();
+    if (resized)
+        compositor_.SetSize(size);
+    if (stream == kLocalStream)
+        compositor_.SetLocal(img);
     else
-        remoteImage_ = img;
-    update();
+        compositor_.SetRemote(tile, img);
+    if (!useFrameRing_) {
+        update();
+    } else if (resized) {
+        // The video moves within the label too.
+        compositor_.TakeDirty();
+        ui->video->update();
+    } else {
+        ui->video->update(compositor_.TakeDirty().translated(VideoOffset()));
+    }
+}
+
+void MainWindow::DetachFrame(int stream) {
+    // Outside frame ring mode the image points into the renderer.
+    QImage& image = shown_[stream].image;
+    if (image.isNull() || useFrameRing_)
+        return;
+    image = image.copy();
+    int tile = TileOf(stream);
+    if (stream == kLocalStream)
+        compositor_.SetLocal(image);
+    else if (tile >= 0)
+        compositor_.SetRemote(tile, image);
+}
+
+int MainWindow::TileOf(int stream) const {
+    if (peerRenderers_.empty())
+        return stream == kRemoteStream ? 0 : -1;
+    int tile = 0;
+    for (const auto& peer : peerRenderers_) {
+        if (peer.second->stream() == stream)
+            return tile;
+        ++tile;
+    }
+    return -1;
+}
+
+void MainWindow::LayoutTiles() {
+    if (peerRenderers_.empty()) {
+        compositor_.SetRemoteCount(1);
+        compositor_.SetRemote(0, shown_[kRemoteStream].image);
+    } else {
+        compositor_.SetSize(ui->video->size());
+        compositor_.SetRemoteCount(static_cast<int>(peerRenderers_.size()));
+        int tile = 0;
+        for (const auto& peer : peerRenderers_)
+            compositor_.SetRemote(tile++, shown_[peer.second->stream()].image);
+    }
+    if (useFrameRing_) {
+        compositor_.TakeDirty();
+        ui->video->update();
+    } else {
+        update();
+    }
+}
+
+bool MainWindow::HasVideo() const {
+    for (const ShownFrame& shown : shown_) {
+        if (!shown.image.isNull())
+            return true;
+    }
+    return false;
 }
 
 void MainWindow::paintEvent(QPaintEvent *event)
 {
+    if (useFrameRing_)
+        return;
     /*
      实际上peerconnection_client这里是通过local_render_和remote_render_获取到frame和，在这里进行合帧的
      然后渲染的(还是gdi来渲染的), 所以为了demo演示，这里也使用效率差的pixmap来做
      */
-    if (image_.size().width() <= 0)
+    if (!HasVideo())
         return;
-    if (!remoteImage_.isNull()) {
-        QPainter painter(&remoteImage_); // if remoteImage_ is null. will print
-        //QPainter::begin: Paint device returned engine == 0, type: 3 all the time
-        painter.drawImage(0, 0, image_);
-        if (remoteImage_.isNull())
-            ui->video->setPixmap(QPixmap::fromImage(image_));
-        else
-            ui->video->setPixmap(QPixmap::fromImage(remoteImage_));
-    } else {
-        ui->video->setPixmap(QPixmap::fromImage(image_));
+    // Repaints without a new frame, e.g. for the label itself, have
+    // nothing to compose and keep the current pixmap.
+    if (compositor_.Compose().isEmpty())
+        return;
+    ui->video->setPixmap(QPixmap::fromImage(compositor_.surface()));
+    renderCounters_.OnCopy();
+    ReportPainted();
+}
+
+bool MainWindow::eventFilter(QObject *watched, QEvent *event)
+{
+    if (useFrameRing_ && watched == ui->video &&
+        event->type() == QEvent::Paint && HasVideo()) {
+        PaintVideo(static_cast<QPaintEvent*>(event)->region());
+        return true;
+    }
+    return QMainWindow::eventFilter(watched, event);
+}
+
+void MainWindow::PaintVideo(const QRegion& region) {
+    // Draw straight from the ring buffers, only where the label needs it.
+    // There is no composite surface or pixmap to copy into.
+    QPainter painter(ui->video);
+    QPoint offset = VideoOffset();
+    painter.translate(offset);
+    compositor_.Draw(&painter, region.translated(-offset));
+    ReportPainted();
+}
+
+QPoint MainWindow::VideoOffset() const {
+    // Where the label would place a pixmap: left, vertically centered.
+    return QPoint(0, (ui->video->height() - compositor_.size().height()) / 2);
+}
+
+void MainWindow::ReportPainted() {
+    int64_t now = rtc::TimeMicros();
+    // The frame reaches the glass with the next refresh at the latest.
+    int64_t scanout_us = pacer_.interval_ms() * 1000;
+    for (ShownFrame& shown : shown_) {
+        if (shown.arrival_us && !shown.image.isNull()) {
+            renderCounters_.OnPainted(now - shown.arrival_us,
+                                      now - shown.capture_us + scanout_us);
+            shown.arrival_us = 0;
+        }
     }
 }
 
@@ -76,6 +305,10 @@ void MainWindow::closeEvent(QCloseEvent *event)
 
 MainWindow::~MainWindow()
 {
+    // The renderers post into members declared after them.
+    local_renderer_.reset();
+    remote_renderer_.reset();
+    peerRenderers_.clear();
     delete ui;
 }
 
@@ -115,19 +348,15 @@ void MainWindow::on_videoSwitch_clicked() {
     }
 }
 
-void MainWindow::on_listPeer_itemDoubleClicked(QListWidgetItem *item)
+void MainWindow::on_listPeer_doubleClicked(const QModelIndex &index)
 {
     if (ui_ == LIST_PEERS) {
-        int peer_id = item->data(Qt::UserRole).toInt();
+        int peer_id = peerModel_->PeerId(index.row());
         if (peer_id != -1 && callback_) {
             callback_->ConnectToPeer(peer_id);
         }
     }
 }
-
-void MainWindow::on_listPeer_currentRowChanged(int currentRow)
-{
-}
 void MainWindow::uiCallbackSlot(int msg_id, void* data) {
     callback_->UIThreadCallback(msg_id, data);
 }
@@ -153,37 +382,71 @@ void MainWindow::RegisterObserver(MainWndCallback* callback) {
 
 void MainWindow::SwitchToPeerList(const Peers& peers) {
     ui->state->setText("connected");
-    ui->listPeer->clear();
-    int i = 0;
     ui_ = LIST_PEERS;
-    for (auto iter = peers.begin(); iter != peers.end(); iter++) {
-        ui->listPeer->addItem((*iter).second.c_str());
-        ui->listPeer->item(i++)->setData(Qt::UserRole, (*iter).first);
-    }
+    peerModel_->Reset(peers);
     return;
 }
 
+void MainWindow::UpdatePeerList(const PeerListChange& change) {
+    peerModel_->Apply(change);
+}
+
 void MainWindow::SwitchToStreamingUI() {
     //ui_ = STREAMING;
     return;
 }
 
 void MainWindow::StartLocalRenderer(webrtc::VideoTrackInterface* local_video) {
-    local_renderer_.reset(new VideoRenderer(true, local_video));
+    local_renderer_.reset(new VideoRenderer(kLocalStream, local_video,
+                                            useFrameRing_, &renderCounters_));
 }
 
 void MainWindow::StopLocalRenderer() {
+    DetachFrame(kLocalStream);
     local_renderer_.reset();
 }
 
 void MainWindow::StartRemoteRenderer(webrtc::VideoTrackInterface* remote_video) {
-    remote_renderer_.reset(new VideoRenderer(false, remote_video));
+    remote_renderer_.reset(new VideoRenderer(kRemoteStream, remote_video,
+                                             useFrameRing_, &renderCounters_));
 }
 
 void MainWindow::StopRemoteRenderer() {
+    DetachFrame(kRemoteStream);
     remote_renderer_.reset();
 }
 
+void MainWindow::StartPeerRenderer(int peer_id,
+                                   webrtc::VideoTrackInterface* remote_video) {
+    StopPeerRenderer(peer_id);
+    // The lowest remote stream no other peer is using.
+    std::vector<bool> used(kMaxStreams, false);
+    for (const auto& peer : peerRenderers_)
+        used[peer.second->stream()] = true;
+    int stream = kRemoteStream;
+    while (stream < kMaxStreams && used[stream])
+        ++stream;
+    if (stream == kMaxStreams) {
+        RTC_LOG(LS_WARNING) << "no tile left for peer " << peer_id;
+        return;
+    }
+    shown_[stream] = ShownFrame();
+    peerRenderers_[peer_id].reset(new VideoRenderer(stream, remote_video,
+                                                    useFrameRing_,
+                                                    &renderCounters_));
+    LayoutTiles();
+}
+
+void MainWindow::StopPeerRenderer(int peer_id) {
+    auto it = peerRenderers_.find(peer_id);
+    if (it == peerRenderers_.end())
+        return;
+    // The tile goes away with the renderer, so its frame is not kept.
+    shown_[it->second->stream()] = ShownFrame();
+    peerRenderers_.erase(it);
+    LayoutTiles();
+}
+
 void MainWindow::QueueUIThreadCallback(int msg_id, void* data) {
     this->uiCallbackSig(msg_id, data);
 }
@@ -196,9 +459,13 @@ void MainWindow::QueueUIThreadCallback(int msg_id, void* data) {
 //
 
 MainWindow::VideoRenderer::VideoRenderer(
-                                         bool isLocal,
-                                         webrtc::VideoTrackInterface* track_to_render)
-: isLocal_(isLocal), rendered_track_(track_to_render) {
+                                         int stream,
+                                         webrtc::VideoTrackInterface* track_to_render,
+                                         bool useFrameRing,
+                                         RenderCounters* counters)
+: stream_(stream), rendered_track_(track_to_render), counters_(counters) {
+    if (useFrameRing)
+        ring_ = FrameRing::Create(kFrameRingSlots);
     rendered_track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
 }
 
@@ -206,39 +473,65 @@ MainWindow::VideoRenderer::~VideoRenderer() {
     rendered_track_->RemoveSink(this);
 }
 
-void MainWindow::VideoRenderer::SetSize(int width, int height) {
-    AutoLock<VideoRenderer> lock(this);
-    if (width == width_ && height == height_) {
-        return;
-    }
-    width_ = width;
-    height_ = height;
-    int biSizeImage = width * height * 4;
-    if (biSizeImage > imageBuf_.size())
-        imageBuf_.resize(biSizeImage);
+bool MainWindow::VideoRenderer::TakeFrame(FrameMailbox::Frame* frame) {
+    if (!frames_.Update())
+        return false;
+    const TripleBuffer::Buffer& front = frames_.front();
+    frame->image = QImage(front.pixels.data(), front.width, front.height,
+                          front.stride(), QImage::Format_ARGB32);
+    frame->arrival_us = front.arrival_us;
+    frame->capture_us = front.capture_us;
+    return true;
 }
 
 void MainWindow::VideoRenderer::OnFrame(const webrtc::VideoFrame& video_frame) {
-    AutoLock<VideoRenderer> lock(this);
+    int64_t timestamp_us = rtc::TimeMicros();
     
     rtc::scoped_refptr<webrtc::I420BufferInterface> buffer(
                                                            video_frame.video_frame_buffer()->ToI420());
-    if (video_frame.rotation() != webrtc::kVideoRotation_0) {
-        buffer = webrtc::I420Buffer::Rotate(*buffer, video_frame.rotation());
+    // The preview is converted straight at its on-screen size.
+    int width = kLocalWidth;
+    int height = kLocalHeight;
+    if (stream_ != kLocalStream) {
+        FrameConverter::RotatedSize(buffer->width(), buffer->height(),
+                                    video_frame.rotation(), &width, &height);
     }
     
-    SetSize(buffer->width(), buffer->height());
+    if (ring_) {
+        RenderToRing(*buffer, video_frame.rotation(), width, height,
+                     timestamp_us, CaptureTimeUs(video_frame, timestamp_us));
+        return;
+    }
     
-    //RTC_DCHECK(image_.get() != NULL);
-    libyuv::I420ToARGB(buffer->DataY(), buffer->StrideY(), buffer->DataU(),
-                       buffer->StrideU(), buffer->DataV(), buffer->StrideV(),
-                       imageBuf_.data(),
-                       width_ * 4,
-                       buffer->width(), buffer->height());
-    QImage tmpImg((uchar *)(imageBuf_.data()), buffer->width(), buffer->height(), QImage::Format_ARGB32);
-    // TODO 这里一次copy
-    if (isLocal_) {
-        tmpImg = tmpImg.scaled(320, 180);
-    }
-    draw(std::move(tmpImg), isLocal_);
+    // The UI reads the front buffer meanwhile; nothing here waits for it.
+    TripleBuffer::Buffer* target = frames_.back();
+    target->Resize(width, height);
+    converter_.Convert(*buffer, video_frame.rotation(), width, height,
+                       target->pixels.data(), target->stride());
+    target->arrival_us = timestamp_us;
+    target->capture_us = CaptureTimeUs(video_frame, timestamp_us);
+    if (frames_.Publish())
+        counters_->OnReplaced();
+    counters_->OnFrame();
+    mainWindow->FrameAvailable();
+}
+
+void MainWindow::VideoRenderer::RenderToRing(
+                                             const webrtc::I420BufferInterface& frame,
+                                             webrtc::VideoRotation rotation,
+                                             int width,
+                                             int height,
+                                             int64_t timestamp_us,
+                                             int64_t capture_us) {
+    int slot = ring_->Acquire(width, height);
+    if (slot < 0) {
+        // The UI has not let go of any frame yet; it would only fall
+        // further behind if we waited.
+        counters_->OnDropped();
+        return;
+    }
+    converter_.Convert(frame, rotation, width, height, ring_->pixels(slot),
+                       ring_->stride(slot));
+    counters_->OnFrame();
+    draw(ring_->Publish(slot), stream_, timestamp_us, capture_us);
 }
@@ -3,7 +3,13 @@
 
 #include "api/media_stream_interface.h"
 #include "api/video/video_frame.h"
+#include "frame_converter.h"
+#include "frame_mailbox.h"
+#include "frame_ring.h"
+#include "triple_buffer.h"
+#include "video_compositor.h"
 #include "peer_connection_client.h"
+#include "peer_list_model.h"
 #include "media/base/media_channel.h"
 #include "media/base/video_common.h"
 #include "rtc_base/thread.h"
@@ -12,8 +18,10 @@
 #endif  // WEBRTC_WIN
 
 #include <QMainWindow>
-#include <QListWidgetItem>
+#include <QModelIndex>
 #include <QImage>
+#include <atomic>
+#include <map>
 #include <vector>
 
 #ifdef WEBRTC_MAC
@@ -62,6 +70,8 @@ public:
     virtual UI current_ui() = 0;
     
     virtual void SwitchToPeerList(const Peers& peers) = 0;
+    // Applies one change to the list without rebuilding it.
+    virtual void UpdatePeerList(const PeerListChange& change) = 0;
     virtual void SwitchToStreamingUI() = 0;
     
     virtual void StartLocalRenderer(webrtc::VideoTrackInterface* local_video) = 0;
@@ -69,6 +79,10 @@ public:
     virtual void StartRemoteRenderer(
                                      webrtc::VideoTrackInterface* remote_video) = 0;
     virtual void StopRemoteRenderer() = 0;
+    // Conference mode: one remote renderer and tile per peer.
+    virtual void StartPeerRenderer(int peer_id,
+                                   webrtc::VideoTrackInterface* remote_video) = 0;
+    virtual void StopPeerRenderer(int peer_id) = 0;
     
     virtual void QueueUIThreadCallback(int msg_id, void* data) = 0;
 };
@@ -84,37 +98,50 @@ public:
 protected:
     void paintEvent(QPaintEvent *event);
     void closeEvent(QCloseEvent *event);
+    bool eventFilter(QObject *watched, QEvent *event);
     
 signals:
     void uiCallbackSig(int msg_id, void* data);
-    void getFrameSig(QImage img, bool isLocal);
+    // New frames are waiting in mailbox_.
+    void framesReadySig();
     
     
     private slots:
     void uiCallbackSlot(int msg_id, void* data);
-    void getFrameSlot(QImage img, bool isLocal);
+    void framesReadySlot();
     
     void on_connectBtn_clicked();
     void on_audioSwitch_clicked();
     void on_videoSwitch_clicked();
     
-    void on_listPeer_itemDoubleClicked(QListWidgetItem *item);
-    
-    void on_listPeer_currentRowChanged(int currentRow);
+    void on_listPeer_doubleClicked(const QModelIndex &index);
     
 private:
-    QImage image_;
-    QImage remoteImage_;
     Ui::MainWindow *ui;
+    PeerListModel *peerModel_;
     
 public:
     static const char kClassName[];
     
+    // Video streams on screen: the local preview, then the remote video,
+    // or in a conference one stream per peer from kRemoteStream up.
+    enum {
+        kLocalStream = 0,
+        kRemoteStream = 1,
+        kMaxStreams = 17,
+    };
+    
     bool Create();
     bool Destroy();
     
     virtual void RegisterObserver(MainWndCallback* callback);
     virtual void SwitchToPeerList(const Peers& peers);
+    virtual void UpdatePeerList(const PeerListChange& change);
+    
+    // Called by the renderers on their own threads.
+    void PostFrame(int stream, FrameMailbox::Frame frame);
+    // A renderer published into its TripleBuffer.
+    void FrameAvailable();
     virtual void SwitchToStreamingUI();
     virtual void MessageBox(const char* caption, const char* text, bool is_error);
     virtual UI current_ui() { return ui_; }
@@ -123,51 +150,57 @@ public:
     virtual void StopLocalRenderer();
     virtual void StartRemoteRenderer(webrtc::VideoTrackInterface* remote_video);
     virtual void StopRemoteRenderer();
+    virtual void StartPeerRenderer(int peer_id,
+                                   webrtc::VideoTrackInterface* remote_video);
+    virtual void StopPeerRenderer(int peer_id);
     
     virtual void QueueUIThreadCallback(int msg_id, void* data);
     
     HWND localHandle() const;
     
+    // Renderers started after this hand frames to the UI in FrameRing
+    // buffers and the video is drawn straight from them.
+    void SetUseFrameRing(bool use) { useFrameRing_ = use; }
+    RenderStats GetRenderStats() const { return renderCounters_.Get(); }
+    
     class VideoRenderer : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
     public:
-        VideoRenderer(bool isLocal,
-                      webrtc::VideoTrackInterface* track_to_render);
+        VideoRenderer(int stream,
+                      webrtc::VideoTrackInterface* track_to_render,
+                      bool useFrameRing,
+                      RenderCounters* counters);
         virtual ~VideoRenderer();
         
-        void Lock() { buffer_lock_.Enter(); }
-        
-        void Unlock() { buffer_lock_.Leave(); }
-        
         // VideoSinkInterface implementation
         void OnFrame(const webrtc::VideoFrame& frame) override;
-        const uint8_t* image() const { return imageBuf_.data(); }
+        
+        // UI thread. Returns the newest frame if one came in since the last
+        // call. |frame| points into the renderer and stays valid until the
+        // next call or until the renderer is gone.
+        bool TakeFrame(FrameMailbox::Frame* frame);
+        int stream() const { return stream_; }
         
     protected:
-        void SetSize(int width, int height);
+        void RenderToRing(const webrtc::I420BufferInterface& frame,
+                          webrtc::VideoRotation rotation,
+                          int width,
+                          int height,
+                          int64_t timestamp_us,
+                          int64_t capture_us);
         
         enum {
             SET_SIZE,
             RENDER_FRAME,
         };
         
-        bool isLocal_;
-        int width_ = 0;
-        int height_ = 0;
-        std::vector<uint8_t> imageBuf_;
-        rtc::CriticalSection buffer_lock_;
+        int stream_;
+        // Converted frames outside frame ring mode.
+        TripleBuffer frames_;
         rtc::scoped_refptr<webrtc::VideoTrackInterface> rendered_track_;
-    };
-    
-    // A little helper class to make sure we always to proper locking and
-    // unlocking when working with VideoRenderer buffers.
-    template <typename T>
-    class AutoLock {
-    public:
-        explicit AutoLock(T* obj) : obj_(obj) { obj_->Lock(); }
-        ~AutoLock() { obj_->Unlock(); }
-        
-    protected:
-        T* obj_;
+        // Only set in frame ring mode.
+        rtc::scoped_refptr<FrameRing> ring_;
+        FrameConverter converter_;
+        RenderCounters* counters_;
     };
     
 protected:
@@ -181,10 +214,28 @@ protected:
     
     void OnPaint();
     void OnDestroyed();
+    // Draws the latest frames onto ui->video in frame ring mode.
+    void PaintVideo(const QRegion& region);
+    // Top left of the video within ui->video.
+    QPoint VideoOffset() const;
+    // Counts the latency of frames drawn for the first time.
+    void ReportPainted();
+    // Shows what waits in mailbox_; paced by pacer_.
+    void DeliverFrames();
+    void ShowFrame(int stream, FrameMailbox::Frame* frame);
+    // Gives the shown frame of a renderer about to go away its own pixels.
+    void DetachFrame(int stream);
+    // Compositor tile of a remote stream, or -1.
+    int TileOf(int stream) const;
+    // Lays the tiles out again after a conference peer came or went.
+    void LayoutTiles();
+    bool HasVideo() const;
     
 private:
     std::unique_ptr<VideoRenderer> local_renderer_;
     std::unique_ptr<VideoRenderer> remote_renderer_;
+    // Conference peers by peer id, in tile order.
+    std::map<int, std::unique_ptr<VideoRenderer>> peerRenderers_;
     UI ui_;
     rtc::PlatformThreadId ui_thread_id_;
     bool destroyed_;
@@ -193,6 +244,23 @@ private:
     std::string server_;
     std::string port_;
     bool isCreatePc_ = false;
+    bool useFrameRing_ = false;
+    RenderCounters renderCounters_;
+    VideoCompositor compositor_;
+    // The frame on screen for each stream. The times are kept until it is
+    // first painted.
+    struct ShownFrame {
+        QImage image;
+        qint64 arrival_us = 0;
+        qint64 capture_us = 0;
+    };
+    std::vector<ShownFrame> shown_;
+    int framesSinceLog_ = 0;
+    FrameMailbox mailbox_;
+    RepaintPacer pacer_;
+    std::vector<FrameMailbox::Frame> taken_;
+    // Set from FrameAvailable until DeliverFrames runs.
+    std::atomic<bool> framesReady_{false};
 };
 
 #endif // MAINWINDOW_H
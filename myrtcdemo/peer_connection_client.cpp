@@ -10,10 +10,15 @@
 
 #include "peer_connection_client.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "defaults.h"
 #include "rtc_base/checks.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/net_helpers.h"
+#include "rtc_base/time_utils.h"
 #include "socket_notifier.h"
 
 #ifdef USE_WIN32
@@ -26,6 +31,26 @@ namespace {
     const char kByeMessage[] = "BYE";
     // Delay between server connection retries, in milliseconds
     const int kReconnectDelay = 2000;
+    // Out of order messages held back per peer before giving up on a gap,
+    // and the longest they are held. Long enough for the sender's retries.
+    const size_t kMaxHeldMessages = 64;
+    const int kMaxHoldMs = 3000;
+    // Attempts at sending one message, and the pause before another.
+    const int kMaxSendAttempts = 3;
+    const int kResendDelayMs = 500;
+    // Free space handed to each Recv call.
+    const size_t kReadChunk = 16 * 1024;
+    
+    // Like atoi, but stops at the end of |text| instead of needing a NUL.
+    int ParseLeadingInt(absl::string_view text) {
+        int value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9')
+                break;
+            value = value * 10 + (c - '0');
+        }
+        return value;
+    }
     
     rtc::AsyncSocket* CreateClientSocket(int family) {
 #ifdef USE_WIN32
@@ -40,9 +65,19 @@ namespace {
 }  // namespace
 
 PeerConnectionClient::PeerConnectionClient()
-: callback_(NULL), resolver_(NULL), state_(NOT_CONNECTED), my_id_(-1) {}
+: callback_(NULL), resolver_(NULL), state_(NOT_CONNECTED), my_id_(-1),
+keep_alive_(false), control_pending_(false), stream_notifications_(false),
+stream_supported_(true), notification_streaming_(false),
+#ifdef USE_WIN32
+network_thread_(rtc::Thread::Current()),
+#else
+network_thread_(SocketNotifier::GetSocketNotifier()->GetThreadPtr()),
+#endif
+max_in_flight_(1), in_flight_(0), barrier_in_flight_(false) {}
 
-PeerConnectionClient::~PeerConnectionClient() {}
+PeerConnectionClient::~PeerConnectionClient() {
+    network_thread_->Clear(this);
+}
 
 void PeerConnectionClient::InitSocketSignals() {
     RTC_DCHECK(control_socket_.get() != NULL);
@@ -71,6 +106,23 @@ const Peers& PeerConnectionClient::peers() const {
     return peers_;
 }
 
+void PeerConnectionClient::SetKeepAlive(bool keep_alive) {
+    keep_alive_ = keep_alive;
+}
+
+void PeerConnectionClient::SetMaxInFlight(int max_in_flight) {
+    rtc::CritScope lock(&send_lock_);
+    max_in_flight_ = std::max(max_in_flight, 1);
+}
+
+void PeerConnectionClient::SetStreamNotifications(bool stream) {
+    stream_notifications_ = stream;
+}
+
+const char* PeerConnectionClient::HttpVersion() const {
+    return keep_alive_ ? "HTTP/1.1" : "HTTP/1.0";
+}
+
 void PeerConnectionClient::RegisterObserver(
                                             PeerConnectionClientObserver* callback) {
     RTC_DCHECK(!callback_);
@@ -129,12 +181,17 @@ void PeerConnectionClient::DoConnect() {
     control_socket_.reset(CreateClientSocket(server_address_.ipaddr().family()));
     hanging_get_.reset(CreateClientSocket(server_address_.ipaddr().family()));
     InitSocketSignals();
+    control_pending_ = false;
+    stream_supported_ = true;
+    send_channels_.clear();
     char buffer[1024];
-    snprintf(buffer, sizeof(buffer), "GET /sign_in?%s HTTP/1.0\r\n\r\n",
-             client_name_.c_str());
+    snprintf(buffer, sizeof(buffer), "GET /sign_in?%s %s\r\n"
+             "Host: %s\r\n\r\n",
+             client_name_.c_str(), HttpVersion(),
+             server_address_.ToString().c_str());
     onconnect_data_ = buffer;
     
-    bool ret = ConnectControlSocket();
+    bool ret = SendControlRequest();
     if (ret)
         state_ = SIGNING_IN;
     if (!ret) {
@@ -147,20 +204,31 @@ bool PeerConnectionClient::SendToPeer(int peer_id, const std::string& message) {
         return false;
     
     RTC_DCHECK(is_connected());
-    RTC_DCHECK(control_socket_->GetState() == rtc::Socket::CS_CLOSED);
     if (!is_connected() || peer_id == -1)
         return false;
     
-    char headers[1024];
-    snprintf(headers, sizeof(headers),
-             "POST /message?peer_id=%i&to=%i HTTP/1.0\r\n"
-             "Content-Length: %zu\r\n"
-             "Content-Type: text/plain\r\n"
-             "\r\n",
-             my_id_, peer_id, message.length());
-    onconnect_data_ = headers;
-    onconnect_data_ += message;
-    return ConnectControlSocket();
+    OutgoingMessage outgoing;
+    outgoing.peer_id = peer_id;
+    outgoing.barrier = message.compare(kByeMessage) == 0;
+    outgoing.enqueued_us = rtc::TimeMicros();
+    {
+        rtc::CritScope lock(&send_lock_);
+        if (max_in_flight_ > 1 && !message.empty() && message[0] == '{') {
+            // Put seq first so the receiver can find it without parsing.
+            size_t body = message.find_first_not_of(" \t\r\n", 1);
+            bool empty = body != std::string::npos && message[body] == '}';
+            char seq[32];
+            snprintf(seq, sizeof(seq), "{\"seq\":%u%s", ++next_seq_[peer_id],
+                     empty ? "" : ",");
+            outgoing.body = seq;
+            outgoing.body.append(message, 1, std::string::npos);
+        } else {
+            outgoing.body = message;
+        }
+        send_queue_.push_back(std::move(outgoing));
+    }
+    network_thread_->Post(RTC_FROM_HERE, this, MSG_PUMP_SENDS);
+    return true;
 }
 
 bool PeerConnectionClient::SendHangUp(int peer_id) {
@@ -168,8 +236,16 @@ bool PeerConnectionClient::SendHangUp(int peer_id) {
 }
 
 bool PeerConnectionClient::IsSendingMessage() {
-    return state_ == CONNECTED &&
-    control_socket_->GetState() != rtc::Socket::CS_CLOSED;
+    rtc::CritScope lock(&send_lock_);
+    return !send_queue_.empty() || in_flight_ > 0;
+}
+
+SignalingStats PeerConnectionClient::GetSignalingStats() {
+    rtc::CritScope lock(&send_lock_);
+    SignalingStats stats = stats_;
+    stats.queue_depth = send_queue_.size();
+    stats.in_flight = in_flight_;
+    return stats;
 }
 
 bool PeerConnectionClient::SignOut() {
@@ -179,15 +255,20 @@ bool PeerConnectionClient::SignOut() {
     if (hanging_get_->GetState() != rtc::Socket::CS_CLOSED)
         hanging_get_->Close();
     
-    if (control_socket_->GetState() == rtc::Socket::CS_CLOSED) {
+    // Let queued messages (typically a BYE) reach the server first;
+    // PumpSendQueue signs out once the queue drains.
+    if (!IsSendingMessage() &&
+        (control_socket_->GetState() == rtc::Socket::CS_CLOSED ||
+         (keep_alive_ && !control_pending_))) {
         state_ = SIGNING_OUT;
         
         if (my_id_ != -1) {
             char buffer[1024];
             snprintf(buffer, sizeof(buffer),
-                     "GET /sign_out?peer_id=%i HTTP/1.0\r\n\r\n", my_id_);
+                     "GET /sign_out?peer_id=%i %s\r\nHost: %s\r\n\r\n",
+                     my_id_, HttpVersion(), server_address_.ToString().c_str());
             onconnect_data_ = buffer;
-            return ConnectControlSocket();
+            return SendControlRequest();
         } else {
             // Can occur if the app is closed before we finish connecting.
             return true;
@@ -203,6 +284,22 @@ void PeerConnectionClient::Close() {
     control_socket_->Close();
     hanging_get_->Close();
     onconnect_data_.clear();
+    control_pending_ = false;
+    for (auto& channel : send_channels_) {
+        channel->socket->Close();
+        channel->response.Reset();
+        channel->busy = false;
+    }
+    control_response_.Reset();
+    ResetNotificationStream();
+    reorder_.clear();
+    {
+        rtc::CritScope lock(&send_lock_);
+        send_queue_.clear();
+        next_seq_.clear();
+        in_flight_ = 0;
+        barrier_in_flight_ = false;
+    }
     peers_.clear();
     if (resolver_ != NULL) {
         resolver_->Destroy(false);
@@ -223,6 +320,28 @@ bool PeerConnectionClient::ConnectControlSocket() {
     return true;
 }
 
+bool PeerConnectionClient::SendControlRequest() {
+    RTC_DCHECK(!onconnect_data_.empty());
+    control_pending_ = true;
+    if (!keep_alive_ ||
+        control_socket_->GetState() != rtc::Socket::CS_CONNECTED) {
+        return ConnectControlSocket();
+    }
+    
+    // Reuse the connection the previous response left open.
+    int sent = control_socket_->Send(onconnect_data_.c_str(),
+                                     onconnect_data_.length());
+    if (sent != static_cast<int>(onconnect_data_.length())) {
+        // The server dropped the idle connection; fall back to a fresh one.
+        RTC_LOG(WARNING) << "Keep-alive send failed, reconnecting";
+        control_socket_->Close();
+        control_response_.Reset();
+        return ConnectControlSocket();
+    }
+    onconnect_data_.clear();
+    return true;
+}
+
 void PeerConnectionClient::OnConnect(rtc::AsyncSocket* socket) {
     RTC_DCHECK(!onconnect_data_.empty());
     size_t sent = socket->Send(onconnect_data_.c_str(), onconnect_data_.length());
@@ -231,98 +350,314 @@ void PeerConnectionClient::OnConnect(rtc::AsyncSocket* socket) {
 }
 
 void PeerConnectionClient::OnHangingGetConnect(rtc::AsyncSocket* socket) {
+    ResetNotificationStream();
+    {
+        rtc::CritScope lock(&send_lock_);
+        ++stats_.notification_connects;
+    }
     char buffer[1024];
-    snprintf(buffer, sizeof(buffer), "GET /wait?peer_id=%i HTTP/1.0\r\n\r\n",
-             my_id_);
+    if (stream_notifications_ && stream_supported_) {
+        // peerconnection_server reads peer_id with atoi, so a server that
+        // does not stream ignores the extra parameter.
+        snprintf(buffer, sizeof(buffer),
+                 "GET /wait?peer_id=%i&stream=1 HTTP/1.1\r\nHost: %s\r\n\r\n",
+                 my_id_, server_address_.ToString().c_str());
+    } else {
+        snprintf(buffer, sizeof(buffer), "GET /wait?peer_id=%i HTTP/1.0\r\n\r\n",
+                 my_id_);
+    }
     int len = static_cast<int>(strlen(buffer));
     int sent = socket->Send(buffer, len);
     RTC_DCHECK(sent == len);
 }
 
+void PeerConnectionClient::PumpSendQueue() {
+    RTC_DCHECK(network_thread_->IsCurrent());
+    while (state_ == CONNECTED || state_ == SIGNING_OUT_WAITING) {
+        OutgoingMessage message;
+        {
+            rtc::CritScope lock(&send_lock_);
+            if (send_queue_.empty() || barrier_in_flight_ ||
+                in_flight_ >= max_in_flight_ ||
+                (send_queue_.front().barrier && in_flight_ > 0)) {
+                break;
+            }
+            // A retry waits at the head so nothing overtakes it; MSG_PUMP_SENDS
+            // is posted for when it is due.
+            if (send_queue_.front().not_before_ms > rtc::TimeMillis())
+                break;
+            message = std::move(send_queue_.front());
+            send_queue_.pop_front();
+            ++in_flight_;
+            barrier_in_flight_ = message.barrier;
+        }
+        StartSend(GetIdleSendChannel(), message);
+    }
+    
+    if (state_ == SIGNING_OUT_WAITING && !IsSendingMessage())
+        SignOut();
+}
+
+PeerConnectionClient::SendChannel* PeerConnectionClient::GetIdleSendChannel() {
+    for (auto& channel : send_channels_) {
+        if (!channel->busy)
+            return channel.get();
+    }
+    
+    SendChannel* channel = new SendChannel();
+    send_channels_.emplace_back(channel);
+    channel->socket.reset(CreateClientSocket(server_address_.ipaddr().family()));
+    channel->socket->SignalConnectEvent.connect(
+                                                this, &PeerConnectionClient::OnSendChannelConnect);
+    channel->socket->SignalReadEvent.connect(
+                                             this, &PeerConnectionClient::OnSendChannelRead);
+    channel->socket->SignalCloseEvent.connect(
+                                              this, &PeerConnectionClient::OnSendChannelClose);
+    return channel;
+}
+
+PeerConnectionClient::SendChannel* PeerConnectionClient::FindSendChannel(
+                                                                         rtc::AsyncSocket* socket) {
+    for (auto& channel : send_channels_) {
+        if (channel->socket.get() == socket)
+            return channel.get();
+    }
+    return nullptr;
+}
+
+void PeerConnectionClient::StartSend(SendChannel* channel,
+                                     const OutgoingMessage& message) {
+    char headers[1024];
+    snprintf(headers, sizeof(headers),
+             "POST /message?peer_id=%i&to=%i %s\r\n"
+             "Host: %s\r\n"
+             "Content-Length: %zu\r\n"
+             "Content-Type: text/plain\r\n"
+             "\r\n",
+             my_id_, message.peer_id, HttpVersion(),
+             server_address_.ToString().c_str(), message.body.length());
+    channel->request = headers;
+    channel->request += message.body;
+    channel->response.Reset();
+    channel->busy = true;
+    channel->message = message;
+    
+    if (keep_alive_ &&
+        channel->socket->GetState() == rtc::Socket::CS_CONNECTED) {
+        int sent = channel->socket->Send(channel->request.c_str(),
+                                         channel->request.length());
+        if (sent == static_cast<int>(channel->request.length())) {
+            channel->request.clear();
+            return;
+        }
+        RTC_LOG(WARNING) << "Keep-alive send failed, reconnecting";
+    }
+    
+    channel->socket->Close();
+    if (channel->socket->Connect(server_address_) == SOCKET_ERROR) {
+        RTC_LOG(LS_ERROR) << "Failed to connect a message channel";
+        FinishSend(channel, channel->socket->GetError());
+    }
+}
+
+void PeerConnectionClient::FinishSend(SendChannel* channel, int err) {
+    int64_t latency_us = rtc::TimeMicros() - channel->message.enqueued_us;
+    int peer_id = channel->message.peer_id;
+    channel->busy = false;
+    channel->request.clear();
+    channel->response.Reset();
+    if (!keep_alive_ || err)
+        channel->socket->Close();
+    // A 4xx will not go away; anything else may: the connection, or the
+    // server for a moment.
+    bool retry = err && (err < 400 || err >= 500) &&
+    channel->message.attempts + 1 < kMaxSendAttempts &&
+    (state_ == CONNECTED || state_ == SIGNING_OUT_WAITING);
+    {
+        rtc::CritScope lock(&send_lock_);
+        --in_flight_;
+        if (channel->message.barrier)
+            barrier_in_flight_ = false;
+        if (retry) {
+            // Back at the front: the receiver holds what was sent after it
+            // until its seq arrives.
+            OutgoingMessage message = std::move(channel->message);
+            ++message.attempts;
+            message.not_before_ms = rtc::TimeMillis() + kResendDelayMs;
+            send_queue_.push_front(std::move(message));
+            ++stats_.messages_retried;
+        } else if (err) {
+            ++stats_.messages_failed;
+        } else {
+            ++stats_.messages_sent;
+            stats_.last_latency_us = latency_us;
+            stats_.max_latency_us = std::max(stats_.max_latency_us, latency_us);
+            stats_.total_latency_us += latency_us;
+        }
+    }
+    if (retry) {
+        RTC_LOG(WARNING) << "Message to peer " << peer_id << " failed, error "
+        << err << "; retrying";
+        network_thread_->PostDelayed(RTC_FROM_HERE, kResendDelayMs, this,
+                                     MSG_PUMP_SENDS);
+        return;
+    }
+    callback_->OnMessageSent(err);
+}
+
+void PeerConnectionClient::OnSendChannelConnect(rtc::AsyncSocket* socket) {
+    SendChannel* channel = FindSendChannel(socket);
+    RTC_DCHECK(channel && !channel->request.empty());
+    size_t sent = socket->Send(channel->request.c_str(),
+                               channel->request.length());
+    RTC_DCHECK(sent == channel->request.length());
+    channel->request.clear();
+}
+
+void PeerConnectionClient::OnSendChannelRead(rtc::AsyncSocket* socket) {
+    SendChannel* channel = FindSendChannel(socket);
+    if (!channel || !channel->busy)
+        return;
+    
+    if (!ReadIntoBuffer(socket, &channel->response))
+        return;
+    
+    int status = channel->response.status();
+    if (status != 200)
+        RTC_LOG(LS_ERROR) << "Server rejected message, status " << status;
+    FinishSend(channel, status == 200 ? 0 : status);
+    PumpSendQueue();
+}
+
+void PeerConnectionClient::OnSendChannelClose(rtc::AsyncSocket* socket,
+                                              int err) {
+    socket->Close();
+    SendChannel* channel = FindSendChannel(socket);
+    // A complete response is finished by OnSendChannelRead.
+    if (!channel || !channel->busy || channel->response.done())
+        return;
+    
+    // Closed before a full response arrived.
+    FinishSend(channel, err ? err : SOCKET_ERROR);
+    PumpSendQueue();
+}
+
 void PeerConnectionClient::OnMessageFromPeer(int peer_id,
-                                             const std::string& message) {
-    if (message.length() == (sizeof(kByeMessage) - 1) &&
-        message.compare(kByeMessage) == 0) {
-        callback_->OnPeerDisconnected(peer_id);
-    } else {
-        callback_->OnMessageFromPeer(peer_id, message);
+                                             absl::string_view message) {
+    const absl::string_view kSeqPrefix = "{\"seq\":";
+    uint32_t seq = 0;
+    if (message.substr(0, kSeqPrefix.size()) == kSeqPrefix)
+        seq = ParseLeadingInt(message.substr(kSeqPrefix.size()));
+    if (seq == 0) {
+        DeliverMessageFromPeer(peer_id, message);
+        return;
     }
+    
+    ReorderState& state = reorder_[peer_id];
+    if (seq < state.next_seq || state.held.count(seq)) {
+        // Handing it over would repeat an offer or undo newer ones.
+        RTC_LOG(WARNING) << "Dropped duplicate or late message " << seq
+        << " from peer " << peer_id;
+        rtc::CritScope lock(&send_lock_);
+        ++stats_.messages_dropped;
+        return;
+    }
+    state.held[seq] = std::string(message);
+    
+    // Collect first: the observer may sign out and clear reorder_.
+    std::vector<std::string> ready;
+    TakeReadyMessages(&state, peer_id, rtc::TimeMillis(), &ready);
+    for (const std::string& next : ready)
+        DeliverMessageFromPeer(peer_id, next);
 }
 
-bool PeerConnectionClient::GetHeaderValue(const std::string& data,
-                                          size_t eoh,
-                                          const char* header_pattern,
-                                          size_t* value) {
-    RTC_DCHECK(value != NULL);
-    size_t found = data.find(header_pattern);
-    if (found != std::string::npos && found < eoh) {
-        *value = atoi(&data[found + strlen(header_pattern)]);
-        return true;
+void PeerConnectionClient::TakeReadyMessages(ReorderState* state,
+                                             int peer_id,
+                                             int64_t now_ms,
+                                             std::vector<std::string>* ready) {
+    // Everything held has waited at least as long as the oldest gap.
+    bool expired = state->gap_since_ms != 0 &&
+    now_ms - state->gap_since_ms >= kMaxHoldMs;
+    while (!state->held.empty() &&
+           (state->held.begin()->first == state->next_seq ||
+            state->held.size() > kMaxHeldMessages || expired)) {
+        auto it = state->held.begin();
+        if (it->first != state->next_seq) {
+            RTC_LOG(WARNING) << "Gave up waiting for message " << state->next_seq
+            << " from peer " << peer_id;
+        }
+        state->next_seq = it->first + 1;
+        ready->push_back(std::move(it->second));
+        state->held.erase(it);
+    }
+    if (state->held.empty()) {
+        state->gap_since_ms = 0;
+    } else if (state->gap_since_ms == 0) {
+        state->gap_since_ms = now_ms;
+        network_thread_->PostDelayed(RTC_FROM_HERE, kMaxHoldMs, this,
+                                     MSG_FLUSH_HELD);
     }
-    return false;
 }
 
-bool PeerConnectionClient::GetHeaderValue(const std::string& data,
-                                          size_t eoh,
-                                          const char* header_pattern,
-                                          std::string* value) {
-    RTC_DCHECK(value != NULL);
-    size_t found = data.find(header_pattern);
-    if (found != std::string::npos && found < eoh) {
-        size_t begin = found + strlen(header_pattern);
-        size_t end = data.find("\r\n", begin);
-        if (end == std::string::npos)
-            end = eoh;
-        value->assign(data.substr(begin, end - begin));
-        return true;
+void PeerConnectionClient::FlushHeldMessages() {
+    int64_t now_ms = rtc::TimeMillis();
+    std::vector<std::pair<int, std::vector<std::string>>> ready;
+    for (auto& entry : reorder_) {
+        std::vector<std::string> messages;
+        TakeReadyMessages(&entry.second, entry.first, now_ms, &messages);
+        if (!messages.empty())
+            ready.emplace_back(entry.first, std::move(messages));
+    }
+    for (const auto& peer : ready) {
+        for (const std::string& next : peer.second)
+            DeliverMessageFromPeer(peer.first, next);
+    }
+}
+
+void PeerConnectionClient::DeliverMessageFromPeer(int peer_id,
+                                                  absl::string_view message) {
+    if (message == kByeMessage) {
+        callback_->OnPeerDisconnected(peer_id);
+    } else {
+        // The only copy of the body: the observer interface takes a string.
+        callback_->OnMessageFromPeer(peer_id, std::string(message));
     }
-    return false;
 }
 
 bool PeerConnectionClient::ReadIntoBuffer(rtc::AsyncSocket* socket,
-                                          std::string* data,
-                                          size_t* content_length) {
-    char buffer[0xffff];
+                                          HttpResponseParser* response) {
+    HttpResponseParser::Result result = HttpResponseParser::kNeedMore;
     do {
-        int bytes = socket->Recv(buffer, sizeof(buffer), nullptr);
+        size_t space = 0;
+        char* buffer = response->PrepareWrite(kReadChunk, &space);
+        int bytes = socket->Recv(buffer, space, nullptr);
         if (bytes <= 0)
             break;
-        data->append(buffer, bytes);
-    } while (true);
-    
-    bool ret = false;
-    size_t i = data->find("\r\n\r\n");
-    if (i != std::string::npos) {
-        RTC_LOG(INFO) << "Headers received";
-        if (GetHeaderValue(*data, i, "\r\nContent-Length: ", content_length)) {
-            size_t total_response_size = (i + 4) + *content_length;
-            if (data->length() >= total_response_size) {
-                ret = true;
-                std::string should_close;
-                const char kConnection[] = "\r\nConnection: ";
-                if (GetHeaderValue(*data, i, kConnection, &should_close) &&
-                    should_close.compare("close") == 0) {
-                    socket->Close();
-                    // Since we closed the socket, there was no notification delivered
-                    // to us.  Compensate by letting ourselves know.
-                    OnClose(socket, 0);
-                }
-            } else {
-                // We haven't received everything.  Just continue to accept data.
-            }
-        } else {
-            RTC_LOG(LS_ERROR) << "No content length field specified by the server.";
-        }
+        result = response->Commit(bytes);
+    } while (result == HttpResponseParser::kNeedMore);
+    
+    if (result == HttpResponseParser::kNeedMore)
+        return false;
+    
+    if (result == HttpResponseParser::kError) {
+        RTC_LOG(LS_ERROR) << "Malformed response from the server.";
+        response->Reset();
     }
-    return ret;
+    
+    if (result == HttpResponseParser::kError || response->connection_close()) {
+        socket->Close();
+        // Since we closed the socket, there was no notification delivered
+        // to us.  Compensate by letting ourselves know.
+        OnClose(socket, 0);
+    }
+    return result == HttpResponseParser::kDone;
 }
 
 void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket) {
-    size_t content_length = 0;
-    if (ReadIntoBuffer(socket, &control_data_, &content_length)) {
-        size_t peer_id = 0, eoh = 0;
-        bool ok =
-        ParseServerResponse(control_data_, content_length, &peer_id, &eoh);
+    if (ReadIntoBuffer(socket, &control_response_)) {
+        control_pending_ = false;
+        size_t peer_id = 0;
+        bool ok = ParseServerResponse(control_response_, &peer_id);
         if (ok) {
             if (my_id_ == -1) {
                 // First response.  Let's store our server assigned ID.
@@ -331,20 +666,23 @@ void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket) {
                 RTC_DCHECK(my_id_ != -1);
                 
                 // The body of the response will be a list of already connected peers.
-                if (content_length) {
-                    size_t pos = eoh + 4;
-                    while (pos < control_data_.size()) {
-                        size_t eol = control_data_.find('\n', pos);
-                        if (eol == std::string::npos)
+                absl::string_view body = control_response_.body();
+                if (!body.empty()) {
+                    // One entry per line; the names fit in the body's size.
+                    peers_.reserve(std::count(body.begin(), body.end(), '\n'),
+                                   body.size());
+                    size_t pos = 0;
+                    while (pos < body.size()) {
+                        size_t eol = body.find('\n', pos);
+                        if (eol == absl::string_view::npos)
                             break;
                         int id = 0;
-                        std::string name;
+                        absl::string_view name;
                         bool connected;
-                        if (ParseEntry(control_data_.substr(pos, eol - pos), &name, &id,
-                                       &connected) &&
+                        if (ParsePeerEntry(body.substr(pos, eol - pos), &name, &id,
+                                           &connected) &&
                             id != my_id_) {
-                            peers_[id] = name;
-                            callback_->OnPeerConnected(id, name);
+                            UpdatePeer(name, id, true);
                         }
                         pos = eol + 1;
                     }
@@ -359,7 +697,7 @@ void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket) {
             }
         }
         
-        control_data_.clear();
+        control_response_.Reset();
         
         if (state_ == SIGNING_IN) {
             RTC_DCHECK(hanging_get_->GetState() == rtc::Socket::CS_CLOSED);
@@ -371,40 +709,26 @@ void PeerConnectionClient::OnRead(rtc::AsyncSocket* socket) {
 
 void PeerConnectionClient::OnHangingGetRead(rtc::AsyncSocket* socket) {
     RTC_LOG(INFO) << __FUNCTION__;
-    size_t content_length = 0;
-    if (ReadIntoBuffer(socket, &notification_data_, &content_length)) {
-        size_t peer_id = 0, eoh = 0;
-        bool ok =
-        ParseServerResponse(notification_data_, content_length, &peer_id, &eoh);
-        
-        if (ok) {
-            RTC_LOG(INFO) << __FUNCTION__<<notification_data_<<"\n";
-            // Store the position where the body begins.
-            size_t pos = eoh + 4;
-            
-            if (my_id_ == static_cast<int>(peer_id)) {
-                // A notification about a new member or a member that just
-                // disconnected.
-                int id = 0;
-                std::string name;
-                bool connected = false;
-                if (ParseEntry(notification_data_.substr(pos), &name, &id,
-                               &connected)) {
-                    if (connected) {
-                        peers_[id] = name;
-                        callback_->OnPeerConnected(id, name);
-                    } else {
-                        peers_.erase(id);
-                        callback_->OnPeerDisconnected(id);
-                    }
-                }
-            } else {
-                OnMessageFromPeer(static_cast<int>(peer_id),
-                                  notification_data_.substr(pos));
+    if (notification_streaming_) {
+        ReadNotificationStream(socket);
+    } else if (ReadIntoBuffer(socket, &notification_response_)) {
+        if (notification_response_.chunked() &&
+            notification_response_.status() == 200) {
+            StartNotificationStream(socket);
+        } else {
+            if (stream_notifications_ && stream_supported_ &&
+                notification_response_.status() == 200) {
+                RTC_LOG(INFO) << "Server does not stream notifications, "
+                "falling back to hanging GET";
+                stream_supported_ = false;
             }
+            HandleNotification(notification_response_);
+            notification_response_.Reset();
+            // A hanging GET carries a single response; ask again on a new
+            // connection even if the server left this one open.
+            if (hanging_get_->GetState() == rtc::Socket::CS_CONNECTED)
+                hanging_get_->Close();
         }
-        
-        notification_data_.clear();
     }
     
     if (hanging_get_->GetState() == rtc::Socket::CS_CLOSED &&
@@ -413,58 +737,147 @@ void PeerConnectionClient::OnHangingGetRead(rtc::AsyncSocket* socket) {
     }
 }
 
-bool PeerConnectionClient::ParseEntry(const std::string& entry,
-                                      std::string* name,
-                                      int* id,
-                                      bool* connected) {
-    RTC_DCHECK(name != NULL);
-    RTC_DCHECK(id != NULL);
-    RTC_DCHECK(connected != NULL);
-    RTC_DCHECK(!entry.empty());
-    
-    *connected = false;
-    size_t separator = entry.find(',');
-    if (separator != std::string::npos) {
-        *id = atoi(&entry[separator + 1]);
-        name->assign(entry.substr(0, separator));
-        separator = entry.find(',', separator + 1);
-        if (separator != std::string::npos) {
-            *connected = atoi(&entry[separator + 1]) ? true : false;
+void PeerConnectionClient::HandleNotification(
+                                              const HttpResponseParser& response) {
+    size_t peer_id = 0;
+    if (!ParseServerResponse(response, &peer_id))
+        return;
+    {
+        rtc::CritScope lock(&send_lock_);
+        ++stats_.notifications_received;
+    }
+    
+    absl::string_view body = response.body();
+    RTC_LOG(INFO) << __FUNCTION__ << " " << body.size() << " bytes";
+    
+    if (my_id_ == static_cast<int>(peer_id)) {
+        // A notification about a new member or a member that just
+        // disconnected.
+        int id = 0;
+        absl::string_view name;
+        bool connected = false;
+        if (ParsePeerEntry(body, &name, &id, &connected))
+            UpdatePeer(name, id, connected);
+    } else {
+        OnMessageFromPeer(static_cast<int>(peer_id), body);
+    }
+}
+
+void PeerConnectionClient::StartNotificationStream(rtc::AsyncSocket* socket) {
+    notification_streaming_ = true;
+    // Whatever arrived with the response head is the start of the body.
+    absl::string_view extra = notification_response_.extra();
+    size_t len = extra.size();
+    if (len > 0) {
+        size_t space = 0;
+        char* buffer = notification_event_.PrepareWrite(len, &space);
+        memcpy(buffer, extra.data(), len);
+        notification_response_.Reset();
+        if (!DecodeNotificationStream(socket, buffer, len))
+            return;
+    } else {
+        notification_response_.Reset();
+    }
+    ReadNotificationStream(socket);
+}
+
+void PeerConnectionClient::ReadNotificationStream(rtc::AsyncSocket* socket) {
+    while (notification_streaming_) {
+        size_t space = 0;
+        char* buffer = notification_event_.PrepareWrite(kReadChunk, &space);
+        int bytes = socket->Recv(buffer, space, nullptr);
+        if (bytes <= 0)
+            break;
+        if (!DecodeNotificationStream(socket, buffer, bytes))
+            break;
+    }
+}
+
+bool PeerConnectionClient::DecodeNotificationStream(rtc::AsyncSocket* socket,
+                                                    char* data,
+                                                    size_t len) {
+    size_t decoded = 0;
+    HttpChunkDecoder::Result chunks =
+    notification_chunks_.Decode(data, len, &decoded);
+    HttpResponseParser::Result result = HttpResponseParser::kError;
+    if (chunks != HttpChunkDecoder::kError)
+        result = notification_event_.Commit(decoded);
+    
+    while (result == HttpResponseParser::kDone) {
+        HandleNotification(notification_event_);
+        // The observer may have signed out, or an error closed us.
+        if (!notification_streaming_ ||
+            socket->GetState() == rtc::Socket::CS_CLOSED) {
+            return false;
         }
+        result = notification_event_.Next();
+    }
+    
+    if (result == HttpResponseParser::kNeedMore &&
+        chunks == HttpChunkDecoder::kNeedMore) {
+        return true;
     }
-    return !name->empty();
+    
+    if (chunks == HttpChunkDecoder::kEnd) {
+        RTC_LOG(INFO) << "Notification stream ended by the server";
+    } else {
+        // Do not keep asking for a stream we cannot read.
+        RTC_LOG(LS_ERROR) << "Malformed notification stream, "
+        "falling back to hanging GET";
+        stream_supported_ = false;
+    }
+    ResetNotificationStream();
+    socket->Close();
+    OnClose(socket, 0);
+    return false;
 }
 
-int PeerConnectionClient::GetResponseStatus(const std::string& response) {
-    int status = -1;
-    size_t pos = response.find(' ');
-    if (pos != std::string::npos)
-        status = atoi(&response[pos + 1]);
-    return status;
+void PeerConnectionClient::ResetNotificationStream() {
+    notification_streaming_ = false;
+    notification_response_.Reset();
+    notification_chunks_.Reset();
+    notification_event_.Reset();
+}
+
+void PeerConnectionClient::UpdatePeer(absl::string_view name,
+                                      int id,
+                                      bool connected) {
+    if (!connected) {
+        if (!peers_.Remove(id))
+            return;
+        reorder_.erase(id);
+        callback_->OnPeerDisconnected(id);
+        return;
+    }
+    
+    // A repeated entry is not a change.
+    switch (peers_.Set(id, name)) {
+        case Peers::ADDED:
+            callback_->OnPeerConnected(id, std::string(name));
+            break;
+        case Peers::RENAMED:
+            callback_->OnPeerRenamed(id, std::string(name));
+            break;
+        case Peers::UNCHANGED:
+            break;
+    }
 }
 
-bool PeerConnectionClient::ParseServerResponse(const std::string& response,
-                                               size_t content_length,
-                                               size_t* peer_id,
-                                               size_t* eoh) {
-    int status = GetResponseStatus(response.c_str());
-    if (status != 200) {
+bool PeerConnectionClient::ParseServerResponse(
+                                               const HttpResponseParser& response,
+                                               size_t* peer_id) {
+    if (response.status() != 200) {
         RTC_LOG(LS_ERROR) << "Received error from server";
         Close();
         callback_->OnDisconnected();
         return false;
     }
     
-    *eoh = response.find("\r\n\r\n");
-    RTC_DCHECK(*eoh != std::string::npos);
-    if (*eoh == std::string::npos)
-        return false;
-    
     *peer_id = -1;
     
     // See comment in peer_channel.cc for why we use the Pragma header and
     // not e.g. "X-Peer-Id".
-    GetHeaderValue(response, *eoh, "\r\nPragma: ", peer_id);
+    response.GetHeaderNumber("Pragma", peer_id);
     
     return true;
 }
@@ -472,6 +885,12 @@ bool PeerConnectionClient::ParseServerResponse(const std::string& response,
 void PeerConnectionClient::OnClose(rtc::AsyncSocket* socket, int err) {
     RTC_LOG(INFO) << __FUNCTION__;
     
+    if (FindSendChannel(socket)) {
+        // ReadIntoBuffer reports closes here for every socket.
+        OnSendChannelClose(socket, err);
+        return;
+    }
+    
     socket->Close();
     
 #ifdef WIN32
@@ -485,13 +904,13 @@ void PeerConnectionClient::OnClose(rtc::AsyncSocket* socket, int err) {
                     hanging_get_->Connect(server_address_);
                 }
             } else {
-                callback_->OnMessageSent(err);
+                control_pending_ = false;
             }
         } else {
             if (socket == control_socket_.get()) {
                 RTC_LOG(WARNING) << "Connection refused; retrying in 2 seconds";
                 rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, kReconnectDelay, this,
-                                                    0);
+                                                    MSG_RETRY);
             } else {
                 Close();
                 callback_->OnDisconnected();
@@ -500,6 +919,10 @@ void PeerConnectionClient::OnClose(rtc::AsyncSocket* socket, int err) {
     }
     
     void PeerConnectionClient::OnMessage(rtc::Message* msg) {
-        // ignore msg; there is currently only one supported message ("retry")
-        DoConnect();
+        if (msg->message_id == MSG_PUMP_SENDS)
+            PumpSendQueue();
+        else if (msg->message_id == MSG_FLUSH_HELD)
+            FlushHeldMessages();
+        else
+            DoConnect();
     }
@@ -11,22 +11,31 @@
 #ifndef EXAMPLES_PEERCONNECTION_CLIENT_PEER_CONNECTION_CLIENT_H_
 #define EXAMPLES_PEERCONNECTION_CLIENT_PEER_CONNECTION_CLIENT_H_
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "absl/strings/string_view.h"
+#include "http_response_parser.h"
+#include "peer_directory.h"
+#include "rtc_base/critical_section.h"
 #include "rtc_base/net_helpers.h"
 #include "rtc_base/physical_socket_server.h"
 #include "rtc_base/signal_thread.h"
 #include "rtc_base/third_party/sigslot/sigslot.h"
+#include "rtc_base/thread.h"
 
-typedef std::map<int, std::string> Peers;
+typedef PeerDirectory Peers;
 
 struct PeerConnectionClientObserver {
     virtual void OnSignedIn() = 0;  // Called when we're logged on.
     virtual void OnDisconnected() = 0;
     virtual void OnPeerConnected(int id, const std::string& name) = 0;
     virtual void OnPeerDisconnected(int peer_id) = 0;
+    // A listed peer signed in again under another name.
+    virtual void OnPeerRenamed(int id, const std::string& name) {}
     virtual void OnMessageFromPeer(int peer_id, const std::string& message) = 0;
     virtual void OnMessageSent(int err) = 0;
     virtual void OnServerConnectionFailure() = 0;
@@ -35,6 +44,28 @@ protected:
     virtual ~PeerConnectionClientObserver() {}
 };
 
+// Counters of the outgoing message pipeline. Latency runs from SendToPeer
+// to the server's response, so it includes the time spent queued.
+struct SignalingStats {
+    size_t queue_depth = 0;
+    size_t in_flight = 0;
+    uint64_t messages_sent = 0;
+    // Failed after every attempt; a failed attempt that is retried only
+    // counts as retried.
+    uint64_t messages_failed = 0;
+    uint64_t messages_retried = 0;
+    int64_t last_latency_us = 0;
+    int64_t max_latency_us = 0;
+    int64_t total_latency_us = 0;
+    // Inbound side: connections made for /wait and the notifications
+    // delivered over them.
+    uint64_t notification_connects = 0;
+    uint64_t notifications_received = 0;
+    // Messages whose seq was delivered or given up on already: resends
+    // the server forwarded twice, or arrivals after their gap timed out.
+    uint64_t messages_dropped = 0;
+};
+
 class PeerConnectionClient : public sigslot::has_slots<>,
 public rtc::MessageHandler {
 public:
@@ -60,55 +91,134 @@ public:
                  int port,
                  const std::string& client_name);
     
+    // When enabled, requests are sent as HTTP/1.1 and the control and
+    // message connections are kept open between requests instead of paying
+    // a TCP connect per message. Takes effect on the next request.
+    void SetKeepAlive(bool keep_alive);
+    bool keep_alive() const { return keep_alive_; }
+    
+    // Number of messages that may be waiting for a server response at the
+    // same time, each on its own connection. With more than one, JSON
+    // messages carry a "seq" field so the receiver can restore their order.
+    void SetMaxInFlight(int max_in_flight);
+    
+    // When enabled, /wait asks the server to stream notifications as chunks
+    // of one long-lived response instead of answering once per connection.
+    // A server that answers the old way is used the old way until the next
+    // sign in. Takes effect on the next /wait connection.
+    void SetStreamNotifications(bool stream);
+    
+    // Queues the message and returns immediately. Safe to call from any
+    // thread; OnMessageSent is called on the socket thread once per message,
+    // after the last attempt: a message that fails goes back to the front
+    // of the queue and is tried again a few times.
     bool SendToPeer(int peer_id, const std::string& message);
     bool SendHangUp(int peer_id);
     bool IsSendingMessage();
+    SignalingStats GetSignalingStats();
     
     bool SignOut();
     //implements the MessageHandler interface
     void OnMessage(rtc::Message* msg);
     
 protected:
+    enum {
+        MSG_RETRY,
+        MSG_PUMP_SENDS,
+        MSG_FLUSH_HELD,
+    };
+    
+    struct OutgoingMessage {
+        int peer_id;
+        std::string body;
+        // BYE has no seq field, so it is sent alone: after everything
+        // queued before it and before anything queued after it.
+        bool barrier;
+        int64_t enqueued_us;
+        // Attempts that failed so far, and when the next one may start.
+        int attempts = 0;
+        int64_t not_before_ms = 0;
+    };
+    
+    // One connection used for /message requests. With keep-alive it
+    // carries one request after another, otherwise it reconnects for each.
+    struct SendChannel {
+        std::unique_ptr<rtc::AsyncSocket> socket;
+        std::string request;
+        HttpResponseParser response;
+        bool busy = false;
+        // What is being sent, kept for a retry.
+        OutgoingMessage message;
+    };
+    
+    // Messages from one peer that arrived ahead of a missing seq.
+    struct ReorderState {
+        uint32_t next_seq = 1;
+        std::map<uint32_t, std::string> held;
+        // When the oldest gap was found, 0 while nothing is held.
+        int64_t gap_since_ms = 0;
+    };
+    
+
     void DoConnect();
     void Close();
     void InitSocketSignals();
     bool ConnectControlSocket();
+    // Sends onconnect_data_ on the open keep-alive connection if there is
+    // one, otherwise connects and sends it from OnConnect.
+    bool SendControlRequest();
+    const char* HttpVersion() const;
     void OnConnect(rtc::AsyncSocket* socket);
     void OnHangingGetConnect(rtc::AsyncSocket* socket);
-    void OnMessageFromPeer(int peer_id, const std::string& message);
-    
-    // Quick and dirty support for parsing HTTP header values.
-    bool GetHeaderValue(const std::string& data,
-                        size_t eoh,
-                        const char* header_pattern,
-                        size_t* value);
+    void OnMessageFromPeer(int peer_id, absl::string_view message);
+    // Moves what |state| can hand on now to |ready|: messages next in
+    // order, and past a gap once too many are held or they have waited
+    // too long.
+    void TakeReadyMessages(ReorderState* state, int peer_id, int64_t now_ms,
+                           std::vector<std::string>* ready);
+    // Hands on every peer's messages held past a gap for too long.
+    void FlushHeldMessages();
+    void DeliverMessageFromPeer(int peer_id, absl::string_view message);
     
-    bool GetHeaderValue(const std::string& data,
-                        size_t eoh,
-                        const char* header_pattern,
-                        std::string* value);
+    // Starts as many queued messages as the in-flight limit allows. Socket
+    // thread only.
+    void PumpSendQueue();
+    SendChannel* GetIdleSendChannel();
+    SendChannel* FindSendChannel(rtc::AsyncSocket* socket);
+    void StartSend(SendChannel* channel, const OutgoingMessage& message);
+    void FinishSend(SendChannel* channel, int err);
+    void OnSendChannelConnect(rtc::AsyncSocket* socket);
+    void OnSendChannelRead(rtc::AsyncSocket* socket);
+    void OnSendChannelClose(rtc::AsyncSocket* socket, int err);
     
-    // Returns true if the whole response has been read.
+    // Reads everything available on the socket into |response|. Returns
+    // true if the whole response has been read.
     bool ReadIntoBuffer(rtc::AsyncSocket* socket,
-                        std::string* data,
-                        size_t* content_length);
+                        HttpResponseParser* response);
     
     void OnRead(rtc::AsyncSocket* socket);
     
     void OnHangingGetRead(rtc::AsyncSocket* socket);
+    void HandleNotification(const HttpResponseParser& response);
     
-    // Parses a single line entry in the form "<name>,<id>,<connected>"
-    bool ParseEntry(const std::string& entry,
-                    std::string* name,
-                    int* id,
-                    bool* connected);
+    // Streamed /wait: each chunk of the response body carries responses
+    // shaped like the ones the hanging GET gets, one per notification.
+    void StartNotificationStream(rtc::AsyncSocket* socket);
+    void ReadNotificationStream(rtc::AsyncSocket* socket);
+    // Decodes |len| bytes just read into notification_event_'s buffer and
+    // handles the notifications they complete. Returns false once the
+    // stream is gone.
+    bool DecodeNotificationStream(rtc::AsyncSocket* socket,
+                                  char* data,
+                                  size_t len);
+    void ResetNotificationStream();
     
-    int GetResponseStatus(const std::string& response);
+    // Applies one "<name>,<id>,<connected>" entry to peers_ and tells the
+    // observer what changed, if anything.
+    void UpdatePeer(absl::string_view name, int id, bool connected);
     
-    bool ParseServerResponse(const std::string& response,
-                             size_t content_length,
-                             size_t* peer_id,
-                             size_t* eoh);
+    bool ParseServerResponse(const HttpResponseParser& response,
+                             size_t* peer_id);
     
     void OnClose(rtc::AsyncSocket* socket, int err);
     
@@ -120,12 +230,36 @@ protected:
     std::unique_ptr<rtc::AsyncSocket> control_socket_;
     std::unique_ptr<rtc::AsyncSocket> hanging_get_;
     std::string onconnect_data_;
-    std::string control_data_;
-    std::string notification_data_;
+    HttpResponseParser control_response_;
+    HttpResponseParser notification_response_;
+    HttpChunkDecoder notification_chunks_;
+    HttpResponseParser notification_event_;
     std::string client_name_;
     Peers peers_;
     State state_;
     int my_id_;
+    bool keep_alive_;
+    // A request was written to control_socket_ and its response has not
+    // been read yet.
+    bool control_pending_;
+    bool stream_notifications_;
+    // Cleared when the server answers a streamed /wait the old way.
+    bool stream_supported_;
+    // hanging_get_ has received the head of a streamed response.
+    bool notification_streaming_;
+    
+    rtc::Thread* network_thread_;
+    std::vector<std::unique_ptr<SendChannel>> send_channels_;
+    std::map<int, ReorderState> reorder_;
+    
+    // Shared with the threads calling SendToPeer.
+    rtc::CriticalSection send_lock_;
+    std::deque<OutgoingMessage> send_queue_;
+    std::map<int, uint32_t> next_seq_;
+    size_t max_in_flight_;
+    size_t in_flight_;
+    bool barrier_in_flight_;
+    SignalingStats stats_;
 };
 
 #endif  // EXAMPLES_PEERCONNECTION_CLIENT_PEER_CONNECTION_CLIENT_H_
@@ -0,0 +1,268 @@
+#include "peer_directory.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace {
+
+    // Fewest buckets the index starts with; must be a power of two.
+    const int kMinIndexBits = 4;
+    
+    // Like atoi, but stops at the end of |text| instead of needing a NUL.
+    int ParseLeadingInt(absl::string_view text) {
+        int value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9')
+                break;
+            value = value * 10 + (c - '0');
+        }
+        return value;
+    }
+
+}  // namespace
+
+const size_t PeerDirectory::kNotFound;
+const uint32_t PeerDirectory::kRemoved;
+
+PeerDirectory::const_iterator::const_iterator(const PeerDirectory* directory,
+                                              size_t pos)
+: directory_(directory), pos_(pos) {
+    SkipRemoved();
+}
+
+PeerDirectory::Entry PeerDirectory::const_iterator::operator*() const {
+    const Slot& slot = directory_->slots_[pos_];
+    Entry entry;
+    entry.id = slot.id;
+    entry.name = directory_->Name(slot);
+    return entry;
+}
+
+PeerDirectory::const_iterator& PeerDirectory::const_iterator::operator++() {
+    ++pos_;
+    SkipRemoved();
+    return *this;
+}
+
+void PeerDirectory::const_iterator::SkipRemoved() {
+    const std::vector<Slot>& slots = directory_->slots_;
+    while (pos_ < slots.size() && slots[pos_].name_len == kRemoved)
+        ++pos_;
+}
+
+PeerDirectory::PeerDirectory() : index_bits_(0), live_(0), garbage_(0) {
+    RebuildIndex(size_t(1) << kMinIndexBits);
+}
+
+void PeerDirectory::clear() {
+    slots_.clear();
+    names_.clear();
+    live_ = 0;
+    garbage_ = 0;
+    RebuildIndex(size_t(1) << kMinIndexBits);
+}
+
+void PeerDirectory::reserve(size_t peers, size_t name_bytes) {
+    slots_.reserve(peers);
+    names_.reserve(name_bytes);
+    size_t buckets = index_.size();
+    while (buckets < peers * 2)
+        buckets *= 2;
+    if (buckets != index_.size())
+        RebuildIndex(buckets);
+}
+
+PeerDirectory::Change PeerDirectory::Set(int id, absl::string_view name) {
+    size_t bucket = Lookup(id);
+    if (bucket != kNotFound) {
+        Slot& slot = slots_[index_[bucket].slot];
+        if (Name(slot) == name)
+            return UNCHANGED;
+        garbage_ += slot.name_len;
+        slot.name_offset = AddName(name);
+        slot.name_len = static_cast<uint32_t>(name.size());
+        MaybeCompact();
+        return RENAMED;
+    }
+    
+    Slot slot;
+    slot.id = id;
+    slot.name_offset = AddName(name);
+    slot.name_len = static_cast<uint32_t>(name.size());
+    ++live_;
+    if (slots_.empty() || slots_.back().id < id) {
+        slots_.push_back(slot);
+        // Keep the index at most half full so probes stay short.
+        if (live_ * 2 > index_.size())
+            RebuildIndex(index_.size() * 2);
+        else
+            Insert(id, static_cast<int32_t>(slots_.size() - 1));
+        return ADDED;
+    }
+    
+    // An id below the newest one. Every entry after it moves, so the index
+    // is rebuilt; the server never does this in practice.
+    auto it = std::lower_bound(slots_.begin(), slots_.end(), id,
+                               [](const Slot& slot, int id) {
+                                   return slot.id < id;
+                               });
+    if (it != slots_.end() && it->id == id) {
+        // The id of an entry that was removed but not swept yet.
+        *it = slot;
+    } else {
+        slots_.insert(it, slot);
+    }
+    size_t buckets = index_.size();
+    if (live_ * 2 > buckets)
+        buckets *= 2;
+    RebuildIndex(buckets);
+    return ADDED;
+}
+
+bool PeerDirectory::Remove(int id) {
+    size_t bucket = Lookup(id);
+    if (bucket == kNotFound)
+        return false;
+    Slot& slot = slots_[index_[bucket].slot];
+    garbage_ += slot.name_len;
+    slot.name_len = kRemoved;
+    Erase(bucket);
+    --live_;
+    MaybeCompact();
+    return true;
+}
+
+bool PeerDirectory::Get(int id, absl::string_view* name) const {
+    size_t bucket = Lookup(id);
+    if (bucket == kNotFound)
+        return false;
+    *name = Name(slots_[index_[bucket].slot]);
+    return true;
+}
+
+void PeerDirectory::Search(absl::string_view text,
+                           std::vector<int>* ids) const {
+    for (const Slot& slot : slots_) {
+        if (slot.name_len != kRemoved &&
+            Name(slot).find(text) != absl::string_view::npos) {
+            ids->push_back(slot.id);
+        }
+    }
+}
+
+absl::string_view PeerDirectory::Name(const Slot& slot) const {
+    return absl::string_view(names_.data() + slot.name_offset, slot.name_len);
+}
+
+uint32_t PeerDirectory::AddName(absl::string_view name) {
+    uint32_t offset = static_cast<uint32_t>(names_.size());
+    names_.append(name.data(), name.size());
+    return offset;
+}
+
+size_t PeerDirectory::Home(int id) const {
+    // Fibonacci hashing: the top bits of the product spread runs of
+    // consecutive ids over the whole table.
+    uint64_t hash = static_cast<uint32_t>(id) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> (64 - index_bits_));
+}
+
+size_t PeerDirectory::Lookup(int id) const {
+    size_t mask = index_.size() - 1;
+    for (size_t i = Home(id);; i = (i + 1) & mask) {
+        const Bucket& bucket = index_[i];
+        if (bucket.slot < 0)
+            return kNotFound;
+        if (bucket.id == id)
+            return i;
+    }
+}
+
+void PeerDirectory::Insert(int id, int32_t slot) {
+    size_t mask = index_.size() - 1;
+    size_t i = Home(id);
+    while (index_[i].slot >= 0)
+        i = (i + 1) & mask;
+    index_[i].id = id;
+    index_[i].slot = slot;
+}
+
+void PeerDirectory::Erase(size_t bucket) {
+    // Backward shift: pull later members of the probe run into the hole so
+    // lookups never need tombstones.
+    size_t mask = index_.size() - 1;
+    size_t hole = bucket;
+    for (size_t i = (bucket + 1) & mask; index_[i].slot >= 0;
+         i = (i + 1) & mask) {
+        size_t home = Home(index_[i].id);
+        bool movable = hole <= i ? (home <= hole || home > i)
+                                 : (home <= hole && home > i);
+        if (movable) {
+            index_[hole] = index_[i];
+            hole = i;
+        }
+    }
+    index_[hole].slot = -1;
+}
+
+void PeerDirectory::RebuildIndex(size_t buckets) {
+    index_bits_ = 0;
+    while ((size_t(1) << index_bits_) < buckets)
+        ++index_bits_;
+    Bucket empty;
+    empty.id = 0;
+    empty.slot = -1;
+    index_.assign(size_t(1) << index_bits_, empty);
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        if (slots_[i].name_len != kRemoved)
+            Insert(slots_[i].id, static_cast<int32_t>(i));
+    }
+}
+
+void PeerDirectory::MaybeCompact() {
+    size_t removed = slots_.size() - live_;
+    if ((removed > live_ && removed > 64) ||
+        (garbage_ > names_.size() / 2 && garbage_ > 4096)) {
+        Compact();
+    }
+}
+
+void PeerDirectory::Compact() {
+    std::string names;
+    names.reserve(names_.size() - garbage_);
+    size_t out = 0;
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        Slot slot = slots_[i];
+        if (slot.name_len == kRemoved)
+            continue;
+        names.append(names_, slot.name_offset, slot.name_len);
+        slot.name_offset = static_cast<uint32_t>(names.size() - slot.name_len);
+        slots_[out++] = slot;
+    }
+    slots_.resize(out);
+    names_.swap(names);
+    garbage_ = 0;
+    size_t buckets = size_t(1) << kMinIndexBits;
+    while (buckets < live_ * 2)
+        buckets *= 2;
+    RebuildIndex(buckets);
+}
+
+bool ParsePeerEntry(absl::string_view entry,
+                    absl::string_view* name,
+                    int* id,
+                    bool* connected) {
+    *connected = false;
+    *name = absl::string_view();
+    size_t separator = entry.find(',');
+    if (separator != absl::string_view::npos) {
+        *id = ParseLeadingInt(entry.substr(separator + 1));
+        *name = entry.substr(0, separator);
+        separator = entry.find(',', separator + 1);
+        if (separator != absl::string_view::npos) {
+            *connected = ParseLeadingInt(entry.substr(separator + 1)) ? true : false;
+        }
+    }
+    return !name->empty();
+}
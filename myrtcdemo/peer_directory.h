@@ -0,0 +1,121 @@
+#ifndef MYRTCDEMO_PEER_DIRECTORY_H_
+#define MYRTCDEMO_PEER_DIRECTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+// The peers signed in to the server, keyed by id.
+//
+// Entries live in one vector sorted by id; the server hands out increasing
+// ids, so adding a peer is an append. Names are packed into a single
+// buffer. An open-addressing index maps ids to entries, so lookups do not
+// walk a tree. Removed entries are only marked and get swept once they
+// outnumber the live ones, which keeps removal O(1) as well.
+//
+// Copying is a few flat copies, cheap enough to hand a snapshot to another
+// thread. Names returned as string_views stay valid until the next change.
+class PeerDirectory {
+public:
+    struct Entry {
+        int id;
+        absl::string_view name;
+    };
+    
+    enum Change {
+        UNCHANGED,
+        ADDED,
+        RENAMED,
+    };
+    
+    // Visits live entries in id order.
+    class const_iterator {
+    public:
+        Entry operator*() const;
+        const_iterator& operator++();
+        bool operator==(const const_iterator& other) const {
+            return pos_ == other.pos_;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return pos_ != other.pos_;
+        }
+        
+    private:
+        friend class PeerDirectory;
+        const_iterator(const PeerDirectory* directory, size_t pos);
+        void SkipRemoved();
+        
+        const PeerDirectory* directory_;
+        size_t pos_;
+    };
+    
+    PeerDirectory();
+    
+    size_t size() const { return live_; }
+    bool empty() const { return live_ == 0; }
+    void clear();
+    void reserve(size_t peers, size_t name_bytes);
+    
+    // Adds the peer or gives a listed one its new name.
+    Change Set(int id, absl::string_view name);
+    bool Remove(int id);
+    
+    bool Contains(int id) const { return Lookup(id) != kNotFound; }
+    bool Get(int id, absl::string_view* name) const;
+    // Appends the ids of peers whose name contains |text|, in id order.
+    void Search(absl::string_view text, std::vector<int>* ids) const;
+    
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, slots_.size()); }
+    
+private:
+    static const size_t kNotFound = static_cast<size_t>(-1);
+    // name_len of an entry that has been removed.
+    static const uint32_t kRemoved = 0xffffffff;
+    
+    struct Slot {
+        int id;
+        uint32_t name_offset;
+        uint32_t name_len;
+    };
+    
+    struct Bucket {
+        int id;
+        // Index into slots_, or -1 for an empty bucket.
+        int32_t slot;
+    };
+    
+    absl::string_view Name(const Slot& slot) const;
+    uint32_t AddName(absl::string_view name);
+    size_t Home(int id) const;
+    // Bucket holding |id|, or kNotFound.
+    size_t Lookup(int id) const;
+    void Insert(int id, int32_t slot);
+    void Erase(size_t bucket);
+    void RebuildIndex(size_t buckets);
+    // Drops removed entries and unused name bytes once they make up more
+    // than half of their storage.
+    void MaybeCompact();
+    void Compact();
+    
+    std::vector<Slot> slots_;
+    std::string names_;
+    std::vector<Bucket> index_;
+    int index_bits_;
+    size_t live_;
+    // Name bytes no live entry points at.
+    size_t garbage_;
+};
+
+// Parses a single line entry in the form "<name>,<id>,<connected>". The
+// name points into |entry|.
+bool ParsePeerEntry(absl::string_view entry,
+                    absl::string_view* name,
+                    int* id,
+                    bool* connected);
+
+#endif  // MYRTCDEMO_PEER_DIRECTORY_H_
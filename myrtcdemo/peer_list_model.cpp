@@ -0,0 +1,93 @@
+#include "peer_list_model.h"
+
+#include <algorithm>
+
+PeerListModel::PeerListModel(QObject* parent) : QAbstractListModel(parent) {}
+
+int PeerListModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(rows_.size());
+}
+
+QVariant PeerListModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() < 0 ||
+        index.row() >= static_cast<int>(rows_.size())) {
+        return QVariant();
+    }
+    const Row& row = rows_[index.row()];
+    if (role == Qt::DisplayRole)
+        return row.name;
+    if (role == Qt::UserRole)
+        return row.id;
+    return QVariant();
+}
+
+void PeerListModel::Reset(const Peers& peers) {
+    beginResetModel();
+    rows_.clear();
+    rows_.reserve(peers.size());
+    // Peers is ordered by id already.
+    for (PeerDirectory::Entry peer : peers) {
+        rows_.push_back({peer.id, QString::fromUtf8(peer.name.data(),
+                                                    static_cast<int>(peer.name.size()))});
+    }
+    endResetModel();
+}
+
+void PeerListModel::AddPeer(int id, const std::string& name) {
+    size_t pos = LowerBound(id);
+    QString text = QString::fromStdString(name);
+    if (pos < rows_.size() && rows_[pos].id == id) {
+        if (rows_[pos].name == text)
+            return;
+        rows_[pos].name = text;
+        QModelIndex changed = index(static_cast<int>(pos));
+        emit dataChanged(changed, changed, {Qt::DisplayRole});
+        return;
+    }
+    // The server hands out increasing ids, so this is nearly always an
+    // append.
+    int row = static_cast<int>(pos);
+    beginInsertRows(QModelIndex(), row, row);
+    rows_.insert(rows_.begin() + pos, {id, text});
+    endInsertRows();
+}
+
+void PeerListModel::RemovePeer(int id) {
+    size_t pos = LowerBound(id);
+    if (pos == rows_.size() || rows_[pos].id != id)
+        return;
+    int row = static_cast<int>(pos);
+    beginRemoveRows(QModelIndex(), row, row);
+    rows_.erase(rows_.begin() + pos);
+    endRemoveRows();
+}
+
+void PeerListModel::Apply(const PeerListChange& change) {
+    switch (change.type) {
+        case PeerListChange::ADDED:
+        case PeerListChange::RENAMED:
+            AddPeer(change.id, change.name);
+            break;
+        case PeerListChange::REMOVED:
+            RemovePeer(change.id);
+            break;
+        case PeerListChange::RESET:
+            Reset(change.peers);
+            break;
+    }
+}
+
+int PeerListModel::PeerId(int row) const {
+    if (row < 0 || row >= static_cast<int>(rows_.size()))
+        return -1;
+    return rows_[row].id;
+}
+
+size_t PeerListModel::LowerBound(int id) const {
+    // Appends are the common case; skip the search for them.
+    if (rows_.empty() || rows_.back().id < id)
+        return rows_.size();
+    auto it = std::lower_bound(rows_.begin(), rows_.end(), id,
+                               [](const Row& row, int id) { return row.id < id; });
+    return it - rows_.begin();
+}
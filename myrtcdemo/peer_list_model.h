@@ -0,0 +1,64 @@
+#ifndef MYRTCDEMO_PEER_LIST_MODEL_H_
+#define MYRTCDEMO_PEER_LIST_MODEL_H_
+
+#include <string>
+#include <vector>
+
+#include <QAbstractListModel>
+#include <QString>
+
+#include "peer_connection_client.h"
+
+// One change to the peer list, carried from the socket thread to the UI
+// thread through QueueUIThreadCallback.
+struct PeerListChange {
+    enum Type {
+        ADDED,
+        REMOVED,
+        RENAMED,
+        // Replaces the whole list with |peers|, e.g. after signing in.
+        RESET,
+    };
+    
+    Type type;
+    int id;
+    std::string name;
+    Peers peers;
+};
+
+// The peer list shown by MainWindow. Rows stay ordered by id like Peers,
+// and every change touches only its own row, so a busy lobby no longer
+// rebuilds the whole list per sign-in. UI thread only.
+class PeerListModel : public QAbstractListModel {
+    Q_OBJECT
+    
+public:
+    explicit PeerListModel(QObject* parent = nullptr);
+    
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    // Qt::DisplayRole is the name, Qt::UserRole the peer id.
+    QVariant data(const QModelIndex& index,
+                  int role = Qt::DisplayRole) const override;
+    
+    void Reset(const Peers& peers);
+    // Adds the peer, or renames it if the id is already listed.
+    void AddPeer(int id, const std::string& name);
+    void RemovePeer(int id);
+    void Apply(const PeerListChange& change);
+    
+    // -1 if |row| is out of range.
+    int PeerId(int row) const;
+    
+private:
+    struct Row {
+        int id;
+        QString name;
+    };
+    
+    // First row whose id is not less than |id|.
+    size_t LowerBound(int id) const;
+    
+    std::vector<Row> rows_;
+};
+
+#endif  // MYRTCDEMO_PEER_LIST_MODEL_H_
@@ -0,0 +1,29 @@
+#include "triple_buffer.h"
+
+void TripleBuffer::Buffer::Resize(int new_width, int new_height) {
+    width = new_width;
+    height = new_height;
+    size_t size = static_cast<size_t>(width) * height * 4;
+    if (pixels.size() < size)
+        pixels.resize(size);
+}
+
+TripleBuffer::TripleBuffer() : back_(0), front_(1), middle_(2) {}
+
+bool TripleBuffer::Publish() {
+    // Release hands the pixels over; acquire takes the old middle back
+    // only after the consumer is done with it.
+    uint8_t old = middle_.exchange(static_cast<uint8_t>(back_ | kFresh),
+                                   std::memory_order_acq_rel);
+    back_ = old & kIndexMask;
+    return (old & kFresh) != 0;
+}
+
+bool TripleBuffer::Update() {
+    if (!(middle_.load(std::memory_order_relaxed) & kFresh))
+        return false;
+    uint8_t old = middle_.exchange(static_cast<uint8_t>(front_),
+                                   std::memory_order_acq_rel);
+    front_ = old & kIndexMask;
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef MYRTCDEMO_TRIPLE_BUFFER_H_
+#define MYRTCDEMO_TRIPLE_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+// Lock-free handoff of the latest frame from one producer thread to one
+// consumer thread. The producer always owns a back buffer and the consumer
+// a front buffer; the third one sits in the middle. Publish() swaps back
+// and middle, Update() swaps middle and front if the middle is newer, and
+// both are a single atomic exchange, so neither side ever waits for the
+// other however long it works on its own buffer. Frames the consumer did
+// not take in time are overwritten.
+class TripleBuffer {
+public:
+    struct Buffer {
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+        int64_t arrival_us = 0;
+        int64_t capture_us = 0;
+        
+        // Sizes |pixels| for a |width|x|height| ARGB frame.
+        void Resize(int new_width, int new_height);
+        int stride() const { return width * 4; }
+    };
+    
+    TripleBuffer();
+    
+    // Producer only.
+    Buffer* back() { return &buffers_[back_]; }
+    // Makes the back buffer the newest frame. Returns true if that
+    // overwrote one the consumer never took.
+    bool Publish();
+    
+    // Consumer only. Moves the newest frame to the front; returns false if
+    // nothing was published since the last call.
+    bool Update();
+    const Buffer& front() const { return buffers_[front_]; }
+    
+private:
+    enum : uint8_t {
+        kIndexMask = 3,
+        // Set in middle_ while it holds a frame the consumer has not seen.
+        kFresh = 4,
+    };
+    
+    Buffer buffers_[3];
+    int back_;
+    int front_;
+    std::atomic<uint8_t> middle_;
+};
+
+#endif  // MYRTCDEMO_TRIPLE_BUFFER_H_
@@ -0,0 +1,126 @@
+#include "video_compositor.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include <QPainter>
+
+#include "rtc_base/time_utils.h"
+
+VideoCompositor::VideoCompositor() {}
+
+void VideoCompositor::SetSize(const QSize& size) {
+    size_ = size;
+    Layout();
+}
+
+void VideoCompositor::SetRemoteCount(int count) {
+    remotes_.resize(count);
+    Layout();
+}
+
+void VideoCompositor::SetRemote(int index, const QImage& frame) {
+    if (index < 0 || index >= remote_count())
+        return;
+    remotes_[index] = frame;
+    dirty_ += tiles_[index];
+}
+
+void VideoCompositor::SetLocal(const QImage& frame) {
+    dirty_ += LocalRect();
+    local_ = frame;
+    dirty_ += LocalRect();
+}
+
+QRegion VideoCompositor::Compose() {
+    if (surface_.size() != size_) {
+        surface_ = QImage(size_, QImage::Format_RGB32);
+        dirty_ = QRect(QPoint(0, 0), size_);
+    }
+    QRegion drawn = TakeDirty();
+    if (drawn.isEmpty())
+        return drawn;
+    
+    int64_t start = rtc::TimeMicros();
+    {
+        QPainter painter(&surface_);
+        Draw(&painter, drawn);
+    }
+    int64_t elapsed = rtc::TimeMicros() - start;
+    
+    ++stats_.frames;
+    for (const QRect& rect : drawn.rects())
+        stats_.pixels += static_cast<uint64_t>(rect.width()) * rect.height();
+    stats_.last_us = elapsed;
+    stats_.total_us += elapsed;
+    stats_.max_us = std::max(stats_.max_us, elapsed);
+    return drawn;
+}
+
+void VideoCompositor::Draw(QPainter* painter, const QRegion& region) const {
+    painter->save();
+    painter->setClipRegion(region);
+    // Grid cells without a stream stay black.
+    QRegion uncovered = region;
+    for (const QRect& tile : tiles_)
+        uncovered -= tile;
+    for (const QRect& rect : uncovered.rects())
+        painter->fillRect(rect, Qt::black);
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        const QRect& tile = tiles_[i];
+        if (!region.intersects(tile))
+            continue;
+        const QImage& frame = remotes_[i];
+        QRect target = frame.isNull() ? QRect() : FitRect(tile, frame.size());
+        // Only clear what the frame leaves uncovered.
+        if (target != tile)
+            painter->fillRect(tile, Qt::black);
+        if (target.isEmpty())
+            continue;
+        // Unscaled blits are much cheaper, so keep them unscaled when
+        // the tile already has the frame's size.
+        if (target.size() == frame.size())
+            painter->drawImage(target.topLeft(), frame);
+        else
+            painter->drawImage(target, frame);
+    }
+    if (!local_.isNull() && region.intersects(LocalRect()))
+        painter->drawImage(0, 0, local_);
+    painter->restore();
+}
+
+QRegion VideoCompositor::TakeDirty() {
+    QRegion dirty = dirty_ & QRect(QPoint(0, 0), size_);
+    dirty_ = QRegion();
+    return dirty;
+}
+
+void VideoCompositor::Layout() {
+    tiles_.clear();
+    int count = remote_count();
+    if (count > 0) {
+        int columns = static_cast<int>(ceil(sqrt(static_cast<double>(count))));
+        int rows = (count + columns - 1) / columns;
+        for (int i = 0; i < count; ++i) {
+            int column = i % columns;
+            int row = i / columns;
+            // Edges computed from the total so the tiles cover it exactly.
+            int left = size_.width() * column / columns;
+            int right = size_.width() * (column + 1) / columns;
+            int top = size_.height() * row / rows;
+            int bottom = size_.height() * (row + 1) / rows;
+            tiles_.push_back(QRect(left, top, right - left, bottom - top));
+        }
+    }
+    dirty_ = QRect(QPoint(0, 0), size_);
+}
+
+QRect VideoCompositor::FitRect(const QRect& tile, const QSize& frame) {
+    if (frame == tile.size())
+        return tile;
+    QSize fitted = frame.scaled(tile.size(), Qt::KeepAspectRatio);
+    return QRect(tile.x() + (tile.width() - fitted.width()) / 2,
+                 tile.y() + (tile.height() - fitted.height()) / 2,
+                 fitted.width(), fitted.height());
+}
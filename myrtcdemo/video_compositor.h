@@ -0,0 +1,71 @@
+#ifndef MYRTCDEMO_VIDEO_COMPOSITOR_H_
+#define MYRTCDEMO_VIDEO_COMPOSITOR_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <QImage>
+#include <QRect>
+#include <QRegion>
+#include <QSize>
+
+class QPainter;
+
+// What VideoCompositor::Compose has cost so far.
+struct ComposeStats {
+    uint64_t frames = 0;
+    // Pixels redrawn, to set against frames times the surface size.
+    uint64_t pixels = 0;
+    int64_t last_us = 0;
+    int64_t total_us = 0;
+    int64_t max_us = 0;
+};
+
+// Lays the remote videos out as a grid of tiles with the local preview on
+// top in the corner, and keeps the result in a persistent surface. A new
+// frame marks only its own tile dirty, or for the preview its old and new
+// area, and Compose() redraws just the dirty region; the frames themselves
+// are never modified. Needs nothing but QtGui, so it also runs under the
+// offscreen platform. UI thread only.
+class VideoCompositor {
+public:
+    VideoCompositor();
+    
+    // Lays the tiles out again; everything is dirty afterwards.
+    void SetSize(const QSize& size);
+    QSize size() const { return size_; }
+    void SetRemoteCount(int count);
+    int remote_count() const { return static_cast<int>(remotes_.size()); }
+    
+    void SetRemote(int index, const QImage& frame);
+    void SetLocal(const QImage& frame);
+    
+    // Redraws the dirty part of the surface and returns it.
+    QRegion Compose();
+    // Draws |region| of the layout with |painter| instead of the surface,
+    // for callers that paint straight to the screen.
+    void Draw(QPainter* painter, const QRegion& region) const;
+    // Returns the dirty region and treats it as drawn.
+    QRegion TakeDirty();
+    
+    const QImage& surface() const { return surface_; }
+    QRect TileRect(int index) const { return tiles_[index]; }
+    QRect LocalRect() const { return QRect(QPoint(0, 0), local_.size()); }
+    const ComposeStats& stats() const { return stats_; }
+    
+private:
+    void Layout();
+    // Largest rectangle centered in |tile| with the aspect of |frame|.
+    static QRect FitRect(const QRect& tile, const QSize& frame);
+    
+    QSize size_;
+    QImage surface_;
+    std::vector<QImage> remotes_;
+    std::vector<QRect> tiles_;
+    QImage local_;
+    QRegion dirty_;
+    ComposeStats stats_;
+};
+
+#endif  // MYRTCDEMO_VIDEO_COMPOSITOR_H_
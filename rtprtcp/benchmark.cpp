@@ -0,0 +1,2073 @@
+/*
+ * Benchmarks for the rtprtcp module.
+ *
+ *   rtprtcpbench          run every case
+ *   rtprtcpbench fanout   exits non-zero if a subscriber's stream is broken
+ *   rtprtcpbench sfu      forwards synthetic streams through an RtpSfu
+ *                         over loopback; exits non-zero if a subscriber
+ *                         gets nothing or a broken stream, or still gets
+ *                         packets after a BYE or going quiet
+ *   rtprtcpbench mmsg     loopback UDP packets/s with sendmmsg/recvmmsg
+ *                         batches against one system call per packet
+ *   rtprtcpbench gso      CPU per Mbit/s of sendto, sendmmsg and UDP
+ *                         GSO/GRO over loopback
+ *   rtprtcpbench packetize
+ *                         frames/s and packets/s of RtpRtcpImpl for
+ *                         H.264, H.265, VP8, AAC and data; exits non-zero if
+ *                         the send path allocates or breaks a stream
+ *   rtprtcpbench jitter   H.264 through an RtpReceiver over loopback with
+ *                         synthetic loss and reordering, NACKs going
+ *                         back to the sender, and one packet lost for
+ *                         good; exits non-zero if a frame comes out
+ *                         broken or out of order, or too few come out
+ *   rtprtcpbench pool     heap allocations per frame at 30 and 60 fps on
+ *                         a growing RtpPacketPool, and the pool shared by
+ *                         threads; exits non-zero on an allocation once
+ *                         warmed up or a buffer handed out twice
+ *   rtprtcpbench annexb   GB/s of the Annex-B start code scan, scalar and
+ *                         vector, over H.264 and H.265 elementary streams;
+ *                         RTPRTCPBENCH_ES=a.h264:b.h265 adds real ones.
+ *                         Exits non-zero if the two disagree
+ *   rtprtcpbench esreader EsReader over H.264, H.265 and AAC files, alone
+ *                         and feeding RtpRtcpImpl, and its real time
+ *                         pacing; exits non-zero if frames go missing,
+ *                         the reader allocates or pacing is off
+ *   rtprtcpbench pacer    RtpPacer on a SimulatedClock: peak rate, audio
+ *                         and retransmission delay against no pacer, and
+ *                         ns per packet with many pacers on one wheel;
+ *                         exits non-zero if the rate or priorities are
+ *                         not kept or two runs differ
+ */
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "api/video/i420_buffer.h"
+#include "api/video/video_frame.h"
+#include "api/video_codecs/video_encoder.h"
+#include "modules/video_coding/codecs/vp8/include/vp8.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "es_reader.h"
+#include "myrtprtcp.h"
+#include "rtp_packetizer.h"
+#include "rtc_base/time_utils.h"
+#include "rtp_fanout.h"
+#include "rtp_pacer.h"
+#include "rtp_receiver.h"
+#include "rtp_sfu.h"
+#include "system_wrappers/include/clock.h"
+#include "udp_batch_transport.h"
+
+namespace {
+
+        // Checks that failed; main() returns non-zero if any did.
+        int g_failures = 0;
+
+        // Heap allocations so far, see operator new below.
+        std::atomic<int64_t> g_allocations(0);
+
+        // Stands in for a subscriber's socket; checks the stream it gets is
+        // one continuous RTP stream with the subscriber's SSRC.
+        class CheckingSink : public RtpPacketSink {
+        public:
+                explicit CheckingSink(uint32_t ssrc) : ssrc_(ssrc) {}
+
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        uint32_t ssrc = (uint32_t(data[8]) << 24) | (uint32_t(data[9]) << 16) |
+                        (uint32_t(data[10]) << 8) | data[11];
+                        uint16_t sequence_number = static_cast<uint16_t>((data[2] << 8) | data[3]);
+                        last_ssrc_ = ssrc;
+                        if (ssrc != ssrc_ ||
+                            (packets_ && sequence_number != uint16_t(last_sequence_number_ + 1)))
+                                ++errors_;
+                        last_sequence_number_ = sequence_number;
+                        ++packets_;
+                }
+
+                int packets() const { return packets_; }
+                int errors() const { return errors_; }
+                uint32_t last_ssrc() const { return last_ssrc_; }
+
+        private:
+                uint32_t ssrc_;
+                uint32_t last_ssrc_ = 0;
+                uint16_t last_sequence_number_ = 0;
+                int packets_ = 0;
+                int errors_ = 0;
+        };
+
+        // Remembers every packet a subscriber got, by sequence number.
+        class RecordingSubscriber : public RtpPacketSink {
+        public:
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        uint16_t sequence_number = static_cast<uint16_t>((data[2] << 8) | data[3]);
+                        packets[sequence_number].push_back(std::vector<uint8_t>(data, data + len));
+                        ++count;
+                }
+
+                std::map<uint16_t, std::vector<std::vector<uint8_t>>> packets;
+                int count = 0;
+        };
+
+        // Two subscribers of one layer; one NACKs packets it got, with the
+        // sequence numbers it got them under. It alone has to get them
+        // again, unchanged.
+        void RunFanOutNack() {
+                std::vector<uint8_t> frame(20000, 0x55);
+                frame[0] = frame[1] = frame[2] = 0;
+                frame[3] = 1;
+                frame[4] = 0x65;
+                RtpFanOut fanout;
+                RecordingSubscriber nacking, other;
+                int id = fanout.AddSubscriber(0, 0x2000, &nacking);
+                fanout.AddSubscriber(0, 0x2001, &other);
+                for (int n = 0; n < 10; ++n) {
+                        fanout.SendVideo(0, reinterpret_cast<char*>(frame.data()), static_cast<int>(frame.size()),
+                                         n == 0, n * 33);
+                }
+                int other_packets = other.count;
+                // The 5th packet and, in the bitmask, the 7th.
+                auto first = nacking.packets.begin();
+                uint16_t pid = static_cast<uint16_t>(first->first + 4);
+                uint8_t nack[16] = {0x81, 205, 0, 3, 0, 0, 0, 1, 0x00, 0x00, 0x20, 0x00};
+                nack[12] = static_cast<uint8_t>(pid >> 8);
+                nack[13] = static_cast<uint8_t>(pid);
+                nack[15] = 0x02;
+                fanout.IncomingRtcpPacket(id, nack, sizeof(nack));
+
+                int resent = 0;
+                int wrong = 0;
+                for (const auto& packet : nacking.packets) {
+                        if (packet.second.size() == 1)
+                                continue;
+                        ++resent;
+                        uint16_t expected = packet.first;
+                        if (packet.second.size() != 2 || packet.second[0] != packet.second[1] ||
+                            (expected != pid && expected != uint16_t(pid + 2)))
+                                ++wrong;
+                }
+                printf("  NACK for 2 packets: %d resent to the subscriber, %d wrong, %d to the other\n",
+                       resent, wrong, other.count - other_packets);
+                if (resent != 2 || wrong || other.count != other_packets)
+                        ++g_failures;
+        }
+
+        // Keeps the last frame a VP8 encoder produced.
+        class FrameCollector : public webrtc::EncodedImageCallback {
+        public:
+                Result OnEncodedImage(const webrtc::EncodedImage& image,
+                                      const webrtc::CodecSpecificInfo* info,
+                                      const webrtc::RTPFragmentationHeader* fragmentation) override {
+                        data.assign(image.data(), image.data() + image.size());
+                        key = image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
+                        return Result(Result::OK);
+                }
+
+                std::vector<uint8_t> data;
+                bool key = false;
+        };
+
+        // One simulcast layer: an encoder at a fixed size.
+        struct EncodedLayer {
+                int width;
+                int height;
+                std::unique_ptr<webrtc::VideoEncoder> encoder;
+                FrameCollector collector;
+                rtc::scoped_refptr<webrtc::I420Buffer> frame;
+        };
+
+        bool InitLayer(EncodedLayer* layer, int width, int height, int kbps) {
+                layer->width = width;
+                layer->height = height;
+                layer->encoder = webrtc::VP8Encoder::Create();
+                webrtc::VideoCodec codec;
+                memset(&codec, 0, sizeof(codec));
+                codec.codecType = webrtc::kVideoCodecVP8;
+                codec.width = width;
+                codec.height = height;
+                codec.maxFramerate = 30;
+                codec.startBitrate = kbps;
+                codec.minBitrate = kbps / 4;
+                codec.maxBitrate = kbps;
+                codec.qpMax = 56;
+                *codec.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+                if (layer->encoder->InitEncode(&codec, 1, 1200) != WEBRTC_VIDEO_CODEC_OK)
+                        return false;
+                layer->encoder->RegisterEncodeCompleteCallback(&layer->collector);
+                layer->frame = webrtc::I420Buffer::Create(width, height);
+                return true;
+        }
+
+        // A moving gradient, so the encoder has something to do every frame.
+        void DrawFrame(webrtc::I420Buffer* frame, int index) {
+                for (int y = 0; y < frame->height(); ++y)
+                        for (int x = 0; x < frame->width(); ++x)
+                                frame->MutableDataY()[y * frame->StrideY() + x] =
+                                static_cast<uint8_t>(x + y + index * 3);
+                memset(frame->MutableDataU(), 128, frame->StrideU() * frame->ChromaHeight());
+                memset(frame->MutableDataV(), 128, frame->StrideV() * frame->ChromaHeight());
+        }
+
+        // Encodes |layer| once. Returns the encode time in microseconds.
+        int64_t EncodeLayer(EncodedLayer* layer, int index, bool key) {
+                DrawFrame(layer->frame, index);
+                webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
+                .set_video_frame_buffer(layer->frame)
+                .set_timestamp_rtp(index * 3000)
+                .set_timestamp_us(index * 33333)
+                .build();
+                std::vector<webrtc::VideoFrameType> types(
+                        1, key ? webrtc::VideoFrameType::kVideoFrameKey
+                               : webrtc::VideoFrameType::kVideoFrameDelta);
+                int64_t start = rtc::TimeMicros();
+                layer->encoder->Encode(frame, &types);
+                return rtc::TimeMicros() - start;
+        }
+
+        // Sends two simulcast layers to |subscribers| subscribers split
+        // between them, either encoding once per layer and fanning out, or
+        // encoding separately for every subscriber the way one
+        // PeerConnection per viewer does.
+        void RunFanOut(int subscribers, bool fan_out, int frames) {
+                const int kWidths[] = {640, 320};
+                const int kHeights[] = {360, 180};
+                const int kKbps[] = {800, 250};
+                const int kLayers = 2;
+
+                std::vector<std::unique_ptr<EncodedLayer>> encoders;
+                int encoder_count = fan_out ? kLayers : subscribers;
+                for (int i = 0; i < encoder_count; ++i) {
+                        encoders.emplace_back(new EncodedLayer());
+                        int layer = i % kLayers;
+                        if (!InitLayer(encoders.back().get(), kWidths[layer], kHeights[layer],
+                                       kKbps[layer])) {
+                                printf("  cannot create a VP8 encoder\n");
+                                ++g_failures;
+                                return;
+                        }
+                }
+
+                RtpFanOut fanout;
+                fanout.SetVideoFormat(VideoFormat::VP8);
+                std::vector<std::unique_ptr<CheckingSink>> sinks;
+                for (int i = 0; i < subscribers; ++i) {
+                        uint32_t ssrc = 0x1000 + i;
+                        sinks.emplace_back(new CheckingSink(ssrc));
+                        // Without fan-out every subscriber is its own layer, i.e.
+                        // its own encoder and packetizer.
+                        fanout.AddSubscriber(fan_out ? i % kLayers : i, ssrc, sinks.back().get());
+                }
+
+                int64_t encode_us = 0;
+                int64_t send_us = 0;
+                for (int n = 0; n < frames; ++n) {
+                        for (int i = 0; i < encoder_count; ++i) {
+                                EncodedLayer* layer = encoders[i].get();
+                                encode_us += EncodeLayer(layer, n, fanout.NeedsKeyFrame(i));
+                                if (layer->collector.data.empty())
+                                        continue;
+                                int64_t start = rtc::TimeMicros();
+                                fanout.SendVideo(i, reinterpret_cast<char*>(layer->collector.data.data()),
+                                                 static_cast<int>(layer->collector.data.size()),
+                                                 layer->collector.key, n * 33);
+                                send_us += rtc::TimeMicros() - start;
+                        }
+                }
+
+                int packets = 0;
+                for (int i = 0; i < subscribers; ++i) {
+                        const CheckingSink& sink = *sinks[i];
+                        packets += sink.packets();
+                        if (sink.errors() || !sink.packets()) {
+                                printf("  subscriber %d: %d packets, %d broken\n", i,
+                                       sink.packets(), sink.errors());
+                                ++g_failures;
+                        }
+                }
+                printf("  %-12s subscribers:%-5d encoders:%-5d encode:%9.1f us/frame  "
+                       "packetize+send:%8.1f us/frame  %8.0f packets/s\n",
+                       fan_out ? "fan-out" : "per-viewer", subscribers, encoder_count,
+                       static_cast<double>(encode_us) / frames,
+                       static_cast<double>(send_us) / frames,
+                       packets * 1e6 / std::max<int64_t>(encode_us + send_us, 1));
+        }
+
+        void BenchFanOut() {
+                const int kSubscribers[] = {2, 8, 32, 128, 512};
+                // Encoding per viewer gets slow fast; stop it early.
+                const int kMaxPerViewer = 32;
+                const int kFrames = 90;
+                printf("VP8 360p+180p simulcast, RFC 7741 RTP\n");
+                for (int subscribers : kSubscribers) {
+                        RunFanOut(subscribers, true, kFrames);
+                        if (subscribers <= kMaxPerViewer)
+                                RunFanOut(subscribers, false, kFrames);
+                }
+                RunFanOutNack();
+        }
+
+        uint16_t Read16(const uint8_t* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+        uint32_t Read32(const uint8_t* p) {
+                return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+        void Write16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = static_cast<uint8_t>(v); }
+        void Write32(uint8_t* p, uint32_t v) {
+                p[0] = v >> 24; p[1] = static_cast<uint8_t>(v >> 16);
+                p[2] = static_cast<uint8_t>(v >> 8); p[3] = static_cast<uint8_t>(v);
+        }
+
+        // A UDP socket on an ephemeral loopback port.
+        int OpenLoopbackSocket() {
+                int fd = socket(AF_INET, SOCK_DGRAM, 0);
+                int size = 4 << 20;
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+                setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+                sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+                return fd;
+        }
+
+        void SendRtcpFeedback(int fd, const sockaddr_in& to, uint8_t type, uint32_t sender_ssrc,
+                              uint32_t media_ssrc, const std::vector<uint16_t>& nacks) {
+                uint8_t packet[12 + 4 * 64];
+                size_t items = std::min<size_t>(nacks.size(), 64);
+                packet[0] = 0x81;
+                packet[1] = type;
+                Write16(packet + 2, static_cast<uint16_t>(2 + items));
+                Write32(packet + 4, sender_ssrc);
+                Write32(packet + 8, media_ssrc);
+                for (size_t i = 0; i < items; ++i) {
+                        Write16(packet + 12 + 4 * i, nacks[i]);
+                        Write16(packet + 14 + 4 * i, 0);
+                }
+                sendto(fd, packet, 12 + 4 * items, 0, reinterpret_cast<const sockaddr*>(&to),
+                       sizeof(to));
+        }
+
+        // Sends an H.264-like stream of 1200 byte FU-A packets and answers
+        // the SFU's PLIs and NACKs the way an encoder with a send history
+        // would.
+        struct SyntheticPublisher {
+                static const int kHistory = 1024;
+                int socket = -1;
+                uint32_t ssrc = 0;
+                uint16_t sequence_number = 0;
+                uint32_t timestamp = 0;
+                bool send_key = true;
+                int plis = 0;
+                int nacks = 0;
+                std::vector<std::vector<uint8_t>> history;
+        };
+
+        void SendSyntheticFrame(SyntheticPublisher* publisher, const sockaddr_in& sfu, int packets) {
+                const size_t kPacketSize = 1200;
+                for (int i = 0; i < packets; ++i) {
+                        std::vector<uint8_t>& packet =
+                        publisher->history[publisher->sequence_number % SyntheticPublisher::kHistory];
+                        packet.assign(kPacketSize, 0);
+                        packet[0] = 0x80;
+                        packet[1] = 96 | (i == packets - 1 ? 0x80 : 0);
+                        Write16(&packet[2], publisher->sequence_number++);
+                        Write32(&packet[4], publisher->timestamp);
+                        Write32(&packet[8], publisher->ssrc);
+                        // FU indicator, then the FU header with S and E bits.
+                        packet[12] = 0x7c;
+                        packet[13] = (publisher->send_key ? 5 : 1) | (i == 0 ? 0x80 : 0) |
+                        (i == packets - 1 ? 0x40 : 0);
+                        sendto(publisher->socket, packet.data(), packet.size(), 0,
+                               reinterpret_cast<const sockaddr*>(&sfu), sizeof(sfu));
+                }
+                publisher->timestamp += 3000;
+                publisher->send_key = false;
+        }
+
+        void HandlePublisherRtcp(SyntheticPublisher* publisher, const sockaddr_in& sfu) {
+                uint8_t buffer[1500];
+                ssize_t len;
+                while ((len = recv(publisher->socket, buffer, sizeof(buffer), MSG_DONTWAIT)) >= 12) {
+                        if ((buffer[0] & 0x1f) != 1)
+                                continue;
+                        if (buffer[1] == 206) {
+                                publisher->send_key = true;
+                                ++publisher->plis;
+                                continue;
+                        }
+                        if (buffer[1] != 205)
+                                continue;
+                        ++publisher->nacks;
+                        for (ssize_t offset = 12; offset + 4 <= len; offset += 4) {
+                                uint16_t pid = Read16(buffer + offset);
+                                uint16_t blp = Read16(buffer + offset + 2);
+                                for (int bit = -1; bit < 16; ++bit) {
+                                        if (bit >= 0 && !(blp & (1 << bit)))
+                                                continue;
+                                        uint16_t seq = static_cast<uint16_t>(pid + bit + 1);
+                                        const std::vector<uint8_t>& packet =
+                                        publisher->history[seq % SyntheticPublisher::kHistory];
+                                        if (packet.size() >= 12 && Read16(&packet[2]) == seq)
+                                                sendto(publisher->socket, packet.data(), packet.size(), 0,
+                                                       reinterpret_cast<const sockaddr*>(&sfu), sizeof(sfu));
+                                }
+                        }
+                }
+        }
+
+        // Receives one forwarded stream. Drops every 100th packet on
+        // purpose and NACKs every gap, so retransmission gets exercised
+        // even when loopback loses nothing.
+        struct SyntheticSubscriber {
+                int socket = -1;
+                uint32_t publisher_ssrc = 0;
+                uint32_t sender_ssrc = 0;
+                uint32_t ssrc = 0;
+                uint16_t next_sequence_number = 0;
+                int64_t packets = 0;
+                int64_t dropped = 0;
+                int64_t recovered = 0;
+                int errors = 0;
+                std::set<uint16_t> missing;
+        };
+
+        // Returns true on the subscriber's first packet.
+        bool HandleSubscriberPacket(SyntheticSubscriber* subscriber, const sockaddr_in& sfu) {
+                uint8_t buffer[1500];
+                ssize_t len = recv(subscriber->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (len < 12)
+                        return false;
+                uint8_t type = buffer[1] & 0x7f;
+                if (type >= 64 && type < 96)
+                        return false;
+                uint32_t ssrc = Read32(buffer + 8);
+                uint16_t seq = Read16(buffer + 2);
+                bool first = !subscriber->packets++;
+                if (first) {
+                        subscriber->ssrc = ssrc;
+                        subscriber->next_sequence_number = seq;
+                } else if (ssrc != subscriber->ssrc) {
+                        ++subscriber->errors;
+                }
+                if (subscriber->missing.erase(seq)) {
+                        ++subscriber->recovered;
+                        return first;
+                }
+                int16_t gap = static_cast<int16_t>(seq - subscriber->next_sequence_number);
+                if (gap < 0)
+                        return first;
+                if (gap > 512) {
+                        ++subscriber->errors;
+                        gap = 0;
+                }
+                std::vector<uint16_t> nacks;
+                for (int i = 0; i < gap; ++i) {
+                        uint16_t lost = static_cast<uint16_t>(subscriber->next_sequence_number + i);
+                        subscriber->missing.insert(lost);
+                        nacks.push_back(lost);
+                }
+                subscriber->next_sequence_number = seq + 1;
+                if (subscriber->packets % 100 == 0) {
+                        ++subscriber->dropped;
+                        subscriber->missing.insert(seq);
+                        nacks.push_back(seq);
+                }
+                if (!nacks.empty())
+                        SendRtcpFeedback(subscriber->socket, sfu, 205, subscriber->sender_ssrc,
+                                         subscriber->ssrc, nacks);
+                return first;
+        }
+
+        // |publishers| streams of about 2.6 Mbit/s, each forwarded to
+        // |subscribers| subscribers. The SFU runs on one thread, so its
+        // CPU time is one core's worth.
+        void RunSfu(int publishers, int subscribers) {
+                const int kFrameMs = 33;
+                const int kKeyFrameInterval = 60;
+                const int kPacketsPerFrame = 9;
+                const int kJoinTimeoutMs = 5000;
+                const int kMeasureMs = 3000;
+
+                RtpSfu sfu;
+                if (!sfu.Start("127.0.0.1", 0)) {
+                        printf("  cannot start the SFU\n");
+                        ++g_failures;
+                        return;
+                }
+                sockaddr_in sfu_addr;
+                memset(&sfu_addr, 0, sizeof(sfu_addr));
+                sfu_addr.sin_family = AF_INET;
+                sfu_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                sfu_addr.sin_port = htons(sfu.port());
+
+                std::vector<SyntheticPublisher> senders(publishers);
+                for (int i = 0; i < publishers; ++i) {
+                        senders[i].socket = OpenLoopbackSocket();
+                        senders[i].ssrc = 0x20000 + i;
+                        senders[i].sequence_number = static_cast<uint16_t>(i * 7919);
+                        senders[i].history.resize(SyntheticPublisher::kHistory);
+                }
+                std::vector<SyntheticSubscriber> receivers(publishers * subscribers);
+                std::vector<pollfd> fds(receivers.size());
+                for (size_t i = 0; i < receivers.size(); ++i) {
+                        receivers[i].socket = OpenLoopbackSocket();
+                        receivers[i].publisher_ssrc = senders[i % publishers].ssrc;
+                        receivers[i].sender_ssrc = 0x30000 + static_cast<uint32_t>(i);
+                        fds[i].fd = receivers[i].socket;
+                        fds[i].events = POLLIN;
+                }
+
+                std::atomic<bool> stop(false);
+                std::atomic<int> joined(0);
+                std::thread sender([&] {
+                        auto next = std::chrono::steady_clock::now();
+                        for (int frame = 0; !stop; ++frame) {
+                                for (SyntheticPublisher& publisher : senders) {
+                                        HandlePublisherRtcp(&publisher, sfu_addr);
+                                        if (frame % kKeyFrameInterval == 0)
+                                                publisher.send_key = true;
+                                        SendSyntheticFrame(&publisher, sfu_addr,
+                                                           publisher.send_key ? 3 * kPacketsPerFrame
+                                                                              : kPacketsPerFrame);
+                                }
+                                next += std::chrono::milliseconds(kFrameMs);
+                                std::this_thread::sleep_until(next);
+                        }
+                });
+                std::thread receiver([&] {
+                        int64_t next_join_ms = 0;
+                        while (!stop) {
+                                // Subscribing is a PLI for the publisher's SSRC; repeat
+                                // it until the stream arrives.
+                                if (joined < static_cast<int>(receivers.size()) &&
+                                    rtc::TimeMillis() >= next_join_ms) {
+                                        for (SyntheticSubscriber& subscriber : receivers)
+                                                if (!subscriber.packets)
+                                                        SendRtcpFeedback(subscriber.socket, sfu_addr, 206,
+                                                                         subscriber.sender_ssrc,
+                                                                         subscriber.publisher_ssrc, {});
+                                        next_join_ms = rtc::TimeMillis() + 200;
+                                }
+                                if (poll(fds.data(), fds.size(), 10) <= 0)
+                                        continue;
+                                for (size_t i = 0; i < fds.size(); ++i) {
+                                        if (!(fds[i].revents & POLLIN))
+                                                continue;
+                                        for (int n = 0; n < 64; ++n) {
+                                                SyntheticSubscriber& subscriber = receivers[i];
+                                                int64_t before = subscriber.packets;
+                                                if (HandleSubscriberPacket(&subscriber, sfu_addr))
+                                                        ++joined;
+                                                if (subscriber.packets == before)
+                                                        break;
+                                        }
+                                }
+                        }
+                });
+
+                int64_t deadline = rtc::TimeMillis() + kJoinTimeoutMs;
+                while (joined < static_cast<int>(receivers.size()) && rtc::TimeMillis() < deadline)
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                RtpSfu::Stats start = sfu.stats();
+                int64_t start_us = rtc::TimeMicros();
+                std::this_thread::sleep_for(std::chrono::milliseconds(kMeasureMs));
+                RtpSfu::Stats end = sfu.stats();
+                double seconds = (rtc::TimeMicros() - start_us) / 1e6;
+                stop = true;
+                sender.join();
+                receiver.join();
+                sfu.Stop();
+
+                int64_t dropped = 0, recovered = 0, unrecovered = 0;
+                for (size_t i = 0; i < receivers.size(); ++i) {
+                        const SyntheticSubscriber& subscriber = receivers[i];
+                        dropped += subscriber.dropped;
+                        recovered += subscriber.recovered;
+                        unrecovered += subscriber.missing.size();
+                        if (!subscriber.packets || subscriber.errors) {
+                                printf("  subscriber %d: %lld packets, %d broken\n", static_cast<int>(i),
+                                       static_cast<long long>(subscriber.packets), subscriber.errors);
+                                ++g_failures;
+                        }
+                        close(subscriber.socket);
+                }
+                for (const SyntheticPublisher& publisher : senders)
+                        close(publisher.socket);
+
+                double cpu = (end.cpu_us - start.cpu_us) / 1e6;
+                double forwarded = static_cast<double>(end.forwarded - start.forwarded);
+                printf("  publishers:%-3d subscribers:%-4d in:%8.0f packets/s  out:%9.0f packets/s  "
+                       "cpu:%5.1f%%  %9.0f packets/s/core  recovered:%lld dropped:%lld lost:%lld pli up:%llu\n",
+                       publishers, publishers * subscribers,
+                       (end.received - start.received) / seconds, forwarded / seconds,
+                       100 * cpu / seconds, cpu > 0 ? forwarded / cpu : 0.0,
+                       static_cast<long long>(recovered), static_cast<long long>(dropped),
+                       static_cast<long long>(unrecovered),
+                       static_cast<unsigned long long>(end.plis_upstream));
+        }
+
+        // Three subscribers of one publisher: the first sends a BYE, the
+        // second goes quiet and the third keeps sending receiver reports.
+        // Only the third may still get packets afterwards.
+        void RunSfuLeave() {
+                const int kFrameMs = 33;
+                const int kLegTimeoutMs = 600;
+                const int kSubscribers = 3;
+
+                RtpSfu sfu;
+                sfu.SetLegTimeout(kLegTimeoutMs);
+                if (!sfu.Start("127.0.0.1", 0)) {
+                        printf("  cannot start the SFU\n");
+                        ++g_failures;
+                        return;
+                }
+                sockaddr_in sfu_addr;
+                memset(&sfu_addr, 0, sizeof(sfu_addr));
+                sfu_addr.sin_family = AF_INET;
+                sfu_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                sfu_addr.sin_port = htons(sfu.port());
+
+                SyntheticPublisher publisher;
+                publisher.socket = OpenLoopbackSocket();
+                publisher.ssrc = 0x21000;
+                publisher.history.resize(SyntheticPublisher::kHistory);
+                int sockets[kSubscribers];
+                uint32_t leg_ssrcs[kSubscribers] = {};
+                int64_t packets[kSubscribers] = {};
+                for (int& fd : sockets)
+                        fd = OpenLoopbackSocket();
+
+                auto send_to_sfu = [&](int i, const uint8_t* data, size_t len) {
+                        sendto(sockets[i], data, len, 0, reinterpret_cast<const sockaddr*>(&sfu_addr),
+                               sizeof(sfu_addr));
+                };
+                auto send_rr = [&](int i) {
+                        uint8_t rr[32] = {};
+                        rr[0] = 0x81;
+                        rr[1] = 201;
+                        Write16(rr + 2, 7);
+                        Write32(rr + 4, 0x31000 + i);
+                        Write32(rr + 8, leg_ssrcs[i]);
+                        send_to_sfu(i, rr, sizeof(rr));
+                };
+                // One frame from the publisher, then whatever came back.
+                auto frame = [&]() {
+                        HandlePublisherRtcp(&publisher, sfu_addr);
+                        SendSyntheticFrame(&publisher, sfu_addr, publisher.send_key ? 27 : 9);
+                        std::this_thread::sleep_for(std::chrono::milliseconds(kFrameMs));
+                        uint8_t buffer[1500];
+                        for (int i = 0; i < kSubscribers; ++i) {
+                                ssize_t len;
+                                while ((len = recv(sockets[i], buffer, sizeof(buffer), MSG_DONTWAIT)) >= 12) {
+                                        uint8_t type = buffer[1] & 0x7f;
+                                        if (type >= 64 && type < 96)
+                                                continue;
+                                        leg_ssrcs[i] = Read32(buffer + 8);
+                                        ++packets[i];
+                                }
+                        }
+                };
+
+                // Everyone joins and reports for a while.
+                for (int n = 0; n < 90; ++n) {
+                        for (int i = 0; i < kSubscribers; ++i) {
+                                if (!packets[i] && n % 6 == 0)
+                                        SendRtcpFeedback(sockets[i], sfu_addr, 206, 0x31000 + i,
+                                                         publisher.ssrc, {});
+                                else if (packets[i] && n % 3 == 0)
+                                        send_rr(i);
+                        }
+                        frame();
+                }
+                bool joined = packets[0] && packets[1] && packets[2];
+                RtpSfu::Stats before = sfu.stats();
+
+                uint8_t bye[8];
+                bye[0] = 0x81;
+                bye[1] = 203;
+                Write16(bye + 2, 1);
+                Write32(bye + 4, 0x31000);
+                send_to_sfu(0, bye, sizeof(bye));
+                // The quiet one has to outlive the timeout plus a report
+                // interval, when legs are checked.
+                for (int n = 0; n < 2000 / kFrameMs; ++n) {
+                        if (n % 3 == 0)
+                                send_rr(2);
+                        frame();
+                }
+                int64_t left[kSubscribers];
+                std::copy(packets, packets + kSubscribers, left);
+                for (int n = 0; n < 15; ++n) {
+                        if (n % 3 == 0)
+                                send_rr(2);
+                        frame();
+                }
+                RtpSfu::Stats after = sfu.stats();
+                sfu.Stop();
+                for (int fd : sockets)
+                        close(fd);
+                close(publisher.socket);
+
+                bool ok = joined && before.legs == kSubscribers && after.legs == 1 &&
+                after.legs_removed == 2 && packets[0] == left[0] && packets[1] == left[1] &&
+                packets[2] > left[2];
+                printf("  leave: legs %llu -> %llu, after leaving bye:%lld quiet:%lld reporting:%lld packets%s\n",
+                       static_cast<unsigned long long>(before.legs),
+                       static_cast<unsigned long long>(after.legs),
+                       static_cast<long long>(packets[0] - left[0]),
+                       static_cast<long long>(packets[1] - left[1]),
+                       static_cast<long long>(packets[2] - left[2]), ok ? "" : "  FAILED");
+                if (!ok)
+                        ++g_failures;
+        }
+
+        void BenchSfu() {
+                const int kConfigs[][2] = {{1, 10}, {4, 25}, {8, 50}};
+                printf("H.264-like FU-A streams, 30 frames/s, over loopback\n");
+                for (const auto& config : kConfigs)
+                        RunSfu(config[0], config[1]);
+                RunSfuLeave();
+        }
+
+        // Counts what a UdpBatchTransport delivers.
+        class CountingSink : public RtpPacketSink {
+        public:
+                void OnRtpPacket(const uint8_t* data, size_t len) override { ++packets; }
+                void OnRtcpPacket(const uint8_t* data, size_t len) override { ++packets; }
+                std::atomic<int64_t> packets{0};
+        };
+
+        // Sends 1200 byte RTP packets over loopback as fast as the sender
+        // goes, |batch| per Flush() as if every pacing interval released
+        // that many, and receives them |batch| per call.
+        void RunBatchedUdp(int batch) {
+                const int kRunMs = 1000;
+                const size_t kPacketSize = 1200;
+
+                UdpBatchTransport receiver(batch);
+                UdpBatchTransport sender(batch);
+                if (receiver.Open("127.0.0.1", 0) != 0 || sender.Open("127.0.0.1", 0) != 0 ||
+                    sender.SetRemote("127.0.0.1", receiver.local_port()) != 0) {
+                        printf("  cannot open loopback sockets\n");
+                        ++g_failures;
+                        return;
+                }
+
+                CountingSink sink;
+                std::atomic<bool> stop(false);
+                std::thread receive_thread([&] {
+                        while (!stop)
+                                receiver.Receive(&sink, 10);
+                        // Whatever is still in the socket buffer.
+                        while (receiver.Receive(&sink, 0) > 0) {
+                        }
+                });
+
+                uint8_t packet[kPacketSize];
+                memset(packet, 0, sizeof(packet));
+                packet[0] = 0x80;
+                packet[1] = 96;
+                uint16_t seq = 0;
+                int64_t start_us = rtc::TimeMicros();
+                int64_t end_us = start_us + kRunMs * 1000;
+                while (rtc::TimeMicros() < end_us) {
+                        for (int i = 0; i < batch; ++i) {
+                                Write16(packet + 2, seq++);
+                                sender.OnRtpPacket(packet, sizeof(packet));
+                        }
+                        sender.Flush();
+                }
+                double seconds = (rtc::TimeMicros() - start_us) / 1e6;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                stop = true;
+                receive_thread.join();
+
+                const UdpBatchTransport::Stats& sent = sender.stats();
+                const UdpBatchTransport::Stats& received = receiver.stats();
+                if (!received.packets_received) {
+                        printf("  batch %d: nothing received\n", batch);
+                        ++g_failures;
+                }
+                printf("  batch:%-3d sent:%9.0f packets/s (%5.1f per call)  "
+                       "received:%9.0f packets/s (%5.1f per call)  %6.2f Gbit/s\n",
+                       batch, sent.packets_sent / seconds,
+                       static_cast<double>(sent.packets_sent) / std::max<uint64_t>(sent.send_calls, 1),
+                       received.packets_received / seconds,
+                       static_cast<double>(received.packets_received) /
+                       std::max<uint64_t>(received.receive_calls, 1),
+                       received.packets_received * kPacketSize * 8 / seconds / 1e9);
+        }
+
+        // A broadcast address without SO_BROADCAST makes every send fail:
+        // Flush() must not report those packets as sent.
+        void RunRefusedSend() {
+                const int kPackets = 4;
+                UdpBatchTransport sender(8);
+                if (sender.Open("127.0.0.1", 0) != 0 || sender.SetRemote("255.255.255.255", 9) != 0) {
+                        printf("  cannot open a socket\n");
+                        ++g_failures;
+                        return;
+                }
+                uint8_t packet[200];
+                memset(packet, 0, sizeof(packet));
+                packet[0] = 0x80;
+                packet[1] = 96;
+                for (int i = 0; i < kPackets; ++i)
+                        sender.OnRtpPacket(packet, sizeof(packet));
+                int sent = sender.Flush();
+                const UdpBatchTransport::Stats& stats = sender.stats();
+                bool ok = sent == 0 && stats.packets_sent == 0 && stats.send_errors == static_cast<uint64_t>(kPackets);
+                printf("  refused: %d of %d reported sent, %llu errors%s\n", sent, kPackets,
+                       static_cast<unsigned long long>(stats.send_errors), ok ? "" : "  FAILED");
+                if (!ok)
+                        ++g_failures;
+        }
+
+        void BenchBatchedUdp() {
+                const int kBatches[] = {1, 8, 32, UdpBatchTransport::kMaxBatch};
+#if defined(__linux__)
+                printf("1200 byte packets over loopback, sendmmsg/recvmmsg\n");
+#else
+                printf("1200 byte packets over loopback, no sendmmsg: one call per packet\n");
+#endif
+                for (int batch : kBatches)
+                        RunBatchedUdp(batch);
+                RunRefusedSend();
+        }
+
+        int64_t ThreadCpuUs() {
+                timespec ts;
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+                return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+        }
+
+        // Sends 50 kB frames, 41 RTP packets with a short last one, one
+        // Flush() per frame. Reports the CPU time both ends spend per
+        // megabit. |batch| 1 without offload is plain sendto().
+        void RunOffload(const char* name, int batch, bool offload) {
+                const int kRunMs = 1000;
+                const int kPacketsPerFrame = 41;
+                const size_t kPacketSize = 1200;
+                const size_t kLastPacketSize = 700;
+
+                UdpBatchTransport receiver(batch);
+                UdpBatchTransport sender(batch);
+                if (receiver.Open("127.0.0.1", 0) != 0 || sender.Open("127.0.0.1", 0) != 0 ||
+                    sender.SetRemote("127.0.0.1", receiver.local_port()) != 0) {
+                        printf("  cannot open loopback sockets\n");
+                        ++g_failures;
+                        return;
+                }
+                bool gso = offload && sender.EnableGso(true);
+                bool gro = offload && receiver.EnableGro(true);
+
+                CountingSink sink;
+                std::atomic<bool> stop(false);
+                int64_t receive_cpu_us = 0;
+                std::thread receive_thread([&] {
+                        int64_t start = ThreadCpuUs();
+                        while (!stop)
+                                receiver.Receive(&sink, 10);
+                        while (receiver.Receive(&sink, 0) > 0) {
+                        }
+                        receive_cpu_us = ThreadCpuUs() - start;
+                });
+
+                uint8_t packet[kPacketSize];
+                memset(packet, 0, sizeof(packet));
+                packet[0] = 0x80;
+                packet[1] = 96;
+                uint16_t seq = 0;
+                uint64_t bytes_sent = 0;
+                int64_t start_us = rtc::TimeMicros();
+                int64_t start_cpu_us = ThreadCpuUs();
+                int64_t end_us = start_us + kRunMs * 1000;
+                while (rtc::TimeMicros() < end_us) {
+                        for (int i = 0; i < kPacketsPerFrame; ++i) {
+                                size_t len = i == kPacketsPerFrame - 1 ? kLastPacketSize : kPacketSize;
+                                Write16(packet + 2, seq++);
+                                sender.OnRtpPacket(packet, len);
+                                bytes_sent += len;
+                        }
+                        sender.Flush();
+                }
+                int64_t send_cpu_us = ThreadCpuUs() - start_cpu_us;
+                double seconds = (rtc::TimeMicros() - start_us) / 1e6;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                stop = true;
+                receive_thread.join();
+
+                const UdpBatchTransport::Stats& sent = sender.stats();
+                const UdpBatchTransport::Stats& received = receiver.stats();
+                if (!received.packets_received) {
+                        printf("  %s: nothing received\n", name);
+                        ++g_failures;
+                        return;
+                }
+                // Packets are all full size but the last of a frame.
+                double megabits_sent = bytes_sent * 8 / 1e6;
+                double megabits_received =
+                megabits_sent * received.packets_received / std::max<uint64_t>(sent.packets_sent, 1);
+                printf("  %-9s gso:%-3s gro:%-3s sent:%7.0f Mbit/s %6.1f us cpu/Mbit  "
+                       "received:%7.0f Mbit/s %6.1f us cpu/Mbit  %5.1f packets/send  %5.1f packets/receive\n",
+                       name, gso ? "on" : "off", gro ? "on" : "off",
+                       megabits_sent / seconds, send_cpu_us / megabits_sent,
+                       megabits_received / seconds, receive_cpu_us / std::max(megabits_received, 1e-9),
+                       static_cast<double>(sent.packets_sent) / std::max<uint64_t>(sent.send_calls, 1),
+                       static_cast<double>(received.packets_received) /
+                       std::max<uint64_t>(received.receive_calls, 1));
+        }
+
+        void BenchOffload() {
+                printf("50 kB frames of 1200 byte packets over loopback\n");
+                RunOffload("sendto", 1, false);
+                RunOffload("sendmmsg", UdpBatchTransport::kMaxBatch, false);
+                // Falls back to sendmmsg where the kernel has no UDP offload.
+                RunOffload("gso/gro", UdpBatchTransport::kMaxBatch, true);
+        }
+
+        // Annex-B access units of about |bytes| bytes: parameter sets and
+        // an IDR slice for a key frame, one slice otherwise. The payload
+        // has no zero bytes, so no accidental start codes.
+        std::vector<uint8_t> MakeAccessUnit(bool h265, bool key, size_t bytes) {
+                static const uint8_t kH264Key[] = {0x67, 0x68, 0x65};
+                static const uint8_t kH265Key[] = {0x40, 0x42, 0x44, 0x26};
+                std::vector<uint8_t> au;
+                auto add_nal = [&](uint8_t type, size_t size) {
+                        au.insert(au.end(), {0, 0, 0, 1, type});
+                        if (h265)
+                                au.push_back(0x01);
+                        for (size_t i = 0; i < size; ++i)
+                                au.push_back(static_cast<uint8_t>(0x80 | (i * 7 & 0x7f)));
+                };
+                if (!key) {
+                        add_nal(h265 ? 0x02 : 0x41, bytes);
+                } else if (h265) {
+                        for (size_t i = 0; i < 3; ++i)
+                                add_nal(kH265Key[i], 16);
+                        add_nal(kH265Key[3], bytes);
+                } else {
+                        for (size_t i = 0; i < 2; ++i)
+                                add_nal(kH264Key[i], 16);
+                        add_nal(kH264Key[2], bytes);
+                }
+                return au;
+        }
+
+        // ADTS frames of |bytes| bytes at 48 kHz.
+        std::vector<uint8_t> MakeAdtsFrame(size_t bytes) {
+                size_t len = bytes + 7;
+                std::vector<uint8_t> frame = {
+                        0xff, 0xf1, 0x4c, static_cast<uint8_t>(0x80 | ((len >> 11) & 0x03)),
+                        static_cast<uint8_t>(len >> 3), static_cast<uint8_t>(((len & 0x07) << 5) | 0x1f),
+                        0xfc,
+                };
+                frame.resize(len, 0x5a);
+                return frame;
+        }
+
+        // Pushes |frames| through |send| and prints the rates. Fails the
+        // case if the stream breaks or the send path touches the heap.
+        template <typename Send>
+        void RunPacketizer(const char* name, int frames, CheckingSink* sink, Send send) {
+                int64_t allocations = g_allocations;
+                int64_t start_us = rtc::TimeMicros();
+                for (int n = 0; n < frames; ++n) {
+                        if (send(n) != 0) {
+                                printf("  %s: frame %d rejected\n", name, n);
+                                ++g_failures;
+                                return;
+                        }
+                }
+                double seconds = std::max<int64_t>(rtc::TimeMicros() - start_us, 1) / 1e6;
+                allocations = g_allocations - allocations;
+                if (allocations || sink->errors()) {
+                        printf("  %s: %lld allocations, %d broken packets\n", name,
+                               static_cast<long long>(allocations), sink->errors());
+                        ++g_failures;
+                }
+                printf("  %-22s %10.0f frames/s %11.0f packets/s\n", name,
+                       frames / seconds, sink->packets() / seconds);
+        }
+
+        // Also puts VP8 frames back together from their RFC 7741
+        // descriptors and compares them with |frame|.
+        class Vp8CheckingSink : public CheckingSink {
+        public:
+                Vp8CheckingSink(uint32_t ssrc, const std::vector<uint8_t>* frame)
+                : CheckingSink(ssrc), frame_(frame) {
+                        received_.reserve(frame->size());
+                }
+
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        CheckingSink::OnRtpPacket(data, len);
+                        if (len <= 13) {
+                                ++vp8_errors_;
+                                return;
+                        }
+                        // S on the first packet of a frame and only there.
+                        if (((data[12] & 0x10) != 0) != received_.empty())
+                                ++vp8_errors_;
+                        received_.insert(received_.end(), data + 13, data + len);
+                        if (data[1] & 0x80) {
+                                if (received_ != *frame_)
+                                        ++vp8_errors_;
+                                received_.clear();
+                        }
+                }
+
+                int vp8_errors() const { return vp8_errors_; }
+
+        private:
+                const std::vector<uint8_t>* frame_;
+                std::vector<uint8_t> received_;
+                int vp8_errors_ = 0;
+        };
+
+        void BenchPacketize() {
+                const int kKbps[] = {500, 2000, 8000, 20000};
+                const int kFps = 30;
+                const int kGop = 30;
+                const int kFrames = 3000;
+                const uint32_t kSsrc = 0x4000;
+
+                for (int h265 = 0; h265 < 2; ++h265) {
+                        for (int kbps : kKbps) {
+                                // Key frames three times the size of the rest.
+                                size_t delta = kbps * 1000 / 8 / kFps * kGop / (kGop + 2);
+                                std::vector<std::vector<uint8_t>> gop;
+                                for (int i = 0; i < kGop; ++i)
+                                        gop.push_back(MakeAccessUnit(h265, i == 0, i == 0 ? 3 * delta : delta));
+
+                                RtpRtcpImpl sender;
+                                CheckingSink sink(kSsrc);
+                                sender.SetPacketSink(&sink);
+                                sender.SetSSRC(kSsrc);
+                                sender.ChangeAVFormat(AudioFormat::Same,
+                                                      h265 ? VideoFormat::H265 : VideoFormat::H264);
+                                char name[32];
+                                snprintf(name, sizeof(name), "%s %5d kbit/s", h265 ? "H.265" : "H.264", kbps);
+                                RunPacketizer(name, kFrames, &sink, [&](int n) {
+                                        std::vector<uint8_t>& au = gop[n % kGop];
+                                        return sender.SendVideo(reinterpret_cast<char*>(au.data()),
+                                                                static_cast<int>(au.size()), n % kGop == 0,
+                                                                n * 1000 / kFps);
+                                });
+                        }
+                }
+
+                {
+                        std::vector<uint8_t> frame(2000 * 1000 / 8 / kFps);
+                        std::mt19937 random(7);
+                        for (uint8_t& byte : frame)
+                                byte = static_cast<uint8_t>(random());
+                        RtpRtcpImpl sender;
+                        Vp8CheckingSink sink(kSsrc, &frame);
+                        sender.SetPacketSink(&sink);
+                        sender.SetSSRC(kSsrc);
+                        sender.ChangeAVFormat(AudioFormat::Same, VideoFormat::VP8);
+                        RunPacketizer("VP8    2000 kbit/s", kFrames, &sink, [&](int n) {
+                                return sender.SendVideo(reinterpret_cast<char*>(frame.data()),
+                                                        static_cast<int>(frame.size()), n % kGop == 0,
+                                                        n * 1000 / kFps);
+                        });
+                        if (sink.vp8_errors()) {
+                                printf("  VP8: %d frames not put back together\n", sink.vp8_errors());
+                                ++g_failures;
+                        }
+                }
+
+                // SetSSRC() moves the audio and data streams along, to the
+                // next two SSRCs.
+                {
+                        RtpRtcpImpl sender;
+                        std::vector<uint8_t> frame = MakeAdtsFrame(384);
+                        CheckingSink sink(kSsrc + 1);
+                        sender.SetPacketSink(&sink);
+                        sender.SetSSRC(kSsrc);
+                        RunPacketizer("AAC 128 kbit/s", kFrames * 4, &sink, [&](int n) {
+                                return sender.SendAduio(reinterpret_cast<char*>(frame.data()),
+                                                        static_cast<int>(frame.size()), n * 1024 / 48);
+                        });
+                }
+                {
+                        RtpRtcpImpl sender;
+                        std::vector<uint8_t> message(4096, 0x42);
+                        CheckingSink sink(kSsrc + 2);
+                        sender.SetPacketSink(&sink);
+                        sender.SetSSRC(kSsrc);
+                        RunPacketizer("data 4 kB messages", kFrames * 4, &sink, [&](int n) {
+                                return sender.SendData(reinterpret_cast<char*>(message.data()),
+                                                       static_cast<int>(message.size()), n);
+                        });
+                }
+        }
+
+        // Sits between a sender and its socket: drops packets at random
+        // and holds some back so they go out after the next one.
+        class ImpairedLink : public RtpPacketSink {
+        public:
+                ImpairedLink(UdpBatchTransport* transport, double loss, double reorder)
+                : transport_(transport), loss_(loss), reorder_(reorder), random_(1234) {}
+
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        if (Chance(loss_)) {
+                                ++dropped_;
+                                return;
+                        }
+                        if (!held_len_ && len <= sizeof(held_) && Chance(reorder_)) {
+                                memcpy(held_, data, len);
+                                held_len_ = len;
+                                return;
+                        }
+                        transport_->OnRtpPacket(data, len);
+                        Flush();
+                }
+
+                // Lets a held packet go, at the latest at the end of a burst.
+                void Flush() {
+                        if (held_len_)
+                                transport_->OnRtpPacket(held_, held_len_);
+                        held_len_ = 0;
+                }
+
+                int dropped() const { return dropped_; }
+
+        private:
+                bool Chance(double p) {
+                        return p > 0 && std::uniform_real_distribution<double>(0, 1)(random_) < p;
+                }
+
+                UdpBatchTransport* transport_;
+                double loss_;
+                double reorder_;
+                std::mt19937 random_;
+                uint8_t held_[RtpPacketPool::kBufferSize];
+                size_t held_len_ = 0;
+                int dropped_ = 0;
+        };
+
+        // The last three bytes of every access unit carry its index, seven
+        // bits a byte so no start code can appear.
+        void StampAccessUnit(uint8_t* data, size_t len, int index) {
+                for (int i = 0; i < 3; ++i)
+                        data[len - 1 - i] = static_cast<uint8_t>(0x80 | ((index >> (7 * i)) & 0x7f));
+        }
+
+        int AccessUnitIndex(const uint8_t* data, size_t len) {
+                int index = 0;
+                for (int i = 0; i < 3; ++i)
+                        index |= (data[len - 1 - i] & 0x7f) << (7 * i);
+                return index;
+        }
+
+        // Checks what an RtpReceiver hands on against what was sent: in
+        // order, and byte for byte the access unit that went out.
+        class CheckingFrameSink : public RtpFrameSink {
+        public:
+                CheckingFrameSink(const std::vector<uint8_t>* key, const std::vector<uint8_t>* delta,
+                                  const std::vector<bool>* sent_as_key)
+                : key_(key), delta_(delta), sent_as_key_(sent_as_key) {}
+
+                void OnFrame(const uint8_t* data, size_t len, uint32_t timestamp, bool key) override {
+                        int index = len >= 3 ? AccessUnitIndex(data, len) : -1;
+                        if (index <= last_index_ || index >= static_cast<int>(sent_as_key_->size()) ||
+                            key != (*sent_as_key_)[index]) {
+                                ++errors_;
+                                return;
+                        }
+                        const std::vector<uint8_t>& sent = key ? *key_ : *delta_;
+                        if (len != sent.size() || memcmp(data, sent.data(), len - 3) != 0)
+                                ++errors_;
+                        last_index_ = index;
+                        ++frames_;
+                        int64_t delay_ms = now_ms - send_ms[index];
+                        total_delay_ms_ += delay_ms;
+                        max_delay_ms_ = std::max(max_delay_ms_, delay_ms);
+                }
+
+                // Set by the caller: the time now and when each frame went out.
+                int64_t now_ms = 0;
+                std::vector<int64_t> send_ms;
+
+                int frames() const { return frames_; }
+                int errors() const { return errors_; }
+                double average_delay_ms() const { return frames_ ? double(total_delay_ms_) / frames_ : 0; }
+                int64_t max_delay_ms() const { return max_delay_ms_; }
+
+        private:
+                const std::vector<uint8_t>* key_;
+                const std::vector<uint8_t>* delta_;
+                const std::vector<bool>* sent_as_key_;
+                int last_index_ = -1;
+                int frames_ = 0;
+                int errors_ = 0;
+                int64_t total_delay_ms_ = 0;
+                int64_t max_delay_ms_ = 0;
+        };
+
+        // Feeds an RtpReceiver on the simulated clock and times it.
+        class ReceiverFeed : public RtpPacketSink {
+        public:
+                explicit ReceiverFeed(RtpReceiver* receiver) : receiver_(receiver) {}
+
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        int64_t allocations = g_allocations;
+                        int64_t start_ns = rtc::TimeNanos();
+                        receiver_->InsertPacketAt(data, len, now_ms);
+                        receive_ns += rtc::TimeNanos() - start_ns;
+                        heap_allocations += g_allocations - allocations;
+                }
+
+                int64_t now_ms = 0;
+                int64_t receive_ns = 0;
+                int64_t heap_allocations = 0;
+
+        private:
+                RtpReceiver* receiver_;
+        };
+
+        // Hands the receiver's RTCP to the sender and notes PLIs, so the
+        // next frame goes out as a key frame.
+        class SenderFeedback : public RtpPacketSink {
+        public:
+                explicit SenderFeedback(RtpRtcpImpl* sender) : sender_(sender) {}
+
+                void OnRtpPacket(const uint8_t* data, size_t len) override {}
+                void OnRtcpPacket(const uint8_t* data, size_t len) override {
+                        if (len >= 12 && data[1] == 206 && (data[0] & 0x1f) == 1)
+                                key_frame_requested = true;
+                        sender_->IncomingRtcpPacket(data, len);
+                }
+
+                bool key_frame_requested = false;
+
+        private:
+                RtpRtcpImpl* sender_;
+        };
+
+        void RunJitter(double loss, double reorder) {
+                const int kKbps = 4000;
+                const int kFrameIntervalMs = 40;
+                const int kTickMs = 5;
+                const int kGop = 50;
+                const int kFrames = 1500;
+                const uint32_t kSsrc = 0x5000;
+
+                size_t delta_bytes = kKbps * 1000 / 8 * kFrameIntervalMs / 1000;
+                std::vector<uint8_t> key = MakeAccessUnit(false, true, 3 * delta_bytes);
+                std::vector<uint8_t> delta = MakeAccessUnit(false, false, delta_bytes);
+                std::vector<uint8_t> frame(key.size());
+                std::vector<bool> sent_as_key(kFrames);
+
+                UdpBatchTransport sender_socket;
+                UdpBatchTransport receiver_socket;
+                if (sender_socket.Open("127.0.0.1", 0) != 0 || receiver_socket.Open("127.0.0.1", 0) != 0 ||
+                    sender_socket.SetRemote("127.0.0.1", receiver_socket.local_port()) != 0 ||
+                    receiver_socket.SetRemote("127.0.0.1", sender_socket.local_port()) != 0) {
+                        printf("  cannot open loopback sockets\n");
+                        ++g_failures;
+                        return;
+                }
+
+                RtpRtcpImpl sender;
+                ImpairedLink link(&sender_socket, loss, reorder);
+                sender.SetPacketSink(&link);
+                sender.SetSSRC(kSsrc);
+                SenderFeedback feedback(&sender);
+
+                CheckingFrameSink frames(&key, &delta, &sent_as_key);
+                frames.send_ms.resize(kFrames);
+                RtpReceiver receiver(kSsrc, &frames, &receiver_socket);
+                ReceiverFeed feed(&receiver);
+
+                // Loopback delivers before the send returns, so each tick
+                // runs to quiet: media, NACKs, retransmissions.
+                auto drain = [&] {
+                        while (receiver_socket.Receive(&feed, 0) > 0) {
+                        }
+                };
+                int64_t start_us = rtc::TimeMicros();
+                int64_t end_ms = int64_t(kFrames) * kFrameIntervalMs + 500;
+                for (int64_t now_ms = 0; now_ms < end_ms; now_ms += kTickMs) {
+                        feed.now_ms = now_ms;
+                        frames.now_ms = now_ms;
+                        int n = static_cast<int>(now_ms / kFrameIntervalMs);
+                        if (now_ms % kFrameIntervalMs == 0 && n < kFrames) {
+                                bool is_key = n % kGop == 0 || feedback.key_frame_requested;
+                                feedback.key_frame_requested = false;
+                                const std::vector<uint8_t>& au = is_key ? key : delta;
+                                memcpy(frame.data(), au.data(), au.size());
+                                StampAccessUnit(frame.data(), au.size(), n);
+                                sent_as_key[n] = is_key;
+                                frames.send_ms[n] = now_ms;
+                                sender.SendVideo(reinterpret_cast<char*>(frame.data()),
+                                                 static_cast<int>(au.size()), is_key, now_ms);
+                                link.Flush();
+                                sender_socket.Flush();
+                        }
+                        drain();
+                        receiver.ProcessAt(now_ms);
+                        while (sender_socket.Receive(&feedback, 0) > 0) {
+                        }
+                        link.Flush();
+                        sender_socket.Flush();
+                        drain();
+                }
+                double seconds = std::max<int64_t>(rtc::TimeMicros() - start_us, 1) / 1e6;
+
+                const RtpReceiver::Stats& stats = receiver.stats();
+                double delivered = 100.0 * frames.frames() / kFrames;
+                printf("  loss %2.0f%% reorder %2.0f%%: %5.1f%% of frames, %3llu dropped, %5llu nacks, "
+                       "%5llu recovered, %2llu plis, delay %5.1f ms avg %4lld ms max, "
+                       "%4.0f ns/packet, %8.0f packets/s\n",
+                       loss * 100, reorder * 100, delivered,
+                       static_cast<unsigned long long>(stats.frames_dropped),
+                       static_cast<unsigned long long>(stats.nacks_sent),
+                       static_cast<unsigned long long>(stats.recovered),
+                       static_cast<unsigned long long>(stats.plis_sent),
+                       frames.average_delay_ms(), static_cast<long long>(frames.max_delay_ms()),
+                       double(feed.receive_ns) / std::max<uint64_t>(stats.packets, 1),
+                       stats.packets / seconds);
+                // NACKs get nearly everything back; what is given up on
+                // costs the rest of a GOP at most.
+                double expected = loss > 0 ? 90 : 100;
+                if (frames.errors() || feed.heap_allocations || delivered < expected) {
+                        printf("  %d broken frames, %lld allocations\n", frames.errors(),
+                               static_cast<long long>(feed.heap_allocations));
+                        ++g_failures;
+                }
+        }
+
+        // Loses the |index|th packet that comes by, and every
+        // retransmission of it.
+        class LosingSink : public RtpPacketSink {
+        public:
+                LosingSink(RtpPacketSink* next, int index) : next_(next), index_(index) {}
+
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        if (len < 12)
+                                return;
+                        uint16_t sequence_number = Read16(data + 2);
+                        if (count_++ == index_) {
+                                lost_ = sequence_number;
+                                has_lost_ = true;
+                        }
+                        if (has_lost_ && sequence_number == lost_)
+                                return;
+                        next_->OnRtpPacket(data, len);
+                }
+
+        private:
+                RtpPacketSink* next_;
+                int index_;
+                int count_ = 0;
+                bool has_lost_ = false;
+                uint16_t lost_ = 0;
+        };
+
+        // A packet in the middle of the first key frame is lost for good,
+        // after the frame's first packet is in: the receiver has to give
+        // up on that frame, ask for a key frame and carry on.
+        void RunLostPacket() {
+                const int kFrameIntervalMs = 40;
+                const int kTickMs = 5;
+                const int kFrames = 100;
+                const uint32_t kSsrc = 0x5001;
+
+                std::vector<uint8_t> key = MakeAccessUnit(false, true, 60000);
+                std::vector<uint8_t> delta = MakeAccessUnit(false, false, 20000);
+                std::vector<uint8_t> frame(key.size());
+                std::vector<bool> sent_as_key(kFrames);
+
+                RtpRtcpImpl sender;
+                sender.SetSSRC(kSsrc);
+                SenderFeedback feedback(&sender);
+                CheckingFrameSink frames(&key, &delta, &sent_as_key);
+                frames.send_ms.resize(kFrames);
+                RtpReceiver receiver(kSsrc, &frames, &feedback);
+                ReceiverFeed feed(&receiver);
+                LosingSink link(&feed, 6);
+                sender.SetPacketSink(&link);
+
+                int64_t end_ms = int64_t(kFrames) * kFrameIntervalMs + 2000;
+                for (int64_t now_ms = 0; now_ms < end_ms; now_ms += kTickMs) {
+                        feed.now_ms = now_ms;
+                        frames.now_ms = now_ms;
+                        int n = static_cast<int>(now_ms / kFrameIntervalMs);
+                        if (now_ms % kFrameIntervalMs == 0 && n < kFrames) {
+                                bool is_key = n == 0 || feedback.key_frame_requested;
+                                feedback.key_frame_requested = false;
+                                const std::vector<uint8_t>& au = is_key ? key : delta;
+                                memcpy(frame.data(), au.data(), au.size());
+                                StampAccessUnit(frame.data(), au.size(), n);
+                                sent_as_key[n] = is_key;
+                                frames.send_ms[n] = now_ms;
+                                sender.SendVideo(reinterpret_cast<char*>(frame.data()),
+                                                 static_cast<int>(au.size()), is_key, now_ms);
+                        }
+                        receiver.ProcessAt(now_ms);
+                }
+
+                const RtpReceiver::Stats& stats = receiver.stats();
+                printf("  packet 6 lost for good: %d of %d frames, %llu dropped, %llu nacks, %llu plis\n",
+                       frames.frames(), kFrames, static_cast<unsigned long long>(stats.frames_dropped),
+                       static_cast<unsigned long long>(stats.nacks_sent),
+                       static_cast<unsigned long long>(stats.plis_sent));
+                // The key frame and what came in while it was waited for
+                // are lost, no more.
+                if (frames.errors() || !stats.frames_dropped || !stats.plis_sent || frames.frames() < kFrames - 10)
+                        ++g_failures;
+        }
+
+        void BenchJitter() {
+                printf("H.264 at 4 Mbit/s, 25 fps, 1500 frames on a simulated clock\n");
+                for (double loss : {0.0, 0.01, 0.05})
+                        for (double reorder : {0.0, 0.05})
+                                RunJitter(loss, reorder);
+                RunLostPacket();
+        }
+
+        // One stream on a pool that starts with a single small slab, so
+        // the history ring fills it up and grows it before it settles.
+        void RunPoolStream(int kbps, int fps) {
+                const int kGop = 60;
+                const int kSeconds = 60;
+                const int kWarmUpSeconds = 5;
+                const size_t kSlabSize = 64;
+                const uint32_t kSsrc = 0x6000;
+
+                size_t delta = kbps * 1000 / 8 / fps * kGop / (kGop + 2);
+                std::vector<uint8_t> key = MakeAccessUnit(false, true, 3 * delta);
+                std::vector<uint8_t> frame = MakeAccessUnit(false, false, delta);
+
+                RtpPacketPool pool(kSlabSize);
+                RtpPacketizer packetizer(&pool, RtpPayloadFormat::H264, 96, kSsrc);
+                CheckingSink sink(kSsrc);
+                packetizer.SetSink(&sink);
+
+                int64_t warm_up_allocations = 0;
+                int64_t steady_allocations = 0;
+                int frames = fps * kSeconds;
+                int64_t start_us = rtc::TimeMicros();
+                for (int n = 0; n < frames; ++n) {
+                        std::vector<uint8_t>& au = n % kGop == 0 ? key : frame;
+                        int64_t allocations = g_allocations;
+                        if (packetizer.SendFrame(au.data(), au.size(), n * 90000 / fps) <= 0) {
+                                printf("  frame %d rejected\n", n);
+                                ++g_failures;
+                                return;
+                        }
+                        allocations = g_allocations - allocations;
+                        if (n < fps * kWarmUpSeconds)
+                                warm_up_allocations += allocations;
+                        else
+                                steady_allocations += allocations;
+                }
+                double seconds = std::max<int64_t>(rtc::TimeMicros() - start_us, 1) / 1e6;
+                const RtpPacketizer::Stats& stats = packetizer.stats();
+                int steady_frames = frames - fps * kWarmUpSeconds;
+                printf("  %5d kbit/s %2d fps: %3d slabs, %5.3f allocations/frame warming up, "
+                       "%5.3f after %d s, %9.0f packets/s\n",
+                       kbps, fps, static_cast<int>(pool.capacity() / kSlabSize),
+                       double(warm_up_allocations) / (fps * kWarmUpSeconds),
+                       double(steady_allocations) / steady_frames, kWarmUpSeconds,
+                       stats.packets / seconds);
+                if (steady_allocations || stats.dropped || sink.errors()) {
+                        printf("  %lld allocations after warm-up, %llu dropped, %d broken packets\n",
+                               static_cast<long long>(steady_allocations),
+                               static_cast<unsigned long long>(stats.dropped), sink.errors());
+                        ++g_failures;
+                }
+        }
+
+        // Threads take buffers from one pool and give them back, each
+        // writing its mark over the buffer while it holds it; a buffer
+        // handed out twice at once shows up as a foreign mark.
+        void RunPoolThreads(int threads) {
+                const int kRounds = 200000;
+                const int kHeld = 8;
+                RtpPacketPool pool(threads * kHeld);
+                std::atomic<int> broken(0);
+                int64_t allocations = g_allocations;
+                int64_t start_us = rtc::TimeMicros();
+                std::vector<std::thread> workers;
+                for (int t = 0; t < threads; ++t) {
+                        workers.emplace_back([&, t] {
+                                uint8_t* held[kHeld];
+                                uint8_t mark = static_cast<uint8_t>(t + 1);
+                                for (int round = 0; round < kRounds; ++round) {
+                                        int count = 1 + round % kHeld;
+                                        for (int i = 0; i < count; ++i) {
+                                                held[i] = pool.Acquire();
+                                                memset(held[i], mark, 64);
+                                        }
+                                        for (int i = 0; i < count; ++i) {
+                                                if (held[i][0] != mark || held[i][63] != mark)
+                                                        ++broken;
+                                                pool.Release(held[i]);
+                                        }
+                                }
+                        });
+                }
+                for (std::thread& worker : workers)
+                        worker.join();
+                double seconds = std::max<int64_t>(rtc::TimeMicros() - start_us, 1) / 1e6;
+                // The threads themselves allocate; the pool has to stay at
+                // its first slab.
+                allocations = g_allocations - allocations;
+                int64_t operations = int64_t(threads) * kRounds * (1 + kHeld) / 2;
+                printf("  %d threads: %6.1f M acquire+release/s, %llu slabs grown, %d broken\n",
+                       threads, operations / seconds / 1e6,
+                       static_cast<unsigned long long>(pool.allocations()), broken.load());
+                if (broken || pool.allocations() || pool.available() != pool.capacity()) {
+                        ++g_failures;
+                        printf("  pool broken: %zu of %zu buffers back, %lld allocations\n",
+                               pool.available(), pool.capacity(), static_cast<long long>(allocations));
+                }
+        }
+
+        void BenchPool() {
+                printf("H.264 on a pool of 64 buffer slabs, 60 s of frames\n");
+                for (int fps : {30, 60})
+                        for (int kbps : {1000, 4000, 12000})
+                                RunPoolStream(kbps, fps);
+                printf("lock-free free list under contention\n");
+                for (int threads : {1, 2, 4})
+                        RunPoolThreads(threads);
+        }
+
+        // Appends |len| random bytes with emulation prevention, the way an
+        // encoder's slice data looks to a start code scan.
+        void AppendSliceData(std::vector<uint8_t>* out, size_t len, std::mt19937* random) {
+                int zeros = 0;
+                for (size_t i = 0; i < len; ++i) {
+                        uint8_t byte = static_cast<uint8_t>((*random)());
+                        if (zeros == 2 && byte <= 3) {
+                                out->push_back(3);
+                                zeros = 0;
+                        }
+                        out->push_back(byte);
+                        zeros = byte ? 0 : zeros + 1;
+                }
+        }
+
+        // An elementary stream of |frames| access units at |kbps| and 30
+        // fps: parameter sets, SEI and an IDR slice every 60 frames, one
+        // slice otherwise. |nal_units| is set to the number of NAL units.
+        std::vector<uint8_t> MakeElementaryStream(bool h265, int kbps, int frames, int* nal_units) {
+                std::mt19937 random(h265 ? 265 : 264);
+                std::vector<uint8_t> es;
+                *nal_units = 0;
+                auto add_nal = [&](uint8_t type, size_t size) {
+                        es.insert(es.end(), {0, 0, 0, 1});
+                        if (h265)
+                                es.insert(es.end(), {static_cast<uint8_t>(type << 1), 1});
+                        else
+                                es.push_back(type);
+                        size_t first = es.size();
+                        AppendSliceData(&es, size, &random);
+                        // first_mb_in_slice 0 / first_slice_segment_in_pic_flag:
+                        // every slice starts a picture.
+                        es[first] |= 0x80;
+                        ++*nal_units;
+                };
+                size_t frame_bytes = kbps * 1000 / 8 / 30;
+                for (int n = 0; n < frames; ++n) {
+                        if (n % 60 == 0) {
+                                if (h265)
+                                        add_nal(32, 20);                // VPS
+                                add_nal(h265 ? 33 : 0x67, 24);          // SPS
+                                add_nal(h265 ? 34 : 0x68, 6);           // PPS
+                                add_nal(h265 ? 39 : 0x06, 30);          // SEI
+                                add_nal(h265 ? 19 : 0x65, frame_bytes * 4);
+                        } else {
+                                add_nal(h265 ? 1 : 0x41, frame_bytes);
+                        }
+                }
+                return es;
+        }
+
+        bool ReadFile(const char* path, std::vector<uint8_t>* data) {
+                FILE* file = fopen(path, "rb");
+                if (!file)
+                        return false;
+                uint8_t buffer[65536];
+                size_t read;
+                while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                        data->insert(data->end(), buffer, buffer + read);
+                fclose(file);
+                return true;
+        }
+
+        // Best of a few passes over |es|, counting start codes.
+        template <typename Find>
+        double ScanGbps(const std::vector<uint8_t>& es, Find find, int* count) {
+                const int kPasses = 5;
+                int64_t best_ns = INT64_MAX;
+                for (int pass = 0; pass < kPasses; ++pass) {
+                        int found = 0;
+                        int64_t start_ns = rtc::TimeNanos();
+                        for (size_t pos = 0;; ++found) {
+                                pos = find(es.data(), es.size(), pos);
+                                if (pos == es.size())
+                                        break;
+                                pos += 3;
+                        }
+                        best_ns = std::min(best_ns, rtc::TimeNanos() - start_ns);
+                        *count = found;
+                }
+                return es.size() / static_cast<double>(std::max<int64_t>(best_ns, 1));
+        }
+
+        void RunAnnexB(const char* name, const std::vector<uint8_t>& es, int nal_units) {
+                int scalar_count = 0;
+                int vector_count = 0;
+                double scalar = ScanGbps(es, AnnexBReader::FindStartCodeScalar, &scalar_count);
+                double vector = ScanGbps(es, AnnexBReader::FindStartCode, &vector_count);
+                printf("  %-24s %6.1f MB %6d NAL units  scalar %5.2f GB/s  %-6s %5.2f GB/s  x%.1f\n",
+                       name, es.size() / 1e6, vector_count, scalar, AnnexBReader::StartCodeScanner(),
+                       vector, vector / scalar);
+                if (scalar_count != vector_count || (nal_units >= 0 && vector_count != nal_units)) {
+                        printf("  %s: %d start codes scalar, %d %s, %d NAL units written\n", name,
+                               scalar_count, vector_count, AnnexBReader::StartCodeScanner(), nal_units);
+                        ++g_failures;
+                }
+        }
+
+        // Real streams can be given as RTPRTCPBENCH_ES=a.h264:b.h265.
+        void BenchAnnexB() {
+                for (int h265 = 0; h265 < 2; ++h265) {
+                        for (int kbps : {1000, 8000}) {
+                                int nal_units = 0;
+                                std::vector<uint8_t> es = MakeElementaryStream(h265, kbps, 600, &nal_units);
+                                char name[32];
+                                snprintf(name, sizeof(name), "%s %d kbit/s", h265 ? "H.265" : "H.264", kbps);
+                                RunAnnexB(name, es, nal_units);
+                        }
+                }
+                const char* files = getenv("RTPRTCPBENCH_ES");
+                std::string paths = files ? files : "";
+                for (size_t begin = 0; begin < paths.size();) {
+                        size_t end = std::min(paths.find(':', begin), paths.size());
+                        std::string path = paths.substr(begin, end - begin);
+                        begin = end + 1;
+                        std::vector<uint8_t> es;
+                        if (!ReadFile(path.c_str(), &es)) {
+                                printf("  cannot read %s\n", path.c_str());
+                                ++g_failures;
+                                continue;
+                        }
+                        size_t slash = path.rfind('/');
+                        RunAnnexB(path.c_str() + (slash == std::string::npos ? 0 : slash + 1), es, -1);
+                }
+        }
+
+        // Writes |data| to a temporary file; returns its path or "".
+        std::string WriteTempFile(const std::vector<uint8_t>& data, const char* suffix) {
+                char path[64];
+                snprintf(path, sizeof(path), "/tmp/rtprtcpbench-XXXXXX%s", suffix);
+                int fd = mkstemps(path, static_cast<int>(strlen(suffix)));
+                if (fd < 0)
+                        return "";
+                bool ok = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+                close(fd);
+                if (!ok) {
+                        unlink(path);
+                        return "";
+                }
+                return path;
+        }
+
+        // Reads a file of |frames| frames, |keys| of them key frames, in a
+        // loop and sends it through RtpRtcpImpl. Fails the case if frames
+        // go missing, the reader copies or allocates, or a stream breaks.
+        void RunEsReader(const char* name, const std::vector<uint8_t>& es, const char* suffix,
+                         int frames, int keys) {
+                const int kLoops = 20;
+                std::string path = WriteTempFile(es, suffix);
+                EsFormat format;
+                EsReader reader;
+                if (path.empty() || !EsReader::FormatFromPath(path.c_str(), &format) ||
+                    reader.Open(path.c_str(), format, 30) != 0) {
+                        printf("  %s: cannot write and read back %s\n", name, path.c_str());
+                        ++g_failures;
+                        return;
+                }
+                unlink(path.c_str());
+
+                // One pass to check the frames.
+                EsFrame frame;
+                int count = 0;
+                int key_count = 0;
+                int64_t last_ms = -1;
+                bool broken = false;
+                const uint8_t* end = nullptr;
+                while (reader.Next(&frame)) {
+                        broken |= frame.timestamp_ms <= last_ms || (end && frame.data != end);
+                        end = frame.data + frame.len;
+                        last_ms = frame.timestamp_ms;
+                        ++count;
+                        key_count += frame.key;
+                }
+
+                // Then the reader alone, looping.
+                reader.set_loop(true);
+                int64_t allocations = g_allocations;
+                int64_t start_ns = rtc::TimeNanos();
+                uint64_t bytes = 0;
+                int read = 0;
+                for (; reader.loops() < kLoops && reader.Next(&frame); ++read)
+                        bytes += frame.len;
+                double read_seconds = std::max<int64_t>(rtc::TimeNanos() - start_ns, 1) / 1e9;
+                allocations = g_allocations - allocations;
+
+                // And feeding the sender.
+                RtpRtcpImpl sender;
+                CheckingSink probe(0);
+                sender.SetPacketSink(&probe);
+                if (format == EsFormat::H265)
+                        sender.ChangeAVFormat(AudioFormat::Same, VideoFormat::H265);
+                auto send = [&](const EsFrame& f) {
+                        char* data = reinterpret_cast<char*>(const_cast<uint8_t*>(f.data));
+                        int len = static_cast<int>(f.len);
+                        return format == EsFormat::AAC ? sender.SendAduio(data, len, f.timestamp_ms)
+                                                       : sender.SendVideo(data, len, f.key, f.timestamp_ms);
+                };
+                reader.Next(&frame);
+                send(frame);
+                CheckingSink sink(probe.last_ssrc());
+                sender.SetPacketSink(&sink);
+                int sent = 0;
+                int rejected = 0;
+                start_ns = rtc::TimeNanos();
+                for (; sent < frames * kLoops / 4 && reader.Next(&frame); ++sent)
+                        rejected += send(frame) != 0;
+                double send_seconds = std::max<int64_t>(rtc::TimeNanos() - start_ns, 1) / 1e9;
+
+                printf("  %-16s %5d frames %4d key  read %6.2f GB/s %9.0f frames/s  "
+                       "sent %8.0f frames/s %9.0f packets/s\n",
+                       name, count, key_count, bytes / read_seconds / 1e9, read / read_seconds,
+                       sent / send_seconds, sink.packets() / send_seconds);
+                if (count != frames || key_count != keys || broken || allocations || rejected ||
+                    sink.errors()) {
+                        printf("  %s: %d of %d frames, %d of %d keys, %s, %lld allocations, "
+                               "%d rejected, %d broken packets\n",
+                               name, count, frames, key_count, keys, broken ? "out of order" : "in order",
+                               static_cast<long long>(allocations), rejected, sink.errors());
+                        ++g_failures;
+                }
+        }
+
+        void BenchEsReader() {
+                const int kFrames = 600;
+                std::vector<std::vector<uint8_t>> streams;
+                for (int h265 = 0; h265 < 2; ++h265) {
+                        int nal_units = 0;
+                        std::vector<uint8_t> es = MakeElementaryStream(h265, 4000, kFrames, &nal_units);
+                        RunEsReader(h265 ? "H.265 4 Mbit/s" : "H.264 4 Mbit/s", es, h265 ? ".h265" : ".h264",
+                                    kFrames, kFrames / 60);
+                }
+                std::vector<uint8_t> aac;
+                std::vector<uint8_t> adts = MakeAdtsFrame(384);
+                for (int i = 0; i < kFrames * 2; ++i)
+                        aac.insert(aac.end(), adts.begin(), adts.end());
+                RunEsReader("AAC 48 kHz", aac, ".aac", kFrames * 2, kFrames * 2);
+
+                // Pacing: 20 frames at 100 fps take 190 ms.
+                int nal_units = 0;
+                std::string path = WriteTempFile(MakeElementaryStream(false, 500, 20, &nal_units), ".h264");
+                EsReader reader;
+                if (path.empty() || reader.Open(path.c_str(), EsFormat::H264, 100) != 0) {
+                        ++g_failures;
+                        return;
+                }
+                unlink(path.c_str());
+                reader.set_realtime(true);
+                EsFrame frame;
+                int64_t start_us = rtc::TimeMicros();
+                while (reader.Next(&frame)) {
+                }
+                int64_t elapsed_ms = (rtc::TimeMicros() - start_us) / 1000;
+                printf("  real time: 20 frames at 100 fps in %lld ms\n", static_cast<long long>(elapsed_ms));
+                if (elapsed_ms < 180 || elapsed_ms > 400) {
+                        printf("  pacing off, expected 190 ms\n");
+                        ++g_failures;
+                }
+        }
+
+        // What left a pacer, and when.
+        class RecordingSink : public RtpPacketSink {
+        public:
+                struct Sent {
+                        int64_t time_us;
+                        uint32_t ssrc;
+                        uint16_t sequence_number;
+                        size_t len;
+                };
+
+                explicit RecordingSink(webrtc::Clock* clock) : clock_(clock) {}
+
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        uint32_t ssrc = (uint32_t(data[8]) << 24) | (uint32_t(data[9]) << 16) |
+                        (uint32_t(data[10]) << 8) | data[11];
+                        sent.push_back({clock_->TimeInMicroseconds(), ssrc, Read16(data + 2), len});
+                }
+
+                // Most bytes in any |window_ms|, as kbit/s.
+                int64_t PeakKbps(int window_ms) const {
+                        int64_t peak = 0;
+                        int64_t bytes = 0;
+                        for (size_t first = 0, last = 0; last < sent.size(); ++last) {
+                                bytes += sent[last].len;
+                                while (sent[last].time_us - sent[first].time_us >= window_ms * 1000)
+                                        bytes -= sent[first++].len;
+                                peak = std::max(peak, bytes);
+                        }
+                        return peak * 8 / window_ms;
+                }
+
+                std::vector<Sent> sent;
+
+        private:
+                webrtc::Clock* clock_;
+        };
+
+        struct PacerTrace {
+                int64_t peak_kbps = 0;
+                int64_t audio_delay_us = 0;
+                int64_t retransmission_delay_us = -1;
+                int64_t max_queue_us = 0;
+                size_t packets = 0;
+                std::vector<RecordingSink::Sent> sent;
+        };
+
+        // Two seconds of H.264 and AAC through RtpRtcpImpl on a simulated
+        // clock: a 150 kB key frame, 5 kB frames after it every 40 ms, an
+        // ADTS frame every 20 ms, and at 30 ms a NACK for the key frame's
+        // first packet. |kbps| 0 lets every packet out on the tick it was
+        // sent on.
+        PacerTrace RunPacedSender(int kbps) {
+                const int kRunMs = 2000;
+                const int kNackMs = 30;
+                webrtc::SimulatedClock clock(1000000);
+                TimerWheel wheel(clock.TimeInMilliseconds());
+                RecordingSink sink(&clock);
+                RtpPacer pacer(&clock, &wheel, &sink);
+                RtpRtcpImpl sender;
+                pacer.SetPacingRate(kbps * 1000LL);
+                pacer.SetAudioSsrc(sender.GetAudioSSRC());
+                sender.SetPacketSink(&pacer);
+
+                std::vector<uint8_t> key = MakeAccessUnit(false, true, 150000);
+                std::vector<uint8_t> delta = MakeAccessUnit(false, false, 5000);
+                std::vector<uint8_t> adts = MakeAdtsFrame(384);
+                PacerTrace trace;
+                uint16_t first_video = 0;
+                uint32_t video_ssrc = 0;
+                int64_t nack_us = 0;
+                int64_t start_us = clock.TimeInMicroseconds();
+                for (int ms = 0; ms < kRunMs; ++ms) {
+                        if (ms % 40 == 0) {
+                                std::vector<uint8_t>& au = ms == 0 ? key : delta;
+                                sender.SendVideo(reinterpret_cast<char*>(au.data()), static_cast<int>(au.size()),
+                                                 ms == 0, ms);
+                        }
+                        if (ms % 20 == 0)
+                                sender.SendAduio(reinterpret_cast<char*>(adts.data()),
+                                                 static_cast<int>(adts.size()), ms);
+                        if (ms == kNackMs) {
+                                for (const RecordingSink::Sent& sent : sink.sent) {
+                                        if (sent.ssrc != sender.GetAudioSSRC()) {
+                                                first_video = sent.sequence_number;
+                                                video_ssrc = sent.ssrc;
+                                                break;
+                                        }
+                                }
+                                uint8_t nack[16] = {0x81, 205, 0, 3};
+                                nack[8] = static_cast<uint8_t>(video_ssrc >> 24);
+                                nack[9] = static_cast<uint8_t>(video_ssrc >> 16);
+                                nack[10] = static_cast<uint8_t>(video_ssrc >> 8);
+                                nack[11] = static_cast<uint8_t>(video_ssrc);
+                                Write16(nack + 12, first_video);
+                                nack_us = clock.TimeInMicroseconds();
+                                sender.IncomingRtcpPacket(nack, sizeof(nack));
+                        }
+                        wheel.Advance(clock.TimeInMilliseconds());
+                        clock.AdvanceTimeMilliseconds(1);
+                }
+                wheel.Advance(clock.TimeInMilliseconds());
+
+                trace.peak_kbps = sink.PeakKbps(10);
+                trace.max_queue_us = pacer.stats().max_queue_us;
+                trace.packets = sink.sent.size();
+                for (const RecordingSink::Sent& sent : sink.sent) {
+                        int64_t at_us = sent.time_us - start_us;
+                        if (sent.ssrc == sender.GetAudioSSRC()) {
+                                // Audio goes out on the tick it was sent on.
+                                trace.audio_delay_us = std::max(trace.audio_delay_us, at_us % 20000);
+                        } else if (sent.ssrc == video_ssrc && sent.sequence_number == first_video &&
+                                   sent.time_us >= nack_us && trace.retransmission_delay_us < 0) {
+                                trace.retransmission_delay_us = sent.time_us - nack_us;
+                        }
+                }
+                trace.sent = sink.sent;
+                return trace;
+        }
+
+        // Many pacers on one wheel, each sending 40 packet frames every 40
+        // ms at a rate that just drains them; times the pacers and the
+        // wheel per packet.
+        void RunPacerOverhead(int pacers) {
+                const int kRunMs = 2000;
+                const int kFramePackets = 40;
+                const size_t kPacketSize = 1200;
+                webrtc::SimulatedClock clock(1000000);
+                TimerWheel wheel(clock.TimeInMilliseconds());
+                CountingSink sink;
+                std::vector<std::unique_ptr<RtpPacer>> paced;
+                for (int i = 0; i < pacers; ++i) {
+                        paced.emplace_back(new RtpPacer(&clock, &wheel, &sink));
+                        paced.back()->SetPacingRate(kFramePackets * kPacketSize * 8 * 25 * 5 / 4);
+                }
+                uint8_t packet[kPacketSize];
+                memset(packet, 0, sizeof(packet));
+                packet[0] = 0x80;
+                packet[1] = 96;
+                int64_t enqueued = 0;
+                int64_t allocations = g_allocations;
+                int64_t start_ns = rtc::TimeNanos();
+                for (int ms = 0; ms < kRunMs; ++ms) {
+                        for (int i = 0; i < pacers; ++i) {
+                                // Frames spread over the 40 ms, not all at once.
+                                if ((ms + i) % 40)
+                                        continue;
+                                Write32(packet + 8, 0x7000 + i);
+                                for (int n = 0; n < kFramePackets; ++n, ++enqueued) {
+                                        Write16(packet + 2, static_cast<uint16_t>(ms / 40 * kFramePackets + n));
+                                        paced[i]->OnRtpPacket(packet, sizeof(packet));
+                                }
+                        }
+                        wheel.Advance(clock.TimeInMilliseconds());
+                        clock.AdvanceTimeMilliseconds(1);
+                }
+                for (int ms = 0; ms < 100; ++ms) {
+                        wheel.Advance(clock.TimeInMilliseconds());
+                        clock.AdvanceTimeMilliseconds(1);
+                }
+                int64_t elapsed_ns = rtc::TimeNanos() - start_ns;
+                allocations = g_allocations - allocations;
+                printf("  %5d pacers: %6.1f ns/packet, %lld of %lld sent, %lld allocations\n",
+                       pacers, double(elapsed_ns) / std::max<int64_t>(enqueued, 1),
+                       static_cast<long long>(sink.packets.load()), static_cast<long long>(enqueued),
+                       static_cast<long long>(allocations));
+                if (sink.packets != enqueued || allocations)
+                        ++g_failures;
+        }
+
+        void BenchPacer() {
+                const int kKbps = 2500;
+                PacerTrace unpaced = RunPacedSender(0);
+                PacerTrace paced = RunPacedSender(kKbps);
+                PacerTrace again = RunPacedSender(kKbps);
+                printf("H.264 with a 150 kB key frame and AAC, 2 s on a simulated clock\n");
+                printf("  unpaced:          peak %6lld kbit/s over 10 ms, %zu packets\n",
+                       static_cast<long long>(unpaced.peak_kbps), unpaced.packets);
+                printf("  paced %d kbit/s: peak %6lld kbit/s over 10 ms, %zu packets, audio within %lld us, "
+                       "retransmission after %lld us, longest wait %lld ms\n",
+                       kKbps, static_cast<long long>(paced.peak_kbps), paced.packets,
+                       static_cast<long long>(paced.audio_delay_us),
+                       static_cast<long long>(paced.retransmission_delay_us),
+                       static_cast<long long>(paced.max_queue_us / 1000));
+                bool same = paced.sent.size() == again.sent.size();
+                for (size_t i = 0; same && i < paced.sent.size(); ++i) {
+                        same = paced.sent[i].time_us - paced.sent[0].time_us ==
+                        again.sent[i].time_us - again.sent[0].time_us &&
+                        paced.sent[i].len == again.sent[i].len;
+                }
+                // A packet over the rate plus the burst is allowed.
+                int64_t limit_kbps = kKbps + (kKbps * RtpPacer::kBurstMs / 1000 * 1000 / 8 +
+                                              RtpPacketPool::kBufferSize) * 8 / 10;
+                if (paced.packets != unpaced.packets || paced.peak_kbps > limit_kbps ||
+                    paced.audio_delay_us > 1000 || paced.retransmission_delay_us < 0 ||
+                    paced.retransmission_delay_us > 2000 || !same) {
+                        printf("  pacing broken: %s, peak limit %lld kbit/s\n",
+                               same ? "deterministic" : "not deterministic", static_cast<long long>(limit_kbps));
+                        ++g_failures;
+                }
+
+                printf("scheduling overhead\n");
+                for (int pacers : {1, 100, 1000})
+                        RunPacerOverhead(pacers);
+        }
+
+        struct BenchCase {
+                const char* name;
+                void (*run)();
+        };
+
+        const BenchCase kBenchCases[] = {
+                {"fanout", BenchFanOut},
+                {"sfu", BenchSfu},
+                {"mmsg", BenchBatchedUdp},
+                {"gso", BenchOffload},
+                {"packetize", BenchPacketize},
+                {"jitter", BenchJitter},
+                {"pool", BenchPool},
+                {"annexb", BenchAnnexB},
+                {"esreader", BenchEsReader},
+                {"pacer", BenchPacer},
+        };
+
+}  // namespace
+
+// Counts every allocation so a case can check its hot path makes none.
+void* operator new(size_t size) {
+        ++g_allocations;
+        void* p = malloc(size ? size : 1);
+        if (!p)
+                abort();
+        return p;
+}
+
+void operator delete(void* p) noexcept {
+        free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+        free(p);
+}
+
+int main(int argc, char** argv) {
+        const char* which = argc > 1 ? argv[1] : nullptr;
+        bool ran = false;
+        for (const BenchCase& bench : kBenchCases) {
+                if (which && strcmp(which, bench.name) != 0)
+                        continue;
+                printf("== %s\n", bench.name);
+                bench.run();
+                ran = true;
+        }
+        if (!ran) {
+                fprintf(stderr, "unknown benchmark: %s\n", which);
+                return 1;
+        }
+        return g_failures ? 1 : 0;
+}
@@ -0,0 +1,219 @@
+#include "es_reader.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <thread>
+
+#include "rtp_packetizer.h"
+
+namespace {
+        const uint32_t kAacSamplesPerFrame = 1024;
+
+        bool IsAdts(const uint8_t* data, size_t len) {
+                return len >= 7 && data[0] == 0xff && (data[1] & 0xf6) == 0xf0;
+        }
+
+        bool EndsWith(const char* s, const char* suffix) {
+                size_t len = strlen(s);
+                size_t suffix_len = strlen(suffix);
+                return len >= suffix_len && strcasecmp(s + len - suffix_len, suffix) == 0;
+        }
+
+        // What a NAL unit means for access unit boundaries (H.264 7.4.1.2.3,
+        // H.265 7.4.2.4.4). |header| points past the start code, |len| bytes.
+        struct NalInfo {
+                bool vcl;
+                // Starts a new access unit if one with a slice is open.
+                bool starts_access_unit;
+                bool key;
+        };
+
+        NalInfo ParseNal(EsFormat format, const uint8_t* header, size_t len) {
+                NalInfo info = {false, false, false};
+                if (format == EsFormat::H264) {
+                        if (len < 1)
+                                return info;
+                        uint8_t type = header[0] & 0x1f;
+                        info.vcl = type >= 1 && type <= 5;
+                        // first_mb_in_slice is ue(v); 0 is a lone 1 bit.
+                        info.starts_access_unit = info.vcl ? len >= 2 && (header[1] & 0x80)
+                                                           : (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+                        info.key = type == 5;
+                } else {
+                        if (len < 2)
+                                return info;
+                        uint8_t type = (header[0] >> 1) & 0x3f;
+                        info.vcl = type < 32;
+                        // first_slice_segment_in_pic_flag.
+                        info.starts_access_unit = info.vcl ? len >= 3 && (header[2] & 0x80)
+                                                           : (type >= 32 && type <= 35) || type == 39 ||
+                                                           (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+                        info.key = type >= 16 && type <= 23;
+                }
+                return info;
+        }
+}  // namespace
+
+EsReader::EsReader()
+: format_(EsFormat::H264), fps_(25), loop_(false), realtime_(false),
+data_(nullptr), size_(0), begin_(0), pos_(0), frames_(0), samples_(0),
+sample_rate_(0), loops_(0), pass_frames_(0) {}
+
+EsReader::~EsReader() {
+        Close();
+}
+
+bool EsReader::FormatFromPath(const char* path, EsFormat* format) {
+        for (const char* suffix : {".h264", ".264", ".avc"}) {
+                if (EndsWith(path, suffix)) {
+                        *format = EsFormat::H264;
+                        return true;
+                }
+        }
+        for (const char* suffix : {".h265", ".265", ".hevc"}) {
+                if (EndsWith(path, suffix)) {
+                        *format = EsFormat::H265;
+                        return true;
+                }
+        }
+        for (const char* suffix : {".aac", ".adts"}) {
+                if (EndsWith(path, suffix)) {
+                        *format = EsFormat::AAC;
+                        return true;
+                }
+        }
+        return false;
+}
+
+int EsReader::Open(const char* path, EsFormat format, double fps) {
+        Close();
+        if (fps <= 0)
+                return -1;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+                return -1;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+                close(fd);
+                return -1;
+        }
+        void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping holds its own reference to the file.
+        close(fd);
+        if (mapping == MAP_FAILED)
+                return -1;
+        madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+        data_ = static_cast<const uint8_t*>(mapping);
+        size_ = static_cast<size_t>(st.st_size);
+        format_ = format;
+        fps_ = fps;
+        begin_ = format == EsFormat::AAC ? 0 : FirstStartCode();
+        pos_ = begin_;
+        frames_ = samples_ = loops_ = pass_frames_ = 0;
+        sample_rate_ = 0;
+        return 0;
+}
+
+void EsReader::Close() {
+        if (data_)
+                munmap(const_cast<uint8_t*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+}
+
+size_t EsReader::FirstStartCode() const {
+        size_t start = AnnexBReader::FindStartCode(data_, size_, 0);
+        while (start > 0 && data_[start - 1] == 0)
+                --start;
+        return start;
+}
+
+bool EsReader::Next(EsFrame* frame) {
+        if (!data_)
+                return false;
+        bool found = format_ == EsFormat::AAC ? NextAdtsFrame(frame) : NextAccessUnit(frame);
+        if (!found) {
+                if (!loop_ || !pass_frames_)
+                        return false;
+                pos_ = begin_;
+                pass_frames_ = 0;
+                ++loops_;
+                found = format_ == EsFormat::AAC ? NextAdtsFrame(frame) : NextAccessUnit(frame);
+                if (!found)
+                        return false;
+        }
+        ++pass_frames_;
+        ++frames_;
+
+        if (realtime_) {
+                std::chrono::milliseconds due(frame->timestamp_ms);
+                if (frames_ == 1)
+                        start_ = std::chrono::steady_clock::now() - due;
+                std::this_thread::sleep_until(start_ + due);
+        }
+        return true;
+}
+
+bool EsReader::NextAccessUnit(EsFrame* frame) {
+        size_t begin = pos_;
+        size_t code = AnnexBReader::FindStartCode(data_, size_, begin);
+        if (code == size_)
+                return false;
+        bool has_slice = false;
+        bool key = false;
+        size_t end = size_;
+        while (code < size_) {
+                const uint8_t* header = data_ + code + 3;
+                size_t next = AnnexBReader::FindStartCode(data_, size_, code + 3);
+                NalInfo info = ParseNal(format_, header, next - code - 3);
+                if (has_slice && info.starts_access_unit) {
+                        // Zero bytes in front of the start code go with
+                        // the access unit it begins.
+                        end = code;
+                        while (end > begin && data_[end - 1] == 0)
+                                --end;
+                        break;
+                }
+                has_slice |= info.vcl;
+                key |= info.key;
+                code = next;
+        }
+        pos_ = end;
+        frame->data = data_ + begin;
+        frame->len = end - begin;
+        frame->timestamp_ms = std::llround(frames_ * 1000 / fps_);
+        frame->key = key;
+        return true;
+}
+
+bool EsReader::NextAdtsFrame(EsFrame* frame) {
+        while (pos_ < size_) {
+                const uint8_t* p = data_ + pos_;
+                size_t left = size_ - pos_;
+                if (IsAdts(p, left)) {
+                        size_t len = ((p[3] & 0x03) << 11) | (p[4] << 3) | (p[5] >> 5);
+                        int rate = RtpPacketizer::AdtsSampleRate(p, left);
+                        if (len >= 7 && len <= left && rate) {
+                                if (!sample_rate_)
+                                        sample_rate_ = rate;
+                                frame->data = p;
+                                frame->len = len;
+                                frame->timestamp_ms = static_cast<int64_t>(samples_ * 1000 / sample_rate_);
+                                frame->key = true;
+                                samples_ += kAacSamplesPerFrame;
+                                pos_ += len;
+                                return true;
+                        }
+                }
+                // Lost sync: look for the next syncword.
+                const void* sync = memchr(p + 1, 0xff, left - 1);
+                pos_ = sync ? static_cast<const uint8_t*>(sync) - data_ : size_;
+        }
+        return false;
+}
@@ -0,0 +1,95 @@
+#ifndef ES_READER_H_
+#define ES_READER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+enum class EsFormat {
+        H264,   // Annex-B byte stream
+        H265,   // Annex-B byte stream
+        AAC,    // ADTS frames
+};
+
+// One frame of an elementary stream, pointing into the file mapping: an
+// Annex-B access unit, start codes included, or one ADTS frame.
+struct EsFrame {
+        const uint8_t* data;
+        size_t len;
+        // From the first frame of the first pass, in ms. Keeps counting up
+        // when the reader loops.
+        int64_t timestamp_ms;
+        bool key;
+};
+
+// Reads an H.264, H.265 or AAC elementary stream file frame by frame. The
+// file is memory mapped and frames are handed out as pointers into the
+// mapping, valid until Close(); nothing is copied.
+//
+// Video access units are found the way a decoder finds them: an access
+// unit delimiter, parameter set or SEI after a slice, or a slice that
+// starts a new picture, begins the next one. Video has no timestamps in
+// the stream, frames are |fps| apart; ADTS frames are 1024 samples at
+// their own sample rate.
+//
+// With set_loop() the reader starts over at the end of the file, with
+// timestamps carrying on, so a short clip makes an endless, reproducible
+// stream. With set_realtime() Next() sleeps until a frame is due.
+class EsReader {
+public:
+        EsReader();
+        EsReader(const EsReader&) = delete;
+        EsReader& operator=(const EsReader&) = delete;
+        ~EsReader();
+
+        // |fps| is ignored for AAC. Returns 0 or -1.
+        int Open(const char* path, EsFormat format, double fps = 25);
+        void Close();
+
+        void set_loop(bool loop) { loop_ = loop; }
+        void set_realtime(bool realtime) { realtime_ = realtime; }
+
+        // False at the end of the file when not looping, or if the file
+        // has no frame at all.
+        bool Next(EsFrame* frame);
+
+        EsFormat format() const { return format_; }
+        size_t size() const { return size_; }
+        // Frames handed out so far, and times the reader started over.
+        uint64_t frames() const { return frames_; }
+        uint64_t loops() const { return loops_; }
+
+        // H.264 for .h264/.264/.avc, H.265 for .h265/.265/.hevc, AAC for
+        // .aac/.adts. False for anything else.
+        static bool FormatFromPath(const char* path, EsFormat* format);
+
+private:
+        bool NextAccessUnit(EsFrame* frame);
+        bool NextAdtsFrame(EsFrame* frame);
+        // Where the Annex-B stream starts, zero bytes of the first start
+        // code included.
+        size_t FirstStartCode() const;
+
+        EsFormat format_;
+        double fps_;
+        bool loop_;
+        bool realtime_;
+
+        const uint8_t* data_;
+        size_t size_;
+        size_t begin_;
+        size_t pos_;
+
+        // Frames and samples since the first frame, across loops.
+        uint64_t frames_;
+        uint64_t samples_;
+        int sample_rate_;
+        uint64_t loops_;
+        // Frames handed out in this pass; a pass without any ends the
+        // stream even when looping.
+        uint64_t pass_frames_;
+
+        std::chrono::steady_clock::time_point start_;
+};
+
+#endif // ES_READER_H_
@@ -0,0 +1,138 @@
+/*
+ * rtpload file [ip [port [fps [kbps]]]]
+ *
+ * Sends an H.264, H.265 or AAC elementary stream file, picked by its
+ * extension, through RtpRtcpImpl to ip:port (default 127.0.0.1:5004) in
+ * real time, looping forever. With |kbps| the packets go through an
+ * RtpPacer at that rate instead of leaving a frame at a time. On Linux
+ * runs of equal-size packets leave with UDP GSO where the kernel has it.
+ * NACKs coming back are answered. Prints what went out every five seconds.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "es_reader.h"
+#include "myrtprtcp.h"
+#include "rtp_pacer.h"
+#include "system_wrappers/include/clock.h"
+#include "udp_batch_transport.h"
+
+namespace {
+        volatile sig_atomic_t g_quit = 0;
+
+        void OnSignal(int) {
+                g_quit = 1;
+        }
+
+        // Hands what the receiver sends back to the sender: RTCP, and RTP
+        // if it streams too, for the receiver reports.
+        class Feedback : public RtpPacketSink {
+        public:
+                explicit Feedback(RtpRtcpImpl* sender) : sender_(sender) {}
+                void OnRtpPacket(const uint8_t* data, size_t len) override {
+                        sender_->IncomingRtpPacket(data, len);
+                }
+                void OnRtcpPacket(const uint8_t* data, size_t len) override {
+                        sender_->IncomingRtcpPacket(data, len);
+                }
+
+        private:
+                RtpRtcpImpl* sender_;
+        };
+}  // namespace
+
+int main(int argc, char** argv) {
+        if (argc < 2) {
+                fprintf(stderr, "usage: %s file [ip [port [fps [kbps]]]]\n", argv[0]);
+                return 1;
+        }
+        const char* path = argv[1];
+        const char* ip = argc > 2 ? argv[2] : "127.0.0.1";
+        int port = argc > 3 ? atoi(argv[3]) : 5004;
+        double fps = argc > 4 ? atof(argv[4]) : 25;
+        int kbps = argc > 5 ? atoi(argv[5]) : 0;
+
+        EsFormat format;
+        if (!EsReader::FormatFromPath(path, &format)) {
+                fprintf(stderr, "%s: not .h264, .h265 or .aac\n", path);
+                return 1;
+        }
+        EsReader reader;
+        if (reader.Open(path, format, fps) != 0) {
+                fprintf(stderr, "cannot read %s\n", path);
+                return 1;
+        }
+        reader.set_loop(true);
+
+        UdpBatchTransport transport;
+        if (transport.Open("0.0.0.0", 0) != 0 ||
+            transport.SetRemote(ip, static_cast<uint16_t>(port)) != 0) {
+                fprintf(stderr, "cannot send to %s:%d\n", ip, port);
+                return 1;
+        }
+        bool gso = transport.EnableGso(true);
+        webrtc::Clock* clock = webrtc::Clock::GetRealTimeClock();
+        TimerWheel wheel(clock->TimeInMilliseconds());
+        RtpPacer pacer(clock, &wheel, &transport);
+        RtpRtcpImpl sender;
+        if (kbps > 0) {
+                pacer.SetPacingRate(kbps * 1000LL);
+                pacer.SetAudioSsrc(sender.GetAudioSSRC());
+                sender.SetPacketSink(&pacer);
+        } else {
+                sender.SetPacketSink(&transport);
+        }
+        if (format == EsFormat::H265)
+                sender.ChangeAVFormat(AudioFormat::Same, VideoFormat::H265);
+        Feedback feedback(&sender);
+
+        signal(SIGINT, OnSignal);
+        signal(SIGTERM, OnSignal);
+        printf("sending %s to %s:%d%s%s\n", path, ip, port, kbps > 0 ? ", paced" : "",
+               gso ? ", gso" : "");
+
+        int64_t start_ms = clock->TimeInMilliseconds();
+        int64_t last_ms = start_ms;
+        uint64_t last_frames = 0;
+        UdpBatchTransport::Stats last_stats;
+        EsFrame frame;
+        bool more = reader.Next(&frame);
+        while (!g_quit && more) {
+                int64_t now_ms = clock->TimeInMilliseconds();
+                for (; more && start_ms + frame.timestamp_ms <= now_ms; more = reader.Next(&frame)) {
+                        char* data = reinterpret_cast<char*>(const_cast<uint8_t*>(frame.data));
+                        int len = static_cast<int>(frame.len);
+                        if (format == EsFormat::AAC)
+                                sender.SendAduio(data, len, frame.timestamp_ms);
+                        else
+                                sender.SendVideo(data, len, frame.key, frame.timestamp_ms);
+                }
+                wheel.Advance(now_ms);
+                transport.Flush();
+                while (transport.Receive(&feedback, 0) > 0) {
+                }
+                // The pacer works in milliseconds.
+                usleep(1000);
+
+                double seconds = (now_ms - last_ms) / 1000.0;
+                if (seconds < 5)
+                        continue;
+                const UdpBatchTransport::Stats& stats = transport.stats();
+                printf("frames:%llu packets:%llu gso sends:%llu loops:%llu queued:%zu "
+                       "%.0f fps %.0f packets/s\n",
+                       static_cast<unsigned long long>(reader.frames() - last_frames),
+                       static_cast<unsigned long long>(stats.packets_sent - last_stats.packets_sent),
+                       static_cast<unsigned long long>(stats.gso_sends - last_stats.gso_sends),
+                       static_cast<unsigned long long>(reader.loops()), pacer.queued_packets(),
+                       (reader.frames() - last_frames) / seconds,
+                       (stats.packets_sent - last_stats.packets_sent) / seconds);
+                fflush(stdout);
+                last_ms = now_ms;
+                last_frames = reader.frames();
+                last_stats = stats;
+        }
+        return 0;
+}
@@ -0,0 +1,5 @@
+#include "myrtprtcp.h"
+
+int main() {
+        RtpRtcpImpl r;
+}
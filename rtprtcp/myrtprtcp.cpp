@@ -1,20 +1,19 @@
 #include "myrtprtcp.h"
+#include "rtp_packetizer.h"
 #include <map>
 #include <memory>
 #include <set>
+#include <vector>
 #include <cassert>
 #include <iostream>
 #include <chrono>
 
 #include "api/video_codecs/video_codec.h"
-#include "modules/rtp_rtcp/include/rtp_header_parser.h"
 #include "modules/rtp_rtcp/include/rtp_rtcp_defines.h"
 #include "modules/rtp_rtcp/source/rtcp_packet.h"
 #include "modules/rtp_rtcp/source/rtcp_packet/nack.h"
 #include "modules/rtp_rtcp/source/rtp_packet_received.h"
 #include "modules/rtp_rtcp/source/rtp_rtcp_impl.h"
-#include "modules/rtp_rtcp/source/rtp_sender_video.h"
-#include "modules/rtp_rtcp/source/rtp_sender_audio.h"
 #include "rtc_base/rate_limiter.h"
 #include "rtc_base/thread.h"
 #include "rtc_base/socket.h"
@@ -31,19 +30,12 @@ const uint32_t kSenderSsrc = 0x12345;
 const uint32_t kReceiverSsrc = 0x23456;
 const int64_t kOneWayNetworkDelayMs = 100;
 const uint16_t kSequenceNumber = 100;
-
-#include "api/transport/webrtc_key_value_config.h"
-#include "api/transport/field_trial_based_config.h"
-#include "system_wrappers/include/field_trial.h"
-class MyFieldTrialBasedConfig : public WebRtcKeyValueConfig {
-public:
-        std::string Lookup(absl::string_view key) const override;
-};
-std::string MyFieldTrialBasedConfig::Lookup(absl::string_view key) const {
-        return field_trial::FindFullName(std::string(key));
-}
-
-
+// Payload types of the streams RtpRtcpImpl sends.
+const uint8_t kVideoPayloadType = 96;
+const uint8_t kAudioPayloadType = 97;
+const uint8_t kDataPayloadType = 98;
+// Buffers for every packetizer's retransmission history and then some.
+const size_t kPacketPoolSize = 3 * RtpPacketizer::kHistorySize + 16;
 
 class RtcpRttStatsTestImpl : public RtcpRttStats {
 public:
@@ -59,12 +51,15 @@ class SendTransport : public Transport {
 public:
         SendTransport()
         : receiver_(nullptr),
+        sink_(nullptr),
         clock_(nullptr),
         delay_ms_(0),
         rtp_packets_sent_(0),
-        rtcp_packets_sent_(0) {}
+        rtcp_packets_sent_(0),
+        last_sequence_number_(0) {}
         
         void SetRtpRtcpModule(ModuleRtpRtcpImpl* receiver) { receiver_ = receiver; }
+        void SetPacketSink(RtpPacketSink* sink) { sink_ = sink; }
         void SimulateNetworkDelay(int64_t delay_ms, SimulatedClock* clock) {
                 clock_ = clock;
                 delay_ms_ = delay_ms;
@@ -72,11 +67,13 @@ public:
         bool SendRtp(const uint8_t* data,
                      size_t len,
                      const PacketOptions& options) override {
-                RTPHeader header;
-                std::unique_ptr<RtpHeaderParser> parser(RtpHeaderParser::Create());
-                assert(parser->Parse(static_cast<const uint8_t*>(data), len, &header));
+                // The packet comes from our own RTPSender; the sequence
+                // number is all we keep, no need for a parser per packet.
+                assert(len >= 12);
                 ++rtp_packets_sent_;
-                last_rtp_header_ = header;
+                last_sequence_number_ = static_cast<uint16_t>((data[2] << 8) | data[3]);
+                if (sink_)
+                        sink_->OnRtpPacket(data, len);
                 return true;
         }
         bool SendRtcp(const uint8_t* data, size_t len) override {
@@ -87,6 +84,8 @@ public:
                 if (clock_) {
                         clock_->AdvanceTimeMilliseconds(delay_ms_);
                 }
+                if (sink_)
+                        sink_->OnRtcpPacket(data, len);
                 assert(receiver_);
                 receiver_->IncomingRtcpPacket(data, len);
                 ++rtcp_packets_sent_;
@@ -94,11 +93,12 @@ public:
         }
         size_t NumRtcpSent() { return rtcp_packets_sent_; }
         ModuleRtpRtcpImpl* receiver_;
+        RtpPacketSink* sink_;
         SimulatedClock* clock_;
         int64_t delay_ms_;
         int rtp_packets_sent_;
         size_t rtcp_packets_sent_;
-        RTPHeader last_rtp_header_;
+        uint16_t last_sequence_number_;
         std::vector<uint16_t> last_nack_list_;
 };
 
@@ -143,7 +143,7 @@ public:
         }
         int RtpSent() { return transport_.rtp_packets_sent_; }
         uint16_t LastRtpSequenceNumber() {
-                return transport_.last_rtp_header_.sequenceNumber;
+                return transport_.last_sequence_number_;
         }
         std::vector<uint16_t> LastNackListSent() {
                 return transport_.last_nack_list_;
@@ -180,24 +180,16 @@ public:
         void SetUp() /*override*/ {
                 // Send module.
                 sender_.impl_->SetSSRC(kSenderSsrc);
-                assert(0 == sender_.impl_->SetSendingStatus(true));
+                int ret = sender_.impl_->SetSendingStatus(true);
+                assert(ret == 0);
                 sender_.impl_->SetSendingMediaStatus(true);
                 sender_.SetRemoteSsrc(kReceiverSsrc);
                 sender_.impl_->SetSequenceNumber(kSequenceNumber);
-                sender_.impl_->SetStorePacketsStatus(true, 100);
-                
-                sender_video_ = absl::make_unique<RTPSenderVideo>(
-                                                                  &clock_, sender_.impl_->RtpSender(), nullptr, &playout_delay_oracle_,
-                                                                  nullptr, false, MyFieldTrialBasedConfig());
-                
-                memset(&codec_, 0, sizeof(VideoCodec));
-                codec_.plType = 100;
-                codec_.width = 320;
-                codec_.height = 180;
-                sender_video_->RegisterPayloadType(codec_.plType, "VP8");
                 
                 // Receive module.
-                assert(0 == receiver_.impl_->SetSendingStatus(false));
+                ret = receiver_.impl_->SetSendingStatus(false);
+                assert(ret == 0);
+                (void)ret;
                 receiver_.impl_->SetSendingMediaStatus(false);
                 receiver_.impl_->SetSSRC(kReceiverSsrc);
                 receiver_.SetRemoteSsrc(kSenderSsrc);
@@ -207,35 +199,22 @@ public:
         }
         
         SimulatedClock clock_;
-        PlayoutDelayOracle playout_delay_oracle_;
         RtpRtcpModule sender_;
-        std::unique_ptr<RTPSenderVideo> sender_video_;
-        std::unique_ptr<RTPSenderAudio> sender_audio_;
         RtpRtcpModule receiver_;
-        VideoCodec codec_;
         
-        void SendFrame(const RtpRtcpModule* module,
-                       RTPSenderVideo* sender,
-                       uint8_t tid) {
-                RTPVideoHeaderVP8 vp8_header = {};
-                vp8_header.temporalIdx = tid;
-                RTPVideoHeader rtp_video_header;
-                rtp_video_header.width = codec_.width;
-                rtp_video_header.height = codec_.height;
-                rtp_video_header.rotation = kVideoRotation_0;
-                rtp_video_header.content_type = VideoContentType::UNSPECIFIED;
-                rtp_video_header.playout_delay = {-1, -1};
-                rtp_video_header.is_first_packet_in_frame = true;
-                rtp_video_header.simulcastIdx = 0;
-                rtp_video_header.codec = kVideoCodecVP8;
-                rtp_video_header.video_type_header = vp8_header;
-                rtp_video_header.video_timing = {0u, 0u, 0u, 0u, 0u, 0u, false};
-                
-                const uint8_t payload[100] = {0};
-                assert(module->impl_->OnSendingRtpFrame(0, 0, codec_.plType, true));
-                assert(sender->SendVideo(VideoFrameType::kVideoFrameKey, codec_.plType,
-                                         0, 0, payload, sizeof(payload), nullptr,
-                                         &rtp_video_header, 0));
+        // RTP from the remote sender counts towards our receiver reports.
+        bool IncomingRtp(const uint8_t* data, size_t len) {
+                RtpPacketReceived packet;
+                if (!packet.Parse(data, len))
+                        return false;
+                packet.set_arrival_time_ms(clock_.TimeInMilliseconds());
+                receiver_.receive_statistics_->OnRtpPacket(packet);
+                return true;
+        }
+        
+        // RTCP from the remote receiver is feedback for our sender.
+        void IncomingRtcp(const uint8_t* data, size_t len) {
+                sender_.impl_->IncomingRtcpPacket(data, len);
         }
         
         void IncomingRtcpNack(const RtpRtcpModule* module, uint16_t sequence_number) {
@@ -252,10 +231,121 @@ public:
         }
 };
 
-RtpRtcpImpl::RtpRtcpImpl() {
+RtpRtcpImpl::RtpRtcpImpl()
+: audioFormat_(AudioFormat::AAC), videoFormat_(VideoFormat::H264),
+audioClockRate_(44100) {
         rtpRtcpImpl_ = absl::make_unique<RtpRtcpWebrtcImpl>();
+        rtpRtcpImpl_->SetUp();
+        pool_ = absl::make_unique<RtpPacketPool>(kPacketPoolSize);
+        video_ = absl::make_unique<RtpPacketizer>(pool_.get(), RtpPayloadFormat::H264,
+                                                  kVideoPayloadType, kSenderSsrc);
+        audio_ = absl::make_unique<RtpPacketizer>(pool_.get(), RtpPayloadFormat::AAC,
+                                                  kAudioPayloadType, kSenderSsrc + 1);
+        data_ = absl::make_unique<RtpPacketizer>(pool_.get(), RtpPayloadFormat::Data,
+                                                 kDataPayloadType, kSenderSsrc + 2);
+}
+
+// The packetizers go first and hand their history back to the pool.
+RtpRtcpImpl::~RtpRtcpImpl() {}
+
+void RtpRtcpImpl::SetPacketSink(RtpPacketSink* sink) {
+        rtpRtcpImpl_->sender_.transport_.SetPacketSink(sink);
+        video_->SetSink(sink);
+        audio_->SetSink(sink);
+        data_->SetSink(sink);
+}
+
+void RtpRtcpImpl::SetSSRC(uint32_t ssrc) {
+        rtpRtcpImpl_->sender_.impl_->SetSSRC(ssrc);
+        video_->SetSSRC(ssrc);
+        audio_->SetSSRC(ssrc + 1);
+        data_->SetSSRC(ssrc + 2);
 }
 
-int main() {
-        RtpRtcpImpl r;
+uint32_t RtpRtcpImpl::GetAudioSSRC() const {
+        return audio_->ssrc();
+}
+
+uint32_t RtpRtcpImpl::GetVideoSSRC() const {
+        return video_->ssrc();
+}
+
+int RtpRtcpImpl::IncomingRtpPacket(const uint8_t* data, size_t len) {
+        return rtpRtcpImpl_->IncomingRtp(data, len) ? 0 : -1;
+}
+
+int RtpRtcpImpl::IncomingRtcpPacket(const uint8_t* data, size_t len) {
+        if (len < 8)
+                return -1;
+        // Our packetizers keep the history, so NACKs are answered here;
+        // the module still sees everything for its reports and RTT.
+        const uint8_t* p = data;
+        size_t left = len;
+        while (left >= 12) {
+                size_t size = 4 * (((p[2] << 8) | p[3]) + 1);
+                if (size > left)
+                        break;
+                // RTPFB, FMT 1: generic NACK.
+                if (p[1] == 205 && (p[0] & 0x1f) == 1) {
+                        uint32_t media_ssrc = (uint32_t(p[8]) << 24) | (uint32_t(p[9]) << 16) |
+                        (uint32_t(p[10]) << 8) | p[11];
+                        RtpPacketizer* packetizer = nullptr;
+                        for (RtpPacketizer* candidate : {video_.get(), audio_.get(), data_.get()}) {
+                                if (candidate->ssrc() == media_ssrc)
+                                        packetizer = candidate;
+                        }
+                        for (size_t i = 12; packetizer && i + 4 <= size; i += 4) {
+                                uint16_t pid = static_cast<uint16_t>((p[i] << 8) | p[i + 1]);
+                                uint16_t blp = static_cast<uint16_t>((p[i + 2] << 8) | p[i + 3]);
+                                packetizer->Resend(pid);
+                                for (int bit = 0; bit < 16; ++bit) {
+                                        if (blp & (1 << bit))
+                                                packetizer->Resend(static_cast<uint16_t>(pid + bit + 1));
+                                }
+                        }
+                }
+                p += size;
+                left -= size;
+        }
+        rtpRtcpImpl_->IncomingRtcp(data, len);
+        return 0;
+}
+
+int RtpRtcpImpl::SendVideo(char *pData, int nLen, bool isKey, int64_t nTimestamp) {
+        if (nLen <= 0)
+                return -1;
+        // 90 kHz video clock.
+        uint32_t rtp_timestamp = static_cast<uint32_t>(nTimestamp * 90);
+        return video_->SendFrame(reinterpret_cast<uint8_t*>(pData), nLen, rtp_timestamp) > 0 ? 0 : -1;
+}
+
+int RtpRtcpImpl::SendAduio(char *pData, int nLen, int64_t nTimestamp) {
+        if (nLen <= 0)
+                return -1;
+        const uint8_t* data = reinterpret_cast<uint8_t*>(pData);
+        // The RTP clock is the sample rate; ADTS headers tell it.
+        int rate = RtpPacketizer::AdtsSampleRate(data, nLen);
+        if (rate)
+                audioClockRate_ = rate;
+        uint32_t rtp_timestamp = static_cast<uint32_t>(nTimestamp * audioClockRate_ / 1000);
+        return audio_->SendFrame(data, nLen, rtp_timestamp) > 0 ? 0 : -1;
+}
+
+int RtpRtcpImpl::SendData(char *pData, int nLen, int64_t nTimestamp) {
+        if (nLen <= 0)
+                return -1;
+        uint32_t rtp_timestamp = static_cast<uint32_t>(nTimestamp * 90);
+        return data_->SendFrame(reinterpret_cast<uint8_t*>(pData), nLen, rtp_timestamp) > 0 ? 0 : -1;
+}
+
+int RtpRtcpImpl::ChangeAVFormat(AudioFormat atype, VideoFormat vtype) {
+        if (atype != AudioFormat::Same)
+                audioFormat_ = atype;
+        if (vtype != VideoFormat::Same) {
+                videoFormat_ = vtype;
+                video_->SetFormat(vtype == VideoFormat::H265 ? RtpPayloadFormat::H265
+                                  : vtype == VideoFormat::VP8 ? RtpPayloadFormat::VP8
+                                                              : RtpPayloadFormat::H264);
+        }
+        return 0;
 }
@@ -1,10 +1,15 @@
+#ifndef MYRTPRTCP_H_
+#define MYRTPRTCP_H_
+
 #include <memory>
 #include <cstdint>
+#include <cstddef>
 
 enum class VideoFormat{
         Same,
         H264,
         H265,
+        VP8,
 };
 
 enum class AudioFormat {
@@ -12,19 +17,54 @@ enum class AudioFormat {
         AAC,
 };
 
+// Where RtpRtcpImpl writes the packets it sends. |data| is only valid
+// during the call.
+class RtpPacketSink {
+public:
+        virtual ~RtpPacketSink() {}
+        virtual void OnRtpPacket(const uint8_t* data, size_t len) = 0;
+        virtual void OnRtcpPacket(const uint8_t* data, size_t len) {}
+};
+
 class RtpRtcpWebrtcImpl;
+class RtpPacketPool;
+class RtpPacketizer;
 
 class RtpRtcpImpl {
 public:
         RtpRtcpImpl();
+        ~RtpRtcpImpl();
+        // nTimestamp is in milliseconds. Video is an Annex-B access unit or
+        // a VP8 frame, in the current format, audio one or more ADTS frames or a raw AAC
+        // access unit, data any bytes. Return 0 or -1. isKey is not used:
+        // the packetizers read key frames from the payload itself.
         int SendVideo(char *pData, int nLen, bool isKey, int64_t nTimestamp);
         int SendAduio(char *pData, int nLen, int64_t nTimestamp);
         int SendData(char *pData, int nLen, int64_t nTimestamp);
         int ChangeAVFormat(AudioFormat atype, VideoFormat vtype);
         AudioFormat GetAudioFormat(){return audioFormat_;}
         VideoFormat GetVideoFormat(){return videoFormat_;}
+        void SetPacketSink(RtpPacketSink* sink);
+        // The video SSRC; audio and data take the next two, so senders
+        // given SSRCs at least three apart do not collide.
+        void SetSSRC(uint32_t ssrc);
+        // The audio stream's SSRC, e.g. for RtpPacer::SetAudioSsrc().
+        uint32_t GetAudioSSRC() const;
+        uint32_t GetVideoSSRC() const;
+        // Packets received from the network, e.g. by UdpBatchTransport.
+        // Return 0 or -1.
+        int IncomingRtpPacket(const uint8_t* data, size_t len);
+        int IncomingRtcpPacket(const uint8_t* data, size_t len);
 private:
         AudioFormat audioFormat_;
         VideoFormat videoFormat_;
+        // Audio RTP clock, the AAC sample rate.
+        int audioClockRate_;
         std::unique_ptr<RtpRtcpWebrtcImpl> rtpRtcpImpl_;
+        std::unique_ptr<RtpPacketPool> pool_;
+        std::unique_ptr<RtpPacketizer> video_;
+        std::unique_ptr<RtpPacketizer> audio_;
+        std::unique_ptr<RtpPacketizer> data_;
 };
+
+#endif // MYRTPRTCP_H_
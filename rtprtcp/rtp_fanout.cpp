@@ -0,0 +1,188 @@
+#include "rtp_fanout.h"
+
+#include <string.h>
+
+namespace {
+        const size_t kRtpHeaderSize = 12;
+        // RTPFB, FMT 1: generic NACK.
+        const uint8_t kRtcpRtpfb = 205;
+        const uint8_t kFmtNack = 1;
+        
+        uint16_t Read16(const uint8_t* p) {
+                return static_cast<uint16_t>((p[0] << 8) | p[1]);
+        }
+        
+        void Write16(uint8_t* p, uint16_t value) {
+                p[0] = static_cast<uint8_t>(value >> 8);
+                p[1] = static_cast<uint8_t>(value);
+        }
+        
+        void Write32(uint8_t* p, uint32_t value) {
+                p[0] = static_cast<uint8_t>(value >> 24);
+                p[1] = static_cast<uint8_t>(value >> 16);
+                p[2] = static_cast<uint8_t>(value >> 8);
+                p[3] = static_cast<uint8_t>(value);
+        }
+        
+        uint32_t Read32(const uint8_t* p) {
+                return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+                (uint32_t(p[2]) << 8) | p[3];
+        }
+}  // namespace
+
+RtpFanOut::RtpFanOut()
+: video_format_(VideoFormat::H264), next_id_(1), random_(std::random_device()()) {}
+
+RtpFanOut::~RtpFanOut() {}
+
+RtpFanOut::Layer* RtpFanOut::GetLayer(int layer) {
+        if (layer < 0)
+                return nullptr;
+        while (static_cast<int>(layers_.size()) <= layer) {
+                layers_.emplace_back(new Layer());
+                layers_.back()->sender.SetPacketSink(layers_.back().get());
+                layers_.back()->sender.ChangeAVFormat(AudioFormat::Same, video_format_);
+        }
+        return layers_[layer].get();
+}
+
+int RtpFanOut::AddSubscriber(int layer, uint32_t ssrc, RtpPacketSink* sink) {
+        Layer* state = GetLayer(layer);
+        if (!state || !sink)
+                return -1;
+        Subscriber subscriber;
+        subscriber.id = next_id_++;
+        subscriber.ssrc = ssrc;
+        subscriber.first_sequence_number = static_cast<uint16_t>(random_());
+        subscriber.sequence_delta = 0;
+        subscriber.started = false;
+        subscriber.timestamp_offset = static_cast<uint32_t>(random_());
+        subscriber.waiting_for_key = true;
+        subscriber.sink = sink;
+        state->subscribers.push_back(subscriber);
+        subscriber_layers_[subscriber.id] = layer;
+        return subscriber.id;
+}
+
+void RtpFanOut::RemoveSubscriber(int id) {
+        auto it = subscriber_layers_.find(id);
+        if (it == subscriber_layers_.end())
+                return;
+        std::vector<Subscriber>& subscribers = layers_[it->second]->subscribers;
+        for (size_t i = 0; i < subscribers.size(); ++i) {
+                if (subscribers[i].id == id) {
+                        subscribers[i] = subscribers.back();
+                        subscribers.pop_back();
+                        break;
+                }
+        }
+        subscriber_layers_.erase(it);
+}
+
+bool RtpFanOut::NeedsKeyFrame(int layer) const {
+        if (layer < 0 || layer >= static_cast<int>(layers_.size()))
+                return false;
+        for (const Subscriber& subscriber : layers_[layer]->subscribers) {
+                if (subscriber.waiting_for_key)
+                        return true;
+        }
+        return false;
+}
+
+int RtpFanOut::SubscriberCount(int layer) const {
+        if (layer < 0 || layer >= static_cast<int>(layers_.size()))
+                return 0;
+        return static_cast<int>(layers_[layer]->subscribers.size());
+}
+
+int RtpFanOut::IncomingRtcpPacket(int id, const uint8_t* data, size_t len) {
+        auto it = subscriber_layers_.find(id);
+        if (it == subscriber_layers_.end())
+                return -1;
+        Layer* state = layers_[it->second].get();
+        const Subscriber* subscriber = nullptr;
+        for (const Subscriber& candidate : state->subscribers) {
+                if (candidate.id == id)
+                        subscriber = &candidate;
+        }
+        if (!subscriber)
+                return -1;
+        // Walk the compound packet; only NACKs for this subscriber's
+        // stream concern the layer, the rest ends here.
+        while (len >= 12) {
+                size_t size = 4 * (Read16(data + 2) + 1);
+                if (size > len)
+                        return -1;
+                if (data[1] == kRtcpRtpfb && (data[0] & 0x1f) == kFmtNack &&
+                    Read32(data + 8) == subscriber->ssrc && subscriber->started) {
+                        // The bitmask is relative, so only the PIDs move.
+                        state->nack.assign(data, data + size);
+                        uint8_t* nack = state->nack.data();
+                        Write32(nack + 8, state->sender.GetVideoSSRC());
+                        for (size_t i = 12; i + 4 <= size; i += 4)
+                                Write16(nack + i, static_cast<uint16_t>(Read16(nack + i) - subscriber->sequence_delta));
+                        state->resend_to = id;
+                        state->sender.IncomingRtcpPacket(nack, size);
+                        state->resend_to = 0;
+                }
+                data += size;
+                len -= size;
+        }
+        return 0;
+}
+
+void RtpFanOut::SetVideoFormat(VideoFormat format) {
+        if (format == VideoFormat::Same)
+                return;
+        video_format_ = format;
+        for (auto& layer : layers_)
+                layer->sender.ChangeAVFormat(AudioFormat::Same, format);
+}
+
+int RtpFanOut::SendVideo(int layer, char *pData, int nLen, bool isKey, int64_t nTimestamp) {
+        Layer* state = GetLayer(layer);
+        if (!state)
+                return -1;
+        if (isKey) {
+                for (Subscriber& subscriber : state->subscribers)
+                        subscriber.waiting_for_key = false;
+        }
+        // Packetized once; OnRtpPacket hands each packet to every subscriber.
+        return state->sender.SendVideo(pData, nLen, isKey, nTimestamp);
+}
+
+bool RtpFanOut::RewriteHeader(uint8_t* packet, size_t len, uint32_t ssrc,
+                              uint16_t sequence_number, uint32_t timestamp_offset) {
+        if (len < kRtpHeaderSize || (packet[0] >> 6) != 2)
+                return false;
+        Write16(packet + 2, sequence_number);
+        Write32(packet + 4, Read32(packet + 4) + timestamp_offset);
+        Write32(packet + 8, ssrc);
+        return true;
+}
+
+void RtpFanOut::Layer::OnRtpPacket(const uint8_t* data, size_t len) {
+        if (len < kRtpHeaderSize)
+                return;
+        if (scratch.size() < len)
+                scratch.resize(len);
+        uint16_t sequence_number = Read16(data + 2);
+        bool copied = false;
+        for (Subscriber& subscriber : subscribers) {
+                if (subscriber.waiting_for_key || (resend_to && subscriber.id != resend_to))
+                        continue;
+                if (!subscriber.started) {
+                        subscriber.sequence_delta =
+                        static_cast<uint16_t>(subscriber.first_sequence_number - sequence_number);
+                        subscriber.started = true;
+                }
+                // Only the 12 byte fixed header differs between subscribers,
+                // so the payload is copied once per packet, not per subscriber.
+                memcpy(scratch.data(), data, copied ? kRtpHeaderSize : len);
+                copied = true;
+                RewriteHeader(scratch.data(), len, subscriber.ssrc,
+                              static_cast<uint16_t>(sequence_number + subscriber.sequence_delta),
+                              subscriber.timestamp_offset);
+                subscriber.sink->OnRtpPacket(scratch.data(), len);
+        }
+}
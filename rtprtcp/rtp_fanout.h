@@ -0,0 +1,86 @@
+#ifndef RTP_FANOUT_H_
+#define RTP_FANOUT_H_
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "myrtprtcp.h"
+
+// Sends one encoded stream to many subscribers. Each simulcast layer is
+// encoded once by the caller and packetized once by its own RtpRtcpImpl;
+// a subscriber only gets the header of those packets rewritten to its own
+// SSRC, sequence numbers and timestamp offset, so every subscriber still
+// sees an independent RTP stream. NACKs from a subscriber are mapped back
+// to the layer's sequence numbers and answered from its history, to that
+// subscriber alone and under the sequence numbers it asked for. Not
+// thread safe.
+class RtpFanOut {
+public:
+        RtpFanOut();
+        ~RtpFanOut();
+        
+        // Adds a subscriber to |layer| that sends as |ssrc|. It gets packets
+        // from the next key frame on. Returns the subscriber id.
+        int AddSubscriber(int layer, uint32_t ssrc, RtpPacketSink* sink);
+        void RemoveSubscriber(int id);
+        // True while a subscriber of |layer| waits for a key frame.
+        bool NeedsKeyFrame(int layer) const;
+        int SubscriberCount(int layer) const;
+        // Payload format of every layer, H.264 until set.
+        void SetVideoFormat(VideoFormat format);
+        
+        // Packetizes one encoded frame of |layer| and sends it to every
+        // subscriber of the layer. Same arguments as RtpRtcpImpl::SendVideo.
+        int SendVideo(int layer, char *pData, int nLen, bool isKey, int64_t nTimestamp);
+        // RTCP from subscriber |id|. Returns 0 or -1.
+        int IncomingRtcpPacket(int id, const uint8_t* data, size_t len);
+        
+        // Rewrites the header of an RTP packet in place.
+        static bool RewriteHeader(uint8_t* packet, size_t len, uint32_t ssrc,
+                                  uint16_t sequence_number, uint32_t timestamp_offset);
+        
+private:
+        struct Subscriber {
+                int id;
+                uint32_t ssrc;
+                // The first sequence number it gets, and from its first
+                // packet on the difference to the layer's: a subscriber
+                // gets every packet from then on, so one offset maps both
+                // ways.
+                uint16_t first_sequence_number;
+                uint16_t sequence_delta;
+                bool started;
+                uint32_t timestamp_offset;
+                bool waiting_for_key;
+                RtpPacketSink* sink;
+        };
+        
+        class Layer : public RtpPacketSink {
+        public:
+                void OnRtpPacket(const uint8_t* data, size_t len) override;
+                
+                RtpRtcpImpl sender;
+                std::vector<Subscriber> subscribers;
+                // Header rewrites happen here; the packet itself is shared.
+                std::vector<uint8_t> scratch;
+                // While a NACK is answered: the subscriber that sent it, the
+                // only one the retransmissions go to.
+                int resend_to = 0;
+                // The NACK in the layer's sequence numbers.
+                std::vector<uint8_t> nack;
+        };
+        
+        Layer* GetLayer(int layer);
+        
+        std::vector<std::unique_ptr<Layer>> layers_;
+        // Layer of each subscriber id.
+        std::map<int, int> subscriber_layers_;
+        VideoFormat video_format_;
+        int next_id_;
+        // Initial sequence numbers and timestamp offsets, as RFC 3550 asks.
+        std::mt19937 random_;
+};
+
+#endif // RTP_FANOUT_H_
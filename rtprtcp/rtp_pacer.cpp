@@ -0,0 +1,234 @@
+#include "rtp_pacer.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "system_wrappers/include/clock.h"
+
+namespace {
+        // Buffers the pacer's pool starts with and grows by.
+        const size_t kPoolSlabSize = 64;
+
+        uint16_t Read16(const uint8_t* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+        uint32_t Read32(const uint8_t* p) {
+                return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+
+        size_t Index(RtpPacketPriority priority) { return static_cast<size_t>(priority); }
+}  // namespace
+
+TimerWheel::TimerWheel(int64_t now_ms) : cursor_ms_(now_ms), count_(0) {
+        for (Timer*& slot : slots_)
+                slot = nullptr;
+}
+
+void TimerWheel::Link(Timer* timer) {
+        Timer*& slot = slots_[timer->due_ms_ % kSlots];
+        timer->prev_ = nullptr;
+        timer->next_ = slot;
+        if (slot)
+                slot->prev_ = timer;
+        slot = timer;
+        timer->scheduled_ = true;
+        ++count_;
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+        if (timer->prev_)
+                timer->prev_->next_ = timer->next_;
+        else
+                slots_[timer->due_ms_ % kSlots] = timer->next_;
+        if (timer->next_)
+                timer->next_->prev_ = timer->prev_;
+        timer->prev_ = timer->next_ = nullptr;
+        timer->scheduled_ = false;
+        --count_;
+}
+
+void TimerWheel::Schedule(Timer* timer, int64_t due_ms) {
+        if (timer->scheduled_)
+                Unlink(timer);
+        timer->due_ms_ = std::max(due_ms, cursor_ms_);
+        Link(timer);
+}
+
+void TimerWheel::Cancel(Timer* timer) {
+        if (timer->scheduled_)
+                Unlink(timer);
+}
+
+void TimerWheel::Advance(int64_t now_ms) {
+        if (now_ms < cursor_ms_)
+                return;
+        // After a long gap every slot is due once; no need to go round
+        // more than that.
+        int64_t ticks = std::min<int64_t>(now_ms - cursor_ms_ + 1, kSlots);
+        for (int64_t tick = 0; tick < ticks; ++tick) {
+                Timer*& slot = slots_[(cursor_ms_ + tick) % kSlots];
+                // Take the whole list: timers scheduled while firing go in
+                // afresh and wait for their own tick.
+                Timer* timer = slot;
+                slot = nullptr;
+                while (timer) {
+                        Timer* next = timer->next_;
+                        if (next)
+                                next->prev_ = nullptr;
+                        timer->prev_ = timer->next_ = nullptr;
+                        timer->scheduled_ = false;
+                        --count_;
+                        if (timer->due_ms_ <= now_ms)
+                                timer->OnTimer(now_ms);
+                        else
+                                Link(timer);
+                        timer = next;
+                }
+        }
+        cursor_ms_ = now_ms + 1;
+}
+
+int64_t TimerWheel::NextDueMs() const {
+        int64_t due = -1;
+        for (Timer* slot : slots_) {
+                for (Timer* timer = slot; timer; timer = timer->next_) {
+                        if (due < 0 || timer->due_ms_ < due)
+                                due = timer->due_ms_;
+                }
+        }
+        return due;
+}
+
+RtpPacer::RtpPacer(webrtc::Clock* clock, TimerWheel* wheel, RtpPacketSink* transport)
+: clock_(clock), wheel_(wheel), transport_(transport), pool_(kPoolSlabSize),
+rate_bps_(0), budget_bytes_(0), max_budget_bytes_(0),
+last_refill_us_(clock->TimeInMicroseconds()), audio_ssrc_(0), queued_bytes_(0),
+stream_count_(0) {
+        for (Queue& queue : queues_)
+                queue.entries.resize(kQueueSize);
+}
+
+RtpPacer::~RtpPacer() {
+        wheel_->Cancel(this);
+        for (Queue& queue : queues_) {
+                for (; queue.count; --queue.count) {
+                        pool_.Release(queue.entries[queue.head].data);
+                        queue.head = (queue.head + 1) % kQueueSize;
+                }
+        }
+}
+
+void RtpPacer::SetPacingRate(int64_t bits_per_second) {
+        Refill(clock_->TimeInMicroseconds());
+        rate_bps_ = std::max<int64_t>(bits_per_second, 0);
+        max_budget_bytes_ = std::max<double>(rate_bps_ / 8.0 * kBurstMs / 1000,
+                                             RtpPacketPool::kBufferSize);
+        budget_bytes_ = std::min(budget_bytes_, max_budget_bytes_);
+}
+
+void RtpPacer::OnRtpPacket(const uint8_t* data, size_t len) {
+        Enqueue(data, len, Classify(data, len));
+}
+
+void RtpPacer::OnRtcpPacket(const uint8_t* data, size_t len) {
+        transport_->OnRtcpPacket(data, len);
+}
+
+RtpPacketPriority RtpPacer::Classify(const uint8_t* data, size_t len) {
+        if (len < 12)
+                return RtpPacketPriority::Video;
+        uint32_t ssrc = Read32(data + 8);
+        if (audio_ssrc_ && ssrc == audio_ssrc_)
+                return RtpPacketPriority::Audio;
+        if (data[0] & 0x20) {
+                size_t header = 12 + 4 * (data[0] & 0x0f);
+                if ((data[0] & 0x10) && len >= header + 4)
+                        header += 4 + 4 * Read16(data + header + 2);
+                if (header + data[len - 1] == len)
+                        return RtpPacketPriority::Padding;
+        }
+        uint16_t sequence_number = Read16(data + 2);
+        for (int i = 0; i < stream_count_; ++i) {
+                Stream& stream = streams_[i];
+                if (stream.ssrc != ssrc)
+                        continue;
+                if (static_cast<int16_t>(sequence_number - stream.newest) <= 0)
+                        return RtpPacketPriority::Retransmission;
+                stream.newest = sequence_number;
+                return RtpPacketPriority::Video;
+        }
+        if (stream_count_ < kMaxStreams)
+                streams_[stream_count_++] = {ssrc, sequence_number};
+        return RtpPacketPriority::Video;
+}
+
+bool RtpPacer::Enqueue(const uint8_t* data, size_t len, RtpPacketPriority priority) {
+        Queue& queue = queues_[Index(priority)];
+        uint8_t* buffer = len <= RtpPacketPool::kBufferSize && queue.count < kQueueSize ? pool_.Acquire()
+                                                                                        : nullptr;
+        if (!buffer) {
+                ++stats_.dropped;
+                return false;
+        }
+        memcpy(buffer, data, len);
+        int64_t now_us = clock_->TimeInMicroseconds();
+        queue.entries[(queue.head + queue.count) % kQueueSize] = {buffer, static_cast<uint16_t>(len), now_us};
+        ++queue.count;
+        queued_bytes_ += len;
+        // Audio does not wait for the bucket, nor for the tick the pacer
+        // was going to wake up on.
+        if (!scheduled() || priority == RtpPacketPriority::Audio)
+                wheel_->Schedule(this, now_us / 1000);
+        return true;
+}
+
+size_t RtpPacer::queued_packets() const {
+        size_t count = 0;
+        for (const Queue& queue : queues_)
+                count += queue.count;
+        return count;
+}
+
+int64_t RtpPacer::ExpectedQueueTimeMs() const {
+        return rate_bps_ ? queued_bytes_ * 8 * 1000 / rate_bps_ : 0;
+}
+
+void RtpPacer::Refill(int64_t now_us) {
+        int64_t elapsed_us = now_us - last_refill_us_;
+        last_refill_us_ = now_us;
+        if (elapsed_us > 0)
+                budget_bytes_ = std::min(budget_bytes_ + rate_bps_ / 8e6 * elapsed_us, max_budget_bytes_);
+}
+
+void RtpPacer::OnTimer(int64_t now_ms) {
+        int64_t now_us = clock_->TimeInMicroseconds();
+        Refill(now_us);
+        for (size_t priority = 0; priority < 4; ++priority) {
+                Queue& queue = queues_[priority];
+                bool audio = priority == Index(RtpPacketPriority::Audio);
+                // A packet may take the budget below zero; the debt is paid
+                // before the next one goes.
+                while (queue.count && (audio || !rate_bps_ || budget_bytes_ > 0)) {
+                        Entry& entry = queue.entries[queue.head];
+                        transport_->OnRtpPacket(entry.data, entry.len);
+                        pool_.Release(entry.data);
+                        queue.head = (queue.head + 1) % kQueueSize;
+                        --queue.count;
+                        queued_bytes_ -= entry.len;
+                        budget_bytes_ -= entry.len;
+                        int64_t waited_us = now_us - entry.enqueue_us;
+                        stats_.max_queue_us = std::max(stats_.max_queue_us, waited_us);
+                        stats_.total_queue_us += waited_us;
+                        ++stats_.sent[priority];
+                        stats_.bytes += entry.len;
+                }
+                if (!rate_bps_)
+                        budget_bytes_ = 0;
+                if (queue.count)
+                        break;
+        }
+        if (!queued_bytes_)
+                return;
+        // Back when the debt is paid, at least a tick from now.
+        int64_t wait_us = static_cast<int64_t>(std::max(-budget_bytes_, 1.0) * 8e6 / rate_bps_);
+        wheel_->Schedule(this, std::max(now_ms + 1, (now_us + wait_us + 999) / 1000));
+}
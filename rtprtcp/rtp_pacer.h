@@ -0,0 +1,161 @@
+#ifndef RTP_PACER_H_
+#define RTP_PACER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "myrtprtcp.h"
+#include "rtp_packetizer.h"
+
+namespace webrtc {
+class Clock;
+}
+
+// A hashed timer wheel with one slot per millisecond. Scheduling and
+// cancelling are O(1); Advance() walks the slots of the milliseconds that
+// went by. Timers further out than kSlots ms stay in their slot and are
+// passed over until due. One wheel can drive any number of RtpPacers from
+// one thread. Not thread safe.
+class TimerWheel {
+public:
+        static const int kSlots = 256;
+
+        class Timer {
+        public:
+                virtual ~Timer() {}
+                virtual void OnTimer(int64_t now_ms) = 0;
+                bool scheduled() const { return scheduled_; }
+
+        private:
+                friend class TimerWheel;
+                int64_t due_ms_ = 0;
+                Timer* prev_ = nullptr;
+                Timer* next_ = nullptr;
+                bool scheduled_ = false;
+        };
+
+        explicit TimerWheel(int64_t now_ms);
+
+        // A |due_ms| in the past fires on the next Advance(). Moves a timer
+        // that is already scheduled.
+        void Schedule(Timer* timer, int64_t due_ms);
+        void Cancel(Timer* timer);
+        // Fires every timer due by |now_ms|. Timers may schedule
+        // themselves again from OnTimer().
+        void Advance(int64_t now_ms);
+
+        // Earliest due time, -1 if nothing is scheduled. Linear in the
+        // number of timers; for deciding how long to sleep.
+        int64_t NextDueMs() const;
+        size_t size() const { return count_; }
+
+private:
+        void Link(Timer* timer);
+        void Unlink(Timer* timer);
+
+        Timer* slots_[kSlots];
+        // The first millisecond Advance() has not walked yet.
+        int64_t cursor_ms_;
+        size_t count_;
+};
+
+enum class RtpPacketPriority {
+        Audio,
+        Retransmission,
+        Video,
+        Padding,
+};
+
+// Sits between a sender and its transport and lets packets out at a set
+// rate, so a key frame leaves as a steady stream instead of one burst.
+//
+// A token bucket fills at the pacing rate, up to kBurstMs worth of bytes
+// or one packet, whichever is more. Packets wait in one queue per
+// priority and the highest non-empty queue goes first: audio, then
+// retransmissions, video and padding. Audio is never held back, it only
+// uses up budget. When the bucket runs dry the pacer puts itself on the
+// timer wheel for the time the next packet's bytes take to come in.
+//
+// Packets handed to OnRtpPacket() are sorted by SSRC (the audio SSRC),
+// sequence number (not newer than the newest seen: a retransmission) and
+// padding bit (nothing but padding: padding); Enqueue() takes the
+// priority from the caller. Either copies the packet into the pacer's
+// pool; nothing is allocated once the pool is warm. RTCP goes straight
+// through.
+//
+// Time comes from |clock|, so a webrtc::SimulatedClock drives it
+// deterministically. Not thread safe; the wheel's thread owns it.
+class RtpPacer : public RtpPacketSink, private TimerWheel::Timer {
+public:
+        static const int kBurstMs = 2;
+        // Packets each queue holds; more are dropped.
+        static const int kQueueSize = 512;
+
+        struct Stats {
+                uint64_t sent[4] = {0, 0, 0, 0};
+                uint64_t bytes = 0;
+                // Packets that found their queue full or the pool empty.
+                uint64_t dropped = 0;
+                // Longest a packet has waited, in us.
+                int64_t max_queue_us = 0;
+                int64_t total_queue_us = 0;
+        };
+
+        RtpPacer(webrtc::Clock* clock, TimerWheel* wheel, RtpPacketSink* transport);
+        ~RtpPacer();
+
+        // 0 sends everything on the next tick, unpaced.
+        void SetPacingRate(int64_t bits_per_second);
+        void SetAudioSsrc(uint32_t ssrc) { audio_ssrc_ = ssrc; }
+
+        void OnRtpPacket(const uint8_t* data, size_t len) override;
+        void OnRtcpPacket(const uint8_t* data, size_t len) override;
+        // Returns false if the packet was dropped.
+        bool Enqueue(const uint8_t* data, size_t len, RtpPacketPriority priority);
+
+        size_t queued_packets() const;
+        int64_t queued_bytes() const { return queued_bytes_; }
+        // How long what is queued now takes to drain at the pacing rate.
+        int64_t ExpectedQueueTimeMs() const;
+        const Stats& stats() const { return stats_; }
+
+private:
+        struct Entry {
+                uint8_t* data;
+                uint16_t len;
+                int64_t enqueue_us;
+        };
+        // A ring of kQueueSize entries.
+        struct Queue {
+                std::vector<Entry> entries;
+                size_t head = 0;
+                size_t count = 0;
+        };
+        struct Stream {
+                uint32_t ssrc;
+                uint16_t newest;
+        };
+        static const int kMaxStreams = 8;
+
+        void OnTimer(int64_t now_ms) override;
+        RtpPacketPriority Classify(const uint8_t* data, size_t len);
+        void Refill(int64_t now_us);
+
+        webrtc::Clock* clock_;
+        TimerWheel* wheel_;
+        RtpPacketSink* transport_;
+        RtpPacketPool pool_;
+        int64_t rate_bps_;
+        double budget_bytes_;
+        double max_budget_bytes_;
+        int64_t last_refill_us_;
+        uint32_t audio_ssrc_;
+        int64_t queued_bytes_;
+        Queue queues_[4];
+        Stream streams_[kMaxStreams];
+        int stream_count_;
+        Stats stats_;
+};
+
+#endif // RTP_PACER_H_
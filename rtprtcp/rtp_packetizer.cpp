@@ -0,0 +1,511 @@
+#include "rtp_packetizer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <random>
+
+// The vector start code scan needs GCC or Clang on x86 for the AVX2
+// target attribute and CPU check; everything else scans bytes.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+#define RTP_ANNEXB_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+        const size_t kRtpHeaderSize = 12;
+        const size_t kMaxPayloadSize = RtpPacketizer::kMaxPacketSize - kRtpHeaderSize;
+
+        // RFC 6184 / RFC 7798 packet types.
+        const uint8_t kH264FuA = 28;
+        const uint8_t kH265Fu = 49;
+        const uint8_t kFuStart = 0x80;
+        const uint8_t kFuEnd = 0x40;
+        // RFC 7741 payload descriptor: S, start of a partition, PID 0.
+        const uint8_t kVp8Start = 0x10;
+
+        // ADTS frames carry 1024 samples.
+        const uint32_t kAacSamplesPerFrame = 1024;
+
+        const int kAdtsSampleRates[] = {
+                96000, 88200, 64000, 48000, 44100, 32000,
+                24000, 22050, 16000, 12000, 11025, 8000, 7350,
+        };
+
+        void Write16(uint8_t* p, uint16_t value) {
+                p[0] = static_cast<uint8_t>(value >> 8);
+                p[1] = static_cast<uint8_t>(value);
+        }
+
+        void Write32(uint8_t* p, uint32_t value) {
+                p[0] = static_cast<uint8_t>(value >> 24);
+                p[1] = static_cast<uint8_t>(value >> 16);
+                p[2] = static_cast<uint8_t>(value >> 8);
+                p[3] = static_cast<uint8_t>(value);
+        }
+
+        bool IsAdts(const uint8_t* data, size_t len) {
+                return len >= 7 && data[0] == 0xff && (data[1] & 0xf6) == 0xf0;
+        }
+}  // namespace
+
+RtpPacketPool::RtpPacketPool(size_t slab_size)
+: slab_size_(slab_size), head_(kEmpty), available_(0), allocations_(0),
+exhausted_(0), slab_count_(0) {
+        for (std::atomic<uint8_t*>& slab : slabs_)
+                slab.store(nullptr, std::memory_order_relaxed);
+        AddSlab();
+        // The first slab is part of constructing the pool.
+        allocations_.store(0, std::memory_order_relaxed);
+}
+
+RtpPacketPool::Header* RtpPacketPool::HeaderAt(uint32_t index) const {
+        uint8_t* slab = slabs_[index / slab_size_].load(std::memory_order_acquire);
+        return reinterpret_cast<Header*>(slab + (index % slab_size_) * kStride);
+}
+
+bool RtpPacketPool::AddSlab() {
+        std::lock_guard<std::mutex> lock(grow_lock_);
+        // Another thread may have grown the pool while we waited.
+        if (static_cast<uint32_t>(head_.load(std::memory_order_acquire)) != kEmpty)
+                return true;
+        size_t slab = slab_count_.load(std::memory_order_relaxed);
+        if (slab == kMaxSlabs || !slab_size_)
+                return false;
+        storage_[slab].reset(new uint8_t[slab_size_ * kStride + 63]);
+        // Buffers start on a cache line.
+        uintptr_t address = reinterpret_cast<uintptr_t>(storage_[slab].get());
+        uint8_t* base = reinterpret_cast<uint8_t*>((address + 63) & ~uintptr_t(63));
+        slabs_[slab].store(base, std::memory_order_release);
+        slab_count_.store(slab + 1, std::memory_order_relaxed);
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        available_.fetch_add(slab_size_, std::memory_order_relaxed);
+        uint32_t first = static_cast<uint32_t>(slab * slab_size_);
+        // Pushed in reverse so the first buffer of the slab goes out first.
+        for (size_t i = slab_size_; i-- > 0;) {
+                Header* header = new (base + i * kStride) Header;
+                header->index = first + static_cast<uint32_t>(i);
+                Push(header->index);
+        }
+        return true;
+}
+
+void RtpPacketPool::Push(uint32_t index) {
+        Header* header = HeaderAt(index);
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t top;
+        do {
+                header->next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+                top = (head & ~uint64_t(0xffffffff)) | index;
+        } while (!head_.compare_exchange_weak(head, top, std::memory_order_release,
+                                              std::memory_order_relaxed));
+}
+
+uint8_t* RtpPacketPool::Acquire() {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        while (true) {
+                uint32_t index = static_cast<uint32_t>(head);
+                if (index == kEmpty) {
+                        if (!AddSlab()) {
+                                exhausted_.fetch_add(1, std::memory_order_relaxed);
+                                return nullptr;
+                        }
+                        head = head_.load(std::memory_order_acquire);
+                        continue;
+                }
+                // |next| may be stale if another thread popped this buffer
+                // first; the tag makes the exchange fail then.
+                Header* header = HeaderAt(index);
+                uint32_t next = header->next.load(std::memory_order_relaxed);
+                uint64_t top = (((head >> 32) + 1) << 32) | next;
+                if (head_.compare_exchange_weak(head, top, std::memory_order_acquire,
+                                                std::memory_order_acquire)) {
+                        available_.fetch_sub(1, std::memory_order_relaxed);
+                        return reinterpret_cast<uint8_t*>(header) + kHeaderSize;
+                }
+        }
+}
+
+void RtpPacketPool::Release(uint8_t* buffer) {
+        if (!buffer)
+                return;
+        Header* header = reinterpret_cast<Header*>(buffer - kHeaderSize);
+        Push(header->index);
+        available_.fetch_add(1, std::memory_order_relaxed);
+}
+
+AnnexBReader::AnnexBReader(const uint8_t* data, size_t len)
+: data_(data), len_(len), pos_(0) {
+        size_t start = FindStartCode(data, len, 0);
+        // No start code at all: the whole buffer is one NAL unit.
+        pos_ = start == len ? 0 : start + 3;
+}
+
+size_t AnnexBReader::FindStartCodeScalar(const uint8_t* data, size_t len, size_t from) {
+        size_t i = from;
+        while (i + 3 <= len) {
+                // Look at the third byte first; anything above 1 lets the
+                // scan skip three bytes.
+                uint8_t third = data[i + 2];
+                if (third > 1) {
+                        i += 3;
+                } else if (third == 1) {
+                        if (data[i] == 0 && data[i + 1] == 0)
+                                return i;
+                        i += 3;
+                } else {
+                        ++i;
+                }
+        }
+        return len;
+}
+
+#if defined(RTP_ANNEXB_X86)
+namespace {
+        // Three overlapping loads put bytes i, i+1 and i+2 in the same lane;
+        // a lane that reads 00 00 01 is a start code at i + lane.
+        size_t FindStartCodeSse2(const uint8_t* data, size_t len, size_t from) {
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i one = _mm_set1_epi8(1);
+                size_t i = from;
+                for (; i + 18 <= len; i += 16) {
+                        __m128i third = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2));
+                        int ones = _mm_movemask_epi8(_mm_cmpeq_epi8(third, one));
+                        // Start codes are rare: most blocks stop here.
+                        if (!ones)
+                                continue;
+                        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+                        __m128i zeros = _mm_and_si128(_mm_cmpeq_epi8(first, zero), _mm_cmpeq_epi8(second, zero));
+                        int hits = ones & _mm_movemask_epi8(zeros);
+                        if (hits)
+                                return i + __builtin_ctz(hits);
+                }
+                return AnnexBReader::FindStartCodeScalar(data, len, i);
+        }
+
+        __attribute__((target("avx2")))
+        size_t FindStartCodeAvx2(const uint8_t* data, size_t len, size_t from) {
+                const __m256i zero = _mm256_setzero_si256();
+                const __m256i one = _mm256_set1_epi8(1);
+                size_t i = from;
+                for (; i + 34 <= len; i += 32) {
+                        __m256i third = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 2));
+                        uint32_t ones = _mm256_movemask_epi8(_mm256_cmpeq_epi8(third, one));
+                        if (!ones)
+                                continue;
+                        __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                        __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+                        __m256i zeros = _mm256_and_si256(_mm256_cmpeq_epi8(first, zero),
+                                                         _mm256_cmpeq_epi8(second, zero));
+                        uint32_t hits = ones & static_cast<uint32_t>(_mm256_movemask_epi8(zeros));
+                        if (hits)
+                                return i + __builtin_ctz(hits);
+                }
+                return FindStartCodeSse2(data, len, i);
+        }
+
+        bool HasAvx2() {
+                static const bool has_avx2 = __builtin_cpu_supports("avx2");
+                return has_avx2;
+        }
+}  // namespace
+#endif
+
+size_t AnnexBReader::FindStartCode(const uint8_t* data, size_t len, size_t from) {
+#if defined(RTP_ANNEXB_X86)
+        return HasAvx2() ? FindStartCodeAvx2(data, len, from) : FindStartCodeSse2(data, len, from);
+#else
+        return FindStartCodeScalar(data, len, from);
+#endif
+}
+
+const char* AnnexBReader::StartCodeScanner() {
+#if defined(RTP_ANNEXB_X86)
+        return HasAvx2() ? "avx2" : "sse2";
+#else
+        return "scalar";
+#endif
+}
+
+bool AnnexBReader::Next(NalUnit* nal) {
+        while (pos_ < len_) {
+                size_t next = FindStartCode(data_, len_, pos_);
+                size_t end = next;
+                while (end > pos_ && data_[end - 1] == 0)
+                        --end;
+                size_t begin = pos_;
+                pos_ = next == len_ ? len_ : next + 3;
+                if (end > begin) {
+                        nal->data = data_ + begin;
+                        nal->len = end - begin;
+                        return true;
+                }
+        }
+        return false;
+}
+
+RtpPacketizer::RtpPacketizer(RtpPacketPool* pool, RtpPayloadFormat format,
+                             uint8_t payload_type, uint32_t ssrc)
+: pool_(pool), sink_(nullptr), format_(format), payload_type_(payload_type),
+ssrc_(ssrc), sequence_number_(static_cast<uint16_t>(std::random_device()())) {
+        memset(history_, 0, sizeof(history_));
+        memset(history_len_, 0, sizeof(history_len_));
+}
+
+RtpPacketizer::~RtpPacketizer() {
+        for (uint8_t* packet : history_)
+                pool_->Release(packet);
+}
+
+int RtpPacketizer::AdtsSampleRate(const uint8_t* data, size_t len) {
+        if (!IsAdts(data, len))
+                return 0;
+        int index = (data[2] >> 2) & 0x0f;
+        return index < 13 ? kAdtsSampleRates[index] : 0;
+}
+
+int RtpPacketizer::SendFrame(const uint8_t* data, size_t len, uint32_t timestamp) {
+        if (!data || !len)
+                return -1;
+        uint64_t allocations = pool_->allocations();
+        int packets = -1;
+        switch (format_) {
+        case RtpPayloadFormat::H264:
+                packets = SendH264(data, len, timestamp);
+                break;
+        case RtpPayloadFormat::H265:
+                packets = SendH265(data, len, timestamp);
+                break;
+        case RtpPayloadFormat::AAC:
+                packets = SendAac(data, len, timestamp);
+                break;
+        case RtpPayloadFormat::VP8:
+                packets = SendVp8(data, len, timestamp);
+                break;
+        case RtpPayloadFormat::Data:
+                packets = SendData(data, len, timestamp);
+                break;
+        }
+        // Slabs the pool grew by while this frame went out.
+        stats_.allocations += pool_->allocations() - allocations;
+        if (packets > 0)
+                ++stats_.frames;
+        return packets;
+}
+
+int RtpPacketizer::Resend(uint16_t sequence_number) {
+        int slot = sequence_number % kHistorySize;
+        uint8_t* packet = history_[slot];
+        if (!packet || !sink_ || packet[2] != (sequence_number >> 8) ||
+            packet[3] != (sequence_number & 0xff))
+                return -1;
+        sink_->OnRtpPacket(packet, history_len_[slot]);
+        ++stats_.resent;
+        return 0;
+}
+
+uint8_t* RtpPacketizer::BeginPacket(uint32_t timestamp) {
+        // The history slot this packet goes to holds the oldest packet;
+        // reuse its buffer instead of going to the pool.
+        int slot = sequence_number_ % kHistorySize;
+        uint8_t* packet = history_[slot];
+        if (packet) {
+                history_[slot] = nullptr;
+        } else {
+                packet = pool_->Acquire();
+                if (!packet) {
+                        ++stats_.dropped;
+                        return nullptr;
+                }
+        }
+        packet[0] = 0x80;
+        packet[1] = payload_type_;
+        Write32(packet + 4, timestamp);
+        Write32(packet + 8, ssrc_);
+        return packet;
+}
+
+void RtpPacketizer::FinishPacket(uint8_t* packet, size_t len, bool marker) {
+        if (marker)
+                packet[1] |= 0x80;
+        Write16(packet + 2, sequence_number_);
+        int slot = sequence_number_ % kHistorySize;
+        history_[slot] = packet;
+        history_len_[slot] = static_cast<uint16_t>(len);
+        ++sequence_number_;
+        ++stats_.packets;
+        stats_.bytes += len;
+        if (sink_)
+                sink_->OnRtpPacket(packet, len);
+}
+
+int RtpPacketizer::SendH264(const uint8_t* data, size_t len, uint32_t timestamp) {
+        AnnexBReader reader(data, len);
+        NalUnit nal;
+        if (!reader.Next(&nal))
+                return -1;
+        // One NAL unit of look-ahead: the marker goes on the last packet
+        // of the access unit.
+        int packets = 0;
+        NalUnit next;
+        bool more;
+        do {
+                more = reader.Next(&next);
+                int sent = SendNalUnit(nal, 1, timestamp, !more);
+                if (sent < 0)
+                        return -1;
+                packets += sent;
+                nal = next;
+        } while (more);
+        return packets;
+}
+
+int RtpPacketizer::SendH265(const uint8_t* data, size_t len, uint32_t timestamp) {
+        AnnexBReader reader(data, len);
+        NalUnit nal;
+        if (!reader.Next(&nal))
+                return -1;
+        int packets = 0;
+        NalUnit next;
+        bool more;
+        do {
+                more = reader.Next(&next);
+                if (nal.len >= 2) {
+                        int sent = SendNalUnit(nal, 2, timestamp, !more);
+                        if (sent < 0)
+                                return -1;
+                        packets += sent;
+                }
+                nal = next;
+        } while (more);
+        return packets;
+}
+
+// |header_size| is the NAL unit header: 1 byte for H.264, 2 for H.265.
+int RtpPacketizer::SendNalUnit(const NalUnit& nal, size_t header_size,
+                               uint32_t timestamp, bool last) {
+        if (nal.len <= kMaxPayloadSize) {
+                uint8_t* packet = BeginPacket(timestamp);
+                if (!packet)
+                        return -1;
+                memcpy(packet + kRtpHeaderSize, nal.data, nal.len);
+                FinishPacket(packet, kRtpHeaderSize + nal.len, last);
+                return 1;
+        }
+
+        // Fragmentation units. The payload header takes the place of the
+        // NAL unit header, followed by a one byte FU header.
+        uint8_t payload_header[2];
+        uint8_t type;
+        if (header_size == 1) {
+                payload_header[0] = (nal.data[0] & 0xe0) | kH264FuA;
+                type = nal.data[0] & 0x1f;
+        } else {
+                payload_header[0] = (nal.data[0] & 0x81) | (kH265Fu << 1);
+                payload_header[1] = nal.data[1];
+                type = (nal.data[0] >> 1) & 0x3f;
+        }
+        size_t overhead = header_size + 1;
+        const uint8_t* payload = nal.data + header_size;
+        size_t remaining = nal.len - header_size;
+        // Fragments of equal size rather than full ones and a runt.
+        size_t fragments = (remaining + kMaxPayloadSize - overhead - 1) / (kMaxPayloadSize - overhead);
+        size_t base = remaining / fragments;
+        size_t extra = remaining % fragments;
+        for (size_t i = 0; i < fragments; ++i) {
+                size_t size = base + (i < extra ? 1 : 0);
+                uint8_t* packet = BeginPacket(timestamp);
+                if (!packet)
+                        return -1;
+                uint8_t* p = packet + kRtpHeaderSize;
+                memcpy(p, payload_header, header_size);
+                p[header_size] = type | (i == 0 ? kFuStart : 0) | (i == fragments - 1 ? kFuEnd : 0);
+                memcpy(p + overhead, payload, size);
+                payload += size;
+                FinishPacket(packet, kRtpHeaderSize + overhead + size, last && i == fragments - 1);
+        }
+        return static_cast<int>(fragments);
+}
+
+int RtpPacketizer::SendAac(const uint8_t* data, size_t len, uint32_t timestamp) {
+        if (!IsAdts(data, len))
+                return SendAccessUnit(data, len, timestamp);
+        int packets = 0;
+        while (IsAdts(data, len)) {
+                size_t frame_len = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+                // protection_absent: 7 byte header, otherwise 9 with CRC.
+                size_t header_len = (data[1] & 0x01) ? 7 : 9;
+                if (frame_len <= header_len || frame_len > len)
+                        break;
+                int sent = SendAccessUnit(data + header_len, frame_len - header_len, timestamp);
+                if (sent < 0)
+                        return -1;
+                packets += sent;
+                data += frame_len;
+                len -= frame_len;
+                timestamp += kAacSamplesPerFrame;
+        }
+        return packets ? packets : -1;
+}
+
+// RFC 3640 AAC-hbr: a 16 bit AU-headers-length, then one AU header of a
+// 13 bit size and a 3 bit index. A fragmented access unit repeats the
+// header, with the full size, in every fragment.
+int RtpPacketizer::SendAccessUnit(const uint8_t* data, size_t len, uint32_t timestamp) {
+        const size_t kAuHeaderSize = 4;
+        if (len >= (1 << 13))
+                return -1;
+        size_t max_fragment = kMaxPayloadSize - kAuHeaderSize;
+        int packets = 0;
+        for (size_t offset = 0; offset < len; ++packets) {
+                size_t size = std::min(max_fragment, len - offset);
+                uint8_t* packet = BeginPacket(timestamp);
+                if (!packet)
+                        return -1;
+                uint8_t* p = packet + kRtpHeaderSize;
+                Write16(p, 16);
+                Write16(p + 2, static_cast<uint16_t>(len << 3));
+                memcpy(p + kAuHeaderSize, data + offset, size);
+                offset += size;
+                FinishPacket(packet, kRtpHeaderSize + kAuHeaderSize + size, offset == len);
+        }
+        return packets;
+}
+
+// The frame is one partition as far as the descriptor goes: S on its
+// first packet only, no extensions. Fragments of equal size, as for FU-A.
+int RtpPacketizer::SendVp8(const uint8_t* data, size_t len, uint32_t timestamp) {
+        const size_t kDescriptorSize = 1;
+        size_t max_fragment = kMaxPayloadSize - kDescriptorSize;
+        size_t fragments = (len + max_fragment - 1) / max_fragment;
+        size_t base = len / fragments;
+        size_t extra = len % fragments;
+        for (size_t i = 0; i < fragments; ++i) {
+                size_t size = base + (i < extra ? 1 : 0);
+                uint8_t* packet = BeginPacket(timestamp);
+                if (!packet)
+                        return -1;
+                packet[kRtpHeaderSize] = i == 0 ? kVp8Start : 0;
+                memcpy(packet + kRtpHeaderSize + kDescriptorSize, data, size);
+                data += size;
+                FinishPacket(packet, kRtpHeaderSize + kDescriptorSize + size, i == fragments - 1);
+        }
+        return static_cast<int>(fragments);
+}
+
+int RtpPacketizer::SendData(const uint8_t* data, size_t len, uint32_t timestamp) {
+        int packets = 0;
+        for (size_t offset = 0; offset < len; ++packets) {
+                size_t size = std::min(kMaxPayloadSize, len - offset);
+                uint8_t* packet = BeginPacket(timestamp);
+                if (!packet)
+                        return -1;
+                memcpy(packet + kRtpHeaderSize, data + offset, size);
+                offset += size;
+                FinishPacket(packet, kRtpHeaderSize + size, offset == len);
+        }
+        return packets;
+}
@@ -0,0 +1,173 @@
+#ifndef RTP_PACKETIZER_H_
+#define RTP_PACKETIZER_H_
+
+#include <cstddef>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "myrtprtcp.h"
+
+// MTU sized packet buffers carved out of slabs. The pool starts with one
+// slab of |slab_size| buffers and allocates another only when every
+// buffer is out, up to kMaxSlabs; once the working set is reached it never
+// touches the heap again. Slabs are only freed with the pool.
+//
+// Free buffers form a lock-free stack, so any thread may Acquire() or
+// Release(); growing the pool takes a lock.
+class RtpPacketPool {
+public:
+        static const size_t kBufferSize = 1500;
+        static const int kMaxSlabs = 16;
+
+        explicit RtpPacketPool(size_t slab_size);
+
+        // Returns nullptr when every buffer is out and no slab is left.
+        uint8_t* Acquire();
+        // |buffer| must come from this pool.
+        void Release(uint8_t* buffer);
+
+        size_t available() const { return static_cast<size_t>(available_.load(std::memory_order_relaxed)); }
+        size_t capacity() const { return slab_count_.load(std::memory_order_relaxed) * slab_size_; }
+        // Heap allocations made after construction, one per slab.
+        uint64_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+        // Acquire() calls that came back empty handed.
+        uint64_t exhausted() const { return exhausted_.load(std::memory_order_relaxed); }
+
+private:
+        // In front of every buffer, a cache line of its own.
+        struct Header {
+                uint32_t index;
+                std::atomic<uint32_t> next;
+        };
+        static const size_t kHeaderSize = 64;
+        static const size_t kStride = kHeaderSize + (kBufferSize + 63) / 64 * 64;
+        static const uint32_t kEmpty = 0xffffffff;
+
+        bool AddSlab();
+        Header* HeaderAt(uint32_t index) const;
+        void Push(uint32_t index);
+
+        const size_t slab_size_;
+        // Low 32 bits: the index of the top buffer. High 32 bits: bumped on
+        // every pop, so a stale compare-exchange fails (ABA).
+        std::atomic<uint64_t> head_;
+        std::atomic<int64_t> available_;
+        std::atomic<uint64_t> allocations_;
+        std::atomic<uint64_t> exhausted_;
+        std::atomic<size_t> slab_count_;
+        std::atomic<uint8_t*> slabs_[kMaxSlabs];
+        std::unique_ptr<uint8_t[]> storage_[kMaxSlabs];
+        std::mutex grow_lock_;
+};
+
+// One NAL unit of an Annex-B buffer, start code excluded.
+struct NalUnit {
+        const uint8_t* data;
+        size_t len;
+};
+
+// Walks the NAL units of an Annex-B buffer. A buffer without start codes
+// is one NAL unit. Zero bytes in front of a start code, a four byte start
+// code included, are not part of the NAL unit before it.
+class AnnexBReader {
+public:
+        AnnexBReader(const uint8_t* data, size_t len);
+        bool Next(NalUnit* nal);
+
+        // Offset of the next 00 00 01 at or after |from|, or |len|. Uses
+        // AVX2 or SSE2 where the CPU has them.
+        static size_t FindStartCode(const uint8_t* data, size_t len, size_t from);
+        // The same one byte at a time, for comparison.
+        static size_t FindStartCodeScalar(const uint8_t* data, size_t len, size_t from);
+        // "avx2", "sse2" or "scalar": what FindStartCode() runs on.
+        static const char* StartCodeScanner();
+
+private:
+        const uint8_t* data_;
+        size_t len_;
+        size_t pos_;
+};
+
+enum class RtpPayloadFormat {
+        H264,   // RFC 6184, single NAL unit and FU-A packets
+        H265,   // RFC 7798, single NAL unit and FU packets
+        AAC,    // RFC 3640 AAC-hbr, one access unit or fragment per packet
+        VP8,    // RFC 7741, a one byte payload descriptor per packet
+        Data,   // opaque bytes split over packets, marker on the last
+};
+
+// Turns frames into RTP packets of one stream. Packets are built in pooled
+// buffers and kept in a history ring for retransmission, so once the pool
+// is warm the send path allocates nothing. Not thread safe.
+class RtpPacketizer {
+public:
+        // Whole RTP packets, header included, stay under this.
+        static const size_t kMaxPacketSize = 1200;
+        static const int kHistorySize = 512;
+
+        struct Stats {
+                uint64_t frames = 0;
+                uint64_t packets = 0;
+                uint64_t bytes = 0;
+                uint64_t resent = 0;
+                // Packets lost because the pool ran dry.
+                uint64_t dropped = 0;
+                // Pool slabs allocated to packets of this stream.
+                uint64_t allocations = 0;
+        };
+
+        RtpPacketizer(RtpPacketPool* pool, RtpPayloadFormat format,
+                      uint8_t payload_type, uint32_t ssrc);
+        ~RtpPacketizer();
+
+        void SetSink(RtpPacketSink* sink) { sink_ = sink; }
+        void SetFormat(RtpPayloadFormat format) { format_ = format; }
+        void SetSSRC(uint32_t ssrc) { ssrc_ = ssrc; }
+        RtpPayloadFormat format() const { return format_; }
+        uint32_t ssrc() const { return ssrc_; }
+
+        // Packetizes one frame: an Annex-B access unit, a VP8 frame, one
+        // or more ADTS frames or a raw AAC access unit, or data. |timestamp| is in the
+        // stream's RTP clock; ADTS frames after the first get 1024 samples
+        // each added. Returns the number of packets sent or -1.
+        int SendFrame(const uint8_t* data, size_t len, uint32_t timestamp);
+
+        // Sends a packet from the history again. Returns 0 or -1.
+        int Resend(uint16_t sequence_number);
+
+        const Stats& stats() const { return stats_; }
+
+        // Sample rate of an ADTS frame, 0 if |data| is not one.
+        static int AdtsSampleRate(const uint8_t* data, size_t len);
+
+private:
+        int SendH264(const uint8_t* data, size_t len, uint32_t timestamp);
+        int SendH265(const uint8_t* data, size_t len, uint32_t timestamp);
+        int SendNalUnit(const NalUnit& nal, size_t header_size, uint32_t timestamp, bool last);
+        int SendAac(const uint8_t* data, size_t len, uint32_t timestamp);
+        int SendAccessUnit(const uint8_t* data, size_t len, uint32_t timestamp);
+        int SendVp8(const uint8_t* data, size_t len, uint32_t timestamp);
+        int SendData(const uint8_t* data, size_t len, uint32_t timestamp);
+
+        // Takes a buffer and writes the fixed header. nullptr if the pool
+        // is empty.
+        uint8_t* BeginPacket(uint32_t timestamp);
+        // Stamps the sequence number, keeps the packet in the history and
+        // hands it to the sink.
+        void FinishPacket(uint8_t* packet, size_t len, bool marker);
+
+        RtpPacketPool* pool_;
+        RtpPacketSink* sink_;
+        RtpPayloadFormat format_;
+        uint8_t payload_type_;
+        uint32_t ssrc_;
+        uint16_t sequence_number_;
+
+        uint8_t* history_[kHistorySize];
+        uint16_t history_len_[kHistorySize];
+        Stats stats_;
+};
+
+#endif // RTP_PACKETIZER_H_
@@ -0,0 +1,362 @@
+#include "rtp_receiver.h"
+
+#include <string.h>
+
+#include <chrono>
+
+namespace {
+        // The SSRC our RTCP goes out under.
+        const uint32_t kFeedbackSsrc = 0x52435652;
+        const int kDefaultNackIntervalMs = 20;
+        const int kDefaultMaxWaitMs = 200;
+        // Room for the largest frame we expect before frame_ has to grow.
+        const size_t kFrameReserve = 512 * 1024;
+
+        const uint8_t kStapA = 24;
+        const uint8_t kFuA = 28;
+        const uint8_t kStartCode[] = {0, 0, 0, 1};
+
+        uint16_t Read16(const uint8_t* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+        uint32_t Read32(const uint8_t* p) {
+                return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+        void Write16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = static_cast<uint8_t>(v); }
+        void Write32(uint8_t* p, uint32_t v) {
+                p[0] = v >> 24; p[1] = static_cast<uint8_t>(v >> 16);
+                p[2] = static_cast<uint8_t>(v >> 8); p[3] = static_cast<uint8_t>(v);
+        }
+
+        // Sequence number distance, negative if |a| is older than |b|.
+        int Distance(uint16_t a, uint16_t b) {
+                return static_cast<int16_t>(a - b);
+        }
+
+        bool IsKeyNal(uint8_t type) { return type == 5 || type == 7; }
+
+        void Append(std::vector<uint8_t>* frame, const uint8_t* data, size_t len) {
+                frame->insert(frame->end(), data, data + len);
+        }
+}  // namespace
+
+RtpReceiver::RtpReceiver(uint32_t ssrc, RtpFrameSink* frames, RtpPacketSink* feedback)
+: ssrc_(ssrc), frames_(frames), feedback_(feedback),
+nack_interval_ms_(kDefaultNackIntervalMs), max_wait_ms_(kDefaultMaxWaitMs),
+started_(false), waiting_for_key_(true), head_(0), end_(0),
+slots_(kRingSize), payloads_(kRingSize * kMaxPayloadSize), nack_count_(0) {
+        memset(slots_.data(), 0, slots_.size() * sizeof(Slot));
+        frame_.reserve(kFrameReserve);
+}
+
+void RtpReceiver::OnRtpPacket(const uint8_t* data, size_t len) {
+        int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        InsertPacketAt(data, len, now_ms);
+}
+
+bool RtpReceiver::InsertPacketAt(const uint8_t* data, size_t len, int64_t now_ms) {
+        if (len < 12 || (data[0] >> 6) != 2)
+                return false;
+        uint8_t payload_type = data[1] & 0x7f;
+        if (payload_type >= 64 && payload_type < 96)
+                return false;
+        if (Read32(data + 8) != ssrc_)
+                return false;
+        size_t offset = 12 + 4 * (data[0] & 0x0f);
+        if ((data[0] & 0x10) && len >= offset + 4)
+                offset += 4 + 4 * Read16(data + offset + 2);
+        size_t end = len;
+        if ((data[0] & 0x20) && len > 0)
+                end -= data[len - 1];
+        if (offset >= end || end > len || end - offset > kMaxPayloadSize)
+                return false;
+        const uint8_t* payload = data + offset;
+        size_t payload_len = end - offset;
+        uint16_t seq = Read16(data + 2);
+
+        ++stats_.packets;
+        if (!started_) {
+                started_ = true;
+                head_ = seq;
+                end_ = seq;
+        }
+        int ahead = Distance(seq, head_);
+        if (ahead < 0) {
+                ++stats_.late;
+                RemoveNack(seq);
+                return true;
+        }
+        if (ahead >= kRingSize) {
+                // Too far ahead to wait for what is missing: start over.
+                for (uint16_t s = head_; s != end_; ++s)
+                        Release(s);
+                head_ = end_ = seq;
+                nack_count_ = 0;
+                ++stats_.frames_dropped;
+                waiting_for_key_ = true;
+                SendPli();
+        }
+
+        Slot& slot = slots_[seq % kRingSize];
+        if (slot.used && slot.sequence_number == seq) {
+                ++stats_.duplicates;
+                return true;
+        }
+        uint8_t type = payload[0] & 0x1f;
+        slot.used = true;
+        slot.marker = (data[1] & 0x80) != 0;
+        slot.sequence_number = seq;
+        slot.payload_len = static_cast<uint16_t>(payload_len);
+        slot.timestamp = Read32(data + 4);
+        slot.key = IsKeyNal(type) || (type == kFuA && payload_len >= 2 && IsKeyNal(payload[1] & 0x1f));
+        if (type == kStapA) {
+                for (size_t pos = 1; pos + 2 < payload_len && !slot.key;) {
+                        size_t size = Read16(payload + pos);
+                        pos += 2;
+                        slot.key = IsKeyNal(payload[pos] & 0x1f);
+                        pos += size;
+                }
+        }
+        memcpy(&payloads_[(seq % kRingSize) * kMaxPayloadSize], payload, payload_len);
+
+        if (Distance(seq, end_) >= 0) {
+                if (seq != end_) {
+                        AddNacks(end_, seq, now_ms);
+                        SendNacks(now_ms);
+                }
+                end_ = seq + 1;
+        } else {
+                RemoveNack(seq);
+        }
+        DeliverFrames();
+        return true;
+}
+
+void RtpReceiver::ProcessAt(int64_t now_ms) {
+        if (started_ && head_ != end_) {
+                // The oldest packet missing holds up the frame it is in,
+                // whether that is the head of the ring or a later packet
+                // of a frame already begun.
+                uint16_t missing = head_;
+                while (missing != end_ && slots_[missing % kRingSize].used)
+                        ++missing;
+                if (missing != end_) {
+                        // Give up on it once it is too old. Not in the NACK
+                        // list: out of retries or never fitted.
+                        bool give_up = true;
+                        for (size_t i = 0; i < nack_count_; ++i) {
+                                if (nacks_[i].sequence_number == missing)
+                                        give_up = now_ms - nacks_[i].first_ms >= max_wait_ms_;
+                        }
+                        if (give_up) {
+                                SkipTo(missing);
+                                DeliverFrames();
+                        }
+                }
+        }
+        SendNacks(now_ms);
+}
+
+void RtpReceiver::DeliverFrames() {
+        while (head_ != end_) {
+                const Slot& first = slots_[head_ % kRingSize];
+                if (!first.used)
+                        return;
+                // Find the marker; every packet up to it has to be here.
+                uint16_t last = head_;
+                bool key = false;
+                while (true) {
+                        const Slot& slot = slots_[last % kRingSize];
+                        if (!slot.used || slot.timestamp != first.timestamp)
+                                break;
+                        key |= slot.key;
+                        if (slot.marker)
+                                break;
+                        if (++last == end_)
+                                return;
+                }
+                const Slot& tail = slots_[last % kRingSize];
+                if (!tail.used)
+                        return;
+                bool complete = tail.marker && tail.timestamp == first.timestamp;
+                if (!complete) {
+                        // The timestamp changed without a marker: the end of
+                        // this frame was lost for good.
+                        --last;
+                }
+                bool ok = complete && Assemble(head_, last);
+                uint32_t timestamp = first.timestamp;
+                for (uint16_t s = head_; s != static_cast<uint16_t>(last + 1); ++s)
+                        Release(s);
+                head_ = last + 1;
+                if (!ok) {
+                        ++stats_.frames_dropped;
+                        if (!waiting_for_key_) {
+                                waiting_for_key_ = true;
+                                SendPli();
+                        }
+                        continue;
+                }
+                if (waiting_for_key_ && !key) {
+                        ++stats_.frames_dropped;
+                        continue;
+                }
+                waiting_for_key_ = false;
+                ++stats_.frames;
+                if (key)
+                        ++stats_.key_frames;
+                if (frames_)
+                        frames_->OnFrame(frame_.data(), frame_.size(), timestamp, key);
+        }
+}
+
+bool RtpReceiver::Assemble(uint16_t first, uint16_t last) {
+        frame_.clear();
+        bool in_fu = false;
+        for (uint16_t s = first; s != static_cast<uint16_t>(last + 1); ++s) {
+                const Slot& slot = slots_[s % kRingSize];
+                const uint8_t* p = &payloads_[(s % kRingSize) * kMaxPayloadSize];
+                size_t len = slot.payload_len;
+                uint8_t type = p[0] & 0x1f;
+                if (type == kFuA) {
+                        if (len < 2)
+                                return false;
+                        if (p[1] & 0x80) {
+                                if (in_fu)
+                                        return false;
+                                in_fu = true;
+                                Append(&frame_, kStartCode, sizeof(kStartCode));
+                                frame_.push_back((p[0] & 0xe0) | (p[1] & 0x1f));
+                        } else if (!in_fu) {
+                                return false;
+                        }
+                        Append(&frame_, p + 2, len - 2);
+                        if (p[1] & 0x40)
+                                in_fu = false;
+                        continue;
+                }
+                if (in_fu)
+                        return false;
+                if (type == kStapA) {
+                        size_t pos = 1;
+                        while (pos + 2 <= len) {
+                                size_t size = Read16(p + pos);
+                                pos += 2;
+                                if (!size || pos + size > len)
+                                        return false;
+                                Append(&frame_, kStartCode, sizeof(kStartCode));
+                                Append(&frame_, p + pos, size);
+                                pos += size;
+                        }
+                } else if (type >= 1 && type <= 23) {
+                        Append(&frame_, kStartCode, sizeof(kStartCode));
+                        Append(&frame_, p, len);
+                } else {
+                        return false;
+                }
+        }
+        return !in_fu && !frame_.empty();
+}
+
+void RtpReceiver::SkipTo(uint16_t to) {
+        // What is before |to| belongs to the frame being given up on.
+        uint16_t s = head_;
+        while (s != to)
+                Release(s++);
+        // Past |to|, the first packet that follows a marker starts a frame.
+        while (s != end_) {
+                const Slot& slot = slots_[s % kRingSize];
+                bool boundary = slot.used && slot.marker;
+                Release(s++);
+                if (boundary)
+                        break;
+        }
+        head_ = s;
+        size_t kept = 0;
+        for (size_t i = 0; i < nack_count_; ++i) {
+                if (Distance(nacks_[i].sequence_number, head_) >= 0)
+                        nacks_[kept++] = nacks_[i];
+        }
+        nack_count_ = kept;
+        ++stats_.frames_dropped;
+        // Even when already waiting: the frame given up on may have been
+        // the key frame waited for.
+        waiting_for_key_ = true;
+        SendPli();
+}
+
+void RtpReceiver::Release(uint16_t sequence_number) {
+        Slot& slot = slots_[sequence_number % kRingSize];
+        if (slot.sequence_number == sequence_number)
+                slot.used = false;
+}
+
+void RtpReceiver::AddNacks(uint16_t from, uint16_t to, int64_t now_ms) {
+        for (uint16_t s = from; s != to && nack_count_ < kMaxNacks; ++s) {
+                Nack& nack = nacks_[nack_count_++];
+                nack.sequence_number = s;
+                nack.retries = 0;
+                nack.first_ms = now_ms;
+                nack.sent_ms = 0;
+        }
+}
+
+void RtpReceiver::RemoveNack(uint16_t sequence_number) {
+        for (size_t i = 0; i < nack_count_; ++i) {
+                if (nacks_[i].sequence_number == sequence_number) {
+                        // Keep the list in sequence order for the FCI.
+                        memmove(&nacks_[i], &nacks_[i + 1], (nack_count_ - i - 1) * sizeof(Nack));
+                        --nack_count_;
+                        ++stats_.recovered;
+                        return;
+                }
+        }
+}
+
+void RtpReceiver::SendNacks(int64_t now_ms) {
+        size_t items = 0;
+        size_t kept = 0;
+        for (size_t i = 0; i < nack_count_; ++i) {
+                Nack nack = nacks_[i];
+                bool due = !nack.sent_ms || now_ms - nack.sent_ms >= nack_interval_ms_;
+                if (due) {
+                        if (nack.retries >= kMaxNackRetries)
+                                continue;
+                        ++nack.retries;
+                        nack.sent_ms = now_ms;
+                        // Packs into the previous item's bitmask when close.
+                        uint8_t* last = rtcp_ + 12 + 4 * (items ? items - 1 : 0);
+                        int distance = items ? Distance(nack.sequence_number, Read16(last)) : 0;
+                        if (items && distance >= 1 && distance <= 16) {
+                                Write16(last + 2, Read16(last + 2) | (1 << (distance - 1)));
+                        } else {
+                                uint8_t* item = rtcp_ + 12 + 4 * items++;
+                                Write16(item, nack.sequence_number);
+                                Write16(item + 2, 0);
+                        }
+                }
+                nacks_[kept++] = nack;
+        }
+        nack_count_ = kept;
+        if (!items || !feedback_)
+                return;
+        rtcp_[0] = 0x81;
+        rtcp_[1] = 205;
+        Write16(rtcp_ + 2, static_cast<uint16_t>(2 + items));
+        Write32(rtcp_ + 4, kFeedbackSsrc);
+        Write32(rtcp_ + 8, ssrc_);
+        feedback_->OnRtcpPacket(rtcp_, 12 + 4 * items);
+        ++stats_.nacks_sent;
+}
+
+void RtpReceiver::SendPli() {
+        if (!feedback_)
+                return;
+        uint8_t pli[12];
+        pli[0] = 0x81;
+        pli[1] = 206;
+        Write16(pli + 2, 2);
+        Write32(pli + 4, kFeedbackSsrc);
+        Write32(pli + 8, ssrc_);
+        feedback_->OnRtcpPacket(pli, sizeof(pli));
+        ++stats_.plis_sent;
+}
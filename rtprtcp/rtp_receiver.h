@@ -0,0 +1,123 @@
+#ifndef RTP_RECEIVER_H_
+#define RTP_RECEIVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "myrtprtcp.h"
+
+// Where RtpReceiver delivers complete frames. |data| is an Annex-B access
+// unit, valid only during the call.
+class RtpFrameSink {
+public:
+        virtual ~RtpFrameSink() {}
+        virtual void OnFrame(const uint8_t* data, size_t len, uint32_t timestamp, bool key) = 0;
+};
+
+// The receive side of one H.264 RTP stream: datagrams go in, complete
+// access units come out in order.
+//
+// Packets sit in a ring indexed by sequence number modulo kRingSize; the
+// per-slot headers are kept apart from the payload bytes so the scans for
+// a complete frame stay within a few cache lines. A frame is handed on
+// once every packet from its first to the marker is there, depacketized
+// from single NAL unit, STAP-A and FU-A packets. Gaps are NACKed at once
+// and again every |nack_interval_ms| up to kMaxNackRetries. A gap still
+// open after |max_wait_ms| or out of NACKs, at the head of the ring or in
+// the middle of a frame begun, or one that falls out of the ring, is
+// given up on: its frame is dropped, and the frames after it until the
+// next key frame, for which a PLI goes out. NACKs and PLIs are written
+// to the feedback sink as RTCP.
+//
+// Not thread safe. The RtpPacketSink interface uses the steady clock; the
+// *At() calls take the time from the caller.
+class RtpReceiver : public RtpPacketSink {
+public:
+        static const int kRingSize = 1024;
+        static const int kMaxNackRetries = 10;
+
+        struct Stats {
+                uint64_t packets = 0;
+                uint64_t duplicates = 0;
+                // Packets older than the last frame handed on.
+                uint64_t late = 0;
+                uint64_t frames = 0;
+                uint64_t key_frames = 0;
+                // Frames lost or thrown away while waiting for a key frame.
+                uint64_t frames_dropped = 0;
+                uint64_t nacks_sent = 0;
+                // Packets that arrived after being NACKed.
+                uint64_t recovered = 0;
+                uint64_t plis_sent = 0;
+        };
+
+        RtpReceiver(uint32_t ssrc, RtpFrameSink* frames, RtpPacketSink* feedback);
+
+        void set_nack_interval_ms(int ms) { nack_interval_ms_ = ms; }
+        void set_max_wait_ms(int ms) { max_wait_ms_ = ms; }
+
+        // RtpPacketSink. RTCP is ignored.
+        void OnRtpPacket(const uint8_t* data, size_t len) override;
+
+        // Returns false for a packet that is not RTP or not this stream.
+        bool InsertPacketAt(const uint8_t* data, size_t len, int64_t now_ms);
+        // Resends NACKs and gives up on old gaps. Call every few ms.
+        void ProcessAt(int64_t now_ms);
+
+        const Stats& stats() const { return stats_; }
+
+private:
+        struct Slot {
+                bool used;
+                bool marker;
+                bool key;
+                uint16_t sequence_number;
+                uint16_t payload_len;
+                uint32_t timestamp;
+        };
+        struct Nack {
+                uint16_t sequence_number;
+                uint8_t retries;
+                int64_t first_ms;
+                int64_t sent_ms;
+        };
+
+        static const size_t kMaxPayloadSize = 1500;
+        static const size_t kMaxNacks = 256;
+
+        // Hands on every complete frame at the head of the ring.
+        void DeliverFrames();
+        // Depacketizes the frame in [first, last]. False if it is broken.
+        bool Assemble(uint16_t first, uint16_t last);
+        // Drops the head of the ring up to the next frame start after
+        // |to|, the first packet still missing, which is given up on.
+        void SkipTo(uint16_t to);
+        void Release(uint16_t sequence_number);
+        void AddNacks(uint16_t from, uint16_t to, int64_t now_ms);
+        void RemoveNack(uint16_t sequence_number);
+        void SendNacks(int64_t now_ms);
+        void SendPli();
+
+        uint32_t ssrc_;
+        RtpFrameSink* frames_;
+        RtpPacketSink* feedback_;
+        int nack_interval_ms_;
+        int max_wait_ms_;
+
+        bool started_;
+        bool waiting_for_key_;
+        // Next packet to hand on, and one past the newest received.
+        uint16_t head_;
+        uint16_t end_;
+
+        std::vector<Slot> slots_;
+        std::vector<uint8_t> payloads_;
+        Nack nacks_[kMaxNacks];
+        size_t nack_count_;
+        std::vector<uint8_t> frame_;
+        uint8_t rtcp_[12 + 4 * kMaxNacks];
+        Stats stats_;
+};
+
+#endif // RTP_RECEIVER_H_
@@ -0,0 +1,512 @@
+#include "rtp_sfu.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "rtp_fanout.h"
+
+namespace {
+        // The SSRC the SFU sends its own RTCP under.
+        const uint32_t kSfuSsrc = 0x5f5f0001;
+        const int kReportIntervalMs = 1000;
+        // Subscribers send receiver reports at least every few seconds.
+        const int kLegTimeoutMs = 10 * kReportIntervalMs;
+        // Publishers get at most one PLI per interval however many
+        // subscribers ask.
+        const int kPliIntervalMs = 300;
+        const int kSocketBufferSize = 4 << 20;
+
+        const uint8_t kRtcpSr = 200;
+        const uint8_t kRtcpRr = 201;
+        const uint8_t kRtcpBye = 203;
+        const uint8_t kRtcpRtpfb = 205;
+        const uint8_t kRtcpPsfb = 206;
+        const uint8_t kFmtNack = 1;
+        const uint8_t kFmtPli = 1;
+
+        int64_t NowMs() {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        int64_t ThreadCpuUs() {
+                timespec ts;
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+                return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+        }
+
+        uint16_t Read16(const uint8_t* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+        uint32_t Read32(const uint8_t* p) {
+                return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+        void Write16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = static_cast<uint8_t>(v); }
+        void Write32(uint8_t* p, uint32_t v) {
+                p[0] = v >> 24; p[1] = static_cast<uint8_t>(v >> 16);
+                p[2] = static_cast<uint8_t>(v >> 8); p[3] = static_cast<uint8_t>(v);
+        }
+
+        // Common header of an RTCP packet |words| 32-bit words long.
+        void WriteRtcpHeader(uint8_t* p, uint8_t count, uint8_t type, size_t words) {
+                p[0] = 0x80 | count;
+                p[1] = type;
+                Write16(p + 2, static_cast<uint16_t>(words - 1));
+        }
+
+        bool SameAddress(const sockaddr_in& a, const sockaddr_in& b) {
+                return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+        }
+
+        // Offset of the payload in an RTP packet, or 0 if it is malformed.
+        size_t RtpPayloadOffset(const uint8_t* data, size_t len) {
+                if (len < 12)
+                        return 0;
+                size_t offset = 12 + 4 * (data[0] & 0x0f);
+                if (data[0] & 0x10) {
+                        if (len < offset + 4)
+                                return 0;
+                        offset += 4 + 4 * Read16(data + offset + 2);
+                }
+                return offset < len ? offset : 0;
+        }
+
+        bool IsKeyNal(uint8_t type) { return type == 5 || type == 7; }
+
+        // True for the first packet of an H.264 IDR or of the SPS before it.
+        bool IsH264KeyFrameStart(const uint8_t* payload, size_t len) {
+                uint8_t type = payload[0] & 0x1f;
+                if (IsKeyNal(type))
+                        return true;
+                if (type == 24) {
+                        // STAP-A: 16 bit sizes, each followed by a NAL unit.
+                        size_t pos = 1;
+                        while (pos + 2 < len) {
+                                size_t size = Read16(payload + pos);
+                                pos += 2;
+                                if (IsKeyNal(payload[pos] & 0x1f))
+                                        return true;
+                                pos += size;
+                        }
+                        return false;
+                }
+                // FU-A with the start bit set.
+                return type == 28 && len >= 2 && (payload[1] & 0x80) &&
+                IsKeyNal(payload[1] & 0x1f);
+        }
+
+        // The current wall clock as an NTP timestamp.
+        void NtpNow(uint32_t* seconds, uint32_t* fraction) {
+                timeval tv;
+                gettimeofday(&tv, nullptr);
+                *seconds = static_cast<uint32_t>(tv.tv_sec + 2208988800u);
+                *fraction = static_cast<uint32_t>((uint64_t(tv.tv_usec) << 32) / 1000000);
+        }
+}  // namespace
+
+RtpSfu::RtpSfu()
+: socket_(-1), port_(0), running_(false), now_ms_(0),
+next_ssrc_(std::random_device()()), leg_timeout_ms_(kLegTimeoutMs), received_(0),
+forwarded_(0), retransmitted_(0), nacks_upstream_(0), plis_upstream_(0),
+legs_count_(0), legs_removed_(0), cpu_us_(0) {
+        scratch_.resize(kMaxPacketSize);
+}
+
+RtpSfu::~RtpSfu() {
+        Stop();
+}
+
+bool RtpSfu::Start(const char* ip, uint16_t port) {
+        socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (socket_ < 0)
+                return false;
+        setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &kSocketBufferSize, sizeof(kSocketBufferSize));
+        setsockopt(socket_, SOL_SOCKET, SO_SNDBUF, &kSocketBufferSize, sizeof(kSocketBufferSize));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr(ip);
+        socklen_t addr_len = sizeof(addr);
+        if (bind(socket_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            getsockname(socket_, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+                close(socket_);
+                socket_ = -1;
+                return false;
+        }
+        port_ = ntohs(addr.sin_port);
+        running_ = true;
+        thread_ = std::thread(&RtpSfu::Run, this);
+        return true;
+}
+
+void RtpSfu::Stop() {
+        running_ = false;
+        if (thread_.joinable())
+                thread_.join();
+        if (socket_ >= 0) {
+                close(socket_);
+                socket_ = -1;
+        }
+}
+
+RtpSfu::Stats RtpSfu::stats() const {
+        Stats stats;
+        stats.received = received_;
+        stats.forwarded = forwarded_;
+        stats.retransmitted = retransmitted_;
+        stats.nacks_upstream = nacks_upstream_;
+        stats.plis_upstream = plis_upstream_;
+        stats.legs = legs_count_;
+        stats.legs_removed = legs_removed_;
+        stats.cpu_us = cpu_us_;
+        return stats;
+}
+
+void RtpSfu::Run() {
+        int64_t cpu_start = ThreadCpuUs();
+        int64_t next_report_ms = NowMs() + kReportIntervalMs;
+        uint8_t buffer[kMaxPacketSize];
+        pollfd pfd;
+        pfd.fd = socket_;
+        pfd.events = POLLIN;
+        while (running_) {
+                poll(&pfd, 1, 10);
+                now_ms_ = NowMs();
+                while (true) {
+                        sockaddr_in from;
+                        socklen_t from_len = sizeof(from);
+                        ssize_t len = recvfrom(socket_, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                               reinterpret_cast<sockaddr*>(&from), &from_len);
+                        if (len <= 0)
+                                break;
+                        OnPacket(buffer, len, from);
+                }
+                if (now_ms_ >= next_report_ms) {
+                        ExpireLegs();
+                        SendReports();
+                        next_report_ms = now_ms_ + kReportIntervalMs;
+                }
+                cpu_us_ = ThreadCpuUs() - cpu_start;
+        }
+}
+
+void RtpSfu::OnPacket(uint8_t* data, size_t len, const sockaddr_in& from) {
+        if (len < 8 || (data[0] >> 6) != 2)
+                return;
+        // RFC 5761: RTCP packet types 192-223 sit where RTP payload types
+        // 64-95 would be.
+        uint8_t type = data[1] & 0x7f;
+        if (type >= 64 && type < 96)
+                OnRtcp(data, len, from);
+        else
+                OnRtp(data, len, from);
+}
+
+void RtpSfu::OnRtp(uint8_t* data, size_t len, const sockaddr_in& from) {
+        size_t payload = RtpPayloadOffset(data, len);
+        if (!payload)
+                return;
+        ++received_;
+        uint32_t ssrc = Read32(data + 8);
+        uint16_t seq = Read16(data + 2);
+        auto it = publishers_.find(ssrc);
+        if (it == publishers_.end()) {
+                it = publishers_.emplace(ssrc, Publisher()).first;
+                it->second.cache.resize(kCacheSize);
+                it->second.base_seq = it->second.max_seq = seq;
+        }
+        Publisher& publisher = it->second;
+        publisher.addr = from;
+
+        // Sequence number bookkeeping from RFC 3550 A.1, without probation.
+        uint16_t delta = seq - publisher.max_seq;
+        if (delta < 3000) {
+                if (seq < publisher.max_seq)
+                        publisher.cycles += 65536;
+                publisher.max_seq = seq;
+        }
+        ++publisher.received;
+
+        CachedPacket& cached = publisher.cache[seq % kCacheSize];
+        cached.valid = true;
+        cached.sequence_number = seq;
+        cached.len = static_cast<uint16_t>(len);
+        memcpy(cached.data, data, len);
+
+        bool key = IsH264KeyFrameStart(data + payload, len - payload);
+        for (int index : publisher.legs) {
+                Leg& leg = legs_[index];
+                if (leg.waiting_for_key) {
+                        if (!key)
+                                continue;
+                        leg.waiting_for_key = false;
+                        leg.seq_delta = leg.first_seq - seq;
+                }
+                Forward(&leg, data, len, seq);
+        }
+}
+
+void RtpSfu::Forward(Leg* leg, const uint8_t* data, size_t len, uint16_t seq) {
+        memcpy(scratch_.data(), data, len);
+        RtpFanOut::RewriteHeader(scratch_.data(), len, leg->ssrc,
+                                 static_cast<uint16_t>(seq + leg->seq_delta), 0);
+        leg->last_timestamp = Read32(data + 4);
+        ++leg->packets;
+        leg->octets += static_cast<uint32_t>(len);
+        SendTo(scratch_.data(), len, leg->addr);
+        ++forwarded_;
+}
+
+void RtpSfu::OnRtcp(const uint8_t* data, size_t len, const sockaddr_in& from) {
+        // Walk the compound packet.
+        while (len >= 8) {
+                size_t size = 4 * (Read16(data + 2) + 1);
+                if (size > len)
+                        return;
+                uint8_t count = data[0] & 0x1f;
+                uint8_t type = data[1];
+                uint32_t sender_ssrc = Read32(data + 4);
+                if (type == kRtcpPsfb && count == kFmtPli && size >= 12) {
+                        OnPli(Read32(data + 8), from);
+                } else if (type == kRtcpRtpfb && count == kFmtNack && size >= 12) {
+                        OnNack(Read32(data + 8), data + 12, size - 12);
+                } else if (type == kRtcpBye) {
+                        OnBye(from);
+                        return;
+                } else if (type == kRtcpSr && size >= 28) {
+                        auto it = publishers_.find(sender_ssrc);
+                        if (it != publishers_.end()) {
+                                it->second.last_sr = (Read32(data + 8) << 16) | (Read32(data + 12) >> 16);
+                                it->second.last_sr_ms = now_ms_;
+                        }
+                }
+                // Report blocks from subscribers end here, but keep their
+                // legs alive.
+                if (type == kRtcpSr || type == kRtcpRr) {
+                        size_t blocks = type == kRtcpSr ? 28 : 8;
+                        for (uint8_t i = 0; i < count && blocks + 24 * (i + 1) <= size; ++i)
+                                TouchLeg(Read32(data + blocks + 24 * i));
+                }
+                data += size;
+                len -= size;
+        }
+}
+
+void RtpSfu::OnPli(uint32_t media_ssrc, const sockaddr_in& from) {
+        auto leg = leg_ssrcs_.find(media_ssrc);
+        if (leg != leg_ssrcs_.end()) {
+                legs_[leg->second].last_rtcp_ms = now_ms_;
+                RequestKeyFrame(legs_[leg->second].publisher_ssrc);
+                return;
+        }
+        auto publisher = publishers_.find(media_ssrc);
+        if (publisher == publishers_.end())
+                return;
+        // A PLI for the publisher itself asks to subscribe, unless this
+        // address already has.
+        for (int index : publisher->second.legs) {
+                if (SameAddress(legs_[index].addr, from)) {
+                        legs_[index].last_rtcp_ms = now_ms_;
+                        RequestKeyFrame(media_ssrc);
+                        return;
+                }
+        }
+        Leg added;
+        added.addr = from;
+        added.publisher_ssrc = media_ssrc;
+        do {
+                added.ssrc = next_ssrc_++;
+        } while (leg_ssrcs_.count(added.ssrc) || publishers_.count(added.ssrc) ||
+                 added.ssrc == kSfuSsrc);
+        added.seq_delta = 0;
+        added.first_seq = static_cast<uint16_t>(added.ssrc * 2654435761u >> 16);
+        added.waiting_for_key = true;
+        added.last_timestamp = 0;
+        added.packets = 0;
+        added.octets = 0;
+        added.last_rtcp_ms = now_ms_;
+        legs_.push_back(added);
+        int index = static_cast<int>(legs_.size()) - 1;
+        leg_ssrcs_[added.ssrc] = index;
+        publisher->second.legs.push_back(index);
+        legs_count_ = legs_.size();
+        RequestKeyFrame(media_ssrc);
+}
+
+void RtpSfu::OnBye(const sockaddr_in& from) {
+        // The BYE names the subscriber's own SSRCs, which the SFU never
+        // learns; its address is what identifies the legs.
+        for (int index = static_cast<int>(legs_.size()) - 1; index >= 0; --index) {
+                if (SameAddress(legs_[index].addr, from))
+                        RemoveLeg(index);
+        }
+}
+
+void RtpSfu::TouchLeg(uint32_t ssrc) {
+        auto it = leg_ssrcs_.find(ssrc);
+        if (it != leg_ssrcs_.end())
+                legs_[it->second].last_rtcp_ms = now_ms_;
+}
+
+// The last leg moves into the hole, so indices stay dense.
+void RtpSfu::RemoveLeg(int index) {
+        int last = static_cast<int>(legs_.size()) - 1;
+        auto unlink = [this](const Leg& leg, int from, int to) {
+                auto publisher = publishers_.find(leg.publisher_ssrc);
+                if (publisher == publishers_.end())
+                        return;
+                std::vector<int>& legs = publisher->second.legs;
+                auto it = std::find(legs.begin(), legs.end(), from);
+                if (it == legs.end())
+                        return;
+                if (to < 0)
+                        legs.erase(it);
+                else
+                        *it = to;
+        };
+        unlink(legs_[index], index, -1);
+        leg_ssrcs_.erase(legs_[index].ssrc);
+        if (index != last) {
+                unlink(legs_[last], last, index);
+                legs_[index] = legs_[last];
+                leg_ssrcs_[legs_[index].ssrc] = index;
+        }
+        legs_.pop_back();
+        legs_count_ = legs_.size();
+        ++legs_removed_;
+}
+
+void RtpSfu::ExpireLegs() {
+        for (int index = static_cast<int>(legs_.size()) - 1; index >= 0; --index) {
+                if (now_ms_ - legs_[index].last_rtcp_ms > leg_timeout_ms_)
+                        RemoveLeg(index);
+        }
+}
+
+void RtpSfu::OnNack(uint32_t media_ssrc, const uint8_t* fci, size_t len) {
+        auto it = leg_ssrcs_.find(media_ssrc);
+        if (it == leg_ssrcs_.end())
+                return;
+        Leg& leg = legs_[it->second];
+        leg.last_rtcp_ms = now_ms_;
+        if (leg.waiting_for_key)
+                return;
+        auto publisher_it = publishers_.find(leg.publisher_ssrc);
+        if (publisher_it == publishers_.end())
+                return;
+        Publisher& publisher = publisher_it->second;
+
+        // Whatever the cache cannot answer goes upstream, in the
+        // publisher's sequence numbers.
+        uint16_t missing[64];
+        size_t missing_count = 0;
+        for (; len >= 4; fci += 4, len -= 4) {
+                uint16_t pid = Read16(fci);
+                uint16_t blp = Read16(fci + 2);
+                for (int bit = -1; bit < 16; ++bit) {
+                        if (bit >= 0 && !(blp & (1 << bit)))
+                                continue;
+                        uint16_t seq = static_cast<uint16_t>(pid + bit + 1 - leg.seq_delta);
+                        const CachedPacket& cached = publisher.cache[seq % kCacheSize];
+                        if (cached.valid && cached.sequence_number == seq) {
+                                Forward(&leg, cached.data, cached.len, seq);
+                                ++retransmitted_;
+                        } else if (missing_count < 64) {
+                                missing[missing_count++] = seq;
+                        }
+                }
+        }
+        if (!missing_count)
+                return;
+
+        uint8_t packet[12 + 4 * 64];
+        size_t items = 0;
+        for (size_t i = 0; i < missing_count; ++i) {
+                if (items) {
+                        uint8_t* last = packet + 12 + 4 * (items - 1);
+                        uint16_t distance = missing[i] - Read16(last);
+                        if (distance >= 1 && distance <= 16) {
+                                Write16(last + 2, Read16(last + 2) | (1 << (distance - 1)));
+                                continue;
+                        }
+                }
+                uint8_t* item = packet + 12 + 4 * items++;
+                Write16(item, missing[i]);
+                Write16(item + 2, 0);
+        }
+        WriteRtcpHeader(packet, kFmtNack, kRtcpRtpfb, 3 + items);
+        Write32(packet + 4, kSfuSsrc);
+        Write32(packet + 8, leg.publisher_ssrc);
+        SendTo(packet, 12 + 4 * items, publisher.addr);
+        ++nacks_upstream_;
+}
+
+void RtpSfu::RequestKeyFrame(uint32_t publisher_ssrc) {
+        auto it = publishers_.find(publisher_ssrc);
+        if (it == publishers_.end() || now_ms_ - it->second.last_pli_ms < kPliIntervalMs)
+                return;
+        it->second.last_pli_ms = now_ms_;
+        uint8_t packet[12];
+        WriteRtcpHeader(packet, kFmtPli, kRtcpPsfb, 3);
+        Write32(packet + 4, kSfuSsrc);
+        Write32(packet + 8, publisher_ssrc);
+        SendTo(packet, sizeof(packet), it->second.addr);
+        ++plis_upstream_;
+}
+
+void RtpSfu::SendReports() {
+        uint8_t packet[32];
+        for (auto& entry : publishers_) {
+                Publisher& publisher = entry.second;
+                uint32_t extended_max = publisher.cycles + publisher.max_seq;
+                uint32_t expected = extended_max - publisher.base_seq + 1;
+                int32_t lost = static_cast<int32_t>(expected - publisher.received);
+                uint32_t expected_interval = expected - publisher.expected_prior;
+                uint32_t received_interval = publisher.received - publisher.received_prior;
+                publisher.expected_prior = expected;
+                publisher.received_prior = publisher.received;
+                int32_t lost_interval = static_cast<int32_t>(expected_interval - received_interval);
+                uint8_t fraction = 0;
+                if (expected_interval && lost_interval > 0)
+                        fraction = static_cast<uint8_t>((lost_interval << 8) / expected_interval);
+                lost = std::max(-8388608, std::min(8388607, lost));
+
+                WriteRtcpHeader(packet, 1, kRtcpRr, 8);
+                Write32(packet + 4, kSfuSsrc);
+                Write32(packet + 8, entry.first);
+                Write32(packet + 12, (uint32_t(fraction) << 24) | (uint32_t(lost) & 0xffffff));
+                Write32(packet + 16, extended_max);
+                Write32(packet + 20, 0);
+                Write32(packet + 24, publisher.last_sr);
+                Write32(packet + 28, publisher.last_sr ?
+                        static_cast<uint32_t>((now_ms_ - publisher.last_sr_ms) * 65536 / 1000) : 0);
+                SendTo(packet, 32, publisher.addr);
+        }
+
+        uint32_t ntp_seconds, ntp_fraction;
+        NtpNow(&ntp_seconds, &ntp_fraction);
+        for (const Leg& leg : legs_) {
+                if (leg.waiting_for_key)
+                        continue;
+                WriteRtcpHeader(packet, 0, kRtcpSr, 7);
+                Write32(packet + 4, leg.ssrc);
+                Write32(packet + 8, ntp_seconds);
+                Write32(packet + 12, ntp_fraction);
+                Write32(packet + 16, leg.last_timestamp);
+                Write32(packet + 20, leg.packets);
+                Write32(packet + 24, leg.octets);
+                SendTo(packet, 28, leg.addr);
+        }
+}
+
+void RtpSfu::SendTo(const uint8_t* data, size_t len, const sockaddr_in& to) {
+        sendto(socket_, data, len, 0, reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+}
@@ -0,0 +1,136 @@
+#ifndef RTP_SFU_H_
+#define RTP_SFU_H_
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Selective forwarding unit on one UDP port. Publishers send RTP to it and
+// every packet is forwarded, undecoded, to each subscriber of that
+// publisher under the subscriber's own SSRC and sequence numbers. RTCP
+// ends at the SFU on every leg: NACKs are answered from a packet cache or
+// passed upstream translated, PLIs are passed upstream rate limited, and
+// the SFU sends its own receiver and sender reports.
+//
+// A subscriber joins by sending a PLI for the publisher's SSRC from the
+// address it wants the stream at. It is sent from the next key frame on.
+// It leaves with an RTCP BYE from that address, or is dropped once none
+// of its RTCP (reports, NACKs, PLIs) has arrived for the leg timeout.
+class RtpSfu {
+public:
+        struct Stats {
+                uint64_t received = 0;
+                uint64_t forwarded = 0;
+                uint64_t retransmitted = 0;
+                uint64_t nacks_upstream = 0;
+                uint64_t plis_upstream = 0;
+                // Subscriptions now, and ended by a BYE or the timeout.
+                uint64_t legs = 0;
+                uint64_t legs_removed = 0;
+                // CPU time of the forwarding thread.
+                int64_t cpu_us = 0;
+        };
+
+        RtpSfu();
+        ~RtpSfu();
+
+        // Binds |ip|:|port|, 0 picks a port, and starts forwarding on a
+        // thread of its own.
+        bool Start(const char* ip, uint16_t port);
+        // How long a subscriber may send no RTCP before it is dropped,
+        // kLegTimeoutMs unless changed. Before Start().
+        void SetLegTimeout(int timeout_ms) { leg_timeout_ms_ = timeout_ms; }
+        void Stop();
+        uint16_t port() const { return port_; }
+        Stats stats() const;
+
+private:
+        // Recent packets of a publisher, indexed by sequence number.
+        static const int kCacheSize = 1024;
+        static const size_t kMaxPacketSize = 1500;
+        struct CachedPacket {
+                bool valid;
+                uint16_t sequence_number;
+                uint16_t len;
+                uint8_t data[kMaxPacketSize];
+        };
+
+        struct Publisher {
+                sockaddr_in addr;
+                std::vector<CachedPacket> cache;
+                std::vector<int> legs;
+                // For receiver reports.
+                uint16_t base_seq = 0;
+                uint32_t cycles = 0;
+                uint16_t max_seq = 0;
+                uint32_t received = 0;
+                uint32_t expected_prior = 0;
+                uint32_t received_prior = 0;
+                uint32_t last_sr = 0;
+                int64_t last_sr_ms = 0;
+                int64_t last_pli_ms = -1000000;
+        };
+
+        // The path from the SFU to one subscriber.
+        struct Leg {
+                sockaddr_in addr;
+                uint32_t publisher_ssrc;
+                uint32_t ssrc;
+                // Outgoing minus incoming sequence number, fixed at the first
+                // key frame so gaps stay gaps and NACKs map back.
+                uint16_t seq_delta;
+                uint16_t first_seq;
+                bool waiting_for_key;
+                uint32_t last_timestamp;
+                uint32_t packets;
+                uint32_t octets;
+                // Last RTCP from the subscriber about this leg.
+                int64_t last_rtcp_ms;
+        };
+
+        void Run();
+        void OnPacket(uint8_t* data, size_t len, const sockaddr_in& from);
+        void OnRtp(uint8_t* data, size_t len, const sockaddr_in& from);
+        void OnRtcp(const uint8_t* data, size_t len, const sockaddr_in& from);
+        void OnPli(uint32_t media_ssrc, const sockaddr_in& from);
+        void OnNack(uint32_t media_ssrc, const uint8_t* fci, size_t len);
+        void OnBye(const sockaddr_in& from);
+        // Marks the leg sending under |ssrc|, if any, as alive.
+        void TouchLeg(uint32_t ssrc);
+        void RemoveLeg(int index);
+        void ExpireLegs();
+        void Forward(Leg* leg, const uint8_t* data, size_t len, uint16_t seq);
+        void RequestKeyFrame(uint32_t publisher_ssrc);
+        void SendReports();
+        void SendTo(const uint8_t* data, size_t len, const sockaddr_in& to);
+
+        int socket_;
+        uint16_t port_;
+        std::atomic<bool> running_;
+        std::thread thread_;
+        int64_t now_ms_;
+        uint32_t next_ssrc_;
+        int leg_timeout_ms_;
+
+        // Only touched on the forwarding thread.
+        std::unordered_map<uint32_t, Publisher> publishers_;
+        std::vector<Leg> legs_;
+        // Leg of each outgoing SSRC.
+        std::unordered_map<uint32_t, int> leg_ssrcs_;
+        std::vector<uint8_t> scratch_;
+
+        std::atomic<uint64_t> received_;
+        std::atomic<uint64_t> forwarded_;
+        std::atomic<uint64_t> retransmitted_;
+        std::atomic<uint64_t> nacks_upstream_;
+        std::atomic<uint64_t> plis_upstream_;
+        std::atomic<uint64_t> legs_count_;
+        std::atomic<uint64_t> legs_removed_;
+        std::atomic<int64_t> cpu_us_;
+};
+
+#endif // RTP_SFU_H_
@@ -0,0 +1,52 @@
+/*
+ * rtpsfu [port]
+ *
+ * Runs an RtpSfu on 0.0.0.0:port (default 5004) and prints its counters
+ * every five seconds.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rtp_sfu.h"
+
+namespace {
+        volatile sig_atomic_t g_quit = 0;
+
+        void OnSignal(int) {
+                g_quit = 1;
+        }
+}  // namespace
+
+int main(int argc, char** argv) {
+        int port = argc > 1 ? atoi(argv[1]) : 5004;
+        RtpSfu sfu;
+        if (!sfu.Start("0.0.0.0", static_cast<uint16_t>(port))) {
+                fprintf(stderr, "cannot bind port %d\n", port);
+                return 1;
+        }
+        signal(SIGINT, OnSignal);
+        signal(SIGTERM, OnSignal);
+        printf("forwarding on port %d\n", sfu.port());
+
+        RtpSfu::Stats last;
+        while (!g_quit) {
+                for (int i = 0; i < 50 && !g_quit; ++i)
+                        usleep(100 * 1000);
+                RtpSfu::Stats now = sfu.stats();
+                double seconds = (now.cpu_us - last.cpu_us) / 1e6;
+                printf("in:%llu out:%llu rtx:%llu nack:%llu pli:%llu cpu:%.2fs %.0f packets/s/core\n",
+                       static_cast<unsigned long long>(now.received - last.received),
+                       static_cast<unsigned long long>(now.forwarded - last.forwarded),
+                       static_cast<unsigned long long>(now.retransmitted - last.retransmitted),
+                       static_cast<unsigned long long>(now.nacks_upstream - last.nacks_upstream),
+                       static_cast<unsigned long long>(now.plis_upstream - last.plis_upstream),
+                       seconds, seconds > 0 ? (now.forwarded - last.forwarded) / seconds : 0.0);
+                fflush(stdout);
+                last = now;
+        }
+        sfu.Stop();
+        return 0;
+}
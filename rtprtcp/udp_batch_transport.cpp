@@ -0,0 +1,331 @@
+#include "udp_batch_transport.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#if defined(__linux__)
+// From linux/udp.h, which older libc headers do not carry.
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+namespace {
+        const int kSocketBufferSize = 4 << 20;
+        // What the kernel takes in one GSO send: UDP_MAX_SEGMENTS, and a
+        // datagram that still fits the 16 bit IP length.
+        const size_t kMaxGsoSegments = 64;
+        const size_t kMaxGsoBytes = 65000;
+        // A GRO receive is at most one full IP datagram.
+        const size_t kMaxGroSize = 65535;
+
+        // RFC 5761: RTCP packet types 192-223 sit where RTP payload types
+        // 64-95 would be.
+        bool IsRtcp(const uint8_t* data, size_t len) {
+                if (len < 2)
+                        return false;
+                uint8_t type = data[1] & 0x7f;
+                return type >= 64 && type < 96;
+        }
+
+#if defined(__linux__)
+        const size_t kSendControlSize = CMSG_SPACE(sizeof(uint16_t));
+        const size_t kReceiveControlSize = CMSG_SPACE(sizeof(int));
+#endif
+}  // namespace
+
+const int UdpBatchTransport::kMaxBatch;
+
+UdpBatchTransport::UdpBatchTransport(int batch_size)
+: batch_size_(std::max(1, std::min(batch_size, kMaxBatch))),
+socket_(-1), local_port_(0), gso_(false), gro_(false), receive_slot_size_(0), queued_(0) {
+        memset(&remote_, 0, sizeof(remote_));
+        send_buffer_.resize(batch_size_ * kMaxPacketSize);
+        send_iov_.resize(batch_size_);
+        receive_iov_.resize(batch_size_);
+        for (int i = 0; i < batch_size_; ++i)
+                send_iov_[i].iov_base = &send_buffer_[i * kMaxPacketSize];
+#if defined(__linux__)
+        send_msgs_.resize(batch_size_);
+        receive_msgs_.resize(batch_size_);
+        message_first_.resize(batch_size_);
+        message_count_.resize(batch_size_);
+        send_control_.resize(batch_size_ * kSendControlSize);
+        receive_control_.resize(batch_size_ * kReceiveControlSize);
+        for (int i = 0; i < batch_size_; ++i) {
+                memset(&send_msgs_[i], 0, sizeof(mmsghdr));
+                send_msgs_[i].msg_hdr.msg_name = &remote_;
+                send_msgs_[i].msg_hdr.msg_namelen = sizeof(remote_);
+                memset(&receive_msgs_[i], 0, sizeof(mmsghdr));
+                receive_msgs_[i].msg_hdr.msg_iov = &receive_iov_[i];
+                receive_msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+#endif
+        SetReceiveSlotSize(kMaxPacketSize);
+}
+
+UdpBatchTransport::~UdpBatchTransport() {
+        Close();
+}
+
+void UdpBatchTransport::SetReceiveSlotSize(size_t size) {
+        receive_slot_size_ = size;
+        receive_buffer_.resize(batch_size_ * size);
+        for (int i = 0; i < batch_size_; ++i) {
+                receive_iov_[i].iov_base = &receive_buffer_[i * size];
+                receive_iov_[i].iov_len = size;
+        }
+}
+
+int UdpBatchTransport::Open(const char* ip, uint16_t port) {
+        Close();
+        socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (socket_ < 0)
+                return -1;
+        setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &kSocketBufferSize, sizeof(kSocketBufferSize));
+        setsockopt(socket_, SOL_SOCKET, SO_SNDBUF, &kSocketBufferSize, sizeof(kSocketBufferSize));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+                Close();
+                return -1;
+        }
+        socklen_t addr_len = sizeof(addr);
+        if (bind(socket_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            getsockname(socket_, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+                Close();
+                return -1;
+        }
+        local_port_ = ntohs(addr.sin_port);
+        return 0;
+}
+
+int UdpBatchTransport::SetRemote(const char* ip, uint16_t port) {
+        remote_.sin_family = AF_INET;
+        remote_.sin_port = htons(port);
+        return inet_pton(AF_INET, ip, &remote_.sin_addr) == 1 ? 0 : -1;
+}
+
+void UdpBatchTransport::Close() {
+        if (socket_ >= 0) {
+                close(socket_);
+                socket_ = -1;
+        }
+        queued_ = 0;
+        gso_ = false;
+        gro_ = false;
+        if (receive_slot_size_ != kMaxPacketSize)
+                SetReceiveSlotSize(kMaxPacketSize);
+}
+
+bool UdpBatchTransport::EnableGso(bool enable) {
+        gso_ = false;
+#if defined(__linux__)
+        if (enable && socket_ >= 0) {
+                // A zero socket wide segment size changes nothing; it only
+                // tells us whether the kernel knows the option. The size
+                // goes with every send.
+                int zero = 0;
+                gso_ = setsockopt(socket_, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+        }
+#endif
+        return gso_;
+}
+
+bool UdpBatchTransport::EnableGro(bool enable) {
+#if defined(__linux__)
+        if (socket_ >= 0 && (enable || gro_)) {
+                int on = enable ? 1 : 0;
+                bool ok = setsockopt(socket_, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+                gro_ = enable && ok;
+        }
+#endif
+        SetReceiveSlotSize(gro_ ? kMaxGroSize : kMaxPacketSize);
+        return gro_;
+}
+
+void UdpBatchTransport::OnRtpPacket(const uint8_t* data, size_t len) {
+        Queue(data, len);
+}
+
+void UdpBatchTransport::OnRtcpPacket(const uint8_t* data, size_t len) {
+        Queue(data, len);
+        Flush();
+}
+
+void UdpBatchTransport::Queue(const uint8_t* data, size_t len) {
+        if (len > kMaxPacketSize)
+                return;
+        if (queued_ == static_cast<size_t>(batch_size_))
+                Flush();
+        memcpy(send_iov_[queued_].iov_base, data, len);
+        send_iov_[queued_].iov_len = len;
+        ++queued_;
+}
+
+#if defined(__linux__)
+size_t UdpBatchTransport::BuildMessages(size_t first, size_t message) {
+        for (size_t i = first; i < queued_; ++message) {
+                size_t segment = send_iov_[i].iov_len;
+                size_t count = 1;
+                size_t bytes = segment;
+                while (gso_ && i + count < queued_ && count < kMaxGsoSegments) {
+                        size_t len = send_iov_[i + count].iov_len;
+                        if (len > segment || bytes + len > kMaxGsoBytes)
+                                break;
+                        bytes += len;
+                        ++count;
+                        // Only the last segment may be shorter.
+                        if (len < segment)
+                                break;
+                }
+
+                msghdr& hdr = send_msgs_[message].msg_hdr;
+                hdr.msg_iov = &send_iov_[i];
+                hdr.msg_iovlen = count;
+                if (count > 1) {
+                        hdr.msg_control = &send_control_[message * kSendControlSize];
+                        hdr.msg_controllen = kSendControlSize;
+                        cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+                        cmsg->cmsg_level = SOL_UDP;
+                        cmsg->cmsg_type = UDP_SEGMENT;
+                        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                        uint16_t size = static_cast<uint16_t>(segment);
+                        memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+                } else {
+                        hdr.msg_control = nullptr;
+                        hdr.msg_controllen = 0;
+                }
+                message_first_[message] = i;
+                message_count_[message] = count;
+                i += count;
+        }
+        return message;
+}
+#endif
+
+int UdpBatchTransport::Flush() {
+        if (socket_ < 0)
+                return -1;
+        size_t sent = 0;
+#if defined(__linux__)
+        size_t messages = BuildMessages(0, 0);
+        size_t done = 0;
+        while (done < messages) {
+                int n = sendmmsg(socket_, &send_msgs_[done], static_cast<unsigned int>(messages - done), 0);
+                ++stats_.send_calls;
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (gso_ && message_count_[done] > 1 && (errno == EIO || errno == EINVAL)) {
+                                // The route's device cannot segment; send the
+                                // rest one packet per message from now on.
+                                gso_ = false;
+                                messages = BuildMessages(message_first_[done], done);
+                                continue;
+                        }
+                        // The first message failed; drop it and carry on
+                        // with the rest. It does not count as sent.
+                        stats_.send_errors += message_count_[done];
+                        ++done;
+                        continue;
+                }
+                for (int m = 0; m < n; ++m, ++done) {
+                        sent += message_count_[done];
+                        stats_.packets_sent += message_count_[done];
+                        if (message_count_[done] > 1)
+                                ++stats_.gso_sends;
+                }
+        }
+#else
+        for (size_t i = 0; i < queued_; ++i) {
+                ssize_t n = sendto(socket_, send_iov_[i].iov_base, send_iov_[i].iov_len, 0,
+                                   reinterpret_cast<const sockaddr*>(&remote_), sizeof(remote_));
+                ++stats_.send_calls;
+                if (n < 0) {
+                        ++stats_.send_errors;
+                } else {
+                        ++sent;
+                        ++stats_.packets_sent;
+                }
+        }
+#endif
+        queued_ = 0;
+        return static_cast<int>(sent);
+}
+
+// |segment| is the GRO segment size, 0 for a plain datagram.
+void UdpBatchTransport::Deliver(RtpPacketSink* sink, const uint8_t* data, size_t len,
+                                size_t segment) {
+        if (segment && len > segment)
+                ++stats_.gro_receives;
+        else
+                segment = len;
+        for (size_t offset = 0; offset < len; offset += segment) {
+                size_t size = std::min(segment, len - offset);
+                if (IsRtcp(data + offset, size))
+                        sink->OnRtcpPacket(data + offset, size);
+                else
+                        sink->OnRtpPacket(data + offset, size);
+                ++stats_.packets_received;
+        }
+}
+
+int UdpBatchTransport::Receive(RtpPacketSink* sink, int timeout_ms) {
+        if (socket_ < 0)
+                return -1;
+        pollfd pfd;
+        pfd.fd = socket_;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready <= 0)
+                return ready < 0 && errno != EINTR ? -1 : 0;
+
+        uint64_t before = stats_.packets_received;
+#if defined(__linux__)
+        for (int i = 0; i < batch_size_; ++i) {
+                msghdr& hdr = receive_msgs_[i].msg_hdr;
+                hdr.msg_control = gro_ ? &receive_control_[i * kReceiveControlSize] : nullptr;
+                hdr.msg_controllen = gro_ ? kReceiveControlSize : 0;
+        }
+        int count = recvmmsg(socket_, receive_msgs_.data(), batch_size_, MSG_DONTWAIT, nullptr);
+        ++stats_.receive_calls;
+        if (count < 0)
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        for (int i = 0; i < count; ++i) {
+                msghdr& hdr = receive_msgs_[i].msg_hdr;
+                size_t segment = 0;
+                for (cmsghdr* cmsg = gro_ ? CMSG_FIRSTHDR(&hdr) : nullptr; cmsg;
+                     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                                int size;
+                                memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                                segment = size;
+                        }
+                }
+                Deliver(sink, static_cast<const uint8_t*>(receive_iov_[i].iov_base),
+                        receive_msgs_[i].msg_len, segment);
+        }
+#else
+        for (int i = 0; i < batch_size_; ++i) {
+                ssize_t len = recv(socket_, receive_iov_[0].iov_base, receive_slot_size_, MSG_DONTWAIT);
+                ++stats_.receive_calls;
+                if (len < 0)
+                        break;
+                Deliver(sink, static_cast<const uint8_t*>(receive_iov_[0].iov_base), len, 0);
+        }
+#endif
+        return static_cast<int>(stats_.packets_received - before);
+}
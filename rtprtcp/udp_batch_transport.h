@@ -0,0 +1,122 @@
+#ifndef UDP_BATCH_TRANSPORT_H_
+#define UDP_BATCH_TRANSPORT_H_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "myrtprtcp.h"
+
+// A UDP socket that moves packets in batches. RTP handed to it is queued
+// and goes out in one sendmmsg() per Flush(), which the owner calls once
+// per pacing interval; a full queue flushes itself. RTCP is queued the
+// same way but flushed at once, feedback should not wait for a tick.
+// Receive() reads up to a batch with one recvmmsg() and hands each packet
+// to a sink as RTP or RTCP.
+//
+// On Linux the socket can also use UDP segmentation offload: with GSO a
+// run of equal-size packets in the queue (the last may be shorter, as the
+// tail of a frame usually is) leaves as one super-packet the kernel or NIC
+// cuts up; with GRO the kernel hands over coalesced datagrams that are
+// split back into packets here. Both are off by default and switch
+// themselves off where the kernel or device cannot do them.
+//
+// Where sendmmsg()/recvmmsg() do not exist (macOS) the same interface
+// falls back to one sendto()/recvfrom() per packet.
+class UdpBatchTransport : public RtpPacketSink {
+public:
+        static const int kMaxBatch = 64;
+        static const size_t kMaxPacketSize = 1500;
+
+        struct Stats {
+                uint64_t packets_sent = 0;
+                uint64_t packets_received = 0;
+                uint64_t send_calls = 0;
+                uint64_t receive_calls = 0;
+                // Packets the kernel refused, e.g. a full send buffer.
+                uint64_t send_errors = 0;
+                // Datagrams the kernel sent or delivered as one, with GSO
+                // or GRO on.
+                uint64_t gso_sends = 0;
+                uint64_t gro_receives = 0;
+        };
+
+        // |batch_size| is clamped to 1..kMaxBatch; 1 means a system call per
+        // packet both ways.
+        explicit UdpBatchTransport(int batch_size = kMaxBatch);
+        UdpBatchTransport(const UdpBatchTransport&) = delete;
+        UdpBatchTransport& operator=(const UdpBatchTransport&) = delete;
+        ~UdpBatchTransport();
+
+        // Binds |ip|:|port|, 0 picks a port. Returns 0 or -1.
+        int Open(const char* ip, uint16_t port);
+        int SetRemote(const char* ip, uint16_t port);
+        void Close();
+        uint16_t local_port() const { return local_port_; }
+        int fd() const { return socket_; }
+
+        // After Open(). Return whether the offload is on afterwards, false
+        // where it is not supported.
+        bool EnableGso(bool enable);
+        bool EnableGro(bool enable);
+        bool gso() const { return gso_; }
+        bool gro() const { return gro_; }
+
+        // RtpPacketSink. Packets longer than kMaxPacketSize are dropped.
+        void OnRtpPacket(const uint8_t* data, size_t len) override;
+        void OnRtcpPacket(const uint8_t* data, size_t len) override;
+
+        // Sends everything queued; packets the kernel refuses are dropped.
+        // Returns the number of packets it accepted or -1.
+        int Flush();
+        size_t queued() const { return queued_; }
+
+        // Waits up to |timeout_ms| for packets and delivers one batch to
+        // |sink|. Returns the number of packets delivered, 0 on timeout or
+        // -1 on error.
+        int Receive(RtpPacketSink* sink, int timeout_ms);
+
+        const Stats& stats() const { return stats_; }
+
+private:
+        void Queue(const uint8_t* data, size_t len);
+        void Deliver(RtpPacketSink* sink, const uint8_t* data, size_t len, size_t segment);
+        void SetReceiveSlotSize(size_t size);
+#if defined(__linux__)
+        // Lays the queue from packet |first| on out as messages from
+        // |message| on. Returns the number of messages.
+        size_t BuildMessages(size_t first, size_t message);
+#endif
+
+        int batch_size_;
+        int socket_;
+        uint16_t local_port_;
+        sockaddr_in remote_;
+        bool gso_;
+        bool gro_;
+
+        // One packet per send slot, kMaxPacketSize bytes each. Receive slots
+        // hold a coalesced datagram with GRO on, one packet otherwise.
+        std::vector<uint8_t> send_buffer_;
+        std::vector<uint8_t> receive_buffer_;
+        size_t receive_slot_size_;
+        std::vector<iovec> send_iov_;
+        std::vector<iovec> receive_iov_;
+#if defined(__linux__)
+        std::vector<mmsghdr> send_msgs_;
+        std::vector<mmsghdr> receive_msgs_;
+        // First packet and packet count of each send message.
+        std::vector<size_t> message_first_;
+        std::vector<size_t> message_count_;
+        // A segment size control message per message, each direction.
+        std::vector<uint8_t> send_control_;
+        std::vector<uint8_t> receive_control_;
+#endif
+        size_t queued_;
+        Stats stats_;
+};
+
+#endif // UDP_BATCH_TRANSPORT_H_
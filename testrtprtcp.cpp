@@ -6,7 +6,6 @@
 #include <chrono>
 
 #include "api/video_codecs/video_codec.h"
-#include "modules/rtp_rtcp/include/rtp_header_parser.h"
 #include "modules/rtp_rtcp/include/rtp_rtcp_defines.h"
 #include "modules/rtp_rtcp/source/rtcp_packet.h"
 #include "modules/rtp_rtcp/source/rtcp_packet/nack.h"
@@ -15,9 +14,12 @@
 #include "rtc_base/rate_limiter.h"
 #include "rtc_base/thread.h"
 #include "rtc_base/socket.h"
+#include "rtc_base/time_utils.h"
 #include "test/rtcp_packet_parser.h"
 #include "test/rtcp_packet_parser.cc"
-//#include "avreader.h"
+#include "rtprtcp/es_reader.h"
+#include "rtprtcp/rtp_packetizer.h"
+#include "rtprtcp/udp_batch_transport.h"
 
 #define os_gettime_ms() std::chrono::high_resolution_clock::now().time_since_epoch().count()/1000
 
@@ -50,20 +52,24 @@ public:
         keepalive_payload_type_(0),
         num_keepalive_sent_(0) {}
         
-        ~SendTransport() {
-                if (pSock)
-                        delete pSock;
-        }
-        
         //127.0.0.1:11001
-        bool Init(std::string ipandport, std::string remoteIpAndPort) {
-                if (!remoteAddr.FromString(remoteIpAndPort)) {
-                        return false;
-                }
-                pSock = Thread::Current()->socketserver()->CreateSocket(AF_INET, SOCK_DGRAM);
+        int Init(std::string ipandport, std::string remoteIpAndPort) {
                 SocketAddress addr;
-                addr.FromString(ipandport);
-                return pSock->Bind(addr);
+                if (!addr.FromString(ipandport) || !remoteAddr.FromString(remoteIpAndPort)) {
+                        return -1;
+                }
+                if (udp_.Open(addr.ipaddr().ToString().c_str(), addr.port()) != 0)
+                        return -1;
+                return udp_.SetRemote(remoteAddr.ipaddr().ToString().c_str(), remoteAddr.port());
+        }
+        
+        // Sends the RTP queued since the last call; call once per pacing
+        // interval.
+        int Flush() { return udp_.Flush(); }
+        
+        // Feeds what arrives on the socket to |sink|, one batch per call.
+        int Receive(RtpPacketSink* sink, int timeout_ms) {
+                return udp_.Receive(sink, timeout_ms);
         }
         
         void SimulateNetworkDelay(int64_t delay_ms, SimulatedClock* clock) {
@@ -74,15 +80,15 @@ public:
         bool SendRtp(const uint8_t* data,
                      size_t len,
                      const PacketOptions& options) override {
-                RTPHeader header;
-                std::unique_ptr<RtpHeaderParser> parser(RtpHeaderParser::Create());
-                assert(parser->Parse(static_cast<const uint8_t*>(data), len, &header) == true);
+                // Our own RTPSender wrote it; read the two fields we count
+                // instead of parsing every packet.
+                assert(len >= 12);
                 ++rtp_packets_sent_;
-                if (header.payloadType == keepalive_payload_type_)
+                if ((data[1] & 0x7f) == keepalive_payload_type_)
                         ++num_keepalive_sent_;
-                last_rtp_header_ = header;
+                last_sequence_number_ = static_cast<uint16_t>((data[2] << 8) | data[3]);
                 
-                pSock->SendTo(data, len, remoteAddr);
+                udp_.OnRtpPacket(data, len);
                 
                 return true;
         }
@@ -98,7 +104,7 @@ public:
               
                 ++rtcp_packets_sent_;
                 
-                pSock->SendTo(data, len, remoteAddr);
+                udp_.OnRtcpPacket(data, len);
                 
                 return true;
         }
@@ -117,11 +123,11 @@ public:
         int64_t delay_ms_;
         int rtp_packets_sent_;
         size_t rtcp_packets_sent_;
-        RTPHeader last_rtp_header_;
+        uint16_t last_sequence_number_ = 0;
         std::vector<uint16_t> last_nack_list_;
         uint8_t keepalive_payload_type_;
         size_t num_keepalive_sent_;
-        Socket* pSock = nullptr;
+        UdpBatchTransport udp_;
         SocketAddress remoteAddr;
         
 };
@@ -168,7 +174,7 @@ public:
         }
         int RtpSent() { return transport_.rtp_packets_sent_; }
         uint16_t LastRtpSequenceNumber() {
-                return transport_.last_rtp_header_.sequenceNumber;
+                return transport_.last_sequence_number_;
         }
         std::vector<uint16_t> LastNackListSent() {
                 return transport_.last_nack_list_;
@@ -184,6 +190,21 @@ public:
                 CreateModuleImpl();
         }
         
+        // Packets from the network. RTP counts towards our receiver
+        // reports, RTCP is feedback for the sender: NACKs are answered
+        // from here.
+        bool IncomingRtpPacket(const uint8_t* data, size_t len) {
+                RtpPacketReceived packet;
+                if (!packet.Parse(data, len))
+                        return false;
+                packet.set_arrival_time_ms(clock_->TimeInMilliseconds());
+                receive_statistics_->OnRtpPacket(packet);
+                return true;
+        }
+        void IncomingRtcpPacket(const uint8_t* data, size_t len) {
+                impl_->IncomingRtcpPacket(data, len);
+        }
+        
 private:
         void CreateModuleImpl() {
                 RtpRtcp::Configuration config;
@@ -204,10 +225,25 @@ private:
         std::map<uint32_t, RtcpPacketTypeCounter> counter_map_;
 };
 
+// Hands what SendTransport::Receive() reads to a module.
+class ModuleReceiveSink : public RtpPacketSink {
+public:
+        explicit ModuleReceiveSink(RtpRtcpModule* module) : module_(module) {}
+        void OnRtpPacket(const uint8_t* data, size_t len) override {
+                module_->IncomingRtpPacket(data, len);
+        }
+        void OnRtcpPacket(const uint8_t* data, size_t len) override {
+                module_->IncomingRtcpPacket(data, len);
+        }
+        
+private:
+        RtpRtcpModule* module_;
+};
+
 class RtpRtcpImplTest {
 protected:
         RtpRtcpImplTest()
-        : clock_(os_gettime_ms()), rtpRtcpModule_(&clock_) {}
+        : clock_(os_gettime_ms()), rtpRtcpModule_(&clock_), receiveSink_(&rtpRtcpModule_) {}
         
         void SetUp(uint32_t ssrc, std::string localIpPort, std::string remoteIpPort) {
                 // Send module.
@@ -222,46 +258,74 @@ protected:
                 codec_.height = 180;
                 rtpRtcpModule_.impl_->RegisterVideoSendPayload(codec_.plType, "H264");
             
+                // The headers only change in their lengths from frame to
+                // frame; set them up once so SendFrame allocates nothing of
+                // its own.
+                RTPVideoHeaderH264 h264_header = {};
+                h264_header.nalu_type = 5;
+                h264_header.packetization_type = kH264FuA;
+                
+                rtp_video_header_.width = codec_.width;
+                rtp_video_header_.height = codec_.height;
+                rtp_video_header_.rotation = kVideoRotation_0;
+                rtp_video_header_.content_type = VideoContentType::UNSPECIFIED;
+                rtp_video_header_.playout_delay = {-1, -1};
+                rtp_video_header_.is_first_packet_in_frame = true;
+                rtp_video_header_.simulcastIdx = 0;
+                rtp_video_header_.codec = kVideoCodecH264;
+                rtp_video_header_.video_type_header = h264_header;
+                rtp_video_header_.video_timing = {0u, 0u, 0u, 0u, 0u, 0u, false};
+                
+                nal_units_.reserve(16);
+                
                 assert(rtpRtcpModule_.transport_.Init(localIpPort, remoteIpPort) == 0);
         }
         
         SimulatedClock clock_;
         RtpRtcpModule rtpRtcpModule_;
+        ModuleReceiveSink receiveSink_;
         VideoCodec codec_;
+        RTPVideoHeader rtp_video_header_;
+        RTPFragmentationHeader fragmentation_;
+        std::vector<NalUnit> nal_units_;
 public:
         void SendFrame(const RtpRtcpModule* module, uint8_t *payload, int payloadLen, int64_t timestamp, int nIsKeyFrame) {
-                RTPVideoHeaderH264 h264_header = {};
-                h264_header.nalu_type = 5;
-                h264_header.packetization_type = kH264FuA;
-                
-                
-                RTPVideoHeader rtp_video_header;
-                rtp_video_header.width = codec_.width;
-                rtp_video_header.height = codec_.height;
-                rtp_video_header.rotation = kVideoRotation_0;
-                rtp_video_header.content_type = VideoContentType::UNSPECIFIED;
-                rtp_video_header.playout_delay = {-1, -1};
-                rtp_video_header.is_first_packet_in_frame = true;
-                rtp_video_header.simulcastIdx = 0;
-                rtp_video_header.codec = kVideoCodecH264;
-                rtp_video_header.video_type_header = h264_header;
-                rtp_video_header.video_timing = {0u, 0u, 0u, 0u, 0u, 0u, false};
-                
-                
                 //https://blog.csdn.net/u013113491/article/details/80285342 RTPFragmentationHeader
                 //的作用大改就是吧关键帧的sps pps sei等分开，但是这里需要自己去找startcode分开
-                RTPFragmentationHeader fragmentation;
-                fragmentation.VerifyAndAllocateFragmentationHeader(1);
-                fragmentation.fragmentationOffset[0] = 0;
-                fragmentation.fragmentationLength[0] = payloadLen;
-                fragmentation.fragmentationPlType[0] = 0;
-                fragmentation.fragmentationTimeDiff[0] = 0;
-                        
-                        
+                // AnnexBReader finds the start codes: one fragment per NAL
+                // unit, start codes left out.
+                AnnexBReader reader(payload, payloadLen);
+                NalUnit nal;
+                nal_units_.clear();
+                while (reader.Next(&nal))
+                        nal_units_.push_back(nal);
+                if (nal_units_.empty())
+                        return;
+                fragmentation_.VerifyAndAllocateFragmentationHeader(nal_units_.size());
+                for (size_t i = 0; i < nal_units_.size(); ++i) {
+                        fragmentation_.fragmentationOffset[i] = nal_units_[i].data - payload;
+                        fragmentation_.fragmentationLength[i] = nal_units_[i].len;
+                        fragmentation_.fragmentationPlType[i] = 0;
+                        fragmentation_.fragmentationTimeDiff[i] = 0;
+                }
                 
                 assert(true == module->impl_->SendOutgoingData(
                                                                 kVideoFrameKey, codec_.plType, 0, 0, payload,
-                                                                sizeof(payload), &fragmentation, &rtp_video_header, nullptr));
+                                                                payloadLen, &fragmentation_, &rtp_video_header_, nullptr));
+        }
+        
+        void SendFrame(const EsFrame& frame) {
+                SendFrame(&rtpRtcpModule_, const_cast<uint8_t*>(frame.data), static_cast<int>(frame.len),
+                          frame.timestamp_ms, frame.key);
+        }
+        
+        // Sends the RTP queued by SendFrame(); call once per frame.
+        int Flush() { return rtpRtcpModule_.transport_.Flush(); }
+        
+        // Waits up to |timeout_ms| for a batch from the socket and hands it
+        // to the module. Returns what SendTransport::Receive() does.
+        int Receive(int timeout_ms) {
+                return rtpRtcpModule_.transport_.Receive(&receiveSink_, timeout_ms);
         }
         
         void IncomingRtcpNack(const RtpRtcpModule* module, uint16_t sequence_number) {
@@ -311,30 +375,45 @@ public:
         }
 };
 
-static void *gpSimVReader;
-
-int avDataCallback(void *opaque, void *pData, int nDataLen, TToolAvType avType, int64_t timestamp, int nIsKeyFrame) {
-        RtpRtcpImplTest* testimpl = (RtpRtcpImplTest*)opaque;
-        testimpl->SendFrame(testimpl->rtpRtcpModule_, (uint8_t*)pData, nDataLen, timestamp, nIsKeyFrame);
-}
-
-static void start_read_avfile(void *pCbOpaque) {
-        TToolReadArg arg;
-        memset(&arg, 0, sizeof(arg));
-        arg.IsLoop = 1;
-        arg.codec = TTOOL_VIDEO_H264;
-        arg.pFilePath = "/Users/liuye/qbox/linking/link/libtsuploader/pcdemo/material/h265_aac_1_16000_h264.h264";
-        arg.callback = avDataCallback;
-        arg.pCbOpaque = pCbOpaque;
-        int ret = TToolStartRead(&arg, &gpSimVReader);
-        if (ret != 0) {
-                fprintf(stderr, "TToolStartRead v fail:%d\n", ret);
+// Sends an H.264 elementary stream in real time, over and over. Each
+// frame leaves in one Flush(); until the next one is due the socket is
+// read, so NACKs and receiver reports reach the module.
+static void send_es_file(RtpRtcpImplTest* test, const char* path) {
+        EsReader reader;
+        if (reader.Open(path, EsFormat::H264) != 0) {
+                fprintf(stderr, "cannot read %s\n", path);
                 exit(1);
         }
+        reader.set_loop(true);
+        int64_t start_ms = rtc::TimeMillis();
+        EsFrame frame;
+        while (reader.Next(&frame)) {
+                int64_t wait_ms;
+                while ((wait_ms = start_ms + frame.timestamp_ms - rtc::TimeMillis()) > 0) {
+                        if (test->Receive(static_cast<int>(wait_ms)) < 0)
+                                break;
+                }
+                test->SendFrame(frame);
+                test->Flush();
+        }
+        test->Flush();
 }
 
+class RtpRtcpImplTestSender : public RtpRtcpImplTest {
+public:
+        void Run(const char* path, const char* localIpPort, const char* remoteIpPort) {
+                SetUp(kSenderSsrc, localIpPort, remoteIpPort);
+                send_es_file(this, path);
+        }
+};
 
+// testrtprtcp <file.h264> <local ip:port> <remote ip:port>
 int main(int argc, char **argv) {
+        if (argc >= 4) {
+                RtpRtcpImplTestSender sender;
+                sender.Run(argv[1], argv[2], argv[3]);
+                return 0;
+        }
         //RtpRtcpImplTestMain test;
         //test.testBody();
         //testUdpSocket();